@@ -0,0 +1,51 @@
+#include "ChunkedResponse.h"
+
+void ChunkedResponse::begin(int code, const char* contentType) {
+  used = 0;
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(code, contentType, "");
+}
+
+void ChunkedResponse::end() {
+  flush();
+  server.sendContent("");   // A zero length chunk marks the end of the response.
+}
+
+size_t ChunkedResponse::write(uint8_t c) {
+  if(copy_to)
+    copy_to->write(c);
+
+  if(used >= BUFFER_SIZE)
+    flush();
+
+  buffer[used++] = c;
+  return 1;
+}
+
+size_t ChunkedResponse::write(const uint8_t* data, size_t size) {
+  if(copy_to)
+    copy_to->write(data, size);
+
+  size_t remaining = size;
+  while(remaining > 0) {
+    if(used >= BUFFER_SIZE)
+      flush();
+
+    size_t count = BUFFER_SIZE - used;
+    if(count > remaining)
+      count = remaining;
+
+    memcpy(buffer + used, data, count);
+    used += count;
+    data += count;
+    remaining -= count;
+  }
+  return size;
+}
+
+void ChunkedResponse::flush() {
+  if(used > 0) {
+    server.sendContent(buffer, used);
+    used = 0;
+  }
+}
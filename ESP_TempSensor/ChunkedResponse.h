@@ -0,0 +1,44 @@
+#include <Arduino.h>
+#include <ESP8266WebServer.h>
+
+#ifndef __CHUNKED_RESPONSE__
+#define __CHUNKED_RESPONSE__
+
+// ----------------------------------------------------------------------
+// Streams a page to the browser in pieces, using HTTP chunked transfer encoding.
+//
+//  Printing goes into a small fixed buffer, which is sent as a chunk each time it fills.
+//  This keeps the heap used by a page the same, no matter how big the page gets.
+
+class ChunkedResponse : public Print
+{
+public:
+    static const size_t BUFFER_SIZE = 512;
+
+    ChunkedResponse(ESP8266WebServer& webServer) : server(webServer) {};
+
+    // Sends the status line and headers.  Content follows with print() calls.
+    void begin(int code, const char* contentType);
+
+    // Sends anything still buffered, and the terminating chunk.
+    void end();
+
+    // Everything printed is also written to copy, e.g. to cache it.
+    void copyTo(Print* copy) { copy_to = copy; }
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+
+    // Sends the buffered content as a chunk.
+    void flush() override;
+
+private:
+    ESP8266WebServer& server;
+
+    char buffer[BUFFER_SIZE];
+    size_t used = 0;
+    Print* copy_to = NULL;
+};
+
+#endif // __CHUNKED_RESPONSE__
@@ -0,0 +1,135 @@
+#include "ClockKeeper.h"
+#include "RecordFile.h"
+#include "PerfStats.h"
+#include "EventLog.h"
+#include <LittleFS.h>
+#include <sys/time.h>
+#include <coredecls.h>
+extern "C" {
+#include <user_interface.h>
+}
+
+const char CLOCK_FILE[] = "/clock.bin";
+const uint8_t RECORD_CLOCK = 1;
+
+const unsigned long RTC_SAVE_PERIOD = 60000;
+const unsigned long FLASH_SAVE_PERIOD = 600000;
+
+// RTC user memory is addressed in 4 byte blocks.  The first 32 blocks are used by OTA updates.
+const uint32_t RTC_CLOCK_BLOCK = 64;
+const uint32_t RTC_CLOCK_MAGIC = 0x434C4B31;    // "CLK1"
+
+// The RTC timer only counts on across a reset, not a power cycle, and wraps after a few hours,
+//  so the time it says has passed is only trusted up to this.
+const uint32_t MAX_RTC_GAP_SECONDS = 3600;
+
+struct RtcClock {
+  uint32_t magic;
+  uint32_t epoch;
+  uint32_t rtc_cycles;      // system_get_rtc_time() when saved
+  uint32_t crc;             // CRC-16 of the fields above
+};
+
+uint32_t rtcClockCrc(const RtcClock& saved) {
+  return RecordFile::Crc16((const uint8_t*)&saved, offsetof(RtcClock, crc));
+}
+
+void ClockKeeper::Begin() {
+  // Only SNTP's setting of the clock counts as a sync, not the estimate below.
+  settimeofday_cb([this](bool fromSntp) {
+    if(fromSntp && !synced && !sync_pending) {
+      if(estimated)
+        correction = (long)(time(NULL) - (estimate_start + (long)((millis() - estimate_millis) / 1000)));
+      sync_pending = true;
+    }
+  });
+
+  if(time(NULL) >= MIN_VALID_EPOCH)
+    return;     // Already set
+
+  time_t rtcTime = ReadRtc();
+  time_t flashTime = ReadFlash();
+  time_t saved = rtcTime > flashTime ? rtcTime : flashTime;
+  if(saved < MIN_VALID_EPOCH)
+    return;     // Never been set, so there's nothing to go on until NTP.
+
+  timeval tv = { saved, 0 };
+  settimeofday(&tv, NULL);
+  estimated = true;
+  estimate_start = saved;
+  estimate_millis = millis();
+  BootTimes::Mark(BOOT_CLOCK_RESTORED);
+  eventLog.Add(PSTR("Clock set from the time saved in %s, until NTP syncs"), rtcTime >= flashTime ? "RTC memory" : "flash");
+}
+
+void ClockKeeper::Service() {
+  if(sync_pending) {
+    sync_pending = false;
+    synced = true;
+    BootTimes::Mark(BOOT_NTP_SYNC);
+    if(estimated) {
+      estimated = false;
+      eventLog.Add(PSTR("NTP synced, clock was %ld seconds out"), correction);
+      if(correction != 0 && onClockCorrected)
+        onClockCorrected(correction);
+    }
+  }
+
+  time_t now = time(NULL);
+  if(now < MIN_VALID_EPOCH)
+    return;
+
+  unsigned long nowMillis = millis();
+  if(last_rtc_save == 0 || nowMillis - last_rtc_save >= RTC_SAVE_PERIOD) {
+    last_rtc_save = nowMillis;
+    SaveToRtc(now);
+  }
+  if(last_flash_save == 0 || nowMillis - last_flash_save >= FLASH_SAVE_PERIOD) {
+    last_flash_save = nowMillis;
+    SaveToFlash(now);
+  }
+}
+
+// The saved time, plus the time the RTC timer says has passed since, or 0 if there's none.
+time_t ClockKeeper::ReadRtc() {
+  RtcClock saved;
+  if(!ESP.rtcUserMemoryRead(RTC_CLOCK_BLOCK, (uint32_t*)&saved, sizeof(saved)) ||
+    saved.magic != RTC_CLOCK_MAGIC || saved.crc != rtcClockCrc(saved))
+    return 0;
+
+  // Cycles are in 1/4096ths of a microsecond.
+  uint32_t cycles = system_get_rtc_time() - saved.rtc_cycles;
+  uint64_t seconds = ((uint64_t)cycles * system_rtc_clock_cali_proc() >> 12) / 1000000;
+  if(seconds > MAX_RTC_GAP_SECONDS)
+    seconds = 0;
+  return saved.epoch + seconds;
+}
+
+time_t ClockKeeper::ReadFlash() {
+  File file = LittleFS.open(CLOCK_FILE, "r");
+  if(!file)
+    return 0;
+
+  uint32_t epoch = 0;
+  uint8_t type;
+  uint8_t length;
+  if(!RecordFile::ReadRecord(file, type, &epoch, sizeof(epoch), length) || type != RECORD_CLOCK || length != sizeof(epoch))
+    epoch = 0;
+  file.close();
+  return epoch;
+}
+
+void ClockKeeper::SaveToRtc(time_t now) {
+  RtcClock saved = { RTC_CLOCK_MAGIC, (uint32_t)now, system_get_rtc_time(), 0 };
+  saved.crc = rtcClockCrc(saved);
+  ESP.rtcUserMemoryWrite(RTC_CLOCK_BLOCK, (uint32_t*)&saved, sizeof(saved));
+}
+
+// A single small record, so a write cut short just leaves no saved time.
+void ClockKeeper::SaveToFlash(time_t now) {
+  File file = LittleFS.open(CLOCK_FILE, "w");
+  uint32_t epoch = now;
+  if(!file || !RecordFile::WriteRecord(file, RECORD_CLOCK, &epoch, sizeof(epoch)))
+    eventLog.Add(PSTR("ClockKeeper: failed to save the time"));
+  file.close();
+}
@@ -0,0 +1,54 @@
+#include <Arduino.h>
+#include <time.h>
+
+#ifndef __CLOCK_KEEPER__
+#define __CLOCK_KEEPER__
+
+// Times before this mean the clock hasn't been set.
+const time_t MIN_VALID_EPOCH = 1104537600;  // Jan 01 2005
+
+// ----------------------------------------------------------------------
+// Keeps a good guess at the time across resets, so readings can start before NTP answers
+//  (or without internet at all).
+//
+//  The time is saved to RTC memory every minute, which survives a reset or brown-out, along
+//  with the RTC timer, so the time spent resetting can be added back.  It's also saved to
+//  flash every 10 minutes, for when the power was off.  At startup the clock is set from the
+//  most recent of these.  That's always a little behind, so when NTP does sync, the
+//  correction is passed to OnClockCorrected(), to move the readings taken in the meantime.
+
+class ClockKeeper
+{
+public:
+    // To be called early in setup(), after the filesystem has started.
+    void Begin();
+
+    // To be called frequently (every 100ms or so).  Saves the time when due, and reports the
+    //  correction once NTP has synced.
+    void Service();
+
+    // Called once, with how far the estimated clock was out (positive if it was behind).
+    void OnClockCorrected(std::function<void(long)> clockCorrected) { onClockCorrected = clockCorrected; }
+
+    bool Estimated() const { return estimated; }    // Running from a saved time, not yet synced
+    bool Synced() const    { return synced; }
+
+private:
+    time_t ReadRtc();
+    time_t ReadFlash();
+    void SaveToRtc(time_t now);
+    void SaveToFlash(time_t now);
+
+    std::function<void(long)> onClockCorrected;
+
+    bool estimated = false;
+    bool synced = false;
+    time_t estimate_start = 0;              // The time the clock was set to
+    unsigned long estimate_millis = 0;      //  and when
+    volatile bool sync_pending = false;     // Set by the NTP callback
+    long correction = 0;
+    unsigned long last_rtc_save = 0;
+    unsigned long last_flash_save = 0;
+};
+
+#endif // __CLOCK_KEEPER__
@@ -1,95 +1,511 @@
 #include "CloudInterface.h"
+#include "PayloadEncoder.h"
+#include "PerfStats.h"
+#include "EventLog.h"
+#include "TextFormat.h"
 
+// Uploaded certificates are converted from PEM to DER once, and only the DER is kept.
+//  That way booting doesn't need the PEM text in RAM, or the base64 decoding.
 const char CloudInterface::ROOT_CERT_FILE[] = "/rootcert.crt";
+const char CloudInterface::TRUST_ANCHOR_FILE[] = "/rootcert.der";
+
+// Maximum Fragment Length the client asks for.  If the server agrees, BearSSL's buffers
+//  shrink from about 16 KB receive + 512 bytes transmit, to 512 bytes each.
+const uint16_t MFLN_BUFFER_SIZE = 512;
+const uint16_t FULL_FRAGMENT_SIZE = 16384;     // The most a server without MFLN sends in a record
+const size_t MAX_CERT_SIZE = 4096;
+
+// Queued readings are sent this many to a post, or as many as fit in the buffer.  That's all
+//  of them as CBOR, and about 6 as JSON.
+const int UPLINK_BATCH_SIZE = 8;
+const unsigned long UPLINK_MIN_BACKOFF = 30 * 1000UL;
+const unsigned long UPLINK_MAX_BACKOFF = 30 * 60 * 1000UL;
+
+const unsigned long POST_TIMEOUT = 15000;
+
+const char HTTPS_SCHEME[] = "https://";
+
+// Finds the parts of "https://host[:port]/path", as where the host ends and the path starts
+//  (-1 if there's no path), and the port.  Posts always go over TLS, so any other scheme is
+//  refused.  Nothing is copied, so checking a URL doesn't use the heap.
+bool splitUrl(const String& url, int& hostEnd, uint16_t& port, int& pathStart) {
+  if(!url.startsWith(HTTPS_SCHEME))
+    return false;
+  int hostStart = strlen(HTTPS_SCHEME);
+
+  hostEnd = url.indexOf('/', hostStart);
+  pathStart = hostEnd;
+  if(hostEnd < 0)
+    hostEnd = url.length();
+
+  int portStart = url.indexOf(':', hostStart);
+  port = 443;
+  if(portStart >= 0 && portStart < hostEnd) {
+    port = atoi(url.c_str() + portStart + 1);
+    hostEnd = portStart;
+  }
+  return hostEnd > hostStart;
+}
+
+// As above, copying the host and path out.
+bool parseUrl(const String& url, String& host, uint16_t& port, String& path) {
+  int hostEnd, pathStart;
+  if(!splitUrl(url, hostEnd, port, pathStart))
+    return false;
+  host = url.substring(strlen(HTTPS_SCHEME), hostEnd);
+  path = pathStart < 0 ? String("/") : url.substring(pathStart);
+  return true;
+}
 
 void CloudInterface::LoadRootCert()
 {
   if(LittleFS.exists(ROOT_CERT_FILE)) {
-    File rootCertFile = LittleFS.open(ROOT_CERT_FILE, "r");
-    if(certs != NULL) { delete certs; }
-    certs = new X509List(rootCertFile);
-    rootCertFile.close();
+    ConvertRootCert();
   }
+
+  if(certs != NULL) { delete certs; certs = NULL; }
+
+  // Each certificate is stored as a 2 byte length, then the DER bytes.
+  File file = LittleFS.open(TRUST_ANCHOR_FILE, "r");
+  if(file) {
+    certs = new X509List();
+    uint16_t length;
+    while(file.read((uint8_t*)&length, sizeof(length)) == sizeof(length) && length > 0 && length <= MAX_CERT_SIZE) {
+      uint8_t* der = (uint8_t*)malloc(length);
+      if(der == NULL)
+        break;
+      if(file.read(der, length) == length) {
+        certs->append(der, length);
+      }
+      free(der);
+    }
+    file.close();
+  }
+
+  // The next post needs to connect with the new trust anchors.
+  client.stop();
+  clientPrepared = false;
 }
 
-String CloudInterface::WriteDataToCloud(SampleBuffer& samples, DeviceConfig& config)
+void CloudInterface::ConvertRootCert()
 {
-  if(config.cloudLoggingUrl == NULL || config.cloudLoggingUrl.length() < 8 ||
-    config.cloudLoggingApiKey == NULL || config.cloudLoggingApiKey.length() < 4 )
-  {
-    // Nothing valid to do.
-    return String("Not configured");
+  File pemFile = LittleFS.open(ROOT_CERT_FILE, "r");
+  String pem = pemFile.readString();
+  pemFile.close();
+
+  X509List parsed(pem.c_str());
+  pem = String();
+  if(parsed.getCount() == 0) {
+    eventLog.Add(PSTR("LoadRootCert: no certificates found in the uploaded file"));
+  }
+
+  File file = LittleFS.open(TRUST_ANCHOR_FILE, "w");
+  const br_x509_certificate* derCerts = parsed.getX509Certs();
+  size_t i;
+  for(i = 0; i < parsed.getCount(); i++) {
+    uint16_t length = derCerts[i].data_len;
+    file.write((const uint8_t*)&length, sizeof(length));
+    file.write(derCerts[i].data, length);
   }
-   
-  WiFiClientSecure client;
+  file.close();
+  LittleFS.remove(ROOT_CERT_FILE);
+}
+
+// The client and session are kept between posts.  If the server keeps the connection
+//  alive, the next post goes straight out on it.  If not, BearSSL resumes the saved
+//  session, which skips the expensive key exchange of a full handshake.
+void CloudInterface::PrepareClient(DeviceConfig& config)
+{
+  if(clientPrepared && preparedUrl == config.cloudLoggingUrl)
+    return;
+
+  client.stop();
+  session = BearSSL::Session();
+  client.setSession(&session);
+
   if(certs != NULL && certs->getCount() > 0)
   {
     client.setTrustAnchors(certs);
   }
   else
   {
-    Serial.println("SendToCloud: using insecure.  No root cert to verify server.");
+    eventLog.Add(PSTR("SendToCloud: using insecure.  No root cert to verify server."));
     client.setInsecure();
   }
 
-  String jsonData = F("{ \"instanceId\": ");
-  jsonData += config.cloudInstanceId + ",";
-  jsonData += F("\"minimumValue\": ") + String(samples.min_temp, 1) + ",";
-  jsonData += F("\"maximumValue\": ") + String(samples.max_temp, 1) + ",";  
-  jsonData += F("\"timestamp\": ") + String(time(NULL)) + ",";
+  // Asking the server first costs a short extra connection, but only once.  The probe can't
+  //  tell a server without MFLN from one it couldn't reach, so a "no" only stands once the
+  //  post's own connection gets through (see StartPost()).  The transmit buffer stays small
+  //  either way, as it only has to hold what's sent.
+  mflnEnabled = parseUrl(config.cloudLoggingUrl, host, port, path) &&
+    WiFiClientSecure::probeMaxFragmentLength(host.c_str(), port, MFLN_BUFFER_SIZE);
+  mflnKnown = mflnEnabled;
+  if(mflnEnabled) {
+    client.setBufferSizes(MFLN_BUFFER_SIZE, MFLN_BUFFER_SIZE);
+    eventLog.Add(PSTR("SendToCloud: max fragment length supported"));
+  }
+  else {
+    client.setBufferSizes(FULL_FRAGMENT_SIZE, MFLN_BUFFER_SIZE);
+  }
 
-  // This is really the "current value".   Trying to get the previous sample period's average
-  //  is problematic if the device has just been reset, and hasn't been running for long enough.
-  // TODO: Think about a better way of reporting this to the cloud.
-  int sampleIndex = samples.GetCurrentSampleIndex();
-  jsonData += "\"value\": " + String(samples.sample_average_temps[sampleIndex]);
-  jsonData += "}";
+  preparedUrl = config.cloudLoggingUrl;
+  clientPrepared = true;
+}
 
+void CloudInterface::Setup()
+{
+  LoadRootCert();
+  queue.Begin();
+}
 
-  int retries = 3;
-  bool postSuccess = false;
-  while(retries > 0 && !postSuccess)
+bool CloudInterface::IsValidUrl(const String& url)
+{
+  int hostEnd, pathStart;
+  uint16_t port;
+  return splitUrl(url, hostEnd, port, pathStart) && port != 0;
+}
+
+bool CloudInterface::IsConfigured(DeviceConfig& config)
+{
+  return IsValidUrl(config.cloudLoggingUrl) && config.cloudLoggingApiKey.length() >= 4;
+}
+
+void CloudInterface::QueueReading(SampleBuffer& samples)
+{
+  // Called as a new half hour starts, so the slot before is the interval just finished.  After
+  //  a reset or a power cut that slot may be partial, or a gap, which its count shows.
+  uint32_t now = time(NULL);
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    if(!samples.HasReadings(channel))
+      continue;
+
+    const SampleChannel& c = samples.Channel(channel);
+    UplinkReading reading;
+    reading.timestamp = now;
+    reading.channel = channel;
+    reading.value = c.current_temp;
+
+    const SampleTier& tier = c.tiers[TIER_HALF_HOUR];
+    if(tier.Filled() > 1 && !tier.IsGap(1)) {
+      reading.mean_value = tier.Mean(1);
+      reading.min_value = tier.Min(1);
+      reading.max_value = tier.Max(1);
+      reading.count = tier.Count(1);
+    } else {
+      reading.mean_value = reading.min_value = reading.max_value = c.current_temp;
+      reading.count = 0;
+    }
+    queue.Push(reading);
+  }
+}
+
+void CloudInterface::Service(DeviceConfig& config)
+{
+  if(postState != POST_IDLE) {
+    StepPost();
+    return;
+  }
+
+  if(queue.Count() == 0 || !IsConfigured(config))
+    return;
+
+  if((long)(millis() - nextAttemptMillis) < 0)
+    return;
+
+  StartBatch(config);
+}
+
+void CloudInterface::WriteDataToCloud(SampleBuffer& samples, DeviceConfig& config, Print& out)
+{
+  PerfTimer timer(perfCloudWrite);
+
+  QueueReading(samples);
+
+  if(!IsConfigured(config))
   {
-    postSuccess = PostData(client, jsonData, config);
-    delay(10);
-    retries--;
+    // Nothing valid to do.
+    out.print(F("Not configured"));
+    return;
+  }
+
+  // Let any post already in flight finish first.
+  while(postState != POST_IDLE) {
+    StepPost();
+    delay(1);
   }
-  return lastResult;
+
+  if(StartBatch(config)) {
+    while(postState != POST_IDLE) {
+      StepPost();
+      delay(1);
+    }
+  }
+  out.print(lastResult.c_str());
+  PrintFormat(out, PSTR("\nReadings still queued: %d"), queue.Count());
 }
 
-bool CloudInterface::PostData(WiFiClientSecure client, String &json, DeviceConfig& config)
+// Posts the oldest queued readings as one array.  They're only removed from the queue
+//  once the server accepts them.  Failures back off exponentially, so an outage or a slow
+//  Lambda cold start doesn't have the loop hammering the server.
+bool CloudInterface::StartBatch(DeviceConfig& config)
+{
+  PrepareClient(config);
+
+  UplinkReading readings[UPLINK_BATCH_SIZE];
+  int count = queue.Peek(readings, UPLINK_BATCH_SIZE);
+  if(count == 0)
+    return false;
+
+  // The body is encoded after room for the headers, which are filled in once its length is
+  //  known, so the whole request is in one buffer.
+  PayloadFormat format = (PayloadFormat)config.cloud_payload_format;
+  size_t bodyLength = 0;
+  {
+    PerfTimer timer(perfCloudPayload);
+    PayloadEncoder encoder(request + REQUEST_HEADER_SIZE, PAYLOAD_BUFFER_SIZE);
+    while(count > 0 && (bodyLength = encoder.Encode(format, readings, count, config.cloudInstanceId.c_str())) == 0)
+      count--;    // The rest go in the next post.
+  }
+
+  if(count == 0) {
+    eventLog.Add(PSTR("SendToCloud: reading too large to send, dropped"));
+    queue.Pop(1);
+    return false;
+  }
+
+  postCount = count;
+  postBytes = bodyLength;
+  return StartPost(bodyLength, format, config);
+}
+
+// Connects if needed, and sends the whole request.  The request is small, so it goes out
+//  in one write.  BearSSL's handshake can't be split up, so a new connection still blocks
+//  for it, but that's much shorter with a resumed session.  The wait for the server (up to
+//  15 seconds for a Lambda cold start) is left to StepPost(), from the main loop.
+bool CloudInterface::StartPost(size_t bodyLength, PayloadFormat format, DeviceConfig& config)
+{
+  PerfTimer timer(perfCloudPost);
+  postStartMillis = millis();
+  postReused = client.connected();
+  postFreeHeap = ESP.getFreeHeap();
+
+  if(!postReused && !client.connect(host.c_str(), port))
+  {
+    if(!mflnKnown)
+      clientPrepared = false;   // The probe may have failed for the same reason, so it's asked again.
+    FinishPost(false, "Failed to connect");
+    return false;
+  }
+  if(!mflnKnown) {
+    mflnKnown = true;
+    eventLog.Add(PSTR("SendToCloud: max fragment length not supported, using full size buffers"));
+  }
+
+  // The headers are written at the start of the buffer, then moved up against the body.
+  int headerLength = snprintf_P((char*)request, REQUEST_HEADER_SIZE,
+    PSTR("POST %s HTTP/1.1\r\nHost: %s\r\nContent-Type: %s\r\nx-api-key: %s\r\n"
+    "Content-Length: %u\r\nConnection: keep-alive\r\n\r\n"),
+    path.c_str(), host.c_str(), PayloadEncoder::ContentType(format), config.cloudLoggingApiKey.c_str(), (unsigned)bodyLength);
+  if(headerLength < 0 || headerLength >= (int)REQUEST_HEADER_SIZE)
+  {
+    FinishPost(false, "URL or API key too long");
+    return false;
+  }
+  uint8_t* start = request + REQUEST_HEADER_SIZE - headerLength;
+  memmove(start, request, headerLength);
+
+  size_t requestLength = headerLength + bodyLength;
+  if(client.write(start, requestLength) != requestLength)
+  {
+    FinishPost(false, "Failed to send");
+    return false;
+  }
+
+  // The TLS buffers are all allocated at this point, so this is close to the low point.
+  postFreeHeap = ESP.getFreeHeap();
+
+  httpCode = 0;
+  contentLength = -1;
+  bodyRead = 0;
+  keepAlive = true;
+  chunked = false;
+  memset(bodyTail, 0, sizeof(bodyTail));
+  responseBody.clear();
+  lineLength = 0;
+  postState = POST_AWAITING_STATUS;
+  return true;
+}
+
+// Reads whatever part of the response has arrived, without waiting for more.
+void CloudInterface::StepPost()
 {
-  HTTPClient https;
-  
   // AWS dotnet Lambdas can be slow to "cold start".
-  https.setTimeout(15000);
-  
-  if(!https.begin(client, config.cloudLoggingUrl))
+  if(millis() - postStartMillis > POST_TIMEOUT)
+  {
+    FinishPost(false, "Timed out");
+    return;
+  }
+
+  while(postState != POST_IDLE && client.available() > 0)
+  {
+    if(postState == POST_READING_BODY) {
+      ReadBody();
+    }
+    else if(ReadLine()) {
+      if(postState == POST_AWAITING_STATUS) {
+        // "HTTP/1.1 200 OK"
+        const char* code = strchr(line, ' ');
+        httpCode = code ? atoi(code + 1) : 0;
+        if(httpCode <= 0) {
+          FinishPost(false, "Bad status line");
+          return;
+        }
+        postState = POST_READING_HEADERS;
+      }
+      else if(lineLength == 0) {
+        // The blank line after the headers.
+        if(httpCode == 204 || httpCode == 304)
+          contentLength = 0;
+        postState = POST_READING_BODY;
+        if(contentLength == 0)
+          FinishPost(true, NULL);
+      }
+      else {
+        ParseHeader();
+      }
+      lineLength = 0;
+    }
+  }
+
+  if(postState != POST_IDLE && !client.connected() && client.available() == 0)
   {
-    lastResult = "Failed to begin";
-    Serial.print("SendToCloud: ");
-    Serial.println(lastResult);
-    return false; 
+    // Without a length, the body ends when the server closes the connection.
+    if(postState == POST_READING_BODY && contentLength < 0 && !chunked)
+      FinishPost(true, NULL);
+    else
+      FinishPost(false, "Connection closed");
   }
+}
+
+// Collects a line of the status or headers.  Returns true once the whole line has arrived.
+//  Anything past the end of the buffer is dropped, as no header we need is that long.
+bool CloudInterface::ReadLine()
+{
+  while(client.available() > 0)
+  {
+    int c = client.read();
+    if(c < 0)
+      return false;
+    if(c == '\n') {
+      line[lineLength] = '\0';
+      return true;
+    }
+    if(c != '\r' && lineLength < (int)sizeof(line) - 1)
+      line[lineLength++] = c;
+  }
+  return false;
+}
 
-  https.addHeader("Content-Type", "application/json");
-  https.addHeader("x-api-key", config.cloudLoggingApiKey);
-  int httpCode = https.POST(json); 
+void CloudInterface::ParseHeader()
+{
+  char* value = strchr(line, ':');
+  if(value == NULL)
+    return;
+  *value++ = '\0';
+  while(*value == ' ')
+    value++;
 
+  char* c;
+  for(c = value; *c != '\0'; c++)
+    *c = tolower(*c);
 
-  if(httpCode > 0)
+  if(strcasecmp(line, "Content-Length") == 0) {
+    contentLength = atol(value);
+  }
+  else if(strcasecmp(line, "Connection") == 0 && strstr(value, "close") != NULL) {
+    keepAlive = false;
+  }
+  else if(strcasecmp(line, "Transfer-Encoding") == 0 && strstr(value, "chunked") != NULL) {
+    chunked = true;
+  }
+}
+
+// Only the start of the body is kept, to show on the test page.  A chunked body is kept as
+//  it arrives, chunk sizes and all, and ends with a zero size chunk.
+void CloudInterface::ReadBody()
+{
+  static const char CHUNKED_END[] = "\n0\r\n\r\n";
+
+  while(client.available() > 0)
   {
-    lastResult = "HTTP Response: ";
-    lastResult += String(httpCode) + "\n";
-    lastResult += https.getString();
+    int c = client.read();
+    if(c < 0)
+      return;
+    bodyRead++;
+    responseBody.write(c);    // Anything past its capacity is dropped.
+
+    if(chunked) {
+      memmove(bodyTail, bodyTail + 1, sizeof(bodyTail) - 1);
+      bodyTail[sizeof(bodyTail) - 1] = c;
+      if(memcmp(bodyTail, CHUNKED_END, sizeof(bodyTail)) == 0 ||
+        (bodyRead == 5 && memcmp(bodyTail + 1, CHUNKED_END + 1, sizeof(bodyTail) - 1) == 0)) {
+        FinishPost(true, NULL);
+        return;
+      }
+    }
+    else if(contentLength >= 0 && bodyRead >= contentLength) {
+      FinishPost(true, NULL);
+      return;
+    }
+  }
+}
+
+// completed is true once a whole response has been read.  The readings are only removed from
+//  the queue if it's a success response.
+void CloudInterface::FinishPost(bool completed, const char* error)
+{
+  lastResult.clear();
+  if(completed)
+  {
+    PrintFormat(lastResult, PSTR("HTTP Response: %d\n"), httpCode);
+    lastResult.print(responseBody.c_str());
   }
   else
   {
-    lastResult = "Failed. err=";
-    lastResult += https.errorToString(httpCode);
+    PrintFormat(lastResult, PSTR("Failed. err=%s"), error);
   }
-  Serial.print("SendToCloud: ");
-  Serial.println(lastResult);
+  responseBody.clear();
+
+  // Leaves the connection open, if the server allows it.  A failed connection is
+  //  closed, so the retry starts clean.  Without MFLN, the 16 KB receive buffer is more than
+  //  can be spared between posts, so that connection's closed too.
+  if(!completed || !keepAlive || !mflnEnabled)
+    client.stop();
+
+  PrintFormat(lastResult, PSTR("\n(%s connection, %lu ms, %s%u bytes heap free)"), postReused ? "reused" : "new",
+    millis() - postStartMillis, mflnEnabled ? "MFLN, " : "", (unsigned)postFreeHeap);
+  if(completed)
+    eventLog.Add(PSTR("SendToCloud: HTTP %d, %d readings in %u bytes, %s connection, %lu ms, %u heap free"), httpCode, postCount, (unsigned)postBytes,
+      postReused ? "reused" : "new", millis() - postStartMillis, (unsigned)postFreeHeap);
+  else
+    eventLog.Add(PSTR("SendToCloud: failed, %s, %s connection, %lu ms"), error,
+      postReused ? "reused" : "new", millis() - postStartMillis);
+
+  // From connecting to the end of the response, including the time waiting in the loop.
+  perfCloudRoundTrip.Record((millis() - postStartMillis) * 1000, 0, ESP.getFreeHeap());
 
-  return httpCode >= 200 && httpCode < 300;
+  bool success = completed && httpCode >= 200 && httpCode < 300;
+  if(success)
+  {
+    queue.Pop(postCount);
+    backoffMillis = 0;
+    nextAttemptMillis = millis();
+  }
+  else
+  {
+    backoffMillis = backoffMillis == 0 ? UPLINK_MIN_BACKOFF : min(backoffMillis * 2, UPLINK_MAX_BACKOFF);
+    nextAttemptMillis = millis() + backoffMillis;
+  }
+  postState = POST_IDLE;
 }
@@ -1,20 +1,102 @@
 #include "DeviceConfig.h"
 #include "SampleBuffer.h"
-#include <ESP8266HTTPClient.h>
 #include <WiFiClientSecure.h>
+#include "UplinkQueue.h"
+#include "PayloadEncoder.h"
+#include "TextFormat.h"
 
 class CloudInterface
 {
 public:
+    // Loads the root certificate, and any readings still queued from before a reboot.
+    void Setup();
     void LoadRootCert();
-    String WriteDataToCloud(SampleBuffer& samples, DeviceConfig& config);
 
-    static const char ROOT_CERT_FILE[];
+    // Queues the latest reading.  Queued readings are sent by Service(), in batches.
+    void QueueReading(SampleBuffer& samples);
+
+    // To be called in the main loop.  Starts posting a batch of queued readings when one is due,
+    //  and moves a post that's in flight along, without waiting on the server.
+    void Service(DeviceConfig& config);
+
+    // Queues the latest reading, and posts straight away, ignoring any backoff.  This waits
+    //  for the response, and prints it for the test page.
+    void WriteDataToCloud(SampleBuffer& samples, DeviceConfig& config, Print& out);
+
+    // Moves the timestamps of the readings queued since startup.
+    void ClockCorrected(long seconds) { queue.Retime(seconds); }
+
+    int QueuedCount() const { return queue.Count(); }
+
+    // True for an https:// URL with a host.  Posts only go over TLS.
+    static bool IsValidUrl(const String& url);
+    bool Posting() const    { return postState != POST_IDLE; }
+
+    static const char ROOT_CERT_FILE[];      // As uploaded (PEM)
+    static const char TRUST_ANCHOR_FILE[];   // As loaded (DER)
+
+private:
+    void ConvertRootCert();
+    void PrepareClient(DeviceConfig& config);
+    bool IsConfigured(DeviceConfig& config);
+    bool StartBatch(DeviceConfig& config);
+    bool StartPost(size_t bodyLength, PayloadFormat format, DeviceConfig& config);
+    void StepPost();
+    bool ReadLine();
+    void ParseHeader();
+    void ReadBody();
+    void FinishPost(bool completed, const char* error);
 
 private:
-    bool PostData(WiFiClientSecure client, String &json, DeviceConfig& config);
+    // A post is sent in one go, and the response read a piece at a time by Service().
+    enum PostState {
+      POST_IDLE,
+      POST_AWAITING_STATUS,
+      POST_READING_HEADERS,
+      POST_READING_BODY
+    };
 
 private:
+    static const size_t MAX_RESPONSE_KEPT = 256;    // See ReadBody()
+
+    // Queued readings are sent as many as fit in the payload buffer, after room for the headers.
+    static const size_t PAYLOAD_BUFFER_SIZE = 1024;
+    static const size_t REQUEST_HEADER_SIZE = 320;
+
     X509List* certs = NULL;
-    String lastResult;
+    FixedString<MAX_RESPONSE_KEPT + 128> lastResult;
+
+    WiFiClientSecure client;
+    BearSSL::Session session;
+    bool clientPrepared = false;
+    String preparedUrl;
+    String host;
+    String path;
+    uint16_t port = 443;
+    bool mflnEnabled = false;
+    bool mflnKnown = false;             // False until a refused probe is borne out by a connection
+
+    PostState postState = POST_IDLE;
+    int postCount = 0;                  // Readings in the post
+    size_t postBytes = 0;               //  and the size of its body
+    unsigned long postStartMillis = 0;
+    bool postReused = false;
+    uint32_t postFreeHeap = 0;
+    int httpCode = 0;
+    long contentLength = -1;            // -1 when the server didn't say
+    long bodyRead = 0;
+    bool keepAlive = true;
+    bool chunked = false;
+    char bodyTail[6];                   // Last bytes of a chunked body, to spot its end
+    FixedString<MAX_RESPONSE_KEPT + 1> responseBody;
+    char line[128];
+    int lineLength = 0;
+
+    // Kept here rather than on the stack, as StartBatch() is also reached from the /testcode
+    //  page, which is already deep in the web server's handlers.
+    uint8_t request[REQUEST_HEADER_SIZE + PAYLOAD_BUFFER_SIZE];
+
+    UplinkQueue queue;
+    unsigned long nextAttemptMillis = 0;
+    unsigned long backoffMillis = 0;
 };
@@ -0,0 +1,238 @@
+#include "ControlEngine.h"
+#include "EventLog.h"
+#include "TextFormat.h"
+
+// With no reading for this long (e.g. the sensor's unplugged), the heater goes off.
+const unsigned long READING_TIMEOUT = 5 * 60 * 1000UL;
+
+const unsigned long MIN_PID_WINDOW = DeviceConfig::MIN_PID_WINDOW_SECONDS * 1000UL;
+const float DERIVATIVE_SMOOTHING = 0.2;     // Weight of each new reading in the smoothed temperature
+
+// Autotune switches at this far either side of the setpoint, to stay clear of sensor noise.
+const float AUTOTUNE_BAND = 0.25;
+const int AUTOTUNE_CYCLES = 3;              // Measured, after a first cycle that's ignored
+const unsigned long AUTOTUNE_TIMEOUT = 48 * 60 * 60 * 1000UL;
+
+const char* const CONTROL_MODE_NAMES[NUM_CONTROL_MODES] = { "hysteresis", "PID" };
+
+float clampUnit(float value) {
+  return value < 0 ? 0 : value > 1 ? 1 : value;
+}
+
+// ----------------------------------------------------------------------
+
+void HysteresisController::Reading(const DeviceConfig& config, float temp, unsigned long nowMillis) {
+  if(temp < config.relay_on_below_temp)
+    on = true;
+
+  if(temp > config.relay_off_above_temp)
+    on = false;
+}
+
+void HysteresisController::PrintStatus(Print& out) const {
+  PrintFormat(out, PSTR("Hysteresis: wants the heater %s"), on ? "on" : "off");
+}
+
+// ----------------------------------------------------------------------
+
+void PidController::Reset() {
+  started = false;
+  integral = 0;
+  output = 0;
+  window_start = 0;
+  window_on_millis = 0;
+  autotuning = false;
+}
+
+void PidController::Reading(const DeviceConfig& config, float temp, unsigned long nowMillis) {
+  if(!started) {
+    started = true;
+    smoothed_temp = temp;
+    last_reading_millis = nowMillis;
+  }
+
+  if(autotuning) {
+    AutotuneReading(config, temp, nowMillis);
+    return;
+  }
+
+  float dt = (nowMillis - last_reading_millis) / 1000.0;
+  last_reading_millis = nowMillis;
+
+  float previousSmoothed = smoothed_temp;
+  smoothed_temp += DERIVATIVE_SMOOTHING * (temp - smoothed_temp);
+
+  float error = config.control_setpoint - temp;
+
+  // Clamping the integral stops it winding up while the heater can't keep up (or is off).
+  integral = clampUnit(integral + config.pid_ki * error * dt);
+
+  // On the measurement rather than the error, so changing the setpoint doesn't kick it.
+  float derivative = dt > 0 ? -config.pid_kd * (smoothed_temp - previousSmoothed) / dt : 0;
+
+  output = clampUnit(config.pid_kp * error + integral + derivative);
+}
+
+bool PidController::HeaterWanted(const DeviceConfig& config, unsigned long nowMillis) {
+  if(autotuning)
+    return autotune_heating;
+
+  unsigned long window = max((unsigned long)config.pid_window_seconds * 1000UL, MIN_PID_WINDOW);
+  if(window_start == 0 || nowMillis - window_start >= window) {
+    window_start = nowMillis;
+
+    // Pulses too short for the minimum on or off time are dropped, rather than stretched.
+    window_on_millis = output * window;
+    if(window_on_millis < (unsigned long)config.min_on_seconds * 1000UL)
+      window_on_millis = 0;
+    if(window - window_on_millis < (unsigned long)config.min_off_seconds * 1000UL)
+      window_on_millis = window;
+  }
+
+  return nowMillis - window_start < window_on_millis;
+}
+
+void PidController::PrintStatus(Print& out) const {
+  if(autotuning) {
+    PrintFormat(out, PSTR("PID: autotuning, cycle %d of %d, heater %s"), autotune_cycles, AUTOTUNE_CYCLES + 1,
+      autotune_heating ? "on" : "off");
+  } else {
+    PrintFormat(out, PSTR("PID: output %d%%, integral %d%%"), (int)(output * 100), (int)(integral * 100));
+  }
+}
+
+void PidController::StartAutotune(unsigned long nowMillis) {
+  autotuning = true;
+  autotune_done = false;
+  autotune_heating = false;
+  autotune_cycles = 0;
+  autotune_start = nowMillis;
+  autotune_last_on = 0;
+  autotune_period_total = 0;
+  autotune_amplitude_total = 0;
+  autotune_high = -1000;
+  autotune_low = 1000;
+}
+
+// The heater goes on below the band and off above it.  Each time it comes back on is the end
+//  of a cycle, whose period and swing give the ultimate gain and period.
+void PidController::AutotuneReading(const DeviceConfig& config, float temp, unsigned long nowMillis) {
+  if(nowMillis - autotune_start > AUTOTUNE_TIMEOUT) {
+    autotuning = false;
+    eventLog.Add(PSTR("Autotune: no steady oscillation after 48 hours, giving up"));
+    return;
+  }
+
+  autotune_high = max(autotune_high, temp);
+  autotune_low = min(autotune_low, temp);
+
+  if(autotune_heating && temp > config.control_setpoint + AUTOTUNE_BAND) {
+    autotune_heating = false;
+  } else if(!autotune_heating && temp < config.control_setpoint - AUTOTUNE_BAND) {
+    if(autotune_last_on != 0) {
+      autotune_cycles++;
+      if(autotune_cycles > 1) {
+        autotune_period_total += nowMillis - autotune_last_on;
+        autotune_amplitude_total += (autotune_high - autotune_low) / 2;
+      }
+    }
+    autotune_last_on = nowMillis;
+    autotune_heating = true;
+    autotune_high = temp;
+    autotune_low = temp;
+
+    if(autotune_cycles > AUTOTUNE_CYCLES) {
+      float period = autotune_period_total / 1000.0 / AUTOTUNE_CYCLES;
+      float amplitude = autotune_amplitude_total / AUTOTUNE_CYCLES;
+      if(amplitude > AUTOTUNE_BAND)
+        amplitude = sqrt(amplitude * amplitude - AUTOTUNE_BAND * AUTOTUNE_BAND);
+      if(amplitude < 0.05)
+        amplitude = 0.05;
+
+      // The relay swings the output by +/-0.5.  Tyreus-Luyben rules, which overshoot less
+      //  than Ziegler-Nichols.
+      float ultimateGain = 4 * 0.5 / (PI * amplitude);
+      tuned_kp = ultimateGain / 2.2;
+      tuned_ki = tuned_kp / (2.2 * period);
+      tuned_kd = tuned_kp * period / 6.3;
+
+      autotuning = false;
+      autotune_done = true;
+      integral = 0;
+      output = 0;
+    }
+  }
+}
+
+bool PidController::AutotuneFinished(DeviceConfig& config) {
+  if(!autotune_done)
+    return false;
+
+  autotune_done = false;
+  config.pid_kp = tuned_kp;
+  config.pid_ki = tuned_ki;
+  config.pid_kd = tuned_kd;
+  return true;
+}
+
+// ----------------------------------------------------------------------
+
+Controller& ControlEngine::Active() {
+  int mode = config.control_mode;
+  if(mode < 0 || mode >= NUM_CONTROL_MODES)
+    mode = CONTROL_HYSTERESIS;
+
+  Controller& controller = mode == CONTROL_PID ? (Controller&)pid : (Controller&)hysteresis;
+  if(mode != active_mode) {
+    active_mode = mode;
+    controller.Reset();
+    eventLog.Add(PSTR("Control: using %s"), CONTROL_MODE_NAMES[mode]);
+  }
+  return controller;
+}
+
+void ControlEngine::Reading(float temp) {
+  last_reading_millis = millis();
+  have_reading = true;
+  Active().Reading(config, temp, last_reading_millis);
+}
+
+bool ControlEngine::Update() {
+  unsigned long now = millis();
+  Controller& controller = Active();
+
+  bool fresh = have_reading && now - last_reading_millis < READING_TIMEOUT;
+  bool wanted = fresh && controller.HeaterWanted(config, now);
+
+  if(pid.AutotuneFinished(config)) {
+    config.WriteToFS();
+    eventLog.Add(PSTR("Autotune: Kp %0.4f, Ki %0.6f, Kd %0.2f"), config.pid_kp, config.pid_ki, config.pid_kd);
+  }
+
+  if(wanted != heater_on) {
+    unsigned long minimum = (heater_on ? config.min_on_seconds : config.min_off_seconds) * 1000UL;
+
+    // Without readings, the heater goes off straight away.  The first switch since boot isn't
+    //  held back either, as there's no last switch to time from.
+    if(switches == 0 || now - last_switch_millis >= minimum || !fresh) {
+      heater_on = wanted;
+      last_switch_millis = now;
+      switches++;
+    }
+  }
+  return heater_on;
+}
+
+void ControlEngine::StartAutotune() {
+  if(config.control_mode != CONTROL_PID) {
+    eventLog.Add(PSTR("Autotune: only for PID control"));
+    return;
+  }
+  pid.StartAutotune(millis());
+  eventLog.Add(PSTR("Autotune: started, around %0.2f C"), config.control_setpoint);
+}
+
+void ControlEngine::PrintStatus(Print& out) {
+  Active().PrintStatus(out);
+  PrintFormat(out, PSTR(".  Heater %s, %u switches since boot."), heater_on ? "on" : "off", (unsigned)switches);
+}
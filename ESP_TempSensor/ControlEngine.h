@@ -0,0 +1,131 @@
+#include <Arduino.h>
+#include "DeviceConfig.h"
+
+#ifndef __CONTROL_ENGINE__
+#define __CONTROL_ENGINE__
+
+// ----------------------------------------------------------------------
+// Decides when the heater relay should be on.
+//
+//  Each kind of control is a Controller.  The ControlEngine runs whichever one the
+//  configuration picks, and enforces the minimum on and off times on top, so no controller
+//  can chatter the relay.  The configuration is read live, so changes on the configure
+//  page take effect on the next update.
+
+enum ControlMode {
+  CONTROL_HYSTERESIS = 0,     // On below one temperature, off above another
+  CONTROL_PID,                // Time proportioning PID around a setpoint
+  NUM_CONTROL_MODES
+};
+
+class Controller
+{
+public:
+    virtual ~Controller() {}
+
+    // Starts again from scratch, e.g. after switching controllers.
+    virtual void Reset() = 0;
+
+    // A new temperature reading.
+    virtual void Reading(const DeviceConfig& config, float temp, unsigned long nowMillis) = 0;
+
+    // Whether the heater should be on now.  Called about once a second.
+    virtual bool HeaterWanted(const DeviceConfig& config, unsigned long nowMillis) = 0;
+
+    virtual void PrintStatus(Print& out) const = 0;
+};
+
+class HysteresisController : public Controller
+{
+public:
+    void Reset() override { on = false; }
+    void Reading(const DeviceConfig& config, float temp, unsigned long nowMillis) override;
+    bool HeaterWanted(const DeviceConfig& config, unsigned long nowMillis) override { return on; }
+    void PrintStatus(Print& out) const override;
+
+private:
+    bool on = false;
+};
+
+// The PID's output (0 to 1) is the fraction of each window the heater is on.  A slow
+//  moving fridge doesn't need anything finer, and the relay only switches twice a window.
+//
+//  The gains can be found with Autotune(), which switches the heater on and off around the
+//  setpoint (a relay feedback test), and works them out from the oscillation that follows.
+class PidController : public Controller
+{
+public:
+    void Reset() override;
+    void Reading(const DeviceConfig& config, float temp, unsigned long nowMillis) override;
+    bool HeaterWanted(const DeviceConfig& config, unsigned long nowMillis) override;
+    void PrintStatus(Print& out) const override;
+
+    void StartAutotune(unsigned long nowMillis);
+    void StopAutotune()                  { autotuning = false; }
+    bool Autotuning() const              { return autotuning; }
+
+    // True once, when an autotune finishes.  The new gains are put in config.
+    bool AutotuneFinished(DeviceConfig& config);
+
+private:
+    void AutotuneReading(const DeviceConfig& config, float temp, unsigned long nowMillis);
+
+    bool started = false;
+    float integral = 0;             // Already scaled by Ki, so changing Ki doesn't bump the output
+    float smoothed_temp = 0;        // For the derivative, as the readings are coarse
+    unsigned long last_reading_millis = 0;
+    float output = 0;
+    unsigned long window_start = 0;
+    unsigned long window_on_millis = 0;   // Decided at the start of each window
+
+    bool autotuning = false;
+    bool autotune_done = false;
+    bool autotune_heating = false;
+    int autotune_cycles = 0;
+    unsigned long autotune_start = 0;
+    unsigned long autotune_last_on = 0;
+    unsigned long autotune_period_total = 0;
+    float autotune_high = 0;
+    float autotune_low = 0;
+    float autotune_amplitude_total = 0;
+    float tuned_kp = 0;
+    float tuned_ki = 0;
+    float tuned_kd = 0;
+};
+
+class ControlEngine
+{
+public:
+    ControlEngine(DeviceConfig& deviceConfig) : config(deviceConfig) {};
+
+    // To be called with each new reading.
+    void Reading(float temp);
+
+    // To be called about once a second.  Returns whether the heater should be on.
+    bool Update();
+
+    bool HeaterOn() const { return heater_on; }
+
+    // Only for PID control.  The gains found are saved to the configuration.
+    void StartAutotune();
+
+    void PrintStatus(Print& out);
+
+public:
+    uint32_t switches = 0;
+
+private:
+    Controller& Active();
+
+    DeviceConfig& config;
+    HysteresisController hysteresis;
+    PidController pid;
+    int active_mode = -1;
+
+    bool heater_on = false;
+    unsigned long last_switch_millis = 0;
+    unsigned long last_reading_millis = 0;
+    bool have_reading = false;
+};
+
+#endif // __CONTROL_ENGINE__
@@ -1,69 +1,329 @@
 #include "DeviceConfig.h"
-#include "CsvHelpers.h"
+#include "RecordFile.h"
+#include "PerfStats.h"
+#include "EventLog.h"
+#include "ControlEngine.h"
+#include "SampleBuffer.h"
+#include "PayloadEncoder.h"
 
-const char CONFIG_FILE[] =  "/config.csv";
-const char CONFIG_FILE_BACKUP[] = "/config.bkp";
+// The configuration is a file of CRC protected records (see RecordFile), one per setting,
+//  after a header.  Settings are found by their record type, so adding one doesn't move the
+//  others, and a file written before a setting existed leaves it at its default.  The file is
+//  written to a temporary file, then renamed over the old one, so it's always complete.
+const char CONFIG_FILE[] = "/config.bin";
+const char CONFIG_FILE_TEMP[] = "/config.tmp";
+
+// Older firmware wrote the settings as a line of comma separated text.
+const char LEGACY_CONFIG_FILE[] = "/config.csv";
+const char LEGACY_CONFIG_FILE_BACKUP[] = "/config.bkp";
+
+// Only changed if existing records stop meaning the same thing.  New settings just get
+//  a new record type.
+const uint8_t CONFIG_VERSION = 1;
+
+// The whole file is read in one go, so it has to fit in this.
+const size_t MAX_CONFIG_SIZE = 1024;
+
+enum ConfigRecordType : uint8_t {
+  CONFIG_HEADER = 1,
+  CONFIG_TIMEZONE_OFFSET = 2,
+  CONFIG_RELAY_ON_BELOW = 3,
+  CONFIG_RELAY_OFF_ABOVE = 4,
+  CONFIG_CLOUD_URL = 5,
+  CONFIG_CLOUD_API_KEY = 6,
+  CONFIG_CLOUD_INSTANCE_ID = 7,
+  CONFIG_CONTROL_MODE = 8,
+  CONFIG_CONTROL_SETPOINT = 9,
+  CONFIG_PID_KP = 10,
+  CONFIG_PID_KI = 11,
+  CONFIG_PID_KD = 12,
+  CONFIG_PID_WINDOW = 13,
+  CONFIG_MIN_ON = 14,
+  CONFIG_MIN_OFF = 15,
+  CONFIG_CONTROL_CHANNEL = 16,
+  CONFIG_CLOUD_FORMAT = 17,
+  CONFIG_END = 255,         // Last, so a file cut short can be told from a complete one.
+};
+
+// The DS1621's range.  A temperature to control to outside it could never be reached.
+const float MIN_CONTROL_TEMP = -55;
+const float MAX_CONTROL_TEMP = 125;
+
+struct __attribute__((packed)) ConfigHeader {
+  uint8_t version;
+};
+
+bool writeInt(File& file, uint8_t type, int32_t value) {
+  return RecordFile::WriteRecord(file, type, &value, sizeof(value));
+}
+
+bool writeFloat(File& file, uint8_t type, float value) {
+  return RecordFile::WriteRecord(file, type, &value, sizeof(value));
+}
+
+// Strings are stored without a terminator, and can hold any character.
+bool writeString(File& file, uint8_t type, const String& value) {
+  if(value.length() > RecordFile::MAX_PAYLOAD) {
+    eventLog.Add(PSTR("DeviceConfig: setting %d too long to save"), type);
+    return false;
+  }
+  return RecordFile::WriteRecord(file, type, value.c_str(), value.length());
+}
+
+// The value is only changed if the record is the expected size.
+template<typename T> void readValue(const uint8_t* payload, uint8_t length, T& value) {
+  if(length == sizeof(T))
+    memcpy(&value, payload, sizeof(T));
+}
+
+// Stored as 32 bits, whatever size the setting is.
+template<typename T> void readInt(const uint8_t* payload, uint8_t length, T& value) {
+  int32_t stored = value;
+  readValue(payload, length, stored);
+  value = stored;
+}
+
+void readString(const uint8_t* payload, uint8_t length, String& value) {
+  char text[RecordFile::MAX_PAYLOAD + 1];
+  memcpy(text, payload, length);
+  text[length] = '\0';
+  value = text;
+}
+
+bool controlTempValid(float temp) {
+  return temp >= MIN_CONTROL_TEMP && temp <= MAX_CONTROL_TEMP;     // False for NaN too
+}
+
+bool gainValid(float gain) {
+  return gain >= 0 && gain < INFINITY;
+}
+
+bool relayTempsValid(float onBelow, float offAbove) {
+  return controlTempValid(onBelow) && controlTempValid(offAbove) && onBelow < offAbove;
+}
+
+bool controlValid(int mode, float setpoint, float kp, float ki, float kd, int windowSeconds, int minOnSeconds, int minOffSeconds) {
+  return mode >= 0 && mode < NUM_CONTROL_MODES &&
+    controlTempValid(setpoint) && gainValid(kp) && gainValid(ki) && gainValid(kd) &&
+    windowSeconds >= DeviceConfig::MIN_PID_WINDOW_SECONDS && windowSeconds <= DeviceConfig::MAX_PID_WINDOW_SECONDS &&
+    minOnSeconds >= 0 && minOnSeconds <= DeviceConfig::MAX_MIN_ON_OFF_SECONDS &&
+    minOffSeconds >= 0 && minOffSeconds <= DeviceConfig::MAX_MIN_ON_OFF_SECONDS &&
+    minOnSeconds + minOffSeconds <= windowSeconds;
+}
 
 void DeviceConfig::SetTimezoneOffset(int timezoneOffset) {
-  if(timezone_offset >= -12 && timezone_offset <= 12)
+  if(timezoneOffset >= -12 && timezoneOffset <= 12)
     timezone_offset = timezoneOffset;
 }
 
+bool DeviceConfig::SetRelayTemps(float onBelow, float offAbove) {
+  if(!relayTempsValid(onBelow, offAbove))
+    return false;
+  relay_on_below_temp = onBelow;
+  relay_off_above_temp = offAbove;
+  return true;
+}
+
+bool DeviceConfig::SetControl(int mode, float setpoint, float kp, float ki, float kd, int windowSeconds, int minOnSeconds, int minOffSeconds) {
+  if(!controlValid(mode, setpoint, kp, ki, kd, windowSeconds, minOnSeconds, minOffSeconds))
+    return false;
+  control_mode = mode;
+  control_setpoint = setpoint;
+  pid_kp = kp;
+  pid_ki = ki;
+  pid_kd = kd;
+  pid_window_seconds = windowSeconds;
+  min_on_seconds = minOnSeconds;
+  min_off_seconds = minOffSeconds;
+  return true;
+}
+
 bool DeviceConfig::ReadFromFS() {
-  File file;
-  
-  if(LittleFS.exists(CONFIG_FILE)) {
-    file = LittleFS.open(CONFIG_FILE, "r");
-  } else if(LittleFS.exists(CONFIG_FILE_BACKUP)) {
-    file = LittleFS.open(CONFIG_FILE_BACKUP, "r");
+  PerfTimer timer(perfConfigRead);
+
+  File file = LittleFS.open(CONFIG_FILE, "r");
+  if(!file) {
+    if(!ReadLegacyCsv())
+      return false;
+    WriteToFS();
+    LittleFS.remove(LEGACY_CONFIG_FILE);
+    LittleFS.remove(LEGACY_CONFIG_FILE_BACKUP);
+    return true;
   }
 
-  if(file) {
-    // Read from file
-    timezone_offset = file.parseInt();
-    if(timezone_offset < -12 || timezone_offset > 12)
-      timezone_offset = DEFAULT_TIMEZONE_OFFSET;
-
-    relay_on_below_temp = file.parseFloat();
-    relay_off_above_temp = file.parseFloat();
-
-    // Sanity check these values, because the relay logic
-    //  wouldn't behave well if they were upside down.
-    if(relay_on_below_temp >= relay_off_above_temp)
-    {
-      relay_on_below_temp = DEFAULT_RELAY_ON_BELOW_TEMP;
-      relay_off_above_temp = DEFAULT_RELAY_OFF_ABOVE_TEMP;
-    }
+  uint8_t data[MAX_CONFIG_SIZE];
+  size_t size = file.size();
+  bool ok = size <= sizeof(data) && file.read(data, size) == size;
+  file.close();
 
-    file.readStringUntil(',');  // Throw away the delimiter, that a "parse" would have skipped.
+  // Checked right through before anything is used, so a damaged file doesn't leave a
+  //  mix of saved and default settings.
+  if(!ok || !ApplyRecords(data, size, false)) {
+    eventLog.Add(PSTR("DeviceConfig: saved configuration damaged, using defaults"));
+    return false;
+  }
+  ApplyRecords(data, size, true);
+  CheckLoaded();
+  return true;
+}
 
-    cloudLoggingUrl = file.readStringUntil(',');
-    cloudLoggingApiKey = file.readStringUntil(',');
-    cloudInstanceId = file.readStringUntil(',');
-    file.close();
-    return true;
+// Sanity check the loaded values, because the relay logic wouldn't behave well if they
+//  were upside down, or out of range.  Settings saved by older firmware weren't all checked.
+void DeviceConfig::CheckLoaded() {
+  if(timezone_offset < -12 || timezone_offset > 12)
+    timezone_offset = DEFAULT_TIMEZONE_OFFSET;
+  if(!relayTempsValid(relay_on_below_temp, relay_off_above_temp)) {
+    relay_on_below_temp = DEFAULT_RELAY_ON_BELOW_TEMP;
+    relay_off_above_temp = DEFAULT_RELAY_OFF_ABOVE_TEMP;
+  }
+
+  if(!controlValid(control_mode, control_setpoint, pid_kp, pid_ki, pid_kd, pid_window_seconds, min_on_seconds, min_off_seconds)) {
+    eventLog.Add(PSTR("DeviceConfig: saved heater control settings out of range, using defaults"));
+    const DeviceConfig defaults;
+    control_mode = defaults.control_mode;
+    control_setpoint = defaults.control_setpoint;
+    pid_kp = defaults.pid_kp;
+    pid_ki = defaults.pid_ki;
+    pid_kd = defaults.pid_kd;
+    pid_window_seconds = defaults.pid_window_seconds;
+    min_on_seconds = defaults.min_on_seconds;
+    min_off_seconds = defaults.min_off_seconds;
+  }
+
+  // Cast straight to a PayloadFormat when posting, so a value from a damaged or newer file
+  //  would pick an encoding that doesn't exist.
+  if(cloud_payload_format < 0 || cloud_payload_format >= NUM_PAYLOAD_FORMATS) {
+    eventLog.Add(PSTR("DeviceConfig: saved cloud payload format %d out of range, using JSON"), cloud_payload_format);
+    cloud_payload_format = PAYLOAD_JSON;
+  }
+
+  // Saved by a build with more channels, it would index past the last channel's history.
+  if(control_channel < 0 || control_channel >= SENSOR_CHANNELS) {
+    eventLog.Add(PSTR("DeviceConfig: heater followed channel %d, which this build doesn't have, using channel 0"), control_channel);
+    control_channel = 0;
+  }
+}
+
+// Returns true if the records are all intact, in a version this firmware understands, up to
+//  the end record.  Only sets the values when apply is true.
+bool DeviceConfig::ApplyRecords(const uint8_t* data, size_t size, bool apply) {
+  size_t offset = 0;
+  uint8_t type;
+  uint8_t length;
+  const uint8_t* payload;
+
+  if(!RecordFile::ParseRecord(data, size, offset, type, payload, length) ||
+    type != CONFIG_HEADER || length != sizeof(ConfigHeader) || ((ConfigHeader*)payload)->version != CONFIG_VERSION)
+    return false;
+
+  while(RecordFile::ParseRecord(data, size, offset, type, payload, length)) {
+    if(type == CONFIG_END)
+      return true;
+    if(!apply)
+      continue;
+
+    switch(type) {
+      case CONFIG_TIMEZONE_OFFSET:   readInt(payload, length, timezone_offset); break;
+      case CONFIG_RELAY_ON_BELOW:    readValue(payload, length, relay_on_below_temp); break;
+      case CONFIG_RELAY_OFF_ABOVE:   readValue(payload, length, relay_off_above_temp); break;
+      case CONFIG_CLOUD_URL:         readString(payload, length, cloudLoggingUrl); break;
+      case CONFIG_CLOUD_API_KEY:     readString(payload, length, cloudLoggingApiKey); break;
+      case CONFIG_CLOUD_INSTANCE_ID: readString(payload, length, cloudInstanceId); break;
+      case CONFIG_CONTROL_MODE:      readInt(payload, length, control_mode); break;
+      case CONFIG_CONTROL_SETPOINT:  readValue(payload, length, control_setpoint); break;
+      case CONFIG_PID_KP:            readValue(payload, length, pid_kp); break;
+      case CONFIG_PID_KI:            readValue(payload, length, pid_ki); break;
+      case CONFIG_PID_KD:            readValue(payload, length, pid_kd); break;
+      case CONFIG_PID_WINDOW:        readInt(payload, length, pid_window_seconds); break;
+      case CONFIG_MIN_ON:            readInt(payload, length, min_on_seconds); break;
+      case CONFIG_MIN_OFF:           readInt(payload, length, min_off_seconds); break;
+      case CONFIG_CONTROL_CHANNEL:   readInt(payload, length, control_channel); break;
+      case CONFIG_CLOUD_FORMAT:      readInt(payload, length, cloud_payload_format); break;
+      default:                       break;    // From newer firmware
+    }
   }
   return false;
 }
 
-void DeviceConfig::WriteToFS() {
+bool DeviceConfig::ReadLegacyCsv() {
+  File file;
+  
+  if(LittleFS.exists(LEGACY_CONFIG_FILE)) {
+    file = LittleFS.open(LEGACY_CONFIG_FILE, "r");
+  } else if(LittleFS.exists(LEGACY_CONFIG_FILE_BACKUP)) {
+    file = LittleFS.open(LEGACY_CONFIG_FILE_BACKUP, "r");
+  }
+
+  if(!file)
+    return false;
+
+  timezone_offset = file.parseInt();
+  relay_on_below_temp = file.parseFloat();
+  relay_off_above_temp = file.parseFloat();
+
+  file.readStringUntil(',');  // Throw away the delimiter, that a "parse" would have skipped.
+
+  cloudLoggingUrl = file.readStringUntil(',');
+  cloudLoggingApiKey = file.readStringUntil(',');
+  cloudInstanceId = file.readStringUntil(',');
 
-  if(LittleFS.exists(CONFIG_FILE)) {
-    LittleFS.remove(CONFIG_FILE_BACKUP);
-    LittleFS.rename(CONFIG_FILE, CONFIG_FILE_BACKUP);
+  // Files from before heater control was configurable stop here, leaving the defaults.
+  if(file.available()) {
+    control_mode = file.parseInt();
+    control_setpoint = file.parseFloat();
+    pid_kp = file.parseFloat();
+    pid_ki = file.parseFloat();
+    pid_kd = file.parseFloat();
+    pid_window_seconds = file.parseInt();
+    min_on_seconds = file.parseInt();
+    min_off_seconds = file.parseInt();
   }
 
-  File file = LittleFS.open(CONFIG_FILE, "w");
-  CsvHelpers::writeInt(file, timezone_offset);
+  // And from before there were several sensors.
+  if(file.available()) {
+    control_channel = file.parseInt();
+  }
+  file.close();
+  CheckLoaded();
+  return true;
+}
+
+void DeviceConfig::WriteToFS() {
+  PerfTimer timer(perfConfigWrite);
 
-  CsvHelpers::writeFloat(file, relay_on_below_temp);
-  CsvHelpers::writeFloat(file, relay_off_above_temp);
+  File file = LittleFS.open(CONFIG_FILE_TEMP, "w");
+  if(!file) {
+    eventLog.Add(PSTR("DeviceConfig: failed to create file"));
+    return;
+  }
 
-  CsvHelpers::writeString(file, cloudLoggingUrl);
-  CsvHelpers::writeString(file, cloudLoggingApiKey);
-  CsvHelpers::writeString(file, cloudInstanceId);
-  file.flush();
+  ConfigHeader header = { CONFIG_VERSION };
+  bool ok = RecordFile::WriteRecord(file, CONFIG_HEADER, &header, sizeof(header));
+  ok = ok && writeInt(file, CONFIG_TIMEZONE_OFFSET, timezone_offset);
+  ok = ok && writeFloat(file, CONFIG_RELAY_ON_BELOW, relay_on_below_temp);
+  ok = ok && writeFloat(file, CONFIG_RELAY_OFF_ABOVE, relay_off_above_temp);
+  ok = ok && writeString(file, CONFIG_CLOUD_URL, cloudLoggingUrl);
+  ok = ok && writeString(file, CONFIG_CLOUD_API_KEY, cloudLoggingApiKey);
+  ok = ok && writeString(file, CONFIG_CLOUD_INSTANCE_ID, cloudInstanceId);
+  ok = ok && writeInt(file, CONFIG_CONTROL_MODE, control_mode);
+  ok = ok && writeFloat(file, CONFIG_CONTROL_SETPOINT, control_setpoint);
+  ok = ok && writeFloat(file, CONFIG_PID_KP, pid_kp);
+  ok = ok && writeFloat(file, CONFIG_PID_KI, pid_ki);
+  ok = ok && writeFloat(file, CONFIG_PID_KD, pid_kd);
+  ok = ok && writeInt(file, CONFIG_PID_WINDOW, pid_window_seconds);
+  ok = ok && writeInt(file, CONFIG_MIN_ON, min_on_seconds);
+  ok = ok && writeInt(file, CONFIG_MIN_OFF, min_off_seconds);
+  ok = ok && writeInt(file, CONFIG_CONTROL_CHANNEL, control_channel);
+  ok = ok && writeInt(file, CONFIG_CLOUD_FORMAT, cloud_payload_format);
+  ok = ok && RecordFile::WriteRecord(file, CONFIG_END, NULL, 0);
+  ok = ok && file.size() <= MAX_CONFIG_SIZE;
   file.close();
+
+  // If the rename fails, the previous configuration is still the one loaded at boot.
+  if(!ok || !LittleFS.rename(CONFIG_FILE_TEMP, CONFIG_FILE)) {
+    eventLog.Add(PSTR("DeviceConfig: failed to write configuration"));
+    LittleFS.remove(CONFIG_FILE_TEMP);
+  }
   
   // The root cert is handled separately, stored in
   //  a separate file, written by the web server via 
@@ -15,6 +15,7 @@ public:
     String cloudLoggingUrl;
     String cloudLoggingApiKey;
     String cloudInstanceId = "1";
+    int cloud_payload_format = 0;           // PayloadFormat: JSON, or CBOR
 
     const float DEFAULT_RELAY_ON_BELOW_TEMP = 21.0;
     const float DEFAULT_RELAY_OFF_ABOVE_TEMP = 21.5;
@@ -22,11 +23,41 @@ public:
     float relay_on_below_temp = DEFAULT_RELAY_ON_BELOW_TEMP;
     float relay_off_above_temp = DEFAULT_RELAY_OFF_ABOVE_TEMP;
 
+    // Heater control.  See ControlEngine.h.  The on below / off above temperatures are
+    //  for hysteresis control, and the setpoint and gains for PID.
+    int control_mode = 0;                   // ControlMode
+    float control_setpoint = 21.25;
+    float pid_kp = 0.5;                     // Output (0 to 1) per degree below the setpoint
+    float pid_ki = 0.0002;                  //  per degree second
+    float pid_kd = 0;                       //  per degree per second
+    int pid_window_seconds = 600;           // The heater's on for a fraction of each window
+    int min_on_seconds = 60;                // The relay always stays on at least this long
+    int min_off_seconds = 60;               //  and off at least this long
+    int control_channel = 0;                // The sensor channel the heater follows
+
+    // Limits on the control settings.  Outside them the relay would chatter, or the PID
+    //  couldn't fit a minimum on and a minimum off time into a window.
+    static const int MIN_PID_WINDOW_SECONDS = 60;
+    static const int MAX_PID_WINDOW_SECONDS = 3600;
+    static const int MAX_MIN_ON_OFF_SECONDS = 1800;
+
 public:
     void SetTimezoneOffset(int timezoneOffset);
 
+    // These return false, changing nothing, if the values are out of range or don't make
+    //  sense together.
+    bool SetRelayTemps(float onBelow, float offAbove);
+    bool SetControl(int mode, float setpoint, float kp, float ki, float kd, int windowSeconds, int minOnSeconds, int minOffSeconds);
+
+    // Loads the stored configuration, converting one saved by older firmware.  Returns false
+    //  if there's none, or it's damaged, leaving the defaults.
     bool ReadFromFS();
     void WriteToFS();
+
+private:
+    void CheckLoaded();
+    bool ApplyRecords(const uint8_t* data, size_t size, bool apply);
+    bool ReadLegacyCsv();
 };
 
 #endif // __DEVICE_CONFIG__
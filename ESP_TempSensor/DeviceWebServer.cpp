@@ -1,7 +1,21 @@
 #include "DeviceWebServer.h"
 #include "CloudInterface.h"
+#include "PerfStats.h"
+#include "ChunkedResponse.h"
+#include "RecordFile.h"
+#include "EventLog.h"
+#include "ClockKeeper.h"
+#include "TextFormat.h"
 
-const long NTP_MIN_VALID_EPOCH = 1104537600;  // Jan 01 2005
+const char INDEX_PAGE_FILE[] = "/index.html.gz";
+
+// Versioned by name, so browsers can keep them.
+const char STATIC_FILES[] = "/static/";
+const char STATIC_CACHE_CONTROL[] = "max-age=31536000, immutable";
+const size_t MAX_STATIC_PATH = 64;
+
+// "\"<boot tag>-<version>-<startup time>\"", each in hex.
+const size_t ETAG_LENGTH = 28;
 
 void DeviceWebServer::Setup() {
   
@@ -11,8 +25,30 @@ void DeviceWebServer::Setup() {
   server.on("/testcode", [&]() { handleTestCode(); });
   server.on("/rootcert", HTTP_POST, [&]() { server.send(200); }, [&]() { handleRootCertUpload(); } );  // Not secure, if anyone on the local LAN can upload a root cert.  This should be password protected.
   server.on("/dir", [&]() { handleDirList(); } );
-  
-  server.onNotFound([&]() { handleNotFound(); });        // When a client requests an unknown URI (i.e. something other than "/"), call function "handleNotFound"
+  server.on("/perf", [&]() { handlePerfStats(); } );
+  server.on("/metrics", [&]() { handleMetrics(); } );
+  server.on("/log", [&]() { handleLog(); } );
+  server.on("/api/samples", [&]() { handleApiSamples(false); } );
+  server.on("/api/samples.csv", [&]() { handleApiSamples(true); } );
+  server.on("/events", [&]() { handleEvents(); } );
+
+  // Needed for the ETag checks.  Other request headers aren't kept.
+  const char* headerKeys[] = { "If-None-Match" };
+  server.collectHeaders(headerKeys, 1);
+  boot_tag = ESP.random();
+  etag.reserve(ETAG_LENGTH);
+  cache_control_header = "Cache-Control";
+  if_none_match_header = "If-None-Match";
+
+  // The core's routes only match a whole URI, so static files are picked out here, rather
+  //  than with its serveStatic(), which isn't timed.
+  //  When a client requests any other URI, call function "handleNotFound".
+  server.onNotFound([&]() {
+    if(server.uri().startsWith(STATIC_FILES))
+      handleStatic();
+    else
+      handleNotFound();
+  });
   server.begin();                           // Actually start the server
 }
 
@@ -21,12 +57,12 @@ bool DeviceWebServer::RecordStartupTime() {
     return true;  // startup time already recorded.
   
   time_t now = time(NULL);
-  if(now >= NTP_MIN_VALID_EPOCH) {
+  if(now >= MIN_VALID_EPOCH) {
     startup_time = now;
     return true;
   }
   
-  return false; // Not yet getting a valid NTP time.
+  return false; // Not yet getting a valid time, from NTP or saved before the reset.
 }
 
 // ----------------------------------------------------------------------
@@ -41,11 +77,15 @@ const char DEFAULT_PAGE_HEADER[] PROGMEM =
 "body { font-family: Arial, Helvetica, Sans-Serif; Color: #000000; }"
 "</style>";
 
-const char INDEX_PAGE_HEADER[] PROGMEM = 
+// The index page and its scripts are built from the web folder into the filesystem image
+//  (see web/build.py).  This is only shown until that's been uploaded.
+const char INDEX_PAGE_MISSING[] PROGMEM = 
 "<title>Beer Brew Monitor</title>"
 "</head>"
 "<body><h1>Beer Brew Monitor</h1>"
-"<script src=\"https://cdn.jsdelivr.net/npm/chart.js\"></script>";  // May move this locally later
+"The web files haven't been uploaded to this device.  Build them with web/build.py, "
+"then upload the data folder."
+"<p><a href=\"/api/samples\">Readings</a>";
 
 const char CONFIGURE_PAGE_HEADER[] PROGMEM = 
 "<title>Beer Brew Monitor - Configuration</title>"
@@ -59,55 +99,101 @@ const char HTML_FOOTER[] PROGMEM =
 // ----------------------------------------------------------------------
 //  Static Helpers
 
-String prepareConfigurationForm(const DeviceConfig& config) {
-  String formContent = F("<form action=\"/configure\" method=\"post\">"
+void printConfigurationForm(Print& out, const DeviceConfig& config) {
+  out.print(F("<form action=\"/configure\" method=\"post\">"
     "<label for=\"minset\">Heater on below : </label>"
-    "<input type=\"text\" id=\"minset\" name=\"minset\" value=\"");
-  formContent += String(config.relay_on_below_temp,1);
-  formContent += F("\" size=\"4\"><p>"
+    "<input type=\"text\" id=\"minset\" name=\"minset\" value=\""));
+  out.print(config.relay_on_below_temp, 1);
+  out.print(F("\" size=\"4\"><p>"
     "<label for=\"maxset\">Heater off above : </label>"
-    "<input type=\"text\" id=\"maxset\" name=\"maxset\" value=\"");
-  formContent += String(config.relay_off_above_temp, 1);
-  formContent += F("\" size=\"4\"><p>");
-
-  formContent += F("<label for=\"cloudUrl\">Cloud API URL : </label>"
-    "<input type=\"text\" id=\"cloudUrl\" name=\"cloudUrl\" value=\"");
-  formContent += config.cloudLoggingUrl;
-  formContent += F("\" size=\"30\"><p>");
-
-  formContent += F("<label for=\"cloudApiKey\">Cloud API key : </label>"
-    "<input type=\"text\" id=\"cloudApiKey\" name=\"cloudApiKey\" value=\"");
-  // formContent += cloudLoggingApiKey;   -- Intentionally not re-exposing.
-  formContent += F("********\" size=\"30\"><p>");
-
-  formContent += F("<label for=\"cloudInstanceId\">Cloud InstanceId : </label>"
-    "<input type=\"text\" id=\"cloudInstanceId\" name=\"cloudInstanceId\" value=\"");
-  formContent += config.cloudInstanceId;
-  formContent += F("\" size=\"30\"><p>");
+    "<input type=\"text\" id=\"maxset\" name=\"maxset\" value=\""));
+  out.print(config.relay_off_above_temp, 1);
+  out.print(F("\" size=\"4\"><p>"));
+
+  out.print(F("<label for=\"controlMode\">Heater control : </label>"
+    "<select id=\"controlMode\" name=\"controlMode\">"
+    "<option value=\"0\""));
+  out.print(config.control_mode == 0 ? F(" selected>") : F(">"));
+  out.print(F("Hysteresis (on below / off above)</option><option value=\"1\""));
+  out.print(config.control_mode == 1 ? F(" selected>") : F(">"));
+  out.print(F("PID (setpoint)</option></select><p>"
+    "<label for=\"setpoint\">Setpoint : </label>"
+    "<input type=\"text\" id=\"setpoint\" name=\"setpoint\" value=\""));
+  out.print(config.control_setpoint, 2);
+  out.print(F("\" size=\"5\"> "
+    "Kp <input type=\"text\" name=\"kp\" value=\""));
+  out.print(config.pid_kp, 4);
+  out.print(F("\" size=\"6\"> Ki <input type=\"text\" name=\"ki\" value=\""));
+  out.print(config.pid_ki, 6);
+  out.print(F("\" size=\"8\"> Kd <input type=\"text\" name=\"kd\" value=\""));
+  out.print(config.pid_kd, 2);
+  out.print(F("\" size=\"6\"><p>"
+    "<label for=\"window\">PID window (s) : </label>"
+    "<input type=\"text\" id=\"window\" name=\"window\" value=\""));
+  out.print(config.pid_window_seconds);
+  out.print(F("\" size=\"5\"> "
+    "Minimum on (s) <input type=\"text\" name=\"minon\" value=\""));
+  out.print(config.min_on_seconds);
+  out.print(F("\" size=\"4\"> Minimum off (s) <input type=\"text\" name=\"minoff\" value=\""));
+  out.print(config.min_off_seconds);
+  out.print(F("\" size=\"4\"><p>"
+    "<label for=\"controlChannel\">Heater follows : </label>"
+    "<select id=\"controlChannel\" name=\"controlChannel\">"));
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    out.print(F("<option value=\""));
+    out.print(channel);
+    out.print(config.control_channel == channel ? F("\" selected>") : F("\">"));
+    out.print(F("Channel "));
+    out.print(channel);
+    out.print(F("</option>"));
+  }
+  out.print(F("</select><p>"));
+
+  out.print(F("<label for=\"cloudUrl\">Cloud API URL : </label>"
+    "<input type=\"text\" id=\"cloudUrl\" name=\"cloudUrl\" value=\""));
+  out.print(config.cloudLoggingUrl);
+  out.print(F("\" size=\"30\" placeholder=\"https://\" pattern=\"https://.+\"><p>"));
+
+  out.print(F("<label for=\"cloudApiKey\">Cloud API key : </label>"
+    "<input type=\"text\" id=\"cloudApiKey\" name=\"cloudApiKey\" value=\""));
+  // out.print(config.cloudLoggingApiKey);   -- Intentionally not re-exposing.
+  out.print(F("********\" size=\"30\"><p>"));
+
+  out.print(F("<label for=\"cloudInstanceId\">Cloud InstanceId : </label>"
+    "<input type=\"text\" id=\"cloudInstanceId\" name=\"cloudInstanceId\" value=\""));
+  out.print(config.cloudInstanceId);
+  out.print(F("\" size=\"30\"><p>"));
+
+  out.print(F("<label for=\"cloudFormat\">Cloud payload : </label>"
+    "<select id=\"cloudFormat\" name=\"cloudFormat\">"
+    "<option value=\"0\""));
+  out.print(config.cloud_payload_format == PAYLOAD_JSON ? F(" selected>") : F(">"));
+  out.print(F("JSON</option><option value=\"1\""));
+  out.print(config.cloud_payload_format == PAYLOAD_CBOR ? F(" selected>") : F(">"));
+  out.print(F("CBOR (smaller)</option></select><p>"));
   
-  formContent += F("<input type=\"submit\" value=\"Save\"></form>");
-  return formContent;
+  out.print(F("<input type=\"submit\" value=\"Save\"></form>"));
 }
 
-String prepareControlButtonsForm() {
-  String formContent = F("<form action=\"/configure\" method=\"post\">"
+void printControlButtonsForm(Print& out) {
+  out.print(F("<form action=\"/configure\" method=\"post\">"
   "<input type=\"submit\" name=\"resetminmax\" value=\"Reset min and max\"> "
   "<input type=\"submit\" name=\"resetall\" value=\"Reset All Values\"> "
   "<input type=\"submit\" name=\"resetwifi\" value=\"Reset Wifi\"> "
-  "</form>");
-  return formContent;
+  "<input type=\"submit\" name=\"autotune\" value=\"Autotune PID\"> "
+  "</form>"));
 }
 
-String prepareRootCertsForm() {
-  String formContent = F("<form action=\"/rootcert\" method=\"post\" enctype=\"multipart/form-data\">Root Certificate ");
-  formContent += LittleFS.exists(CloudInterface::ROOT_CERT_FILE) ? F("(loaded): ") : F("(none): ");
-  formContent += F("<input type=\"file\" name=\"name\"> "
+void printRootCertsForm(Print& out) {
+  out.print(F("<form action=\"/rootcert\" method=\"post\" enctype=\"multipart/form-data\">Root Certificate "));
+  out.print(LittleFS.exists(CloudInterface::TRUST_ANCHOR_FILE) ? F("(loaded): ") : F("(none): "));
+  out.print(F("<input type=\"file\" name=\"name\"> "
     "<input type=\"submit\" class=\"button\" value=\"Upload\"> "
-    "</form>");
-  return formContent;  
+    "</form>"));
 }
 
-String DeviceWebServer::getUpTime() {
+void DeviceWebServer::printUpTime(Print& out) {
   unsigned long uptime_total_seconds = time(NULL) - startup_time;
   int days = uptime_total_seconds / 86400;
   uptime_total_seconds -= days * 86400;
@@ -116,89 +202,259 @@ String DeviceWebServer::getUpTime() {
   int minutes = uptime_total_seconds / 60;
   uptime_total_seconds -= minutes * 60;
 
-  char tempBuf[20];
-  sprintf_P(tempBuf, PSTR("%d days %02d:%02d:%02d"), days, hours, minutes, uptime_total_seconds);
-  return String(tempBuf);
+  PrintFormat(out, PSTR("%d days %02d:%02d:%02lu"), days, hours, minutes, uptime_total_seconds);
 }
 
 
-String getTimeFromSampleIndex(int sampleIdx) {
-  int sample_time_minutes = sampleIdx * MINUTES_PER_SAMPLE;
-  char tempBuf[6];
-  sprintf(tempBuf, "%02d:%02d", sample_time_minutes / 60, sample_time_minutes % 60);
-  return String(tempBuf);
+const char* const TIER_NAMES[NUM_TIERS] = { "minute", "halfhour", "daily" };
+
+enum SlotValue { SLOT_MEAN, SLOT_COUNT, SLOT_MIN, SLOT_MAX, SLOT_STD_DEV };
+
+int slotValue(const SampleTier& tier, int age, SlotValue which) {
+  switch(which) {
+    case SLOT_COUNT:   return tier.Count(age);
+    case SLOT_MIN:     return tier.Min(age);
+    case SLOT_MAX:     return tier.Max(age);
+    case SLOT_STD_DEV: return tier.StdDev(age);
+    default:           return tier.Mean(age);
+  }
 }
 
-String DeviceWebServer::getChartHtml(int startAtSample) {
-  String labels;
-  String data_values;
-  int sample;
-  for(sample = startAtSample; sample < NUM_SAMPLES; sample++) {
-    if(sample > startAtSample) {
-      labels += ",";  data_values += ",";
-    }
-    labels += "\"" + getTimeFromSampleIndex(sample) + "\"";
-    data_values += String(samplesRef.sample_average_temps[sample], 1);
+// Writes a JSON array of one value from each slot, oldest first.  Gaps (slots with no
+//  readings) have a count of 0, and null for the temperatures.
+void printSlotArray(Print& out, const __FlashStringHelper* name, const SampleTier& tier, int points, SlotValue which) {
+  out.print(F(",\""));
+  out.print(name);
+  out.print(F("\":["));
+  int age;
+  for(age = points - 1; age >= 0; age--) {
+    if(which != SLOT_COUNT && tier.IsGap(age))
+      out.print(F("null"));
+    else
+      out.print(slotValue(tier, age, which));
+    if(age > 0)
+      out.print(',');
   }
-  
-  for(sample = 0; sample < startAtSample; sample++) {
-    labels += ",\"" + getTimeFromSampleIndex(sample) + "\"";
-    data_values += "," + String(samplesRef.sample_average_temps[sample], 1);  
+  out.print(']');
+}
+
+// ?channel= picks the sensor, and is channel 0 if not given.
+int DeviceWebServer::getChannel() {
+  int channel = server.arg("channel").toInt();
+  if(channel < 0 || channel >= SENSOR_CHANNELS)
+    channel = 0;
+  return channel;
+}
+
+// ?tier=minute|halfhour|daily selects the history shown, and ?points= how much of it.
+//  With neither, the chart shows the last day of half hour averages.
+SampleTierId DeviceWebServer::getChartTier(int& points) {
+  SampleTierId tier = TIER_HALF_HOUR;
+  points = SAMPLES_PER_DAY;
+
+  const String& tierArg = server.arg("tier");
+  if(tierArg == "halfhour") {
+    points = HALF_HOUR_TIER_SAMPLES;
+  } else if(tierArg == "minute") {
+    tier = TIER_MINUTE;
+    points = MINUTE_TIER_SAMPLES;
+  } else if(tierArg == "daily") {
+    tier = TIER_DAILY;
+    points = DAILY_TIER_SAMPLES;
   }
-  
-  String chartHtml = F("<div><canvas id=\"tempChart\" style=\"max-height=300px\"></canvas></div>"
-    "<script>const ctx = document.getElementById('tempChart');"
-    "new Chart(ctx, {"
-      "type: 'line',"
-      "data: {"
-       "labels: [");
-  chartHtml += labels;
-  chartHtml += F(
-       "],"
-       "datasets: [{"
-         "label: 'temperature (C)',"
-         "data: [");
-  chartHtml += data_values;
-  chartHtml += F(
-         "],"
-         "borderWidth: 1"
-       "}]"
-      "},"
-     "options: {"
-     " scales: {"
-      " y: { "
-         " suggestedMin: 15, "
-         " suggestedMax: 30"
-       " } "
-     " } "
-   " } "
-  " }); "
-  "</script>");
-  return chartHtml;
+
+  if(server.hasArg("points")) {
+    points = server.arg("points").toInt();
+  }
+  return tier;
+}
+
+// Limits the slots sent to those filled, and with ?since=, to those starting at or after
+//  that time (local minutes since 1970, as in the "start" the API returns).  Passing the last
+//  "start" received gets the current slot again, with any newer ones.
+int DeviceWebServer::getSlotCount(const SampleTier& tier, int points) {
+  if(points > tier.Filled())
+    points = tier.Filled();
+  if(points < 0)
+    points = 0;
+
+  if(server.hasArg("since")) {
+    long since = server.arg("since").toInt();
+    while(points > 0 && tier.StartMinutes(points - 1) < since)
+      points--;
+  }
+  return points;
 }
 
 void DeviceWebServer::handleRoot() {
-  String response = FPSTR(DEFAULT_PAGE_HEADER);
-  response += FPSTR(INDEX_PAGE_HEADER);
-  time_t nowtime = time(NULL);
-  response += "Time: ";
-  response += ctime(&nowtime);
-  response += "<p>";
-  response += "Uptime: " + getUpTime() + "<p>";
-  response += samplesRef.GetTempSummary() + "<p>";
-  
-  int startAt = samplesRef.GetCurrentSampleIndex() + 1;
-  if(startAt >= NUM_SAMPLES) {
-    startAt = 0;
+  PerfTimer timer(perfWebRoot);
+
+  File page = LittleFS.open(INDEX_PAGE_FILE, "r");
+  if(!page) {
+    ChunkedResponse response(server);
+    response.begin(200, "text/html");
+    response.print(FPSTR(DEFAULT_PAGE_HEADER));
+    response.print(FPSTR(INDEX_PAGE_MISSING));
+    response.print(F("<p><a href=\"/configure\">Configure</a>"));
+    response.print(FPSTR(HTML_FOOTER));
+    response.end();
+    return;
+  }
+
+  // The page only changes when the filesystem is uploaded, which restarts the device.
+  //  So its checksum is only worked out once.
+  if(index_page_version == 0) {
+    uint8_t buffer[128];
+    uint16_t crc = 0xFFFF;
+    int length;
+    while((length = page.read(buffer, sizeof(buffer))) > 0)
+      crc = RecordFile::Crc16(buffer, length, crc);
+    index_page_version = 0x10000 | crc;
+    page.seek(0);
+  }
+
+  if(!notModified(index_page_version))
+    server.streamFile(page, "text/html");
+  page.close();
+}
+
+// The slots of one tier of one channel, as stored.  Temperatures are whole hundredths of a
+//  degree, and the slots are oldest first, each starting minutesPerSample after the one
+//  before.  Takes the same ?tier= and ?points= as the index page, ?channel= and ?since=.
+//
+//  JSON: { "channel", "channels", "tier", "minutesPerSample", "updated", "startup", "current",
+//          "min", "max", "start", "means", "counts", and "mins", "maxs", "stdDevs" if the tier
+//          has them }.  "channels" is how many the firmware keeps, whether or not they have
+//          a sensor; "updated" is 0 for a channel with no readings since startup.
+//  CSV:  start,mean,count[,min,max,std_dev] - one line per slot, with only the start and
+//        count for a gap
+//
+//  Slots with no readings (the device was off) are gaps: null in the JSON arrays, apart
+//  from the counts, which are 0.
+//
+//  Nothing in the response depends on the time of the request, so it only changes with the
+//  SampleBuffer's generation, and the startup time.  Those are used as the ETag, and to cache
+//  the last response.
+void DeviceWebServer::handleApiSamples(bool csv) {
+  PerfTimer timer(perfWebApi);
+
+  int points;
+  int channel = getChannel();
+  SampleTierId tierId = getChartTier(points);
+  const SampleTier& tier = samplesRef.GetTier(channel, tierId);
+  points = getSlotCount(tier, points);
+
+  // The startup time is in the response, and is only recorded once the clock's valid, so
+  //  it's part of the ETag as well as the cache key.
+  if(notModified(samplesRef.Generation(), startup_time))
+    return;
+
+  // The slots sent are fully decided by the tier and count, as the generation
+  //  changes whenever a slot does.
+  char key[ResponseCache::MAX_KEY];
+  snprintf_P(key, sizeof(key), PSTR("%d/%d/%d/%d/%lu"), channel, (int)tierId, points, (int)csv, (unsigned long)startup_time);
+  const char* contentType = csv ? "text/csv" : "application/json";
+
+  if(responseCache.Matches(key, samplesRef.Generation())) {
+    responseCache.hits++;
+    server.send(200, contentType, responseCache.Content(), responseCache.Length());
+    return;
+  }
+
+  responseCache.misses++;
+  responseCache.Begin(key, samplesRef.Generation());
+  ChunkedResponse response(server);
+  response.copyTo(&responseCache);
+  response.begin(200, contentType);
+  if(csv)
+    writeSamplesCsv(response, tier, points);
+  else
+    writeSamplesJson(response, channel, tierId, points);
+  response.end();
+  responseCache.End();
+}
+
+void DeviceWebServer::writeSamplesCsv(Print& out, const SampleTier& tier, int points) {
+  out.print(tier.HasStats() ? F("start,mean,count,min,max,std_dev\n") : F("start,mean,count\n"));
+  int age;
+  for(age = points - 1; age >= 0; age--) {
+    if(tier.IsGap(age)) {
+      PrintFormat(out, tier.HasStats() ? PSTR("%ld,,0,,,\n") : PSTR("%ld,,0\n"), tier.StartMinutes(age));
+      continue;
+    }
+    PrintFormat(out, PSTR("%ld,%d,%d"), tier.StartMinutes(age), (int)tier.Mean(age), tier.Count(age));
+    if(tier.HasStats())
+      PrintFormat(out, PSTR(",%d,%d,%d"), (int)tier.Min(age), (int)tier.Max(age), (int)tier.StdDev(age));
+    out.print('\n');
+  }
+}
+
+void DeviceWebServer::writeSamplesJson(Print& out, int channel, SampleTierId tierId, int points) {
+  const SampleChannel& c = samplesRef.Channel(channel);
+  const SampleTier& tier = c.tiers[tierId];
+  PrintFormat(out, PSTR("{\"channel\":%d,\"channels\":%d,\"tier\":\"%s\",\"minutesPerSample\":%d,\"updated\":%lu,\"startup\":%lu,"
+    "\"current\":%d,\"min\":%d,\"max\":%d,\"start\":%ld"),
+    channel, SENSOR_CHANNELS, TIER_NAMES[tierId], tier.MinutesPerSample(), (unsigned long)c.last_sample_time,
+    (unsigned long)startup_time,
+    (int)c.current_temp, (int)c.min_temp, (int)c.max_temp,
+    points > 0 ? tier.StartMinutes(points - 1) : 0L);
+  printSlotArray(out, F("means"), tier, points, SLOT_MEAN);
+  printSlotArray(out, F("counts"), tier, points, SLOT_COUNT);
+  if(tier.HasStats()) {
+    printSlotArray(out, F("mins"), tier, points, SLOT_MIN);
+    printSlotArray(out, F("maxs"), tier, points, SLOT_MAX);
+    printSlotArray(out, F("stdDevs"), tier, points, SLOT_STD_DEV);
+  }
+  out.print('}');
+}
+
+// Sends the ETag for this version of the content.  If the browser already has that version,
+//  answers with a 304, and returns true.  The boot tag stops a version from before a reboot
+//  being mistaken for the same one after.  startup is the startup time, for content that
+//  shows it.
+bool DeviceWebServer::notModified(uint32_t version, time_t startup) {
+  char tag[ETAG_LENGTH + 1];
+  snprintf_P(tag, sizeof(tag), PSTR("\"%08x-%x-%lx\""), (unsigned)boot_tag, (unsigned)version, (unsigned long)startup);
+  etag = tag;
+  server.sendHeader("ETag", etag);
+  server.sendHeader(cache_control_header, "no-cache");   // Always check, but only fetch if changed.
+
+  if(server.hasHeader(if_none_match_header) && server.header(if_none_match_header) == etag) {
+    notModifiedCount++;
+    server.send(304);
+    return true;
+  }
+  return false;
+}
+
+// Live readings, as Server-Sent Events.  Each event is a few dozen bytes, and the page
+//  fetches only the changed slots from /api/samples?since= when a reading arrives.
+void DeviceWebServer::handleEvents() {
+  PerfTimer timer(perfWebEvents);
+  WiFiClient client = server.client();
+  if(!events.Subscribe(client)) {
+    server.send(503, "text/plain", "503: Too many event subscribers");
   }
-  response += getChartHtml(startAt);
-  response += "<p>";
-  response += F("<a href=\"/configure\">Configure</a>");
-  response += FPSTR(HTML_FOOTER);
-  server.send(200, "text/html", response);   // Send HTTP status 200 (Ok) and send some text to the browser/client
+}
+
+// One event per channel read, so an event's size doesn't grow with the number of sensors.
+void DeviceWebServer::PublishReading(int channel) {
+  const SampleChannel& c = samplesRef.Channel(channel);
+  char data[96];
+  snprintf_P(data, sizeof(data), PSTR("{\"channel\":%d,\"updated\":%lu,\"current\":%d,\"min\":%d,\"max\":%d,\"relay\":%s}"),
+    channel, (unsigned long)c.last_sample_time,
+    (int)c.current_temp, (int)c.min_temp, (int)c.max_temp,
+    relay_on ? "true" : "false");
+  events.Publish("reading", data);
+}
+
+void DeviceWebServer::PublishRelay(bool on) {
+  relay_on = on;
+  events.Publish("relay", on ? "{\"on\":true}" : "{\"on\":false}");
 }
 
 void DeviceWebServer::handleConfigure() {
+  PerfTimer timer(perfWebConfigure);
   if(server.hasArg("minset")) {
     return processConfigSet();
   }
@@ -211,25 +467,39 @@ void DeviceWebServer::handleConfigure() {
     return processResetSamples();
   }
 
+  if(server.hasArg("autotune")) {
+    if(onAutotune)
+      onAutotune();
+    return redirectBackToRoot();
+  }
+
   if(server.hasArg("resetwifi")) {
     if(onResetWifi)
       onResetWifi();  // this should reset the device and not return
     return redirectBackToRoot();
   }
   
-  String response = FPSTR(DEFAULT_PAGE_HEADER);
-  response += FPSTR(CONFIGURE_PAGE_HEADER);
+  ChunkedResponse response(server);
+  response.begin(200, "text/html");
+  response.print(FPSTR(DEFAULT_PAGE_HEADER));
+  response.print(FPSTR(CONFIGURE_PAGE_HEADER));
   time_t nowtime = time(NULL);
-  response += "Time: ";
-  response += ctime(&nowtime);
-  response += "<p>";
+  response.print(F("Time: "));
+  response.print(ctime(&nowtime));
+  response.print(F("<p>"));
   
-  response += prepareConfigurationForm(configRef) + "<p>";
-  response += prepareRootCertsForm() + "<p>";
-  response += prepareControlButtonsForm() + "<p>";
-  response += F("<a href=\"/\">back to main page</a>");
-  response += FPSTR(HTML_FOOTER);
-  server.send(200, "text/html", response);   // Send HTTP status 200 (Ok) and send some text to the browser/client 
+  if(onControlStatus) {
+    onControlStatus(response);
+    response.print(F("<p>"));
+  }
+  printConfigurationForm(response, configRef);
+  response.print(F("<p>"));
+  printRootCertsForm(response);
+  response.print(F("<p>"));
+  printControlButtonsForm(response);
+  response.print(F("<p><a href=\"/\">back to main page</a>"));
+  response.print(FPSTR(HTML_FOOTER));
+  response.end();
 }
 
 void DeviceWebServer::redirectBackToRoot() {
@@ -251,44 +521,65 @@ void DeviceWebServer::processResetSamples() {
 }
 
 void DeviceWebServer::processConfigSet() {
-  String minsetvalue = server.arg("minset");
-  String maxsetvalue = server.arg("maxset");
-  String cloudUrlValue = server.arg("cloudUrl");
-  String cloudApiKeyValue = server.arg("cloudApiKey");
-  String cloudInstanceIdValue = server.arg("cloudInstanceId");
+  const String& cloudUrlValue = server.arg("cloudUrl");
+  const String& cloudApiKeyValue = server.arg("cloudApiKey");
+  const String& cloudInstanceIdValue = server.arg("cloudInstanceId");
   
-  float fminsetvalue = minsetvalue.toFloat();
-  float fmaxsetvalue = maxsetvalue.toFloat();
+  float fminsetvalue = server.arg("minset").toFloat();
+  float fmaxsetvalue = server.arg("maxset").toFloat();
 
-  if(minsetvalue < maxsetvalue) {
-    configRef.relay_on_below_temp = fminsetvalue;
-    configRef.relay_off_above_temp = fmaxsetvalue;
-
-    configRef.cloudLoggingUrl = cloudUrlValue;
+  if(configRef.SetRelayTemps(fminsetvalue, fmaxsetvalue)) {
+    // Empty turns posting off.
+    if(cloudUrlValue.length() == 0 || CloudInterface::IsValidUrl(cloudUrlValue))
+      configRef.cloudLoggingUrl = cloudUrlValue;
+    else
+      eventLog.Add(PSTR("Config: cloud URL not changed, it must be https://host/path"));
 
     if(!cloudApiKeyValue.startsWith("**"))
     {
       configRef.cloudLoggingApiKey = cloudApiKeyValue;
     }
     configRef.cloudInstanceId = cloudInstanceIdValue;
+
+    if(server.hasArg("cloudFormat")) {
+      int format = server.arg("cloudFormat").toInt();
+      if(format >= 0 && format < NUM_PAYLOAD_FORMATS)
+        configRef.cloud_payload_format = format;
+    }
+
+    if(server.hasArg("controlMode")) {
+      bool controlSet = configRef.SetControl(server.arg("controlMode").toInt(), server.arg("setpoint").toFloat(),
+        server.arg("kp").toFloat(), server.arg("ki").toFloat(), server.arg("kd").toFloat(),
+        server.arg("window").toInt(), server.arg("minon").toInt(), server.arg("minoff").toInt());
+      if(!controlSet)
+        eventLog.Add(PSTR("Config: heater control not changed, the window must be %d to %d s, and fit the minimum on and off times (up to %d s each)"),
+          DeviceConfig::MIN_PID_WINDOW_SECONDS, DeviceConfig::MAX_PID_WINDOW_SECONDS, DeviceConfig::MAX_MIN_ON_OFF_SECONDS);
+
+      int channel = server.arg("controlChannel").toInt();
+      if(channel >= 0 && channel < SENSOR_CHANNELS)
+        configRef.control_channel = channel;
+    }
     
     // Store the new values (along with everything else)
     configRef.WriteToFS();  
+  } else {
+    eventLog.Add(PSTR("Config: not changed, the heater on temperature must be below the off temperature"));
   }
   redirectBackToRoot();
 }
 
 void DeviceWebServer::handleRootCertUpload() {
+  PerfTimer timer(perfWebRootCert);
   HTTPUpload& upload = server.upload();
   
   if(upload.status == UPLOAD_FILE_START) {
     rootCertUploadFile = LittleFS.open(CloudInterface::ROOT_CERT_FILE, "w");
-    if(rootCertUploadFile) Serial.println("file created");
+    if(rootCertUploadFile) eventLog.Add(PSTR("RootCertUpload: file created"));
   } else if(upload.status == UPLOAD_FILE_WRITE) {
     if(rootCertUploadFile) {
       rootCertUploadFile.write(upload.buf, upload.currentSize);
     } else {
-      Serial.println("RootCertUpload: no file to write to");
+      eventLog.Add(PSTR("RootCertUpload: no file to write to"));
     }
   } else if(upload.status == UPLOAD_FILE_END) {
     if(rootCertUploadFile) {
@@ -300,30 +591,154 @@ void DeviceWebServer::handleRootCertUpload() {
         onCertChanged();
       }
     } else {
-      Serial.println("RootCertUpload: No file to close.");
+      eventLog.Add(PSTR("RootCertUpload: no file to close"));
       server.send(500, "text/plain", "500: Couldn't create file");
     }
   }
 }
 
 void DeviceWebServer::handleTestCode() {
-    String result = "not implemented";
-    if(onTestCall) {
-      result = onTestCall();    
-    }
-    server.send(200, "text/plain", result);
+    PerfTimer timer(perfWebTestCode);
+    ChunkedResponse response(server);
+    response.begin(200, "text/plain");
+    if(onTestCall)
+      onTestCall(response);
+    else
+      response.print(F("not implemented"));
+    response.end();
 };
 
 void DeviceWebServer::handleDirList() {
+  PerfTimer timer(perfWebDir);
   Dir dirList = LittleFS.openDir("/");
-  String result = "Listing of /\n";
+  ChunkedResponse response(server);
+  response.begin(200, "text/plain");
+  response.print(F("Listing of /\n"));
   while(dirList.next())
   {
-    result += dirList.fileName() + " " + dirList.fileSize() + "\n";
+    response.print(dirList.fileName());
+    PrintFormat(response, PSTR(" %u\n"), (unsigned)dirList.fileSize());
   }
-  server.send(200, "text/plain", result);
+  response.end();
+}
+
+void DeviceWebServer::handlePerfStats() {
+  PerfTimer timer(perfWebPerf);
+  bool reset = server.hasArg("reset");
+  if(reset) {
+    PerfCounter::ResetAll();
+    HeapStats::Reset();
+  }
+
+  ChunkedResponse result(server);
+  result.begin(200, "text/plain");
+  PrintFormat(result, PSTR("Free heap: %u  Uptime: "), (unsigned)ESP.getFreeHeap());
+  printUpTime(result);
+  result.print('\n');
+  PrintFormat(result, PSTR("Heap low points: %u free, %u largest block, %u%% fragmented\n"),
+    (unsigned)HeapStats::min_free_heap, (unsigned)HeapStats::min_max_free_block, (unsigned)HeapStats::max_fragmentation);
+  BootTimes::PrintAll(result);
+  result.print('\n');
+  PerfCounter::PrintAll(result);
+  PrintFormat(result, PSTR("\nResponse cache: %u hits, %u misses, %u not modified\n"),
+    (unsigned)responseCache.hits, (unsigned)responseCache.misses, (unsigned)notModifiedCount);
+  PrintFormat(result, PSTR("Events: %d subscribers, %u sent, %u dropped, %u disconnected for falling behind\n"),
+    events.Subscribers(), (unsigned)events.sent, (unsigned)events.dropped, (unsigned)events.disconnected);
+  if(reset) {
+    events.sent = 0;
+    events.dropped = 0;
+    events.disconnected = 0;
+    responseCache.hits = 0;
+    responseCache.misses = 0;
+    notModifiedCount = 0;
+  }
+  if(onPerfStats) {
+    result.print('\n');
+    onPerfStats(result, reset);
+  }
+  result.end();
+}
+
+// The recent log, oldest first.  Each line starts with its sequence number, so a reader
+//  can pass the last one it saw as ?since= to only get newer lines.
+void DeviceWebServer::handleLog() {
+  PerfTimer timer(perfWebLog);
+
+  uint32_t since = server.hasArg("since") ? strtoul(server.arg("since").c_str(), NULL, 10) : 0;
+  ChunkedResponse response(server);
+  response.begin(200, "text/plain");
+  eventLog.PrintSince(response, since);
+  response.end();
+}
+
+// As ESP.getResetReason(), without building a String on every scrape.
+const char* resetReason() {
+  static const char* const REASONS[] = { "Power On", "Hardware Watchdog", "Exception", "Software Watchdog",
+    "Software/System restart", "Deep-Sleep Wake", "External System" };
+  uint32_t reason = ESP.getResetInfoPtr()->reason;
+  return reason < sizeof(REASONS) / sizeof(REASONS[0]) ? REASONS[reason] : "Unknown";
+}
+
+// Prometheus text format, for scraping.  Counters run from boot (or the last /perf?reset).
+void DeviceWebServer::handleMetrics() {
+  PerfTimer timer(perfWebMetrics);
+
+  ChunkedResponse response(server);
+  response.begin(200, "text/plain; version=0.0.4");
+  PrintFormat(response, PSTR("# TYPE brewmon_uptime_seconds gauge\nbrewmon_uptime_seconds %u\n"), (unsigned)(millis() / 1000));
+  PrintFormat(response, PSTR("# TYPE brewmon_reset_info gauge\nbrewmon_reset_info{reason=\"%s\"} 1\n"), resetReason());
+  HeapStats::PrintMetrics(response);
+  BootTimes::PrintMetrics(response);
+  PerfCounter::PrintMetrics(response);
+
+  PrintFormat(response, PSTR("# TYPE brewmon_response_cache_total counter\n"
+    "brewmon_response_cache_total{result=\"hit\"} %u\n"
+    "brewmon_response_cache_total{result=\"miss\"} %u\n"
+    "brewmon_response_cache_total{result=\"not_modified\"} %u\n"),
+    (unsigned)responseCache.hits, (unsigned)responseCache.misses, (unsigned)notModifiedCount);
+  PrintFormat(response, PSTR("# TYPE brewmon_event_subscribers gauge\nbrewmon_event_subscribers %d\n"
+    "# TYPE brewmon_events_total counter\n"
+    "brewmon_events_total{result=\"sent\"} %u\n"
+    "brewmon_events_total{result=\"dropped\"} %u\n"
+    "brewmon_events_total{result=\"disconnected\"} %u\n"),
+    events.Subscribers(), (unsigned)events.sent, (unsigned)events.dropped, (unsigned)events.disconnected);
+
+  if(onMetrics)
+    onMetrics(response);
+  response.end();
+}
+
+// Files under /static/, as build.py writes them: gzipped, with .gz added to the name the page
+//  asks for.  The core's streamFile() sends a .gz file as it is, with Content-Encoding: gzip.
+//  Names with ".." are refused, as LittleFS would follow them out of /static/.
+void DeviceWebServer::handleStatic() {
+  PerfTimer timer(perfWebStatic);
+
+  const char* uri = server.uri().c_str();
+  char path[MAX_STATIC_PATH];
+  File file;
+  if(strstr(uri, "..") == NULL && snprintf(path, sizeof(path), "%s.gz", uri) < (int)sizeof(path)) {
+    if(LittleFS.exists(uri))
+      file = LittleFS.open(uri, "r");
+    else
+      file = LittleFS.open(path, "r");
+  }
+  if(!file) {
+    server.send(404, "text/plain", "404: Not found");
+    return;
+  }
+
+  const char* type = "application/octet-stream";
+  if(server.uri().endsWith(".js"))
+    type = "application/javascript";
+  else if(server.uri().endsWith(".css"))
+    type = "text/css";
+  server.sendHeader(cache_control_header, STATIC_CACHE_CONTROL);
+  server.streamFile(file, type);
+  file.close();
 }
 
 void DeviceWebServer::handleNotFound() {
+  PerfTimer timer(perfWebNotFound);
   server.send(404, "text/plain", "404: Not found"); // Send HTTP status 404 (Not Found) when there's no handler for the URI in the request
 }
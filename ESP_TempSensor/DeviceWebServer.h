@@ -1,5 +1,7 @@
 #include "DeviceConfig.h"
 #include "SampleBuffer.h"
+#include "ResponseCache.h"
+#include "EventStream.h"
 #include <WiFiManager.h>
 #include <ESP8266WebServer.h>
 
@@ -18,10 +20,20 @@ public:
     void handleClient() { server.handleClient(); }
     
     bool RecordStartupTime();
+    void ClockCorrected(long seconds) { if(startup_time != 0) startup_time += seconds; }
+
+    // Pushed to the browsers watching /events.
+    void PublishReading(int channel);
+    void PublishRelay(bool on);
+    void KeepEventsAlive() { events.KeepAlive(); }
 
     void OnRootCertChanged(std::function<void()> certChanged)  { onCertChanged = certChanged; }
-    void OnTestCall(std::function<String()> testFunction)      { onTestCall = testFunction; }  // returns a result to display
+    void OnTestCall(std::function<void(Print&)> testFunction)  { onTestCall = testFunction; }  // prints a result to display
     void OnResetWiFiSettings(std::function<void()> resetWifi)  { onResetWifi = resetWifi; }
+    void OnPerfStats(std::function<void(Print&, bool)> perfStats) { onPerfStats = perfStats; }  // adds to /perf, and resets
+    void OnMetrics(std::function<void(Print&)> metrics)      { onMetrics = metrics; }      // adds to /metrics
+    void OnAutotune(std::function<void()> autotune)          { onAutotune = autotune; }
+    void OnControlStatus(std::function<void(Print&)> controlStatus) { onControlStatus = controlStatus; }  // shown on /configure
 
 private:
     ESP8266WebServer server;    // Create a webserver object that listens for HTTP request on port 80    
@@ -35,9 +47,28 @@ private:
     // Used during file uploads.
     File rootCertUploadFile;
 
+    // The last data API response, and the tag that makes ETags unique to this boot.
+    ResponseCache responseCache;
+    uint32_t boot_tag = 0;
+    uint32_t notModifiedCount = 0;
+
+    // The ETag, and the header names too long for String's inline buffer, kept so the
+    //  Strings the server takes don't have to be made on the heap for every request.
+    String etag;
+    String cache_control_header;
+    String if_none_match_header;
+    uint32_t index_page_version = 0;      // Checksum of the page file, once known
+
+    EventStream events;
+    bool relay_on = false;      // As last published
+
     std::function<void()> onCertChanged;
-    std::function<String()> onTestCall;
+    std::function<void(Print&)> onTestCall;
     std::function<void()> onResetWifi;
+    std::function<void(Print&, bool)> onPerfStats;
+    std::function<void(Print&)> onMetrics;
+    std::function<void()> onAutotune;
+    std::function<void(Print&)> onControlStatus;
 
 private:
     void handleRoot();              // function prototypes for HTTP handlers
@@ -45,10 +76,21 @@ private:
     void handleRootCertUpload();
     void handleDirList();
     void handleTestCode();
+    void handlePerfStats();
+    void handleMetrics();
+    void handleLog();
+    void handleApiSamples(bool csv);
+    void handleEvents();
+    void handleStatic();
     void handleNotFound();
 
-    String getUpTime();
-    String getChartHtml(int startAtSample);
+    void printUpTime(Print& out);
+    int getChannel();
+    SampleTierId getChartTier(int& points);
+    int getSlotCount(const SampleTier& tier, int points);
+    void writeSamplesCsv(Print& out, const SampleTier& tier, int points);
+    void writeSamplesJson(Print& out, int channel, SampleTierId tierId, int points);
+    bool notModified(uint32_t version, time_t startup = 0);
 
     void processConfigSet();
     void processResetMinMaxTemps();
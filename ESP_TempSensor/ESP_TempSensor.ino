@@ -18,6 +18,12 @@
 #include "SampleBuffer.h"
 #include "CloudInterface.h"
 #include "DeviceWebServer.h"
+#include "TaskScheduler.h"
+#include "ControlEngine.h"
+#include "ClockKeeper.h"
+#include "WiFiFastConnect.h"
+#include "PerfStats.h"
+#include "EventLog.h"
 
 #define WIFI_CONFIG_NAME "BrewBeerSensor"
 #define MDNS_NAME "BrewBeer"  // BrewBeer.local
@@ -34,6 +40,23 @@ SensorInterface sensor;
 CloudInterface cloudInterface;
 SampleBuffer samples;
 DeviceWebServer webServer(config, samples);
+TaskScheduler scheduler;
+ControlEngine controlEngine(config);
+ClockKeeper clockKeeper;
+WiFiFastConnect wifiFastConnect;
+
+// Task periods, in milliseconds.
+const unsigned long CLOCK_PERIOD = 100;     // Picks up an NTP sync promptly.
+const unsigned long WIFI_PERIOD = 100;      // Watches the direct reconnect at startup.
+const unsigned long SENSOR_PERIOD = 10000;
+const unsigned long SENSOR_POLL_PERIOD = 100;  // Collects a conversion once it's done.
+const unsigned long RELAY_PERIOD = 1000;    // Time proportioning switches part way between readings.
+const unsigned long FLASH_FLUSH_PERIOD = 1000;
+const unsigned long UPLINK_PERIOD = 50;     // Reads the response to a post in flight.
+const unsigned long EVENTS_KEEP_ALIVE_PERIOD = 15000;
+const unsigned long HEAP_SAMPLE_PERIOD = 1000;
+
+bool relayOn = false;
 
 // ----------------------------------------------------------------------
 
@@ -43,31 +66,61 @@ void setup()
   Serial.println();
   
   if(!LittleFS.begin()) {
-    Serial.println(F("Failed to start filesystem!"));
+    eventLog.Add(PSTR("Failed to start filesystem!"));
   }
+  BootTimes::Mark(BOOT_FILESYSTEM);
+
+  clockKeeper.Begin();  // The time saved before the reset, until NTP syncs.
 
   config.ReadFromFS(); // Read any stored configuration.
+  BootTimes::Mark(BOOT_CONFIG);
+  setupTime();  // Before any reading, restored or new, is put in a slot by its local time.
   samples.ReadFromFS();  // Read any existing data.
+  if(clockKeeper.Estimated())
+    samples.ClockRestored();  // Kept apart from the readings before the reset, until NTP syncs.
+  BootTimes::Mark(BOOT_SAMPLES);
+  cloudInterface.Setup();  // Root cert, and any readings not yet sent.
 
+  // Readings are queued here, and posted by the uplink task
   samples.OnSampleIndexChange( []() {
-    String result = "CloudInterface: ";
-    result += cloudInterface.WriteDataToCloud(samples, config);
-    Serial.println(result);
+    cloudInterface.QueueReading(samples);
+  });
+
+  samples.OnSampleRecorded( [](int channel) {
+    BootTimes::Mark(BOOT_FIRST_SAMPLE);
+    if(channel == config.control_channel)
+      controlEngine.Reading(CentisToDegrees(samples.Channel(channel).current_temp));
+    webServer.PublishReading(channel);
+  });
+  
+  // Readings taken before NTP syncs are moved once it does.
+  clockKeeper.OnClockCorrected( [](long seconds) {
+    samples.ClockCorrected(seconds);
+    cloudInterface.ClockCorrected(seconds);
+    webServer.ClockCorrected(seconds);
   });
   
   sensor.Setup();
 
   setupRelay();
-  setupWifi();
+  takeFirstReading();
+
+  // The direct reconnect carries on in the background, and the "wifi" task falls back to
+  //  WiFiManager if it doesn't connect.
+  if(!wifiFastConnect.Begin()) {
+    connectWifi();
+    setupTime();    // The timezone may have been set in the portal.
+  }
   
   webServer.Setup();
+  BootTimes::Mark(BOOT_SERVING);
 
   webServer.OnRootCertChanged( []() {
-    cloudInterface.LoadRootCert();
+    cloudInterface.Setup();  // Root cert, and any readings not yet sent.
   });
 
-  webServer.OnTestCall( []() {
-    return cloudInterface.WriteDataToCloud(samples, config);
+  webServer.OnTestCall( [](Print& out) {
+    cloudInterface.WriteDataToCloud(samples, config, out);
   });
   
   webServer.OnResetWiFiSettings( []() { 
@@ -75,17 +128,48 @@ void setup()
     ESP.restart();
   });
 
-  // Setup the inbuilt NTP server with config loaded or obtained via the WiFi manager.
-  String timezone = String("UTC+") + String(config.timezone_offset);
-  configTime(timezone.c_str(), "pool.ntp.org");
+  webServer.OnPerfStats( [](Print& out, bool reset) {
+    if(reset)
+      scheduler.ResetStats();
+    scheduler.PrintStats(out);
+  });
+
+  webServer.OnMetrics( [](Print& out) {
+    scheduler.PrintMetrics(out);
+  });
+
+  webServer.OnAutotune( []() {
+    controlEngine.StartAutotune();
+  });
+
+  webServer.OnControlStatus( [](Print& out) {
+    controlEngine.PrintStatus(out);
+  });
+
+  setupTasks();
 
   if(!MDNS.begin(MDNS_NAME)) {
-    Serial.println(F("Failed to setup MDNS responder!"));
+    eventLog.Add(PSTR("Failed to setup MDNS responder!"));
   }
   
   ArduinoOTA.setHostname(OTA_HOSTNAME);
   ArduinoOTA.setPassword(OTA_PASSWORD);
   ArduinoOTA.begin();
+  BootTimes::Mark(BOOT_SETUP_DONE);
+}
+
+// If the clock was restored, the heater is set from a reading straight away, rather than
+//  waiting on WiFi and NTP.  The conversion takes under a second.
+void takeFirstReading() {
+  if(!webServer.RecordStartupTime())
+    return;
+
+  sensor.StartReading(samples);
+  while(sensor.Converting()) {
+    delay(10);
+    sensor.Service(samples);
+  }
+  switchRelay();
 }
 
 // Used by the WiFi manager when configuring the timezone.
@@ -99,7 +183,7 @@ void setupWifi() {
   wifiManager.setConfigPortalTimeout(300);  // 5 minutes for configuration
   
   char str_tz_offset[6];
-  sprintf(str_tz_offset, "%d", config.timezone_offset);
+  snprintf_P(str_tz_offset, sizeof(str_tz_offset), PSTR("%ld"), config.timezone_offset);
   WiFiManagerParameter timezoneParam("timezone_offset", "Timezone Offset", str_tz_offset, 3);
   wifiManager.addParameter(&timezoneParam);
   wifiManager.setSaveConfigCallback(saveConfigCallback);
@@ -114,6 +198,75 @@ void setupWifi() {
   }
 }
 
+// The full WiFiManager flow: a scan, DHCP, and the configuration portal if that fails.  The
+//  connection is saved for a direct reconnect next time.
+void connectWifi() {
+  // WiFiManager can block for the whole portal timeout, with nothing running the control, so
+  //  the heater's off until the relay task next runs.
+  if(relayOn) {
+    relayOn = false;
+    digitalWrite(RELAY_OUTPUT, LOW);
+    webServer.PublishRelay(false);
+  }
+  setupWifi();
+  BootTimes::Mark(BOOT_WIFI);
+  wifiFastConnect.Save();
+}
+
+// Setup the inbuilt NTP server with config loaded or obtained via the WiFi manager.
+void setupTime() {
+  char timezone[16];
+  snprintf_P(timezone, sizeof(timezone), PSTR("UTC+%ld"), config.timezone_offset);
+  configTime(timezone, "pool.ntp.org");
+  samples.TimezoneChanged();
+}
+
+void setupTasks() {
+  // First, so the readings are moved before any more are taken with the corrected clock.
+  scheduler.Add("clock", CLOCK_PERIOD, []() {
+    clockKeeper.Service();
+  });
+
+  // Blocks while WiFiManager runs, as it did in setup(), but only when the direct reconnect failed.
+  scheduler.Add("wifi", WIFI_PERIOD, []() {
+    if(wifiFastConnect.Service()) {
+      connectWifi();
+      setupTime();    // The timezone may have been set in the portal.
+    }
+  });
+
+  // If the webserver has successfully recorded the startup time, then the time looks valid
+  //  (from NTP, or restored from before the reset), and processing can start.
+  scheduler.Add("sensor", SENSOR_PERIOD, []() {
+    if(webServer.RecordStartupTime())
+      sensor.StartReading(samples);
+  });
+
+  scheduler.Add("sensor poll", SENSOR_POLL_PERIOD, []() {
+    sensor.Service(samples);
+  });
+
+  scheduler.Add("relay", RELAY_PERIOD, []() {
+    switchRelay();
+  });
+
+  scheduler.Add("flash flush", FLASH_FLUSH_PERIOD, []() {
+    samples.FlushToFS();
+  });
+
+  scheduler.Add("uplink", UPLINK_PERIOD, []() {
+    cloudInterface.Service(config);
+  });
+
+  scheduler.Add("events", EVENTS_KEEP_ALIVE_PERIOD, []() {
+    webServer.KeepEventsAlive();
+  });
+
+  scheduler.Add("heap", HEAP_SAMPLE_PERIOD, []() {
+    HeapStats::Sample();
+  });
+}
+
 void setupRelay() {
   pinMode(RELAY_OUTPUT, OUTPUT);
 
@@ -123,37 +276,21 @@ void setupRelay() {
 
 // ----------------------------------------------------------------------
 
-const int LOOP_DELAY = 1000;
-int loopCount = LOOP_DELAY;
-
 void loop() {
+  PerfTimer timer(perfLoop);
   MDNS.update();                       // Some tutorials leave this out, but it doesn't work without it.
   webServer.handleClient();            // Listen for HTTP requests from clients
   ArduinoOTA.handle();
-  
-  delay(10);    
-  
-  loopCount++;
-  if(loopCount > LOOP_DELAY)
-  {
-    // If the webserver has successfully recorded the startup time, then the NTP time looks valid,
-    //  and processing can start.
-    if(webServer.RecordStartupTime())
-    {
-      sensor.RecordTemperature(samples);
-      switchRelay();
-    }
-    loopCount = 0;
-  }
+  scheduler.Run();                     // Sensor, relay, flash and cloud tasks, when due.
 }
 
 
+// The control engine turns the heater off by itself if the readings stop.
 void switchRelay() {
-  if(samples.current_temp < config.relay_on_below_temp) {
-    digitalWrite(RELAY_OUTPUT, HIGH);
-  }
-
-  if(samples.current_temp > config.relay_off_above_temp) {
-    digitalWrite(RELAY_OUTPUT, LOW);
+  bool on = controlEngine.Update();
+  if(on != relayOn) {
+    relayOn = on;
+    digitalWrite(RELAY_OUTPUT, on ? HIGH : LOW);
+    webServer.PublishRelay(on);
   }
 }
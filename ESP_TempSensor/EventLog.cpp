@@ -0,0 +1,44 @@
+#include "EventLog.h"
+#include "TextFormat.h"
+#include "ClockKeeper.h"
+#include <time.h>
+#include <stdarg.h>
+
+EventLog eventLog;
+
+void EventLog::Add(PGM_P format, ...) {
+  Entry& entry = entries[(next_sequence - 1) % EVENT_LOG_ENTRIES];
+  entry.sequence = next_sequence++;
+  entry.uptime_millis = millis();
+  time_t now = time(NULL);
+  entry.time = now >= MIN_VALID_EPOCH ? now : 0;     // Before that, entries show the uptime.
+
+  va_list args;
+  va_start(args, format);
+  vsnprintf_P(entry.text, sizeof(entry.text), format, args);
+  va_end(args);
+
+  Serial.println(entry.text);
+}
+
+void EventLog::PrintSince(Print& out, uint32_t since) const {
+  if(since >= LastSequence())
+    return;     // Nothing newer.  (And since + 1 would wrap for UINT32_MAX.)
+
+  uint32_t first = next_sequence > EVENT_LOG_ENTRIES ? next_sequence - EVENT_LOG_ENTRIES : 1;
+  if(since >= first)
+    first = since + 1;
+
+  uint32_t sequence;
+  for(sequence = first; sequence < next_sequence; sequence++) {
+    const Entry& entry = entries[(sequence - 1) % EVENT_LOG_ENTRIES];
+    if(entry.time != 0) {
+      struct tm* t = localtime(&entry.time);
+      PrintFormat(out, PSTR("%u %04d-%02d-%02d %02d:%02d:%02d %s\n"), (unsigned)entry.sequence,
+        t->tm_year + 1900, t->tm_mon + 1, t->tm_mday, t->tm_hour, t->tm_min, t->tm_sec, entry.text);
+    } else {
+      PrintFormat(out, PSTR("%u +%u.%03us %s\n"), (unsigned)entry.sequence,
+        (unsigned)(entry.uptime_millis / 1000), (unsigned)(entry.uptime_millis % 1000), entry.text);
+    }
+  }
+}
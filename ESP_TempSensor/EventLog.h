@@ -0,0 +1,47 @@
+#include <Arduino.h>
+
+#ifndef __EVENT_LOG__
+#define __EVENT_LOG__
+
+// Log storage is fixed at compile time.  These can be overridden with build flags.
+#ifndef EVENT_LOG_ENTRIES
+#define EVENT_LOG_ENTRIES 40
+#endif
+#ifndef EVENT_LOG_TEXT
+#define EVENT_LOG_TEXT 80          // Longer messages are cut short
+#endif
+
+// ----------------------------------------------------------------------
+// The most recent log messages, kept in RAM so they can be read from /log.
+//
+//  Messages are formatted straight into a fixed ring of entries, so logging never touches
+//  the heap.  When the ring is full, the oldest entry is overwritten.  Each entry has a
+//  sequence number, so a reader can ask for just the entries after the last one it saw.
+//  Everything logged is also written to Serial.
+
+class EventLog
+{
+public:
+    // printf style, with the format in PROGMEM, e.g. eventLog.Add(PSTR("Failed: %d"), code);
+    void Add(PGM_P format, ...) __attribute__((format(printf, 2, 3)));
+
+    // Writes the entries with a sequence number after since, oldest first, one per line.
+    void PrintSince(Print& out, uint32_t since) const;
+
+    uint32_t LastSequence() const { return next_sequence - 1; }
+
+private:
+    struct Entry {
+      uint32_t sequence;
+      uint32_t uptime_millis;
+      time_t time;              // 0 if the clock wasn't set yet
+      char text[EVENT_LOG_TEXT];
+    };
+
+    Entry entries[EVENT_LOG_ENTRIES];
+    uint32_t next_sequence = 1;     // 0 is never used, so since=0 gets everything
+};
+
+extern EventLog eventLog;
+
+#endif // __EVENT_LOG__
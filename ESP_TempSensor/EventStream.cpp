@@ -0,0 +1,83 @@
+#include "EventStream.h"
+
+bool EventStream::Subscribe(WiFiClient& client) {
+  int i;
+  for(i = 0; i < MAX_SUBSCRIBERS; i++) {
+    Subscriber& s = subscribers[i];
+    if(s.active && !s.client.connected()) {
+      s.client.stop();
+      s.active = false;
+    }
+    if(!s.active)
+      break;
+  }
+  if(i == MAX_SUBSCRIBERS)
+    return false;
+
+  // Events are small, and should go out as soon as they're written.
+  client.setNoDelay(true);
+  client.setSync(false);
+  client.print(F("HTTP/1.1 200 OK\r\n"
+    "Content-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "retry: 10000\n\n"));
+
+  subscribers[i].client = client;
+  subscribers[i].active = true;
+  subscribers[i].missed = 0;
+  return true;
+}
+
+void EventStream::Publish(const char* event, const char* data) {
+  char message[MAX_EVENT];
+  int length = snprintf_P(message, sizeof(message), PSTR("event: %s\ndata: %s\n\n"), event, data);
+  if(length <= 0 || length >= (int)sizeof(message))
+    return;
+  Send(message, length);
+}
+
+void EventStream::KeepAlive() {
+  static const char COMMENT[] = ":\n\n";
+  Send(COMMENT, sizeof(COMMENT) - 1);
+}
+
+void EventStream::Send(const char* message, size_t length) {
+  int i;
+  for(i = 0; i < MAX_SUBSCRIBERS; i++) {
+    Subscriber& s = subscribers[i];
+    if(!s.active)
+      continue;
+
+    if(!s.client.connected()) {
+      s.client.stop();
+      s.active = false;
+      continue;
+    }
+
+    if((size_t)s.client.availableForWrite() < length) {
+      dropped++;
+      if(++s.missed >= MAX_MISSED) {
+        s.client.stop();
+        s.active = false;
+        disconnected++;
+      }
+      continue;
+    }
+
+    s.client.write((const uint8_t*)message, length);
+    s.missed = 0;
+    sent++;
+  }
+}
+
+int EventStream::Subscribers() const {
+  int count = 0;
+  int i;
+  for(i = 0; i < MAX_SUBSCRIBERS; i++) {
+    if(subscribers[i].active)
+      count++;
+  }
+  return count;
+}
@@ -0,0 +1,52 @@
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+
+#ifndef __EVENT_STREAM__
+#define __EVENT_STREAM__
+
+// ----------------------------------------------------------------------
+// Server-Sent Events, pushed to the browsers watching /events.
+//
+//  The web server hands each subscriber's connection over, and it's kept open here.  Events
+//  are only written to a subscriber when the whole event fits in its send buffer, so a slow
+//  browser can't hold up the loop.  Events it had no room for are dropped (the next reading
+//  replaces them anyway), and a subscriber that keeps falling behind is disconnected.
+
+class EventStream
+{
+public:
+    static const int MAX_SUBSCRIBERS = 4;
+    static const int MAX_MISSED = 3;          // Dropped events in a row, before disconnecting
+    static const size_t MAX_EVENT = 128;
+
+    // Sends the event stream headers, and keeps the connection.  Returns false if there
+    //  are already MAX_SUBSCRIBERS.
+    bool Subscribe(WiFiClient& client);
+
+    // Sends "event: <event>" with a line of data (normally JSON) to every subscriber.
+    void Publish(const char* event, const char* data);
+
+    // Sends a comment, which stops proxies timing out the connection, and finds subscribers
+    //  that have gone away.
+    void KeepAlive();
+
+    int Subscribers() const;
+
+public:
+    uint32_t sent = 0;
+    uint32_t dropped = 0;
+    uint32_t disconnected = 0;    // For falling behind
+
+private:
+    void Send(const char* message, size_t length);
+
+    struct Subscriber {
+      WiFiClient client;
+      bool active = false;
+      uint8_t missed = 0;
+    };
+
+    Subscriber subscribers[MAX_SUBSCRIBERS];
+};
+
+#endif // __EVENT_STREAM__
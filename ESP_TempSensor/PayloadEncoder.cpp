@@ -0,0 +1,225 @@
+#include "PayloadEncoder.h"
+
+// CBOR major types (the top 3 bits of each item's first byte).
+const uint8_t CBOR_UNSIGNED = 0;
+const uint8_t CBOR_NEGATIVE = 1;
+const uint8_t CBOR_TEXT = 3;
+const uint8_t CBOR_ARRAY = 4;
+const uint8_t CBOR_MAP = 5;
+const uint8_t CBOR_TAG = 6;
+
+const uint32_t CBOR_TAG_DECIMAL_FRACTION = 4;
+
+// Digits only, so it can be sent as a number, as the server has always had it.
+bool isNumericId(const char* id) {
+  if(*id == 0 || strlen(id) > 9 || (id[0] == '0' && id[1]))
+    return false;
+  for(; *id; id++) {
+    if(*id < '0' || *id > '9')
+      return false;
+  }
+  return true;
+}
+
+// Control characters are left out of a string id, in both formats, so the server gets the same
+//  id whichever it's sent.
+bool keptInId(char c) {
+  return (uint8_t)c >= ' ';
+}
+
+size_t PayloadEncoder::Encode(PayloadFormat format, const UplinkReading* readings, int count, const char* instanceId) {
+  length = 0;
+  overflowed = false;
+
+  int i;
+  if(format == PAYLOAD_CBOR) {
+    CborHead(CBOR_ARRAY, count);
+    for(i = 0; i < count; i++)
+      CborReading(readings[i], instanceId);
+  } else {
+    Put('[');
+    for(i = 0; i < count; i++) {
+      if(i > 0)
+        Put(',');
+      JsonReading(readings[i], instanceId);
+    }
+    Put(']');
+  }
+  return overflowed ? 0 : length;
+}
+
+const char* PayloadEncoder::ContentType(PayloadFormat format) {
+  return format == PAYLOAD_CBOR ? "application/cbor" : "application/json";
+}
+
+void PayloadEncoder::Put(uint8_t byte) {
+  if(length < capacity)
+    data[length++] = byte;
+  else
+    overflowed = true;
+}
+
+void PayloadEncoder::Put(const char* text) {
+  while(*text)
+    Put((uint8_t)*text++);
+}
+
+// ----------------------------------------------------------------------
+//  JSON
+
+void PayloadEncoder::JsonKey(const char* key) {
+  Put('"');
+  Put(key);
+  Put("\":");
+}
+
+void PayloadEncoder::JsonUnsigned(uint32_t value) {
+  char digits[11];
+  int n = 0;
+  do {
+    digits[n++] = '0' + value % 10;
+    value /= 10;
+  } while(value);
+  while(n)
+    Put(digits[--n]);
+}
+
+void PayloadEncoder::JsonCentis(int32_t centis) {
+  if(centis < 0) {
+    Put('-');
+    centis = -centis;
+  }
+  JsonUnsigned(centis / CENTIS_PER_DEGREE);
+  Put('.');
+  Put('0' + (centis % CENTIS_PER_DEGREE) / 10);
+  Put('0' + centis % 10);
+}
+
+void PayloadEncoder::JsonInstanceId(const char* instanceId) {
+  if(isNumericId(instanceId)) {
+    Put(instanceId);
+    return;
+  }
+  Put('"');
+  for(; *instanceId; instanceId++) {
+    if(*instanceId == '"' || *instanceId == '\\')
+      Put('\\');
+    if(keptInId(*instanceId))
+      Put((uint8_t)*instanceId);
+  }
+  Put('"');
+}
+
+void PayloadEncoder::JsonReading(const UplinkReading& reading, const char* instanceId) {
+  Put('{');
+  JsonKey("instanceId");
+  JsonInstanceId(instanceId);
+  Put(',');
+  JsonKey("channel");
+  JsonUnsigned(reading.channel);
+  Put(',');
+  JsonKey("timestamp");
+  JsonUnsigned(reading.timestamp);
+  Put(',');
+  JsonKey("value");
+  JsonCentis(reading.value);
+  if(reading.count > 0) {
+    Put(',');
+    JsonKey("meanValue");
+    JsonCentis(reading.mean_value);
+    Put(',');
+    JsonKey("minimumValue");
+    JsonCentis(reading.min_value);
+    Put(',');
+    JsonKey("maximumValue");
+    JsonCentis(reading.max_value);
+    Put(',');
+    JsonKey("count");
+    JsonUnsigned(reading.count);
+  }
+  Put('}');
+}
+
+// ----------------------------------------------------------------------
+//  CBOR
+
+// The shortest head for the value, as the deterministic encoding requires.
+void PayloadEncoder::CborHead(uint8_t majorType, uint32_t value) {
+  uint8_t major = majorType << 5;
+  if(value < 24) {
+    Put(major | value);
+  } else if(value <= 0xFF) {
+    Put(major | 24);
+    Put(value);
+  } else if(value <= 0xFFFF) {
+    Put(major | 25);
+    Put(value >> 8);
+    Put(value);
+  } else {
+    Put(major | 26);
+    Put(value >> 24);
+    Put(value >> 16);
+    Put(value >> 8);
+    Put(value);
+  }
+}
+
+void PayloadEncoder::CborInt(int32_t value) {
+  if(value >= 0)
+    CborHead(CBOR_UNSIGNED, value);
+  else
+    CborHead(CBOR_NEGATIVE, (uint32_t)(-1 - value));
+}
+
+void PayloadEncoder::CborText(const char* text) {
+  size_t textLength = strlen(text);
+  CborHead(CBOR_TEXT, textLength);
+  Put(text);
+}
+
+void PayloadEncoder::CborInstanceId(const char* instanceId) {
+  if(isNumericId(instanceId)) {
+    CborInt(atol(instanceId));
+    return;
+  }
+  size_t kept = 0;
+  const char* c;
+  for(c = instanceId; *c; c++) {
+    if(keptInId(*c))
+      kept++;
+  }
+  CborHead(CBOR_TEXT, kept);
+  for(c = instanceId; *c; c++) {
+    if(keptInId(*c))
+      Put((uint8_t)*c);
+  }
+}
+
+void PayloadEncoder::CborCentis(int32_t centis) {
+  CborHead(CBOR_TAG, CBOR_TAG_DECIMAL_FRACTION);
+  CborHead(CBOR_ARRAY, 2);
+  CborInt(-2);
+  CborInt(centis);
+}
+
+void PayloadEncoder::CborReading(const UplinkReading& reading, const char* instanceId) {
+  CborHead(CBOR_MAP, reading.count > 0 ? 8 : 4);
+  CborText("instanceId");
+  CborInstanceId(instanceId);
+  CborText("channel");
+  CborInt(reading.channel);
+  CborText("timestamp");
+  CborHead(CBOR_UNSIGNED, reading.timestamp);
+  CborText("value");
+  CborCentis(reading.value);
+  if(reading.count > 0) {
+    CborText("meanValue");
+    CborCentis(reading.mean_value);
+    CborText("minimumValue");
+    CborCentis(reading.min_value);
+    CborText("maximumValue");
+    CborCentis(reading.max_value);
+    CborText("count");
+    CborInt(reading.count);
+  }
+}
@@ -0,0 +1,58 @@
+#include <Arduino.h>
+#include "UplinkQueue.h"
+
+#ifndef __PAYLOAD_ENCODER__
+#define __PAYLOAD_ENCODER__
+
+// The body format of posts to the cloud.  Stored in the configuration, so the values are fixed.
+enum PayloadFormat {
+  PAYLOAD_JSON = 0,
+  PAYLOAD_CBOR = 1,
+  NUM_PAYLOAD_FORMATS
+};
+
+// ----------------------------------------------------------------------
+// Writes a batch of readings into a fixed buffer, as JSON or CBOR (RFC 8949), with no heap use.
+//
+//  Either way the body is an array of maps, one per reading, with the same keys:
+//    instanceId, channel, timestamp, value (the latest reading),
+//    and, when the interval has readings, meanValue, minimumValue, maximumValue and count.
+//
+//  Temperatures are in degrees.  In JSON they're written with 2 decimal places, and in CBOR as
+//  decimal fractions (tag 4, [-2, hundredths]), so they're exact either way.  The instance id
+//  is a number if it's all digits, otherwise a string, with any control characters left out.
+
+class PayloadEncoder
+{
+public:
+    PayloadEncoder(uint8_t* buffer, size_t capacity) : data(buffer), capacity(capacity) {}
+
+    // Returns the length of the body, or 0 if it doesn't fit.
+    size_t Encode(PayloadFormat format, const UplinkReading* readings, int count, const char* instanceId);
+
+    static const char* ContentType(PayloadFormat format);
+
+private:
+    void Put(uint8_t byte);
+    void Put(const char* text);
+
+    void JsonKey(const char* key);
+    void JsonUnsigned(uint32_t value);
+    void JsonCentis(int32_t centis);
+    void JsonInstanceId(const char* instanceId);
+    void JsonReading(const UplinkReading& reading, const char* instanceId);
+
+    void CborHead(uint8_t majorType, uint32_t value);
+    void CborInt(int32_t value);
+    void CborText(const char* text);
+    void CborInstanceId(const char* instanceId);
+    void CborCentis(int32_t centis);
+    void CborReading(const UplinkReading& reading, const char* instanceId);
+
+    uint8_t* data;
+    size_t capacity;
+    size_t length = 0;
+    bool overflowed = false;
+};
+
+#endif // __PAYLOAD_ENCODER__
@@ -0,0 +1,184 @@
+#include "PerfStats.h"
+#include "TextFormat.h"
+
+PerfCounter* PerfCounter::first = NULL;
+
+PerfCounter perfSetSample("SampleBuffer::SetSample");
+PerfCounter perfSamplesWrite("SampleBuffer::WriteToFS");
+PerfCounter perfSamplesAppend("SampleBuffer::AppendToFS");
+PerfCounter perfSamplesRead("SampleBuffer::ReadFromFS");
+PerfCounter perfConfigWrite("DeviceConfig::WriteToFS");
+PerfCounter perfConfigRead("DeviceConfig::ReadFromFS");
+PerfCounter perfCloudPayload("CloudInterface payload");
+PerfCounter perfCloudWrite("CloudInterface::WriteDataToCloud");
+PerfCounter perfCloudPost("CloudInterface::StartPost");
+PerfCounter perfWebRoot("DeviceWebServer::handleRoot");
+PerfCounter perfWebApi("DeviceWebServer::handleApiSamples");
+PerfCounter perfWebConfigure("DeviceWebServer::handleConfigure");
+PerfCounter perfWebRootCert("DeviceWebServer::handleRootCertUpload");
+PerfCounter perfWebTestCode("DeviceWebServer::handleTestCode");
+PerfCounter perfWebDir("DeviceWebServer::handleDirList");
+PerfCounter perfWebPerf("DeviceWebServer::handlePerfStats");
+PerfCounter perfWebMetrics("DeviceWebServer::handleMetrics");
+PerfCounter perfWebLog("DeviceWebServer::handleLog");
+PerfCounter perfWebEvents("DeviceWebServer::handleEvents");
+PerfCounter perfWebStatic("DeviceWebServer::handleStatic");
+PerfCounter perfWebNotFound("DeviceWebServer::handleNotFound");
+PerfCounter perfCloudRoundTrip("CloudInterface post round trip");
+PerfCounter perfSensorRead("SensorInterface::ReadSensor");
+PerfCounter perfLoop("loop");
+
+// Upper bounds of the histogram buckets, except the last, which takes the rest.
+const uint32_t BUCKET_MICROS[PerfCounter::NUM_BUCKETS - 1] = { 100, 1000, 10000, 100000, 1000000, 10000000 };
+const char* const BUCKET_LABELS[PerfCounter::NUM_BUCKETS] = { "0.0001", "0.001", "0.01", "0.1", "1", "10", "+Inf" };
+
+uint32_t HeapStats::min_free_heap = 0;
+uint32_t HeapStats::min_max_free_block = 0;
+uint8_t HeapStats::max_fragmentation = 0;
+
+PerfCounter::PerfCounter(const char* counterName) : name(counterName), next(NULL) {
+  // Append, so the listing comes out in declaration order.
+  PerfCounter** link = &first;
+  while(*link != NULL) {
+    link = &(*link)->next;
+  }
+  *link = this;
+}
+
+void PerfCounter::Record(uint32_t elapsedMicros, int32_t heapUsed, uint32_t freeHeap) {
+  if(calls == 0 || freeHeap < min_free_heap)
+    min_free_heap = freeHeap;
+
+  calls++;
+  total_micros += elapsedMicros;
+
+  if(elapsedMicros > max_micros)
+    max_micros = elapsedMicros;
+
+  if(heapUsed > max_heap_used)
+    max_heap_used = heapUsed;
+
+  int bucket = 0;
+  while(bucket < NUM_BUCKETS - 1 && elapsedMicros > BUCKET_MICROS[bucket])
+    bucket++;
+  buckets[bucket]++;
+}
+
+void PerfCounter::Reset() {
+  calls = 0;
+  total_micros = 0;
+  max_micros = 0;
+  max_heap_used = 0;
+  min_free_heap = 0;
+  memset(buckets, 0, sizeof(buckets));
+}
+
+void PerfCounter::ResetAll() {
+  for(PerfCounter* counter = first; counter != NULL; counter = counter->next) {
+    counter->Reset();
+  }
+}
+
+void PerfCounter::PrintAll(Print& out) {
+  PrintFormat(out, PSTR("%-34s %8s %12s %10s %10s %10s\n"), "counter", "calls", "avg ns", "max us", "heap used", "min free");
+  for(PerfCounter* counter = first; counter != NULL; counter = counter->next) {
+    // Average in nanoseconds, as the short calls are only a few microseconds each.
+    uint32_t avgNanos = counter->calls ? (uint32_t)((uint64_t)counter->total_micros * 1000 / counter->calls) : 0;
+    PrintFormat(out, PSTR("%-34s %8u %12u %10u %10d %10u\n"), counter->name,
+      (unsigned)counter->calls, (unsigned)avgNanos, (unsigned)counter->max_micros,
+      (int)counter->max_heap_used, (unsigned)counter->min_free_heap);
+  }
+}
+
+void PerfCounter::PrintMetrics(Print& out) {
+  out.print(F("# HELP brewmon_duration_seconds Time taken by instrumented code.\n"
+    "# TYPE brewmon_duration_seconds histogram\n"));
+  for(PerfCounter* counter = first; counter != NULL; counter = counter->next) {
+    uint32_t cumulative = 0;
+    int bucket;
+    for(bucket = 0; bucket < NUM_BUCKETS; bucket++) {
+      cumulative += counter->buckets[bucket];
+      PrintFormat(out, PSTR("brewmon_duration_seconds_bucket{name=\"%s\",le=\"%s\"} %u\n"),
+        counter->name, BUCKET_LABELS[bucket], (unsigned)cumulative);
+    }
+    PrintFormat(out, PSTR("brewmon_duration_seconds_sum{name=\"%s\"} %u.%06u\n"), counter->name,
+      (unsigned)(counter->total_micros / 1000000), (unsigned)(counter->total_micros % 1000000));
+    PrintFormat(out, PSTR("brewmon_duration_seconds_count{name=\"%s\"} %u\n"), counter->name, (unsigned)counter->calls);
+  }
+
+  out.print(F("# HELP brewmon_heap_used_max_bytes Largest drop in free heap across a single call.\n"
+    "# TYPE brewmon_heap_used_max_bytes gauge\n"));
+  for(PerfCounter* counter = first; counter != NULL; counter = counter->next) {
+    PrintFormat(out, PSTR("brewmon_heap_used_max_bytes{name=\"%s\"} %d\n"), counter->name, (int)counter->max_heap_used);
+  }
+}
+
+// ----------------------------------------------------------------------
+
+const char* const BOOT_PHASE_NAMES[NUM_BOOT_PHASES] = {
+  "filesystem", "clock_restored", "config", "samples", "serving", "setup_done", "wifi", "wifi_fallback",
+  "first_sample", "ntp_sync"
+};
+
+uint32_t BootTimes::phase_millis[NUM_BOOT_PHASES] = {};
+
+void BootTimes::Mark(BootPhase phase) {
+  if(phase_millis[phase] == 0)
+    phase_millis[phase] = millis() ? millis() : 1;
+}
+
+void BootTimes::PrintAll(Print& out) {
+  out.print(F("Boot phases (ms after reset):"));
+  int phase;
+  for(phase = 0; phase < NUM_BOOT_PHASES; phase++) {
+    if(phase_millis[phase])
+      PrintFormat(out, PSTR(" %s %u"), BOOT_PHASE_NAMES[phase], (unsigned)phase_millis[phase]);
+    else
+      PrintFormat(out, PSTR(" %s -"), BOOT_PHASE_NAMES[phase]);
+  }
+  out.print('\n');
+}
+
+void BootTimes::PrintMetrics(Print& out) {
+  out.print(F("# HELP brewmon_boot_phase_seconds Time from the reset to each stage of starting up.\n"
+    "# TYPE brewmon_boot_phase_seconds gauge\n"));
+  int phase;
+  for(phase = 0; phase < NUM_BOOT_PHASES; phase++) {
+    if(phase_millis[phase])
+      PrintFormat(out, PSTR("brewmon_boot_phase_seconds{phase=\"%s\"} %u.%03u\n"), BOOT_PHASE_NAMES[phase],
+        (unsigned)(phase_millis[phase] / 1000), (unsigned)(phase_millis[phase] % 1000));
+  }
+}
+
+// ----------------------------------------------------------------------
+
+void HeapStats::Sample() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  uint32_t maxFreeBlock = ESP.getMaxFreeBlockSize();
+  uint8_t fragmentation = ESP.getHeapFragmentation();
+
+  if(min_free_heap == 0 || freeHeap < min_free_heap)
+    min_free_heap = freeHeap;
+  if(min_max_free_block == 0 || maxFreeBlock < min_max_free_block)
+    min_max_free_block = maxFreeBlock;
+  if(fragmentation > max_fragmentation)
+    max_fragmentation = fragmentation;
+}
+
+void HeapStats::Reset() {
+  min_free_heap = 0;
+  min_max_free_block = 0;
+  max_fragmentation = 0;
+}
+
+void HeapStats::PrintMetrics(Print& out) {
+  PrintFormat(out, PSTR("# TYPE brewmon_heap_free_bytes gauge\nbrewmon_heap_free_bytes %u\n"
+    "# TYPE brewmon_heap_max_free_block_bytes gauge\nbrewmon_heap_max_free_block_bytes %u\n"
+    "# TYPE brewmon_heap_fragmentation_percent gauge\nbrewmon_heap_fragmentation_percent %u\n"),
+    (unsigned)ESP.getFreeHeap(), (unsigned)ESP.getMaxFreeBlockSize(), (unsigned)ESP.getHeapFragmentation());
+  PrintFormat(out, PSTR("# HELP brewmon_heap_free_min_bytes Lowest values sampled since boot, or the last reset.\n"
+    "# TYPE brewmon_heap_free_min_bytes gauge\nbrewmon_heap_free_min_bytes %u\n"
+    "# TYPE brewmon_heap_max_free_block_min_bytes gauge\nbrewmon_heap_max_free_block_min_bytes %u\n"
+    "# TYPE brewmon_heap_fragmentation_max_percent gauge\nbrewmon_heap_fragmentation_max_percent %u\n"),
+    (unsigned)min_free_heap, (unsigned)min_max_free_block, (unsigned)max_fragmentation);
+}
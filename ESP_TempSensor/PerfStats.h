@@ -0,0 +1,140 @@
+#include <Arduino.h>
+
+#ifndef __PERF_STATS__
+#define __PERF_STATS__
+
+// ----------------------------------------------------------------------
+// Lightweight on-device timing and heap counters.
+//
+//  There's no debugger attached to a running board, so the interesting code paths
+//  record how long they take and how much heap they hold on to.  The totals can be
+//  viewed at /perf, which gives a baseline to compare any later changes against.
+//
+//  Each counter also keeps a histogram of call times, and the lot can be scraped as
+//  Prometheus text from /metrics.  Nothing here allocates, so it's safe to use anywhere.
+
+class PerfCounter
+{
+public:
+    PerfCounter(const char* counterName);
+
+    void Record(uint32_t elapsedMicros, int32_t heapUsed, uint32_t freeHeap);
+    void Reset();
+
+    // Writes one line per counter, in the order they were created.
+    static void PrintAll(Print& out);
+    static void ResetAll();
+
+    // Writes every counter as a Prometheus histogram, labelled with the counter's name.
+    static void PrintMetrics(Print& out);
+
+    // Histogram buckets are powers of 10, from 100us to 10s, then everything slower.
+    static const int NUM_BUCKETS = 7;
+
+public:
+    const char* name;
+    uint32_t calls = 0;
+    uint64_t total_micros = 0;
+    uint32_t max_micros = 0;
+    int32_t max_heap_used = 0;      // Largest drop in free heap across a single call.
+    uint32_t min_free_heap = 0;     // Lowest free heap seen at the end of a call.
+    uint32_t buckets[NUM_BUCKETS] = {};
+
+private:
+    // Counters chain themselves together, so they can be listed without a registry.
+    static PerfCounter* first;
+    PerfCounter* next;
+};
+
+// Times the enclosing scope, and records it against a counter when it goes out of scope.
+class PerfTimer
+{
+public:
+    PerfTimer(PerfCounter& perfCounter) :
+      counter(perfCounter),
+      start_heap(ESP.getFreeHeap()),
+      start_micros(micros())
+    {};
+
+    ~PerfTimer() {
+      uint32_t elapsed = micros() - start_micros;
+      uint32_t freeHeap = ESP.getFreeHeap();
+      counter.Record(elapsed, (int32_t)start_heap - (int32_t)freeHeap, freeHeap);
+    }
+
+private:
+    PerfCounter& counter;
+    uint32_t start_heap;
+    uint32_t start_micros;
+};
+
+// The heap's low points.  Sampled regularly from the loop, as a board resetting under load
+//  is usually the heap running out, or getting too fragmented for a TLS buffer.
+class HeapStats
+{
+public:
+    static void Sample();
+    static void Reset();
+    static void PrintMetrics(Print& out);
+
+public:
+    static uint32_t min_free_heap;
+    static uint32_t min_max_free_block;
+    static uint8_t max_fragmentation;
+};
+
+// The stages of starting up, in the order they usually finish.
+enum BootPhase {
+  BOOT_FILESYSTEM,
+  BOOT_CLOCK_RESTORED,      // Clock set from the time saved before the reset
+  BOOT_CONFIG,
+  BOOT_SAMPLES,
+  BOOT_SERVING,             // Web server listening
+  BOOT_SETUP_DONE,
+  BOOT_WIFI,                // Connected, directly or by WiFiManager
+  BOOT_WIFI_FALLBACK,       // Gave up on the direct reconnect
+  BOOT_FIRST_SAMPLE,
+  BOOT_NTP_SYNC,
+  NUM_BOOT_PHASES
+};
+
+// When each stage of starting up finished, in milliseconds since the reset.  Each is only
+//  recorded the first time, so Mark() can be called from code that runs repeatedly.
+class BootTimes
+{
+public:
+    static void Mark(BootPhase phase);
+    static uint32_t Millis(BootPhase phase) { return phase_millis[phase]; }   // 0 if not reached
+    static void PrintAll(Print& out);
+    static void PrintMetrics(Print& out);
+
+private:
+    static uint32_t phase_millis[NUM_BOOT_PHASES];
+};
+
+extern PerfCounter perfSetSample;
+extern PerfCounter perfSamplesWrite;
+extern PerfCounter perfSamplesAppend;
+extern PerfCounter perfSamplesRead;
+extern PerfCounter perfConfigWrite;
+extern PerfCounter perfConfigRead;
+extern PerfCounter perfCloudPayload;
+extern PerfCounter perfCloudWrite;
+extern PerfCounter perfCloudPost;
+extern PerfCounter perfWebRoot;
+extern PerfCounter perfWebApi;
+extern PerfCounter perfWebConfigure;
+extern PerfCounter perfWebRootCert;
+extern PerfCounter perfWebTestCode;
+extern PerfCounter perfWebDir;
+extern PerfCounter perfWebPerf;
+extern PerfCounter perfWebMetrics;
+extern PerfCounter perfWebLog;
+extern PerfCounter perfWebEvents;
+extern PerfCounter perfWebStatic;
+extern PerfCounter perfWebNotFound;
+extern PerfCounter perfCloudRoundTrip;
+extern PerfCounter perfSensorRead;
+extern PerfCounter perfLoop;
+
+#endif // __PERF_STATS__
@@ -0,0 +1,74 @@
+#include "RecordFile.h"
+
+// ----------------------------------------------------------------------
+// Binary record reading and writing helper functions
+
+bool RecordFile::WriteRecord(File& file, uint8_t type, const void* payload, uint8_t length) {
+  if(length > MAX_PAYLOAD)
+    return false;
+
+  // Assemble the whole record first, so it goes to the file in a single write.
+  uint8_t record[MAX_PAYLOAD + 4];
+  record[0] = type;
+  record[1] = length;
+  memcpy(record + 2, payload, length);
+
+  uint16_t crc = Crc16(record, length + 2);
+  record[length + 2] = crc & 0xFF;
+  record[length + 3] = crc >> 8;
+
+  size_t size = RecordSize(length);
+  return file.write(record, size) == size;
+}
+
+bool RecordFile::ReadRecord(File& file, uint8_t& type, void* payload, uint8_t maxLength, uint8_t& length) {
+  uint8_t record[MAX_PAYLOAD + 4];
+
+  if(file.read(record, 2) != 2)
+    return false;
+
+  length = record[1];
+  if(length > MAX_PAYLOAD)
+    return false;
+
+  if(file.read(record + 2, length + 2) != (size_t)(length + 2))
+    return false;
+
+  uint16_t crc = record[length + 2] | (record[length + 3] << 8);
+  if(crc != Crc16(record, length + 2))
+    return false;
+
+  type = record[0];
+  memcpy(payload, record + 2, length < maxLength ? length : maxLength);
+  return true;
+}
+
+bool RecordFile::ParseRecord(const uint8_t* data, size_t size, size_t& offset, uint8_t& type,
+  const uint8_t*& payload, uint8_t& length) {
+  if(offset + 2 > size)
+    return false;
+
+  const uint8_t* record = data + offset;
+  length = record[1];
+  if(length > MAX_PAYLOAD || offset + RecordSize(length) > size)
+    return false;
+
+  uint16_t crc = record[length + 2] | (record[length + 3] << 8);
+  if(crc != Crc16(record, length + 2))
+    return false;
+
+  type = record[0];
+  payload = record + 2;
+  offset += RecordSize(length);
+  return true;
+}
+
+uint16_t RecordFile::Crc16(const uint8_t* data, size_t length, uint16_t crc) {
+  while(length--) {
+    crc ^= (uint16_t)(*data++) << 8;
+    for(int bit = 0; bit < 8; bit++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+  }
+  return crc;
+}
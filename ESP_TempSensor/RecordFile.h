@@ -0,0 +1,36 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+
+#ifndef __RECORD_FILE__
+#define __RECORD_FILE__
+
+// ----------------------------------------------------------------------
+// Binary record reading and writing helper functions
+//
+//  Each record is written as:  type (1 byte), length (1 byte), payload, CRC16 (2 bytes).
+//  The CRC covers the type, length and payload, so a record that was only partly
+//  written when the power went off can be detected, and everything after it ignored.
+
+class RecordFile {
+public:
+  static const uint8_t MAX_PAYLOAD = 250;
+
+  static bool WriteRecord(File& file, uint8_t type, const void* payload, uint8_t length);
+
+  // Reads the next record into payload (up to maxLength bytes).  Returns false at the
+  //  end of the file, or at a damaged or truncated record.
+  static bool ReadRecord(File& file, uint8_t& type, void* payload, uint8_t maxLength, uint8_t& length);
+
+  // As ReadRecord(), for a file already read into memory.  The record at offset is checked,
+  //  payload points into data, and offset moves on to the next record.
+  static bool ParseRecord(const uint8_t* data, size_t size, size_t& offset, uint8_t& type,
+    const uint8_t*& payload, uint8_t& length);
+
+  // The size a record takes up in the file.
+  static size_t RecordSize(uint8_t length) { return length + 4; }
+
+  // CRC-16/CCITT-FALSE
+  static uint16_t Crc16(const uint8_t* data, size_t length, uint16_t crc = 0xFFFF);
+};
+
+#endif // __RECORD_FILE__
@@ -0,0 +1,38 @@
+#include "ResponseCache.h"
+
+bool ResponseCache::Matches(const char* requestKey, uint32_t dataGeneration) const {
+  return valid && generation == dataGeneration && strcmp(key, requestKey) == 0;
+}
+
+void ResponseCache::Begin(const char* requestKey, uint32_t dataGeneration) {
+  strncpy(key, requestKey, MAX_KEY - 1);
+  key[MAX_KEY - 1] = '\0';
+  generation = dataGeneration;
+  used = 0;
+  valid = false;
+  overflowed = false;
+  capturing = true;
+}
+
+void ResponseCache::End() {
+  valid = capturing && !overflowed;
+  capturing = false;
+}
+
+size_t ResponseCache::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t ResponseCache::write(const uint8_t* data, size_t size) {
+  if(!capturing || overflowed)
+    return size;
+
+  if(used + size > BUFFER_SIZE) {
+    overflowed = true;
+    return size;
+  }
+
+  memcpy(buffer + used, data, size);
+  used += size;
+  return size;
+}
@@ -0,0 +1,50 @@
+#include <Arduino.h>
+
+#ifndef __RESPONSE_CACHE__
+#define __RESPONSE_CACHE__
+
+// ----------------------------------------------------------------------
+// Keeps the last response rendered for the data API, so repeat polls can be answered from it.
+//
+//  The readings only change when a sample is recorded, so a response stays good until the
+//  SampleBuffer's generation moves on.  The response is captured as it's streamed out (see
+//  ChunkedResponse::copyTo), into a fixed buffer.  Responses too big for the buffer aren't kept.
+
+class ResponseCache : public Print
+{
+public:
+    static const size_t BUFFER_SIZE = 4096;
+    static const size_t MAX_KEY = 32;
+
+    // True if the cached response was rendered for this key (the request's arguments),
+    //  at this generation.
+    bool Matches(const char* requestKey, uint32_t dataGeneration) const;
+
+    // Throws away the cached response, and starts capturing a new one.
+    void Begin(const char* requestKey, uint32_t dataGeneration);
+
+    // Finishes capturing.  The response is only kept if all of it fitted.
+    void End();
+
+    const char* Content() const { return buffer; }
+    size_t Length() const       { return used; }
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* data, size_t size) override;
+    using Print::write;
+
+public:
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+
+private:
+    char buffer[BUFFER_SIZE];
+    size_t used = 0;
+    bool capturing = false;
+    bool overflowed = false;
+    bool valid = false;
+    uint32_t generation = 0;
+    char key[MAX_KEY];
+};
+
+#endif // __RESPONSE_CACHE__
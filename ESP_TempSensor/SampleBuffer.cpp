@@ -1,106 +1,522 @@
 #include "SampleBuffer.h"
-#include "CsvHelpers.h"
+#include "RecordFile.h"
+#include "PerfStats.h"
+#include "EventLog.h"
 #include <LittleFS.h>
 
-const char DATA_FILE[] = "/avgs.csv";
-const char DATA_FILE_BACKUP[] = "/avgs.bkp";
+// The samples are kept in an append-only binary journal.  Each half hour only the changed
+//  slots are appended, and the whole buffer is only rewritten (compacted) once the appends
+//  grow past JOURNAL_APPEND_LIMIT, or when values are reset.
+const char JOURNAL_FILE[] = "/avgs.jnl";
+const char JOURNAL_FILE_TEMP[] = "/avgs.tmp";
+const size_t JOURNAL_APPEND_LIMIT = 4096 * SENSOR_CHANNELS;
+
+// Older firmware wrote a single day of samples as text.  Those can't be placed on the
+//  tiers' timeline, so only the current, min and max temperatures are carried over.
+const char LEGACY_DATA_FILE[] = "/avgs.csv";
+const char LEGACY_DATA_FILE_BACKUP[] = "/avgs.bkp";
+
+// Version 6 added the commit records, and version 5 the channel records.  A version 4
+//  journal is all channel 0.
+const uint8_t JOURNAL_VERSION = 6;
+const uint8_t JOURNAL_VERSION_UNCOMMITTED = 5;
+const uint8_t JOURNAL_VERSION_SINGLE_CHANNEL = 4;
+
+// The minute tier changes too often to be worth the flash wear.
+const bool TIER_PERSISTED[NUM_TIERS] = { false, true, true };
+
+enum JournalRecordType : uint8_t {
+  RECORD_HEADER = 1,
+  RECORD_TEMPS = 2,
+  RECORD_TIER = 4,
+  RECORD_TIER_SLOT = 5,
+  RECORD_CHANNEL = 6,     // The temps, tier and slot records after it are for this channel.
+  RECORD_COMMIT = 7,      // Ends each snapshot and append.  No payload.
+};
+
+struct __attribute__((packed)) JournalHeader {
+  uint8_t version;
+  uint8_t num_tiers;
+};
+
+struct __attribute__((packed)) JournalChannel {
+  uint8_t channel;
+};
+
+struct __attribute__((packed)) JournalTemps {
+  centi_t current_temp;
+  centi_t min_temp;
+  centi_t max_temp;
+};
+
+struct __attribute__((packed)) JournalTier {
+  uint8_t tier;
+  uint16_t capacity;
+  uint16_t head;
+  uint16_t filled;
+  int32_t current_period;
+  int32_t current_sum;
+  int64_t current_sum_sq;
+};
+
+struct __attribute__((packed)) JournalSlot {
+  uint8_t tier;
+  uint16_t position;
+  uint16_t count;
+  centi_t mean;
+  centi_t min;
+  centi_t max;
+  centi_t std_dev;
+};
+
+// The largest a freshly compacted journal can be.
+size_t journalSnapshotSize(const SampleTier* tiers) {
+  size_t size = RecordFile::RecordSize(sizeof(JournalHeader));
+  size_t channelSize = RecordFile::RecordSize(sizeof(JournalChannel)) + RecordFile::RecordSize(sizeof(JournalTemps));
+  int tier;
+  for(tier = 0; tier < NUM_TIERS; tier++) {
+    if(TIER_PERSISTED[tier]) {
+      channelSize += RecordFile::RecordSize(sizeof(JournalTier));
+      channelSize += tiers[tier].Capacity() * RecordFile::RecordSize(sizeof(JournalSlot));
+    }
+  }
+  return size + channelSize * SENSOR_CHANNELS + RecordFile::RecordSize(0);
+}
+
+bool writeChannelRecord(File& file, int channel) {
+  JournalChannel record = { (uint8_t)channel };
+  return RecordFile::WriteRecord(file, RECORD_CHANNEL, &record, sizeof(record));
+}
+
+bool writeCommitRecord(File& file) {
+  return RecordFile::WriteRecord(file, RECORD_COMMIT, NULL, 0);
+}
+
+// The length of the journal up to the end of its last whole snapshot or append, each of which
+//  ends with a commit record.  Older journals have no commit records, so every whole record
+//  in them counts.
+size_t committedLength(File& file) {
+  uint8_t payload[RecordFile::MAX_PAYLOAD];
+  uint8_t type;
+  uint8_t length;
+  bool hasCommits = false;
+  size_t committed = 0;
+  while(RecordFile::ReadRecord(file, type, payload, sizeof(payload), length)) {
+    if(type == RECORD_HEADER && length == sizeof(JournalHeader))
+      hasCommits = ((JournalHeader*)payload)->version > JOURNAL_VERSION_UNCOMMITTED;
+    if(!hasCommits || type == RECORD_COMMIT)
+      committed = file.position();
+  }
+  return committed;
+}
+
+// Days since 1970-01-01 for a calendar date.  (Howard Hinnant's days_from_civil)
+long daysFromCivil(int year, int month, int day) {
+  year -= month <= 2;
+  long era = (year >= 0 ? year : year - 399) / 400;
+  long yearOfEra = year - era * 400;
+  long dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+  long dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + dayOfEra - 719468;
+}
+
+SampleChannel::SampleChannel() :
+  tiers{
+    SampleTier(minute_means, minute_counts, MINUTE_TIER_SAMPLES, 1),
+    SampleTier(half_hour_means, half_hour_counts, half_hour_mins, half_hour_maxs, half_hour_std_devs,
+      HALF_HOUR_TIER_SAMPLES, MINUTES_PER_SAMPLE),
+    SampleTier(daily_means, daily_counts, daily_mins, daily_maxs, daily_std_devs,
+      DAILY_TIER_SAMPLES, MINUTES_PER_DAY)
+  }
+{
+}
+
+SampleBuffer::SampleBuffer() {
+  ClearAll();
+}
 
 void SampleBuffer::ClearAll() {
-    int i;
-    for(i=0; i<NUM_SAMPLES; i++) {
-    sample_average_counts[i] = 0;
-    sample_average_temps[i] = 0;
+  int channel, tier;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    for(tier = 0; tier < NUM_TIERS; tier++) {
+      channels[channel].tiers[tier].Clear();
     }
-    ResetMinMaxTemps();
+  }
+  ResetMinMaxTemps();
 }
 
 void SampleBuffer::ResetMinMaxTemps() {
-    min_temp = 50.0;
-    max_temp = 0.0;
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    channels[channel].min_temp = 50 * CENTIS_PER_DEGREE;
+    channels[channel].max_temp = 0;
+  }
+  generation++;
 }
 
-void SampleBuffer::WriteToFS() {
+long SampleBuffer::LocalMinutesNow() {
+  time_t timeNow = time(NULL);
+  struct tm *nowTime = localtime(&timeNow);
+  long days = daysFromCivil(nowTime->tm_year + 1900, nowTime->tm_mon + 1, nowTime->tm_mday);
+  return days * MINUTES_PER_DAY + nowTime->tm_hour * 60 + nowTime->tm_min;
+}
+
+// localtime() works through the timezone rules, so it's only called when the minute changes.
+//  Until then, a reading's minute is the one already worked out.
+long SampleBuffer::LocalMinutes(time_t now) {
+  if(now >= next_minute_time) {
+    local_minutes = LocalMinutesNow();
+    next_minute_time = now - now % 60 + 60;     // Timezones are whole minutes from UTC.
+  }
+  return local_minutes;
+}
+
+void SampleBuffer::TimezoneChanged() {
+  next_minute_time = 0;
+}
+
+void SampleBuffer::ClockRestored() {
+  int channel, tier;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    for(tier = 0; tier < NUM_TIERS; tier++) {
+      channels[channel].tiers[tier].SplitNext();
+    }
+  }
+}
 
-  if(LittleFS.exists(DATA_FILE)) {
-    LittleFS.remove(DATA_FILE_BACKUP);
-    LittleFS.rename(DATA_FILE, DATA_FILE_BACKUP);
+void SampleBuffer::ClockCorrected(long seconds) {
+  next_minute_time = 0;
+  if(first_local_minutes < 0)
+    return;     // Nothing recorded yet
+
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    SampleChannel& c = channels[channel];
+    if(c.last_sample_time != 0)
+      c.last_sample_time += seconds;
+
+    // A clock that was ahead is left to catch up, as the tiers don't go back over slots.  The
+    //  first reading since may have been put a slot later than its time, to keep it apart from
+    //  the slots loaded, so it's moved from there to where it belongs.
+    int tier;
+    for(tier = 0; tier < NUM_TIERS; tier++) {
+      SampleTier& t = c.tiers[tier];
+      long from = t.split_period;
+      long to = (first_local_minutes + seconds / 60) / t.minutes_per_sample;
+      if(from >= 0)
+        t.ShiftRecent(from, to - from);
+      t.split_next = false;
+      t.split_period = -1;
+    }
   }
+  if(last_sample_time != 0)
+    last_sample_time += seconds;
+  first_local_minutes += seconds / 60;
+  generation++;
+  WriteToFS();
+}
 
-  File file = LittleFS.open(DATA_FILE, "w");
-  CsvHelpers::writeFloat(file, current_temp);
-  CsvHelpers::writeFloat(file, min_temp);
-  CsvHelpers::writeFloat(file, max_temp);
-  
-  int i = 0;
-  for(i = 0; i < NUM_SAMPLES; i++) {
-    CsvHelpers::writeFloat(file, sample_average_temps[i]);
-    CsvHelpers::writeInt(file, sample_average_counts[i]);
+void SampleBuffer::WriteToFS() {
+  PerfTimer timer(perfSamplesWrite);
+
+  // Written to a temporary file, then renamed over the journal.  If the power goes off part
+  //  way through, the previous journal is still intact.
+  File file = LittleFS.open(JOURNAL_FILE_TEMP, "w");
+  if(!file) {
+    eventLog.Add(PSTR("SampleBuffer: failed to create journal"));
+    return;
   }
 
-  file.flush();
-  file.close(); 
+  JournalHeader header = { JOURNAL_VERSION, NUM_TIERS };
+  bool ok = RecordFile::WriteRecord(file, RECORD_HEADER, &header, sizeof(header));
+
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    ok = ok && writeChannelRecord(file, channel);
+    ok = ok && WriteTempsRecord(file, channel);
 
+    int tier;
+    for(tier = 0; tier < NUM_TIERS; tier++) {
+      if(!TIER_PERSISTED[tier])
+        continue;
+
+      ok = ok && WriteTierRecord(file, channel, (SampleTierId)tier);
+
+      // Only the slots in use need writing.  They're usually from position 0, but not once
+      //  ShiftRecent() has dropped older ones, so they're found by age.
+      const SampleTier& t = channels[channel].tiers[tier];
+      int age;
+      for(age = t.Filled() - 1; age >= 0; age--) {
+        ok = ok && WriteSlotRecord(file, channel, (SampleTierId)tier, t.Position(age));
+      }
+    }
+  }
+  ok = ok && writeCommitRecord(file);
+  file.close();
+
+  if(ok && LittleFS.rename(JOURNAL_FILE_TEMP, JOURNAL_FILE)) {
+    MarkSaved();
+  } else {
+    eventLog.Add(PSTR("SampleBuffer: failed to write journal"));
+    LittleFS.remove(JOURNAL_FILE_TEMP);
+  }
 }
 
-void SampleBuffer::ReadFromFS() { 
+void SampleBuffer::AppendToFS(bool newHalfHour, bool newDay) {
+  PerfTimer timer(perfSamplesAppend);
 
-  File file;
-  
-  if(LittleFS.exists(DATA_FILE)) {
-    file = LittleFS.open(DATA_FILE, "r");
-  } else if(LittleFS.exists(DATA_FILE_BACKUP)) {
-    file = LittleFS.open(DATA_FILE_BACKUP, "r");
-  } 
-
-  if(file) {
-    current_temp = file.parseFloat();  
-    min_temp = file.parseFloat();
-    max_temp = file.parseFloat();
-    
-    int i = 0;
-    for(i = 0; i < NUM_SAMPLES; i++) {
-      sample_average_temps[i] = file.parseFloat();
-      sample_average_counts[i] = file.parseInt();
+  // The slots that finished, any gaps left before them, and the ones replacing them.
+  SampleTierId changed[2] = { TIER_HALF_HOUR, TIER_DAILY };
+  bool isNew[2] = { newHalfHour, newDay };
+  size_t appendSize = 0;
+  int channel, i;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    for(i = 0; i < 2; i++) {
+      if(isNew[i])
+        appendSize += (UnsavedAges(channel, changed[i]) + 1) * RecordFile::RecordSize(sizeof(JournalSlot));
     }
+  }
+
+  File file = LittleFS.open(JOURNAL_FILE, "a");
+  if(!file || file.size() == 0 || file.size() + appendSize >= journalSnapshotSize(channels[0].tiers) + JOURNAL_APPEND_LIMIT) {
+    // Missing, or time to compact (e.g. after a long gap, there are many empty slots to
+    //  write).  Either way, start a fresh journal.
     file.close();
+    WriteToFS();
+    return;
+  }
+
+  bool ok = true;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    if(!HasReadings(channel))
+      continue;
+
+    ok = ok && writeChannelRecord(file, channel);
+    ok = ok && WriteTempsRecord(file, channel);
+
+    for(i = 0; i < 2; i++) {
+      if(!isNew[i])
+        continue;
+
+      const SampleTier& tier = channels[channel].tiers[changed[i]];
+      ok = ok && WriteTierRecord(file, channel, changed[i]);
+      int age;
+      for(age = UnsavedAges(channel, changed[i]); age >= 0; age--) {
+        ok = ok && WriteSlotRecord(file, channel, changed[i], tier.Position(age));
+      }
+    }
+  }
+  ok = ok && writeCommitRecord(file);
+  file.close();
+
+  if(ok) {
+    MarkSaved();
+  } else {
+    eventLog.Add(PSTR("SampleBuffer: failed to append to journal"));
   }
 }
 
-String SampleBuffer::GetTempSummary() {
-  char tempBuf[20];
-  sprintf_P(tempBuf, PSTR("Now: %0.1f C,  Min: %0.1f C,  Max: %0.1f C"), current_temp, min_temp, max_temp);
-  return String(tempBuf);
+// The oldest slot an append needs to write, by age.  Slots that have dropped off the end of
+//  the ring don't need writing.
+int SampleBuffer::UnsavedAges(int channel, SampleTierId tier) const {
+  const SampleTier& t = channels[channel].tiers[tier];
+  return min(t.unsaved_slots, t.Filled() - 1);
+}
+
+void SampleBuffer::MarkSaved() {
+  int channel, tier;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    for(tier = 0; tier < NUM_TIERS; tier++) {
+      channels[channel].tiers[tier].unsaved_slots = 0;
+    }
+  }
 }
 
-void SampleBuffer::SetSample(float value) 
+bool SampleBuffer::WriteTempsRecord(File& file, int channel) {
+  const SampleChannel& c = channels[channel];
+  JournalTemps temps = { c.current_temp, c.min_temp, c.max_temp };
+  return RecordFile::WriteRecord(file, RECORD_TEMPS, &temps, sizeof(temps));
+}
+
+bool SampleBuffer::WriteTierRecord(File& file, int channel, SampleTierId tier) {
+  const SampleTier& t = channels[channel].tiers[tier];
+  JournalTier record = { (uint8_t)tier, (uint16_t)t.capacity, (uint16_t)t.head, (uint16_t)t.filled, (int32_t)t.current_period,
+    t.current_sum, t.current_sum_sq };
+  return RecordFile::WriteRecord(file, RECORD_TIER, &record, sizeof(record));
+}
+
+bool SampleBuffer::WriteSlotRecord(File& file, int channel, SampleTierId tier, int position) {
+  const SampleTier& t = channels[channel].tiers[tier];
+  JournalSlot slot = { (uint8_t)tier, (uint16_t)position, t.counts[position], t.MeanAt(position), 0, 0, 0 };
+  if(t.HasStats()) {
+    slot.min = t.mins[position];
+    slot.max = t.maxs[position];
+    slot.std_dev = t.StdDevAt(position);
+  }
+  return RecordFile::WriteRecord(file, RECORD_TIER_SLOT, &slot, sizeof(slot));
+}
+
+void SampleBuffer::ReadFromFS() {
+  PerfTimer timer(perfSamplesRead);
+  generation++;
+
+  if(LittleFS.exists(JOURNAL_FILE)) {
+    if(!ReadJournal()) {
+      // Keep what was recovered, and drop the damaged tail, so later appends can be read back.
+      eventLog.Add(PSTR("SampleBuffer: journal damaged, compacting"));
+      WriteToFS();
+    }
+  } else if(ReadLegacyCsv()) {
+    WriteToFS();
+    LittleFS.remove(LEGACY_DATA_FILE);
+    LittleFS.remove(LEGACY_DATA_FILE_BACKUP);
+  }
+}
+
+// Replays each record in order, with later records replacing earlier ones.  An append the
+//  power went off part way through is left out as a whole, as replaying only some of its
+//  records would move a tier on without its new slot.  Returns false if anything after the
+//  last commit was left out.
+bool SampleBuffer::ReadJournal() {
+  File file = LittleFS.open(JOURNAL_FILE, "r");
+  if(!file)
+    return false;
+
+  size_t committed = committedLength(file);
+  file.seek(0);
+
+  uint8_t payload[RecordFile::MAX_PAYLOAD];
+  uint8_t type;
+  uint8_t length;
+  bool versionOk = false;
+  int channel = 0;
+
+  // A tier's slots are only used if its size matches this firmware's.
+  bool tierOk[SENSOR_CHANNELS][NUM_TIERS] = { { false } };
+
+  while(file.position() < committed && RecordFile::ReadRecord(file, type, payload, sizeof(payload), length)) {
+    if(type == RECORD_HEADER && length == sizeof(JournalHeader)) {
+      JournalHeader* header = (JournalHeader*)payload;
+      versionOk = header->version == JOURNAL_VERSION || header->version == JOURNAL_VERSION_UNCOMMITTED ||
+        header->version == JOURNAL_VERSION_SINGLE_CHANNEL;
+      channel = 0;
+    } else if(!versionOk) {
+      continue;   // Not a layout this firmware understands.
+    } else if(type == RECORD_CHANNEL && length == sizeof(JournalChannel)) {
+      channel = ((JournalChannel*)payload)->channel;
+    } else if(channel >= SENSOR_CHANNELS) {
+      continue;   // Built for more channels than this firmware keeps.
+    } else if(type == RECORD_TEMPS && length == sizeof(JournalTemps)) {
+      JournalTemps* temps = (JournalTemps*)payload;
+      channels[channel].current_temp = temps->current_temp;
+      channels[channel].min_temp = temps->min_temp;
+      channels[channel].max_temp = temps->max_temp;
+    } else if(type == RECORD_TIER && length == sizeof(JournalTier)) {
+      JournalTier* record = (JournalTier*)payload;
+      if(record->tier < NUM_TIERS) {
+        SampleTier& t = channels[channel].tiers[record->tier];
+        bool& ok = tierOk[channel][record->tier];
+        ok = record->capacity == t.capacity && record->head < t.capacity && record->filled <= t.capacity;
+        if(ok) {
+          t.head = record->head;
+          t.filled = record->filled;
+          t.StartPeriod(record->current_period);
+          t.current_sum = record->current_sum;
+          t.current_sum_sq = record->current_sum_sq;
+        }
+      }
+    } else if(type == RECORD_TIER_SLOT && length == sizeof(JournalSlot)) {
+      JournalSlot* slot = (JournalSlot*)payload;
+      if(slot->tier < NUM_TIERS && tierOk[channel][slot->tier] && slot->position < channels[channel].tiers[slot->tier].capacity) {
+        SampleTier& t = channels[channel].tiers[slot->tier];
+        t.means[slot->position] = slot->mean;
+        if(t.HasStats()) {
+          t.mins[slot->position] = slot->min;
+          t.maxs[slot->position] = slot->max;
+          t.std_devs[slot->position] = slot->std_dev;
+        }
+        t.counts[slot->position] = slot->count;
+      }
+    }
+  }
+
+  bool complete = committed == file.size();
+  file.close();
+  MarkSaved();
+  return complete;
+}
+
+bool SampleBuffer::ReadLegacyCsv() {
+  File file;
+
+  if(LittleFS.exists(LEGACY_DATA_FILE)) {
+    file = LittleFS.open(LEGACY_DATA_FILE, "r");
+  } else if(LittleFS.exists(LEGACY_DATA_FILE_BACKUP)) {
+    file = LittleFS.open(LEGACY_DATA_FILE_BACKUP, "r");
+  }
+
+  if(!file)
+    return false;
+
+  channels[0].current_temp = DegreesToCentis(file.parseFloat());
+  channels[0].min_temp = DegreesToCentis(file.parseFloat());
+  channels[0].max_temp = DegreesToCentis(file.parseFloat());
+  file.close();
+  return true;
+}
+
+void SampleBuffer::SetSample(int channel, centi_t value)
 {
-  current_temp = value;
+  if(channel < 0 || channel >= SENSOR_CHANNELS)
+    return;
+
+  PerfTimer timer(perfSetSample);
+  SampleChannel& c = channels[channel];
+  time_t now = time(NULL);
+  c.current_temp = value;
+  c.last_sample_time = now;
+  last_sample_time = now;
+  generation++;
 
   // Update min and max
-  if (current_temp < min_temp) 
-    min_temp = current_temp;
+  if (c.current_temp < c.min_temp)
+    c.min_temp = c.current_temp;
 
-  if (current_temp > max_temp) 
-    max_temp = current_temp;
+  if (c.current_temp > c.max_temp)
+    c.max_temp = c.current_temp;
 
-  // Calculate which sample timeslot we're in  
-  time_t timeNow = time(NULL);
-  struct tm *nowTime = localtime(&timeNow);
-  int nowSample = (nowTime->tm_hour * 60 + nowTime->tm_min) / MINUTES_PER_SAMPLE;
-  
-  // Update the sample record
-  if(nowSample != current_index)
+  // Each tier averages the readings for its own period, so there's no later pass
+  //  needed to downsample from one tier to the next.
+  long localMinutes = LocalMinutes(now);
+  if(first_local_minutes < 0)
+    first_local_minutes = localMinutes;
+  c.tiers[TIER_MINUTE].AddSample(localMinutes, value);
+  bool newHalfHour = c.tiers[TIER_HALF_HOUR].AddSample(localMinutes, value);
+  bool newDay = c.tiers[TIER_DAILY].AddSample(localMinutes, value);
+
+  pending_half_hour |= newHalfHour;
+  pending_day |= newDay;
+
+  if(onSampleRecorded)
   {
-    current_index = nowSample;
-    sample_average_temps[current_index] = current_temp;
-    sample_average_counts[current_index] = 1;
-    WriteToFS();
-    if(onSampleIndexChanged)
-      onSampleIndexChanged();
+    onSampleRecorded(channel);
   }
-  else
+}
+
+void SampleBuffer::FlushToFS()
+{
+  bool newHalfHour = pending_half_hour;
+  bool newDay = pending_day;
+  pending_half_hour = false;
+  pending_day = false;
+
+  if(newHalfHour || newDay)
+  {
+    AppendToFS(newHalfHour, newDay);
+  }
+
+  if(newHalfHour && onSampleIndexChanged)
   {
-    sample_average_temps[current_index] = ((sample_average_temps[current_index] * sample_average_counts[current_index]) + current_temp) / (sample_average_counts[current_index] + 1);
-    sample_average_counts[current_index]++;
+    onSampleIndexChanged();
   }
 }
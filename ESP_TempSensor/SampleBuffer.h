@@ -1,61 +1,161 @@
 #include <Arduino.h>
+#include <FS.h>
+#include "Temperature.h"
+#include "SampleTier.h"
 
 #ifndef _SENSOR_SAMPLES_
 #define _SENSOR_SAMPLES_
 
 // Samples per day determining minutes per sample.
 //  Because this is a slow moving temperature, 30 minute recorded "samples"
-//  should be enough.  
+//  should be enough for charting a day.  Finer and coarser tiers are kept as well.
 const int SAMPLES_PER_DAY = 48;
 const int MINUTES_PER_DAY = 24 * 60;
 const int MINUTES_PER_SAMPLE = MINUTES_PER_DAY / SAMPLES_PER_DAY;
 
-// Used to start the max/minimum recording.
-const float MIN_EXPECTED_TEMP = 0.0;
-const float MAX_EXPECTED_TEMP = 100;
+// Readings outside this range are treated as sensor errors.
+const centi_t MIN_EXPECTED_TEMP = 0 * CENTIS_PER_DEGREE;
+const centi_t MAX_EXPECTED_TEMP = 100 * CENTIS_PER_DEGREE;
 
-// Sample storage
-const int NUM_SAMPLES = SAMPLES_PER_DAY;
+// Sample storage.  Each tier is a fixed size ring buffer, so these decide how much RAM is used
+//  for history (4 bytes per minute slot, and 10 bytes for the half hour and daily slots, which
+//  also keep min, max and standard deviation).  They can be overridden with build flags.
+#ifndef MINUTE_TIER_SAMPLES
+#define MINUTE_TIER_SAMPLES 180                    // 3 hours of 1 minute averages
+#endif
+#ifndef HALF_HOUR_TIER_SAMPLES
+#define HALF_HOUR_TIER_SAMPLES (14 * SAMPLES_PER_DAY)  // 14 days of 30 minute averages
+#endif
+#ifndef DAILY_TIER_SAMPLES
+#define DAILY_TIER_SAMPLES 120                     // A season of daily averages
+#endif
+
+// Each DS1621 on the bus is a channel, numbered by its address (0x48 + channel), so a channel
+//  keeps its history when another sensor is added or removed.  Every channel has its own
+//  history, so this sets the RAM used along with the tier sizes above: about 9 KB a channel.
+//  One by default, as three (e.g. wort, ambient and fridge air) leave too little heap for a
+//  TLS post while a page is served.  See "Heap budget" in the README.
+#ifndef SENSOR_CHANNELS
+#define SENSOR_CHANNELS 1
+#endif
+
+enum SampleTierId {
+  TIER_MINUTE = 0,
+  TIER_HALF_HOUR,
+  TIER_DAILY,
+  NUM_TIERS
+};
+
+// ----------------------------------------------------------------------
+// One sensor's readings.  The storage for all of its tiers is kept together, so each
+//  channel's history is one contiguous block.
+
+struct SampleChannel
+{
+    SampleChannel();
+
+    // In hundredths of a degree.  See Temperature.h
+    centi_t min_temp = MAX_EXPECTED_TEMP;
+    centi_t max_temp = MIN_EXPECTED_TEMP;
+    centi_t current_temp = MIN_EXPECTED_TEMP;
+    time_t last_sample_time = 0;
+
+    centi_t minute_means[MINUTE_TIER_SAMPLES];
+    uint16_t minute_counts[MINUTE_TIER_SAMPLES];
+    centi_t half_hour_means[HALF_HOUR_TIER_SAMPLES];
+    uint16_t half_hour_counts[HALF_HOUR_TIER_SAMPLES];
+    centi_t half_hour_mins[HALF_HOUR_TIER_SAMPLES];
+    centi_t half_hour_maxs[HALF_HOUR_TIER_SAMPLES];
+    centi_t half_hour_std_devs[HALF_HOUR_TIER_SAMPLES];
+    centi_t daily_means[DAILY_TIER_SAMPLES];
+    uint16_t daily_counts[DAILY_TIER_SAMPLES];
+    centi_t daily_mins[DAILY_TIER_SAMPLES];
+    centi_t daily_maxs[DAILY_TIER_SAMPLES];
+    centi_t daily_std_devs[DAILY_TIER_SAMPLES];
+
+    SampleTier tiers[NUM_TIERS];
+};
 
 class SampleBuffer
 {
 public:
-    SampleBuffer() { ClearAll(); }
+    SampleBuffer();
 
-    // The sample index changes every MINUTES_PER_SAMPLE (30 minutes).  When that happens
-    //  the samples are written to the filesystem, and this callback fires.
+    // The half hour sample index changes every MINUTES_PER_SAMPLE (30 minutes).  When that happens
+    //  the changed samples are appended to the filesystem by FlushToFS(), and this callback fires.
     void OnSampleIndexChange(std::function<void()> sampleIndexChanged) { onSampleIndexChanged = sampleIndexChanged; }
-  
-private: 
-    int current_index = 0;
-    std::function<void()> onSampleIndexChanged;
 
-public:
-    float min_temp = MAX_EXPECTED_TEMP;
-    float max_temp = MIN_EXPECTED_TEMP;
-    float current_temp = MIN_EXPECTED_TEMP;
+    // Called for every reading recorded, with its channel.
+    void OnSampleRecorded(std::function<void(int)> sampleRecorded) { onSampleRecorded = sampleRecorded; }
+
+private:
+    std::function<void()> onSampleIndexChanged;
+    std::function<void(int)> onSampleRecorded;
+    bool pending_half_hour = false;   // Slots finished, but not yet appended to the filesystem
+    bool pending_day = false;
+    uint32_t generation = 0;
+    time_t last_sample_time = 0;
+    long local_minutes = 0;           // The local time's minute, as of the last reading
+    time_t next_minute_time = 0;      //  and when that changes
+    long first_local_minutes = -1;    // The first reading since startup
 
-    int sample_average_counts[NUM_SAMPLES];
-    float sample_average_temps[NUM_SAMPLES];
+    SampleChannel channels[SENSOR_CHANNELS];
 
 public:
     void ClearAll();         // Not persisted
     void ResetMinMaxTemps(); // Not persisted
 
-    // Record a new sensor reading.   If the sample index has moved onto the next "sample period"
-    //  then the current array of values is written to the filesystem, and the 
-    //  OnSampleIndexChanged callback is called.
-    void SetSample(float value);  
+    // Record a new sensor reading for a channel, in every tier.   If the half hour or daily tier
+    //  has moved onto its next "sample period", then the changed values are left for FlushToFS().
+    void SetSample(int channel, centi_t value);
 
-    // Reload sample from the filesystem
+    // Appends any slots finished since the last flush to the filesystem.  The OnSampleIndexChanged
+    //  callback is called if there was a new half hour.  Kept apart from SetSample(), so the
+    //  flash writes don't delay the reading.
+    void FlushToFS();
+
+    // Reload samples from the filesystem.  The minute tier isn't persisted.
     void ReadFromFS();
 
-    // The web server calls these, to present data
-    String GetTempSummary();
-    int GetCurrentSampleIndex() { return current_index; }
-    
-    // Called after resetting values, or clearing samples.
+    // The web server and cloud interface read the readings and history through these.
+    const SampleChannel& Channel(int channel) const { return channels[channel]; }
+    const SampleTier& GetTier(int channel, SampleTierId tier) const { return channels[channel].tiers[tier]; }
+    bool HasReadings(int channel) const { return channels[channel].last_sample_time != 0 || channels[channel].tiers[TIER_HALF_HOUR].Filled() > 0; }
+
+    // Changes whenever the readings do, so anything rendered from them can be cached until then.
+    uint32_t Generation() const { return generation; }
+    time_t LastSampleTime() const { return last_sample_time; }   // Of any channel
+
+    // Called after resetting values, or clearing samples.  Rewrites the whole journal.
     void WriteToFS();
+
+    // The local time now, in minutes since 1970.
+    static long LocalMinutesNow();
+
+    // To be called after the timezone is set, so readings use the new local time.  A slot
+    //  isn't split, or started again, when the clock goes back.
+    void TimezoneChanged();
+
+    // To be called at startup, after ReadFromFS(), when the clock was set from the time saved
+    //  before a reset rather than NTP.  The readings from then on start new slots, rather than
+    //  being added to the slots loaded, so they can be moved on their own when it's corrected.
+    void ClockRestored();
+
+    // To be called when the clock is found to have been out by seconds (positive if it was
+    //  behind) since startup.  The readings taken since ClockRestored() are moved to where they
+    //  belong, to the nearest slot, and the journal rewritten.
+    void ClockCorrected(long seconds);
+
+private:
+    long LocalMinutes(time_t now);
+    void AppendToFS(bool newHalfHour, bool newDay);
+    int UnsavedAges(int channel, SampleTierId tier) const;
+    void MarkSaved();
+    bool WriteTempsRecord(File& file, int channel);
+    bool WriteTierRecord(File& file, int channel, SampleTierId tier);
+    bool WriteSlotRecord(File& file, int channel, SampleTierId tier, int position);
+    bool ReadJournal();
+    bool ReadLegacyCsv();
 };
 
 #endif // _SENSOR_SAMPLES_
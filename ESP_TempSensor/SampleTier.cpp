@@ -0,0 +1,179 @@
+#include "SampleTier.h"
+
+SampleTier::SampleTier(centi_t* meanStorage, uint16_t* countStorage, int capacity, int minutesPerSample) :
+  means(meanStorage),
+  counts(countStorage),
+  capacity(capacity),
+  minutes_per_sample(minutesPerSample)
+{
+  Clear();
+}
+
+SampleTier::SampleTier(centi_t* meanStorage, uint16_t* countStorage,
+  centi_t* minStorage, centi_t* maxStorage, centi_t* stdDevStorage,
+  int capacity, int minutesPerSample) :
+  means(meanStorage),
+  counts(countStorage),
+  mins(minStorage),
+  maxs(maxStorage),
+  std_devs(stdDevStorage),
+  capacity(capacity),
+  minutes_per_sample(minutesPerSample)
+{
+  Clear();
+}
+
+void SampleTier::Clear() {
+  int i;
+  for(i = 0; i < capacity; i++) {
+    ClearSlot(i);
+  }
+  head = 0;
+  filled = 0;
+  StartPeriod(-1);
+  current_sum = 0;
+  current_sum_sq = 0;
+  unsaved_slots = 0;
+}
+
+void SampleTier::ClearSlot(int position) {
+  means[position] = 0;
+  counts[position] = 0;
+  if(HasStats()) {
+    mins[position] = 0;
+    maxs[position] = 0;
+    std_devs[position] = 0;
+  }
+}
+
+void SampleTier::CopySlot(int to, int from) {
+  means[to] = means[from];
+  counts[to] = counts[from];
+  if(HasStats()) {
+    mins[to] = mins[from];
+    maxs[to] = maxs[from];
+    std_devs[to] = std_devs[from];
+  }
+}
+
+void SampleTier::StartPeriod(long period) {
+  current_period = period;
+  next_start = (period + 1) * minutes_per_sample;
+}
+
+bool SampleTier::AddSample(long localMinutes, centi_t value) {
+  // Most readings are in the current slot, so that's a single comparison.
+  if(localMinutes < next_start && filled > 0 && !split_next) {
+    if(counts[head] < UINT16_MAX) {
+      current_sum += value;
+      counts[head]++;
+      if(HasStats()) {
+        current_sum_sq += (int32_t)value * value;
+        if(value < mins[head]) mins[head] = value;
+        if(value > maxs[head]) maxs[head] = value;
+      }
+    }
+    return false;
+  }
+
+  // Close off the current slot, then move onto the next, overwriting the oldest once the ring is full.
+  //  Any periods skipped over are left as empty slots, unless that's the whole ring.
+  long period = localMinutes / minutes_per_sample;
+  if(split_next) {
+    if(filled > 0 && period <= current_period)
+      period = current_period + 1;
+    split_next = false;
+    split_period = period;
+  }
+  if(filled > 0) {
+    means[head] = AverageCentis(current_sum, counts[head]);
+    if(HasStats()) {
+      std_devs[head] = CurrentStdDev();
+    }
+
+    long skipped = period - current_period - 1;
+    if(skipped >= capacity - 1) {
+      Clear();
+    } else {
+      unsaved_slots += skipped + 1;
+      for(; skipped > 0; skipped--) {
+        head = (head + 1) % capacity;
+        ClearSlot(head);
+        if(filled < capacity)
+          filled++;
+      }
+      head = (head + 1) % capacity;
+    }
+  }
+  if(filled < capacity) {
+    filled++;
+  }
+  StartPeriod(period);
+  current_sum = value;
+  means[head] = value;
+  counts[head] = 1;
+  if(HasStats()) {
+    current_sum_sq = (int32_t)value * value;
+    mins[head] = value;
+    maxs[head] = value;
+    std_devs[head] = 0;
+  }
+  return true;
+}
+
+void SampleTier::ShiftRecent(long fromPeriod, long periods) {
+  long recent = current_period - fromPeriod + 1;
+  if(filled == 0 || periods <= 0 || recent <= 0)
+    return;
+  if(recent > filled)
+    recent = filled;
+
+  if(recent + periods >= capacity) {
+    // Nothing from before the shifted slots is still in range, so the slots can stay where
+    //  they are, with the older ones dropped.
+    filled = recent;
+  } else {
+    // Newest first, so a slot is never overwritten before it's been moved.
+    int age;
+    for(age = 0; age < recent; age++) {
+      CopySlot((head + periods - age) % capacity, Position(age));
+    }
+    for(age = recent; age < recent + periods; age++) {
+      ClearSlot((head + periods - age + capacity) % capacity);
+    }
+    head = (head + periods) % capacity;
+    filled += periods;
+    if(filled > capacity)
+      filled = capacity;
+  }
+  StartPeriod(current_period + periods);
+}
+
+// Population standard deviation of the current slot, from
+//  variance = (n * sum(x^2) - sum(x)^2) / n^2, which is exact in integers.
+centi_t SampleTier::CurrentStdDev() const {
+  int64_t n = counts[head];
+  if(!HasStats() || n < 2)
+    return 0;
+
+  int64_t scaledVariance = n * current_sum_sq - (int64_t)current_sum * current_sum;
+  if(scaledVariance <= 0)
+    return 0;
+
+  // Integer square root, then divide by n, rounding to the nearest hundredth.
+  uint64_t value = scaledVariance;
+  uint64_t root = 0;
+  uint64_t bit = (uint64_t)1 << 62;
+  while(bit > value)
+    bit >>= 2;
+  while(bit != 0) {
+    if(value >= root + bit) {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    } else {
+      root >>= 1;
+    }
+    bit >>= 2;
+  }
+  return (centi_t)((root + n / 2) / n);
+}
@@ -0,0 +1,113 @@
+#include <Arduino.h>
+#include "Temperature.h"
+
+#ifndef _SAMPLE_TIER_
+#define _SAMPLE_TIER_
+
+// ----------------------------------------------------------------------
+// A ring buffer of average temperatures, at a single resolution (e.g. 1 minute, or 1 day).
+//
+//  The storage arrays are owned by the SampleBuffer, so the RAM used is fixed at compile time.
+//  Each reading is added to the current slot's sum, until the reading's time moves into
+//  the next period.  Then the current slot's mean is stored, and the oldest slot is reused
+//  for the new period.
+//
+//  Slots are always consecutive periods, so each slot's start time is known from its age.  If
+//  readings stop for a while (e.g. a power cut), the periods missed are kept as empty slots
+//  (a Count() of 0), which are gaps in the history rather than older data moved up to
+//  look recent.
+//
+//  Tiers can also keep each slot's minimum, maximum and standard deviation, to show short
+//  spikes that the mean hides.  These are accumulated as the readings arrive, using exact
+//  integer sums of the readings and their squares, so no readings need to be kept.
+
+class SampleTier
+{
+public:
+    SampleTier(centi_t* meanStorage, uint16_t* countStorage, int capacity, int minutesPerSample);
+
+    // As above, with storage for the per-slot statistics.
+    SampleTier(centi_t* meanStorage, uint16_t* countStorage,
+      centi_t* minStorage, centi_t* maxStorage, centi_t* stdDevStorage,
+      int capacity, int minutesPerSample);
+
+    void Clear();
+
+    // Add a reading taken at localMinutes (minutes since 1970, in local time).
+    //  Returns true if the reading started a new slot.  A reading from before the current
+    //  slot (the clock or timezone went back) is added to the current slot.
+    bool AddSample(long localMinutes, centi_t value);
+
+    // Moves the slots from fromPeriod on to periods later, leaving gaps before them.  Used
+    //  when the clock turns out to have been behind while they were recorded.
+    void ShiftRecent(long fromPeriod, long periods);
+
+    // The next reading starts a new slot, even if it's in the current slot's period (it then
+    //  goes in the period after), so the slots from there on can be moved by ShiftRecent()
+    //  without taking the readings before with them.
+    void SplitNext() { split_next = true; }
+    long SplitPeriod() const { return split_period; }   // Of the slot it started, or -1
+
+    int Capacity() const         { return capacity; }
+    int MinutesPerSample() const { return minutes_per_sample; }
+    int Filled() const           { return filled; }    // Slots holding data, up to Capacity()
+
+    // Slots are addressed by age: 0 is the current slot, 1 is the one before it, and so on,
+    //  up to Filled() - 1.
+    centi_t Mean(int age) const  { return MeanAt(Position(age)); }
+    int Count(int age) const     { return counts[Position(age)]; }
+    bool IsGap(int age) const    { return Count(age) == 0; }     // No readings in the period
+    float Average(int age) const { return CentisToDegrees(Mean(age)); }
+
+    // Only available when HasStats() is true.
+    bool HasStats() const         { return mins != NULL; }
+    centi_t Min(int age) const    { return mins[Position(age)]; }
+    centi_t Max(int age) const    { return maxs[Position(age)]; }
+    centi_t StdDev(int age) const { return StdDevAt(Position(age)); }
+
+    // The local time the slot started, in minutes since 1970.
+    long StartMinutes(int age) const { return (current_period - age) * minutes_per_sample; }
+
+private:
+    int Position(int age) const { return (head - age + capacity) % capacity; }
+    void StartPeriod(long period);
+    void ClearSlot(int position);
+    void CopySlot(int to, int from);
+
+    // The current slot's mean is only worked out when it's asked for.
+    centi_t MeanAt(int position) const {
+      return position == head ? AverageCentis(current_sum, counts[head]) : means[position];
+    }
+    centi_t StdDevAt(int position) const {
+      return position == head ? CurrentStdDev() : std_devs[position];
+    }
+    centi_t CurrentStdDev() const;
+
+    // Struct-of-arrays, so each slot costs 4 bytes, or 10 with statistics.
+    centi_t* means;
+    uint16_t* counts;
+    centi_t* mins = NULL;
+    centi_t* maxs = NULL;
+    centi_t* std_devs = NULL;
+    int capacity;
+    int minutes_per_sample;
+
+    int head = 0;               // Position of the current slot
+    int filled = 0;
+    long current_period = -1;   // localMinutes / minutes_per_sample of the current slot
+    long next_start = 0;        // localMinutes the next slot starts at
+    int32_t current_sum = 0;    // Exact sum of the current slot's readings
+    int64_t current_sum_sq = 0; //  and of their squares, when keeping statistics
+
+    // Slots finished since the SampleBuffer last saved the tier, counting any gaps left
+    //  between them, so it knows how many older slots to append.
+    int unsaved_slots = 0;
+
+    bool split_next = false;
+    long split_period = -1;
+
+    // The SampleBuffer saves and restores the tiers directly.
+    friend class SampleBuffer;
+};
+
+#endif // _SAMPLE_TIER_
@@ -1,51 +1,229 @@
 #include "SensorInterface.h"
+#include "PerfStats.h"
+#include "EventLog.h"
 #include <Wire.h>
 #include <time.h>
 
+static_assert(SENSOR_CHANNELS <= DS1621_MAX_SENSORS, "The DS1621 only has 8 addresses, so SENSOR_CHANNELS can't be more than 8");
+
+// Missing sensors are looked for again every this many readings (about 5 minutes), so one
+//  plugged in later is picked up without a restart.
+const int RESCAN_READINGS = 30;
+
+// DS1621 commands
+const uint8_t DS1621_READ_TEMPERATURE = 0xAA;
+const uint8_t DS1621_READ_COUNTER = 0xA8;       // COUNT_REMAIN
+const uint8_t DS1621_READ_SLOPE = 0xA9;         // COUNT_PER_C
+const uint8_t DS1621_ACCESS_CONFIG = 0xAC;
+const uint8_t DS1621_START_CONVERT = 0xEE;
+
+// Configuration register bits
+const uint8_t DS1621_CONFIG_DONE = 0x80;
+const uint8_t DS1621_CONFIG_ONE_SHOT = 0x01;
+
+// The datasheet's conversion time is 750ms at most.  A sensor that isn't done well after that
+//  is treated as not answering.
+const unsigned long CONVERSION_TIMEOUT = 1500;
+
+// The configuration register is EEPROM, and takes up to 10ms to write.
+const unsigned long CONFIG_WRITE_MILLIS = 10;
+
 void SensorInterface::Setup()
 {
   Wire.begin();
   Wire.setClock(400000);
 
-  Reset();
+  Scan();
+}
+
+void SensorInterface::Scan()
+{
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    uint8_t bit = 1 << channel;
+    if(present & bit)
+      continue;
+
+    if(Reset(channel)) {
+      present |= bit;
+      eventLog.Add(PSTR("Sensor found on channel %d (0x%02x)"), channel, Address(channel));
+    }
+  }
+  scans_due = RESCAN_READINGS;
+}
+
+// Sets the conversion mode, and in continuous mode, starts converting.  Returns false if no
+//  sensor answered at the channel's address.
+bool SensorInterface::Reset(int channel)
+{
+  uint8_t config;
+  if(!ReadRegister(channel, DS1621_ACCESS_CONFIG, &config, 1))
+    return false;
+
+  // Only written when it needs to change, to save wearing the EEPROM.
+  uint8_t wanted = SENSOR_HIGH_RESOLUTION ? DS1621_CONFIG_ONE_SHOT : 0;
+  if((config & DS1621_CONFIG_ONE_SHOT) != wanted) {
+    Wire.beginTransmission(Address(channel));
+    Wire.write(DS1621_ACCESS_CONFIG);
+    Wire.write(wanted);
+    if(Wire.endTransmission() != 0)
+      return false;
+    delay(CONFIG_WRITE_MILLIS);
+  }
+
+  return SENSOR_HIGH_RESOLUTION || StartConversion(channel);
+}
+
+bool SensorInterface::StartConversion(int channel)
+{
+  Wire.beginTransmission(Address(channel));
+  Wire.write(DS1621_START_CONVERT);
+  return Wire.endTransmission() == 0;
+}
+
+bool SensorInterface::ConversionDone(int channel)
+{
+  uint8_t config;
+  return ReadRegister(channel, DS1621_ACCESS_CONFIG, &config, 1) && (config & DS1621_CONFIG_DONE);
+}
+
+void SensorInterface::StartReading(SampleBuffer& samples)
+{
+  if(converting)
+    return;     // The last reading is still being collected.
+
+  if(--scans_due <= 0)
+    Scan();
+
+  if(!SENSOR_HIGH_RESOLUTION) {
+    RecordReadings(samples, present);
+    return;
+  }
+
+  // The sensors all convert at the same time.  One that won't start would only give the
+  //  last conversion's registers, so it's left out of this reading.
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    uint8_t bit = 1 << channel;
+    if(!(present & bit))
+      continue;
+    if(StartConversion(channel)) {
+      converting |= bit;
+    } else {
+      eventLog.Add(PSTR("Sensor on channel %d not answering"), channel);
+      present &= ~bit;     // Looked for again on the next scan.
+    }
+  }
+  conversion_start = millis();
 }
 
-void SensorInterface::Reset()
+void SensorInterface::Service(SampleBuffer& samples)
 {
-  // Assumes Initialise() has been called.
-  Wire.beginTransmission(DS1621_ADDRESS_1);
-  Wire.write(0xAC);                         // send configuration register address (Access Config)
-  Wire.write(0);                            // perform continuous conversion
-  Wire.beginTransmission(DS1621_ADDRESS_1); // send repeated start condition
-  Wire.write(0xEE);                         // send start temperature conversion command
-  Wire.endTransmission();                   // stop transmission and release the I2C 
+  if(!converting)
+    return;
+
+  bool timedOut = millis() - conversion_start >= CONVERSION_TIMEOUT;
+  uint8_t done = 0;
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    uint8_t bit = 1 << channel;
+    if(!(converting & bit))
+      continue;
+    if(ConversionDone(channel))
+      done |= bit;
+    else if(!timedOut)
+      return;     // Still converting.
+  }
+
+  // A sensor that never finished would only give the last conversion's registers again, so
+  //  it's left out of this reading.
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    uint8_t bit = 1 << channel;
+    if((converting & bit) && !(done & bit)) {
+      eventLog.Add(PSTR("Sensor on channel %d didn't finish converting"), channel);
+      present &= ~bit;     // Looked for again on the next scan.
+    }
+  }
+
+  converting = 0;
+  RecordReadings(samples, done);
 }
 
-void SensorInterface::RecordTemperature(SampleBuffer& samples)
+// All the sensors are read first, so the readings are as close together in time as the
+//  bus allows, and the sample buffer's work doesn't stretch the gap between them.
+void SensorInterface::RecordReadings(SampleBuffer& samples, uint8_t channels)
 {
-  float now_temp = ReadSensor();
-  if(now_temp < MIN_EXPECTED_TEMP || now_temp > MAX_EXPECTED_TEMP)
+  centi_t temps[SENSOR_CHANNELS];
+  uint8_t valid = 0;
+  int channel;
   {
-    Serial.println("Temp outside range.  Ignoring it.");
-    // Try and re-initialise the temp sensor.  It could have been disconnected and power-cycled,
-    //  so it needs to be configured to start conversions again.
-    Reset();
-  } else {
-    samples.SetSample(now_temp);
-  }
-}
-
-float SensorInterface::ReadSensor() {
-  float temp = 0;
-  Wire.beginTransmission(DS1621_ADDRESS_1); // connect to DS1621 (send DS1621 address)
-  Wire.write(0xAA);                       // read temperature command
-  Wire.endTransmission(false);            // send repeated start condition
-  Wire.requestFrom(DS1621_ADDRESS_1, static_cast<size_t>(2));  // request 2 bytes from DS1621 and release I2C bus at end of reading
-  uint8_t t_msb = Wire.read();            // read temperature MSB register
-  uint8_t t_lsb = Wire.read();            // read temperature LSB register
- 
-  temp = t_msb;
-  if(t_lsb)
-    temp += 0.5;
-  return temp;
+    PerfTimer timer(perfSensorRead);
+    for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+      if((channels & (1 << channel)) && ReadSensor(channel, temps[channel]))
+        valid |= 1 << channel;
+    }
+  }
+
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    uint8_t bit = 1 << channel;
+    if(!(channels & bit))
+      continue;
+
+    if(!(valid & bit)) {
+      eventLog.Add(PSTR("Sensor on channel %d not answering"), channel);
+      present &= ~bit;     // Looked for again on the next scan.
+    } else if(temps[channel] < MIN_EXPECTED_TEMP || temps[channel] > MAX_EXPECTED_TEMP) {
+      eventLog.Add(PSTR("Channel %d temp outside range (%0.2f C).  Ignoring it."), channel, CentisToDegrees(temps[channel]));
+      // Try and re-initialise the temp sensor.  It could have been disconnected and power-cycled,
+      //  so it needs to be configured again.
+      Reset(channel);
+    } else {
+      samples.SetSample(channel, temps[channel]);
+    }
+  }
+}
+
+// Sends a command, then reads the bytes it returns.
+bool SensorInterface::ReadRegister(int channel, uint8_t command, uint8_t* data, size_t length)
+{
+  byte address = Address(channel);
+  Wire.beginTransmission(address);        // connect to DS1621 (send DS1621 address)
+  Wire.write(command);
+  if(Wire.endTransmission(false) != 0)    // send repeated start condition
+    return false;
+  if(Wire.requestFrom(address, length) != length)  // request the bytes, and release I2C bus at end of reading
+    return false;
+  size_t i;
+  for(i = 0; i < length; i++)
+    data[i] = Wire.read();
+  return true;
+}
+
+// Gets hundredths of a degree.  The temperature register's MSB is whole degrees (two's
+//  complement), and the top bit of the LSB is the half degree.
+bool SensorInterface::ReadSensor(int channel, centi_t& temp) {
+  uint8_t t[2];
+  if(!ReadRegister(channel, DS1621_READ_TEMPERATURE, t, 2))
+    return false;
+
+  if(SENSOR_HIGH_RESOLUTION) {
+    uint8_t countRemain, countPerC;
+    if(!ReadRegister(channel, DS1621_READ_COUNTER, &countRemain, 1) ||
+      !ReadRegister(channel, DS1621_READ_SLOPE, &countPerC, 1))
+      return false;
+    if(countPerC != 0) {
+      temp = HighResolutionCentis(t[0], countRemain, countPerC);
+      return true;
+    }
+  }
+
+  temp = (int8_t)t[0] * CENTIS_PER_DEGREE;
+  if(t[1] & 0x80)
+    temp += CENTIS_PER_DEGREE / 2;
+  return true;
+}
+
+centi_t SensorInterface::HighResolutionCentis(uint8_t tempMsb, uint8_t countRemain, uint8_t countPerC) {
+  int32_t counted = ((int32_t)countPerC - countRemain) * CENTIS_PER_DEGREE;
+  return (centi_t)((int8_t)tempMsb * CENTIS_PER_DEGREE - CENTIS_PER_DEGREE / 4 + AverageCentis(counted, countPerC));
 }
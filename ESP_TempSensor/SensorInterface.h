@@ -1,16 +1,60 @@
 #include <Arduino.h>
 #include "SampleBuffer.h"
 
-const byte DS1621_ADDRESS_1 = 0x48;  // All address pins on the IC connect to ground, results in this being the I2C address.
+// A DS1621's address is 0x48 plus its three address pins (A2 A1 A0).  Channel n is the sensor
+//  with those pins set to n, so with all three grounded it's channel 0.
+const byte DS1621_BASE_ADDRESS = 0x48;
+const int DS1621_MAX_SENSORS = 8;
+
+// In high resolution mode, each reading is a one-shot conversion, and the DS1621's counter
+//  registers give about 1/16 C, rather than the 0.5 C steps of its temperature register.
+//  The conversion takes up to a second, so it's started by StartReading(), and collected
+//  by Service() once done.  Otherwise the sensors convert continuously, and StartReading()
+//  reads them straight away.
+#ifndef SENSOR_HIGH_RESOLUTION
+#define SENSOR_HIGH_RESOLUTION 1
+#endif
+
+// ----------------------------------------------------------------------
+// The DS1621 temperature sensors on the I2C bus.
 
 class SensorInterface
 {
 public:
     void Setup();
-    void Reset();
 
-    void RecordTemperature(SampleBuffer& samples);
+    // Looks for a sensor on each channel's address, and sets up the ones found.
+    void Scan();
+
+    // Starts a reading of every sensor found.  The readings are recorded together, once
+    //  they're all available.
+    void StartReading(SampleBuffer& samples);
+
+    // To be called frequently (every 100ms or so).  Records the readings once the sensors
+    //  have finished converting, or after a timeout, those that have.  Doesn't wait on the
+    //  sensors.
+    void Service(SampleBuffer& samples);
+
+    bool Converting() const   { return converting != 0; }
+    uint8_t PresentMask() const { return present; }   // Bit n set when channel n answered
+
+    // Hundredths of a degree from the registers read in high resolution mode:
+    //  TEMP_READ - 0.25 + (COUNT_PER_C - COUNT_REMAIN) / COUNT_PER_C, where TEMP_READ is the
+    //  temperature register's whole degrees.
+    static centi_t HighResolutionCentis(uint8_t tempMsb, uint8_t countRemain, uint8_t countPerC);
 
 private:
-    float ReadSensor();
+    bool Reset(int channel);
+    bool StartConversion(int channel);
+    bool ConversionDone(int channel);
+    bool ReadSensor(int channel, centi_t& temp);
+    bool ReadRegister(int channel, uint8_t command, uint8_t* data, size_t length);
+    void RecordReadings(SampleBuffer& samples, uint8_t channels);
+
+    static byte Address(int channel) { return DS1621_BASE_ADDRESS + channel; }
+
+    uint8_t present = 0;
+    uint8_t converting = 0;         // Channels with a one-shot conversion in progress
+    unsigned long conversion_start = 0;
+    int scans_due = 0;              // Readings until missing sensors are looked for again
 };
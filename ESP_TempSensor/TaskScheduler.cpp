@@ -0,0 +1,102 @@
+#include "TaskScheduler.h"
+#include "TextFormat.h"
+
+// For the /perf table, which is in microseconds.  A task hours late shows as the most it can.
+unsigned clampedMicros(uint64_t micros) {
+  return micros > UINT32_MAX ? UINT32_MAX : (unsigned)micros;
+}
+
+bool TaskScheduler::Add(const char* name, unsigned long periodMillis, std::function<void()> task) {
+  if(task_count >= MAX_TASKS)
+    return false;
+
+  Task& t = tasks[task_count++];
+  t.name = name;
+  t.period_millis = periodMillis;
+  t.run = task;
+  t.next_due = millis();
+  t.runs = 0;
+  t.overruns = 0;
+  t.total_late_micros = 0;
+  t.max_late_micros = 0;
+  t.max_run_micros = 0;
+  return true;
+}
+
+void TaskScheduler::Run() {
+  int i;
+  for(i = 0; i < task_count; i++) {
+    Task& t = tasks[i];
+    unsigned long now = millis();
+    long late = (long)(now - t.next_due);
+    if(late < 0)
+      continue;
+
+    uint64_t lateMicros = (uint64_t)late * 1000;
+    t.total_late_micros += lateMicros;
+    if(lateMicros > t.max_late_micros)
+      t.max_late_micros = lateMicros;
+
+    uint32_t startMicros = micros();
+    t.run();
+    uint32_t runMicros = micros() - startMicros;
+    t.runs++;
+
+    if(runMicros > t.max_run_micros)
+      t.max_run_micros = runMicros;
+
+    // Keep to the original deadlines, unless a whole period was missed.  Then start
+    //  again from now, rather than running the task several times to catch up.
+    t.next_due += t.period_millis;
+    if((unsigned long)late >= t.period_millis || runMicros / 1000 >= t.period_millis) {
+      t.overruns++;
+      if((long)(millis() - t.next_due) >= 0)
+        t.next_due = millis() + t.period_millis;
+    }
+  }
+}
+
+void TaskScheduler::PrintStats(Print& out) {
+  PrintFormat(out, PSTR("%-16s %8s %8s %10s %12s %12s %10s\n"), "task", "period", "runs", "overruns", "avg late us", "max late us", "max run us");
+  int i;
+  for(i = 0; i < task_count; i++) {
+    Task& t = tasks[i];
+    uint64_t avgLate = t.runs ? t.total_late_micros / t.runs : 0;
+    PrintFormat(out, PSTR("%-16s %8u %8u %10u %12u %12u %10u\n"), t.name,
+      (unsigned)t.period_millis, (unsigned)t.runs, (unsigned)t.overruns,
+      clampedMicros(avgLate), clampedMicros(t.max_late_micros), (unsigned)t.max_run_micros);
+  }
+}
+
+void TaskScheduler::PrintMetrics(Print& out) {
+  out.print(F("# TYPE brewmon_task_runs_total counter\n"));
+  int i;
+  for(i = 0; i < task_count; i++)
+    PrintFormat(out, PSTR("brewmon_task_runs_total{task=\"%s\"} %u\n"), tasks[i].name, (unsigned)tasks[i].runs);
+  out.print(F("# TYPE brewmon_task_overruns_total counter\n"));
+  for(i = 0; i < task_count; i++)
+    PrintFormat(out, PSTR("brewmon_task_overruns_total{task=\"%s\"} %u\n"), tasks[i].name, (unsigned)tasks[i].overruns);
+  out.print(F("# TYPE brewmon_task_late_seconds_total counter\n"));
+  for(i = 0; i < task_count; i++)
+    PrintFormat(out, PSTR("brewmon_task_late_seconds_total{task=\"%s\"} %u.%06u\n"), tasks[i].name,
+      (unsigned)(tasks[i].total_late_micros / 1000000), (unsigned)(tasks[i].total_late_micros % 1000000));
+  out.print(F("# TYPE brewmon_task_late_max_seconds gauge\n"));
+  for(i = 0; i < task_count; i++)
+    PrintFormat(out, PSTR("brewmon_task_late_max_seconds{task=\"%s\"} %u.%06u\n"), tasks[i].name,
+      (unsigned)(tasks[i].max_late_micros / 1000000), (unsigned)(tasks[i].max_late_micros % 1000000));
+  out.print(F("# TYPE brewmon_task_run_max_seconds gauge\n"));
+  for(i = 0; i < task_count; i++)
+    PrintFormat(out, PSTR("brewmon_task_run_max_seconds{task=\"%s\"} %u.%06u\n"), tasks[i].name,
+      (unsigned)(tasks[i].max_run_micros / 1000000), (unsigned)(tasks[i].max_run_micros % 1000000));
+}
+
+void TaskScheduler::ResetStats() {
+  int i;
+  for(i = 0; i < task_count; i++) {
+    tasks[i].runs = 0;
+    tasks[i].overruns = 0;
+    tasks[i].total_late_micros = 0;
+    tasks[i].max_late_micros = 0;
+    tasks[i].max_run_micros = 0;
+  }
+}
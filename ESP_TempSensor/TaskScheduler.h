@@ -0,0 +1,48 @@
+#include <Arduino.h>
+
+#ifndef __TASK_SCHEDULER__
+#define __TASK_SCHEDULER__
+
+// ----------------------------------------------------------------------
+// A small cooperative scheduler for periodic tasks.
+//
+//  Each task has a fixed period, and its next deadline is worked out from the previous
+//  deadline (not from when it actually ran), so the cadence doesn't drift with the time other
+//  work takes.  Tasks must return quickly; anything slow needs to be split into steps.
+//
+//  Lateness (jitter) and overruns are recorded per task, to show whether the loop keeps up.
+
+class TaskScheduler
+{
+public:
+    static const int MAX_TASKS = 10;
+
+    // Returns false if there's no room for another task.
+    bool Add(const char* name, unsigned long periodMillis, std::function<void()> task);
+
+    // To be called in the main loop.  Runs each task that is due.
+    void Run();
+
+    void PrintStats(Print& out);
+    void PrintMetrics(Print& out);     // Prometheus text
+    void ResetStats();
+
+private:
+    struct Task {
+      const char* name;
+      unsigned long period_millis;
+      std::function<void()> run;
+      unsigned long next_due;
+
+      uint32_t runs;
+      uint32_t overruns;          // Ran longer than its period, or missed a whole period.
+      uint64_t total_late_micros;   // Would wrap after 71 minutes as 32 bits
+      uint64_t max_late_micros;
+      uint32_t max_run_micros;
+    };
+
+    Task tasks[MAX_TASKS];
+    int task_count = 0;
+};
+
+#endif // __TASK_SCHEDULER__
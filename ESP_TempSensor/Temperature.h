@@ -0,0 +1,34 @@
+#include <Arduino.h>
+
+#ifndef _TEMPERATURE_
+#define _TEMPERATURE_
+
+// ----------------------------------------------------------------------
+// Temperatures are held as whole hundredths of a degree C (fixed point), so sums and
+//  averages are exact integer arithmetic.  The ESP8266 has no FPU, so floats are only
+//  used at the edges, when temperatures are displayed or entered.
+//
+//  The DS1621's 0.5 C steps are exact multiples of 50, its high resolution readings are
+//  rounded to the nearest hundredth, and int16_t covers +/-327 C.
+
+typedef int16_t centi_t;
+
+const int16_t CENTIS_PER_DEGREE = 100;
+
+inline float CentisToDegrees(int32_t centis) {
+  return centis / (float)CENTIS_PER_DEGREE;
+}
+
+inline centi_t DegreesToCentis(float degrees) {
+  return (centi_t)lroundf(degrees * CENTIS_PER_DEGREE);
+}
+
+// Rounded to the nearest hundredth, rather than truncated towards zero.
+inline centi_t AverageCentis(int32_t sum, uint16_t count) {
+  if(count == 0)
+    return 0;
+  int32_t half = count / 2;
+  return (centi_t)((sum >= 0 ? sum + half : sum - half) / count);
+}
+
+#endif // _TEMPERATURE_
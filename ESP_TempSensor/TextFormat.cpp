@@ -0,0 +1,15 @@
+#include "TextFormat.h"
+#include <stdarg.h>
+
+size_t PrintFormat(Print& out, PGM_P format, ...) {
+  char buffer[FORMAT_BUFFER_SIZE];
+  va_list args;
+  va_start(args, format);
+  int length = vsnprintf_P(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  if(length <= 0)
+    return 0;
+  if((size_t)length >= sizeof(buffer))
+    length = sizeof(buffer) - 1;
+  return out.write((const uint8_t*)buffer, length);
+}
@@ -0,0 +1,59 @@
+#include <Arduino.h>
+
+#ifndef __TEXT_FORMAT__
+#define __TEXT_FORMAT__
+
+// ----------------------------------------------------------------------
+// Text building without the heap.
+//
+//  Arduino's String reallocates as it grows, and Print::printf_P() allocates for anything
+//  longer than 64 characters, which fragments the heap over weeks of running.  Instead, text
+//  is printed straight to where it's going (a ChunkedResponse, a file), or into a FixedString
+//  when it has to be kept.
+
+// As printf_P(), formatting into a stack buffer.  Output longer than FORMAT_BUFFER_SIZE - 1
+//  characters is cut short, so longer text is printed in several calls.
+const size_t FORMAT_BUFFER_SIZE = 256;
+size_t PrintFormat(Print& out, PGM_P format, ...) __attribute__((format(printf, 2, 3)));
+
+// A string in a fixed size array, built up with print() and PrintFormat() like any Print.
+//  Anything beyond the capacity is dropped (and Overflowed() says so), rather than allocated.
+template<size_t CAPACITY>
+class FixedString : public Print
+{
+public:
+    FixedString() { clear(); }
+
+    size_t write(uint8_t c) override {
+      return write(&c, 1);
+    }
+
+    size_t write(const uint8_t* buffer, size_t size) override {
+      if(size > CAPACITY - 1 - used) {
+        size = CAPACITY - 1 - used;
+        overflowed = true;
+      }
+      memcpy(text + used, buffer, size);
+      used += size;
+      text[used] = 0;
+      return size;
+    }
+    using Print::write;
+
+    void clear() {
+      used = 0;
+      text[0] = 0;
+      overflowed = false;
+    }
+
+    const char* c_str() const { return text; }
+    size_t length() const     { return used; }
+    bool Overflowed() const   { return overflowed; }
+
+private:
+    char text[CAPACITY];
+    size_t used;
+    bool overflowed;
+};
+
+#endif // __TEXT_FORMAT__
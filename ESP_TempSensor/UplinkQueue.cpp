@@ -0,0 +1,196 @@
+#include "UplinkQueue.h"
+#include "RecordFile.h"
+#include "EventLog.h"
+
+const char QUEUE_FILE[] = "/uplink.q";
+const char QUEUE_FILE_TEMP[] = "/uplink.tmp";
+const char QUEUE_HEAD_FILE[] = "/uplink.hd";
+
+const uint8_t RECORD_READING = 1;
+const uint8_t RECORD_HEAD = 2;
+
+const size_t READING_RECORD_SIZE = RecordFile::RecordSize(sizeof(UplinkReading));
+
+// Readings queued by older firmware are shorter: without the channel, or the finished interval.
+const uint8_t SINGLE_CHANNEL_READING_SIZE = offsetof(UplinkReading, channel);
+const uint8_t CURRENT_ONLY_READING_SIZE = offsetof(UplinkReading, mean_value);
+
+// Fills in the fields missing from the older, shorter records.
+void upgradeReading(UplinkReading& reading, uint8_t length) {
+  if(length <= SINGLE_CHANNEL_READING_SIZE)
+    reading.channel = 0;
+  if(length <= CURRENT_ONLY_READING_SIZE) {
+    reading.mean_value = reading.value;
+    reading.count = 0;
+  }
+}
+
+bool readReading(File& file, UplinkReading& reading) {
+  uint8_t type;
+  uint8_t length;
+  if(!RecordFile::ReadRecord(file, type, &reading, sizeof(reading), length))
+    return false;
+  upgradeReading(reading, length);
+  return true;
+}
+
+// Sent readings are only cleared out of the file once this many bytes of them build up.
+const uint32_t COMPACT_AFTER = (UplinkQueue::MAX_QUEUED / 4) * READING_RECORD_SIZE;
+
+void UplinkQueue::Begin() {
+  head = 0;
+  count = 0;
+  last_timestamp = 0;
+  last_channel = -1;
+
+  File headFile = LittleFS.open(QUEUE_HEAD_FILE, "r");
+  if(headFile) {
+    uint8_t type;
+    uint8_t length;
+    uint32_t savedHead;
+    if(RecordFile::ReadRecord(headFile, type, &savedHead, sizeof(savedHead), length) &&
+      type == RECORD_HEAD && length == sizeof(savedHead)) {
+      head = savedHead;
+    }
+    headFile.close();
+  }
+
+  File file = LittleFS.open(QUEUE_FILE, "r");
+  if(!file) {
+    head = 0;
+    return;
+  }
+
+  if(head > file.size() || (head % READING_RECORD_SIZE) != 0)
+    head = 0;
+
+  // Count what's left to send.  A reading cut short by a power failure ends the queue.
+  file.seek(head);
+  UplinkReading reading;
+  uint8_t type;
+  uint8_t length;
+  bool shortRecords = false;
+  size_t end = head;
+  while(RecordFile::ReadRecord(file, type, &reading, sizeof(reading), length)) {
+    count++;
+    shortRecords |= length != sizeof(reading);
+    upgradeReading(reading, length);
+    last_timestamp = reading.timestamp;
+    last_channel = reading.channel;
+    end = file.position();
+  }
+  // Anything after the last whole reading has to go, or the readings queued after it
+  //  couldn't be read back.
+  bool damaged = end != file.size();
+  file.close();
+
+  // Older readings are rewritten at the current size, as the offsets assume it.
+  if(damaged || shortRecords || count == 0) {
+    Compact();
+  }
+}
+
+bool UplinkQueue::Push(const UplinkReading& reading) {
+  if(reading.timestamp < last_timestamp ||
+    (reading.timestamp == last_timestamp && (int)reading.channel <= last_channel))
+    return false;
+
+  File file = LittleFS.open(QUEUE_FILE, "a");
+  if(!file || !RecordFile::WriteRecord(file, RECORD_READING, &reading, sizeof(reading))) {
+    eventLog.Add(PSTR("UplinkQueue: failed to queue reading"));
+    return false;
+  }
+  file.close();
+
+  last_timestamp = reading.timestamp;
+  last_channel = reading.channel;
+  count++;
+  pushed++;
+  if(count > MAX_QUEUED) {
+    Pop(1);
+  }
+  return true;
+}
+
+int UplinkQueue::Peek(UplinkReading* readings, int maxCount) {
+  File file = LittleFS.open(QUEUE_FILE, "r");
+  if(!file)
+    return 0;
+
+  file.seek(head);
+  int found = 0;
+  while(found < maxCount && found < count && readReading(file, readings[found])) {
+    found++;
+  }
+  file.close();
+  return found;
+}
+
+void UplinkQueue::Pop(int popCount) {
+  if(popCount > count)
+    popCount = count;
+
+  head += popCount * READING_RECORD_SIZE;
+  count -= popCount;
+
+  if(count == 0 || head >= COMPACT_AFTER) {
+    Compact();
+  } else {
+    SaveHead();
+  }
+}
+
+void UplinkQueue::SaveHead() {
+  File file = LittleFS.open(QUEUE_HEAD_FILE, "w");
+  RecordFile::WriteRecord(file, RECORD_HEAD, &head, sizeof(head));
+  file.close();
+}
+
+void UplinkQueue::Retime(long seconds) {
+  // The newest readings are the ones queued since, less any already sent.
+  int retimeCount = min(pushed, count);
+  if(retimeCount > 0)
+    Compact(retimeCount, seconds);
+  pushed = 0;
+}
+
+// Copies the unsent readings to the start of a new file, moving the timestamps of the newest
+//  retimeCount by seconds.  The new file only replaces the queue if all of it was written,
+//  so a full filesystem or a power cut part way through leaves the queue as it was.
+void UplinkQueue::Compact(int retimeCount, long seconds) {
+  if(count == 0) {
+    LittleFS.remove(QUEUE_FILE);
+  } else {
+    File source = LittleFS.open(QUEUE_FILE, "r");
+    File dest = LittleFS.open(QUEUE_FILE_TEMP, "w");
+    bool ok = source && dest;
+    if(ok)
+      source.seek(head);
+
+    int copied = 0;
+    uint32_t lastTimestamp = last_timestamp;
+    UplinkReading reading;
+    while(ok && copied < count && readReading(source, reading)) {
+      if(copied >= count - retimeCount) {
+        reading.timestamp += seconds;
+        lastTimestamp = reading.timestamp;
+      }
+      ok = RecordFile::WriteRecord(dest, RECORD_READING, &reading, sizeof(reading));
+      copied++;
+    }
+    source.close();
+    dest.close();
+
+    if(!ok || !LittleFS.rename(QUEUE_FILE_TEMP, QUEUE_FILE)) {
+      eventLog.Add(PSTR("UplinkQueue: failed to compact queue"));
+      LittleFS.remove(QUEUE_FILE_TEMP);
+      SaveHead();
+      return;
+    }
+    count = copied;
+    last_timestamp = lastTimestamp;
+  }
+
+  head = 0;
+  SaveHead();
+}
@@ -0,0 +1,66 @@
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "Temperature.h"
+
+#ifndef __UPLINK_QUEUE__
+#define __UPLINK_QUEUE__
+
+// A reading waiting to be sent to the cloud: the latest reading, and the interval (half hour)
+//  that just finished.  Fields are only ever added at the end, so the shorter records queued
+//  by older firmware still load.
+struct __attribute__((packed)) UplinkReading {
+  uint32_t timestamp;     // With the channel, identifies the reading, so the server can ignore repeats.
+  centi_t value;          // The latest reading
+  centi_t min_value;      // The finished interval's minimum
+  centi_t max_value;      //  and maximum
+  uint8_t channel;        // 0 for readings queued before there were channels.
+  centi_t mean_value;     // The finished interval's mean
+  uint16_t count;         // Readings in the finished interval.  0 if there's no interval (a gap,
+                          //  or queued by older firmware), and only value is meaningful.
+};
+
+// ----------------------------------------------------------------------
+// Readings waiting to be posted to the cloud, kept in flash so they survive outages and reboots.
+//
+//  Readings are appended to the queue file as CRC protected records (see RecordFile).  The
+//  position of the oldest unsent reading is kept in a second small file, so sending a batch
+//  only rewrites a few bytes.  When the queue is full, the oldest reading is dropped.
+
+class UplinkQueue
+{
+public:
+    static const int MAX_QUEUED = 1000;     // About 3 weeks of half hourly readings.
+
+    // Finds the unsent readings left from before a reboot.
+    void Begin();
+
+    // Adds a reading to the end of the queue.  Readings that aren't newer than the last one
+    //  queued (or, at the same time, for a later channel) are ignored, so a reading is never
+    //  sent twice.
+    bool Push(const UplinkReading& reading);
+
+    // Copies up to maxCount of the oldest readings, without removing them.
+    int Peek(UplinkReading* readings, int maxCount);
+
+    // Removes the oldest count readings, once they have been sent.
+    void Pop(int count);
+
+    int Count() const { return count; }
+
+    // Adds seconds to the timestamps of the readings queued since startup, for when the clock
+    //  they were taken with turns out to have been wrong.  Those left from before the reboot
+    //  were taken with the clock as it was then, so they're left alone.
+    void Retime(long seconds);
+
+private:
+    void SaveHead();
+    void Compact(int retimeCount = 0, long seconds = 0);
+
+    uint32_t head = 0;      // File offset of the oldest unsent reading
+    int count = 0;
+    uint32_t last_timestamp = 0;
+    int last_channel = -1;
+    int pushed = 0;         // Readings queued since startup (not reset by Begin())
+};
+
+#endif // __UPLINK_QUEUE__
@@ -0,0 +1,91 @@
+#include "WiFiFastConnect.h"
+#include "RecordFile.h"
+#include "PerfStats.h"
+#include "EventLog.h"
+#include <ESP8266WiFi.h>
+#include <LittleFS.h>
+
+const char WIFI_FILE[] = "/wifi.bin";
+const uint8_t RECORD_WIFI = 1;
+
+// A direct connection, and DHCP, usually take well under a second.  Long enough for a slow
+//  access point, while not holding up the WiFiManager flow for long if it's gone.
+const unsigned long FAST_CONNECT_TIMEOUT = 3000;
+
+// The address DHCP gave out used to be saved here too.  A file from then is the wrong length,
+//  so it's ignored, and rewritten after the WiFiManager flow.
+struct SavedWiFi {
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint8_t reserved;
+};
+
+bool readSavedWiFi(SavedWiFi& saved) {
+  File file = LittleFS.open(WIFI_FILE, "r");
+  if(!file)
+    return false;
+
+  uint8_t type;
+  uint8_t length;
+  bool ok = RecordFile::ReadRecord(file, type, &saved, sizeof(saved), length) && type == RECORD_WIFI && length == sizeof(saved);
+  file.close();
+  return ok;
+}
+
+bool WiFiFastConnect::Begin() {
+  SavedWiFi saved;
+  String ssid = WiFi.SSID();
+  if(ssid.length() == 0 || !readSavedWiFi(saved) || saved.channel == 0)
+    return false;
+
+  // The credentials are already stored, so don't have begin() write them to flash again.
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+  WiFi.begin(ssid.c_str(), WiFi.psk().c_str(), saved.channel, saved.bssid);
+  state = FAST_CONNECTING;
+  start_millis = millis();
+  return true;
+}
+
+bool WiFiFastConnect::Service() {
+  if(state != FAST_CONNECTING)
+    return false;
+
+  if(WiFi.status() == WL_CONNECTED) {
+    state = FAST_CONNECTED;
+    BootTimes::Mark(BOOT_WIFI);
+    eventLog.Add(PSTR("WiFi reconnected directly in %lums"), millis() - start_millis);
+    return false;
+  }
+
+  if(millis() - start_millis < FAST_CONNECT_TIMEOUT)
+    return false;
+
+  // Back to a scan.  The saved details are rewritten once that connects.
+  state = FAST_FAILED;
+  WiFi.disconnect();
+  WiFi.persistent(true);
+  LittleFS.remove(WIFI_FILE);
+  BootTimes::Mark(BOOT_WIFI_FALLBACK);
+  eventLog.Add(PSTR("WiFi direct reconnect failed, using WiFiManager"));
+  return true;
+}
+
+// Only written when something changed, which is rarely, to spare the flash.
+void WiFiFastConnect::Save() {
+  if(WiFi.status() != WL_CONNECTED)
+    return;
+
+  SavedWiFi current = {};
+  memcpy(current.bssid, WiFi.BSSID(), sizeof(current.bssid));
+  current.channel = WiFi.channel();
+
+  SavedWiFi saved;
+  if(readSavedWiFi(saved) && memcmp(&saved, &current, sizeof(saved)) == 0)
+    return;
+
+  File file = LittleFS.open(WIFI_FILE, "w");
+  if(!file || !RecordFile::WriteRecord(file, RECORD_WIFI, &current, sizeof(current)))
+    eventLog.Add(PSTR("WiFiFastConnect: failed to save the connection"));
+  file.close();
+}
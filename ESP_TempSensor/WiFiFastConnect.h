@@ -0,0 +1,47 @@
+#include <Arduino.h>
+
+#ifndef __WIFI_FAST_CONNECT__
+#define __WIFI_FAST_CONNECT__
+
+// ----------------------------------------------------------------------
+// Reconnects to the last access point without a scan.
+//
+//  Once connected, the access point's BSSID and channel are saved to flash.  At the next boot,
+//  Begin() joins that access point directly, using the credentials the SDK keeps, which skips
+//  the seconds a scan takes.  The address still comes from DHCP, as a saved one could have
+//  been given to another device once its lease ran out.  It doesn't wait for the connection,
+//  so setup carries on and the web server is listening before WiFi is up.
+//
+//  If the access point has moved, or the connection isn't made in time, Service() says so, the
+//  saved details are dropped, and the full WiFiManager flow should be run instead.
+
+class WiFiFastConnect
+{
+public:
+    // Starts connecting with the saved details.  Returns false if there are none, and the
+    //  full WiFiManager flow is needed.
+    bool Begin();
+
+    // To be called frequently while Connecting().  Returns true, once, if the connection
+    //  wasn't made.
+    bool Service();
+
+    // Saves the details of the current connection, if they've changed.
+    void Save();
+
+    bool Connecting() const { return state == FAST_CONNECTING; }
+    bool Connected() const  { return state == FAST_CONNECTED; }
+
+private:
+    enum State {
+      FAST_IDLE,
+      FAST_CONNECTING,
+      FAST_CONNECTED,
+      FAST_FAILED
+    };
+
+    State state = FAST_IDLE;
+    unsigned long start_millis = 0;
+};
+
+#endif // __WIFI_FAST_CONNECT__
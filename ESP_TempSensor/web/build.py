@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Builds the web files for the device's flash filesystem.
+
+The page, stylesheet and Chart.js are gzipped into ../data, which the "LittleFS Data Upload"
+tool (or an OTA filesystem update) puts on the device.  The device sends them as they are,
+with Content-Encoding: gzip, so it never compresses anything itself.
+
+Everything except the page gets a versioned name (Chart.js by release, the stylesheet by a
+hash of its content), so browsers can cache them for good.  The page refers to them as
+{{style.css}} and {{chart.js}}.
+
+Chart.js is downloaded once, into .cache, so the page needs no internet access afterwards.
+"""
+import gzip
+import hashlib
+import pathlib
+import shutil
+import urllib.request
+
+CHART_JS_VERSION = "4.4.1"
+CHART_JS_URL = "https://cdn.jsdelivr.net/npm/chart.js@%s/dist/chart.umd.js" % CHART_JS_VERSION
+
+WEB_DIR = pathlib.Path(__file__).resolve().parent
+CACHE_DIR = WEB_DIR / ".cache"
+DATA_DIR = WEB_DIR.parent / "data"
+STATIC_DIR = DATA_DIR / "static"
+
+
+def write_gzipped(data, path):
+    # mtime=0 keeps the output the same for the same input.
+    with open(path, "wb") as f:
+        with gzip.GzipFile(filename="", mode="wb", fileobj=f, compresslevel=9, mtime=0) as gz:
+            gz.write(data)
+    print("%-32s %7d -> %6d bytes" % (path.relative_to(DATA_DIR), len(data), path.stat().st_size))
+
+
+def chart_js():
+    cached = CACHE_DIR / ("chart-%s.js" % CHART_JS_VERSION)
+    if not cached.exists():
+        CACHE_DIR.mkdir(exist_ok=True)
+        print("Downloading " + CHART_JS_URL)
+        with urllib.request.urlopen(CHART_JS_URL) as response:
+            cached.write_bytes(response.read())
+    return cached.read_bytes()
+
+
+def main():
+    # Old versions of the files would otherwise pile up in the filesystem image.
+    shutil.rmtree(STATIC_DIR, ignore_errors=True)
+    STATIC_DIR.mkdir(parents=True)
+
+    style = (WEB_DIR / "style.css").read_bytes()
+    names = {
+        "chart.js": "chart-%s.js" % CHART_JS_VERSION,
+        "style.css": "style-%s.css" % hashlib.sha1(style).hexdigest()[:8],
+    }
+    write_gzipped(chart_js(), STATIC_DIR / (names["chart.js"] + ".gz"))
+    write_gzipped(style, STATIC_DIR / (names["style.css"] + ".gz"))
+
+    page = (WEB_DIR / "index.html").read_text()
+    for placeholder, name in names.items():
+        page = page.replace("{{%s}}" % placeholder, "/static/" + name)
+    write_gzipped(page.encode(), DATA_DIR / "index.html.gz")
+
+
+if __name__ == "__main__":
+    main()
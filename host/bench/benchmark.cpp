@@ -0,0 +1,251 @@
+// Times the sample buffer's hot path and its journal, the web pages and a post to the cloud, on
+//  the host, and counts the heap they use.  Once running, none of them should allocate: the
+//  benchmark fails if a reading, a page or a post does.
+//
+//  The host is much faster than an 80 MHz ESP8266, so the times are for comparing builds of
+//  the firmware with each other, not for reading as a board's.  The allocation counts and the
+//  bytes written to flash are the same as on a board.  The buffers LittleFS allocates for each
+//  file opened are the core's, so they're in the peak, but not counted as allocations.
+
+#include <DeviceWebServer.h>
+#include <CloudInterface.h>
+#include <PerfStats.h>
+#include <LittleFS.h>
+#include <HostHeap.h>
+#include <HostHttpServer.h>
+#include <chrono>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+const unsigned long SAMPLE_INTERVAL_MILLIS = 10000;
+const int DAYS = 14;
+const int REPEATS = 20;
+
+// Outlives the cloud interface, which keeps its connection open.
+HostHttpServer server("cloud.example");
+
+DeviceConfig config;
+SampleBuffer samples;
+SampleBuffer restored;
+DeviceWebServer webServer(config, samples);
+CloudInterface cloud;
+
+// Any allocations made where none should be, by name.
+std::vector<std::string> allocating;
+
+uint32_t noise = 12345;
+
+// A slow daily swing around 20 degrees, and a little sensor noise.
+centi_t reading(int channel) {
+  noise = noise * 1103515245 + 12345;
+  double hours = (HostClock::WorldMillis() / 1000 % 86400) / 3600.0;
+  return (centi_t)(2000 + channel * 150 + 200 * sin(hours * PI / 12) + (int)(noise >> 16) % 25);
+}
+
+long nanosSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct Result {
+  const char* name;
+  long calls;
+  double total_nanos;
+  long max_nanos;
+  HostHeap::Stats heap;
+  uint32_t bytes_written;
+};
+
+void print(const Result& r) {
+  printf("%-22s %7ld calls %10.0f ns/call (max %7ld ns) %5u allocations %6u bytes peak %7u bytes written/call\n",
+    r.name, r.calls, r.total_nanos / r.calls, r.max_nanos,
+    (unsigned)r.heap.allocations, (unsigned)(r.heap.peak_bytes - HostHeap::LiveBytes()),
+    (unsigned)(r.calls ? r.bytes_written / r.calls : 0));
+  if(r.heap.allocations > 0)
+    allocating.push_back(r.name);
+}
+
+// The allocations since HostHeap::Reset(), less the files opened since opened.
+uint32_t allocationsSince(uint32_t opened) {
+  return HostHeap::Get().allocations - (LittleFS.files_opened - opened);
+}
+
+// Readings every 10 seconds on every channel, for two weeks, appending to the journal as each
+//  half hour finishes, as the main loop does.
+void benchmarkSampling() {
+  Result setSample = { "SetSample", 0, 0, 0, {}, 0 };
+  Result flush = { "FlushToFS (append)", 0, 0, 0, {}, 0 };
+  HostHeap::Stats setSampleHeap = {};
+
+  long readings = DAYS * 24L * 3600 * 1000 / SAMPLE_INTERVAL_MILLIS;
+  long i;
+  for(i = 0; i < readings; i++) {
+    HostClock::Advance(SAMPLE_INTERVAL_MILLIS);
+
+    int channel;
+    for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+      centi_t value = reading(channel);
+      uint32_t opened = LittleFS.files_opened;
+      HostHeap::Reset();
+      auto start = std::chrono::steady_clock::now();
+      samples.SetSample(channel, value);
+      long nanos = nanosSince(start);
+      HostHeap::Stats heap = HostHeap::Get();
+      setSampleHeap.allocations += allocationsSince(opened);
+      setSampleHeap.peak_bytes = std::max(setSampleHeap.peak_bytes, heap.peak_bytes);
+      setSample.calls++;
+      setSample.total_nanos += nanos;
+      setSample.max_nanos = std::max(setSample.max_nanos, nanos);
+    }
+
+    uint32_t written = LittleFS.bytes_written;
+    uint32_t appends = perfSamplesAppend.calls;
+    uint32_t opened = LittleFS.files_opened;
+    HostHeap::Reset();
+    auto start = std::chrono::steady_clock::now();
+    samples.FlushToFS();
+    long nanos = nanosSince(start);
+    if(perfSamplesAppend.calls != appends) {
+      HostHeap::Stats heap = HostHeap::Get();
+      flush.heap.allocations += allocationsSince(opened);
+      flush.heap.peak_bytes = std::max(flush.heap.peak_bytes, heap.peak_bytes);
+      flush.calls++;
+      flush.total_nanos += nanos;
+      flush.max_nanos = std::max(flush.max_nanos, nanos);
+      flush.bytes_written += LittleFS.bytes_written - written;
+    }
+  }
+
+  setSample.heap = setSampleHeap;
+  print(setSample);
+  print(flush);
+}
+
+// f() timed, after prepare() each time, which isn't.
+template<typename F, typename P> void benchmarkRepeated(const char* name, F f, P prepare) {
+  Result result = { name, 0, 0, 0, {}, 0 };
+  int i;
+  for(i = 0; i < REPEATS; i++) {
+    prepare();
+    uint32_t written = LittleFS.bytes_written;
+    uint32_t opened = LittleFS.files_opened;
+    HostHeap::Reset();
+    auto start = std::chrono::steady_clock::now();
+    f();
+    long nanos = nanosSince(start);
+    HostHeap::Stats heap = HostHeap::Get();
+    result.heap.allocations += allocationsSince(opened);
+    result.heap.peak_bytes = std::max(result.heap.peak_bytes, heap.peak_bytes);
+    result.calls++;
+    result.total_nanos += nanos;
+    result.max_nanos = std::max(result.max_nanos, nanos);
+    result.bytes_written += LittleFS.bytes_written - written;
+  }
+  print(result);
+}
+
+template<typename F> void benchmarkRepeated(const char* name, F f) {
+  benchmarkRepeated(name, f, []() {});
+}
+
+// A new reading before each request, so the pages are rendered each time rather than coming
+//  from the response cache, or answered with a 304.
+void benchmarkPages() {
+  const char* pages[][2] = {
+    { "Page /", "/" },
+    { "Page /configure", "/configure" },
+    { "Page /perf", "/perf" },
+    { "Page /metrics", "/metrics" },
+    { "Page /log", "/log" },
+    { "Page /api/samples", "/api/samples?tier=halfhour&points=336" },
+    { "Page /api/samples.csv", "/api/samples.csv?tier=daily" },
+  };
+  auto newReading = []() {
+    HostClock::Advance(SAMPLE_INTERVAL_MILLIS);
+    samples.SetSample(0, reading(0));
+  };
+
+  LittleFS.SetContents("/index.html.gz", std::vector<uint8_t>(20000, 'x'));
+  webServer.Setup();
+  ESP8266WebServer* web = ESP8266WebServer::Instance();
+  for(const auto& page : pages) {
+    const char* uri = page[1];
+    web->Request(HTTP_GET, uri);     // The first time, to find the page's checksum
+    benchmarkRepeated(page[0], [web, uri]() { web->Request(HTTP_GET, uri); }, newReading);
+  }
+}
+
+// A half hour's reading queued before each post, which goes out on the connection kept open
+//  from the last.  The first post makes the connection, so isn't counted: the TLS client's
+//  buffers are allocated by the core for each new connection.
+void benchmarkPost() {
+  server.keep_alive_millis = 2 * MINUTES_PER_SAMPLE * 60000UL;
+  LittleFS.SetContents(CloudInterface::ROOT_CERT_FILE, server.CertificatePem().c_str());
+  config.cloudLoggingUrl = "https://cloud.example/readings";
+  config.cloudLoggingApiKey = "test-api-key";
+  cloud.Setup();
+  samples.OnSampleIndexChange([]() { cloud.QueueReading(samples); });
+
+  auto nextHalfHour = []() {
+    int i;
+    for(i = 0; i < MINUTES_PER_SAMPLE; i++) {
+      HostClock::Advance(60000);
+      samples.SetSample(0, reading(0));
+      samples.FlushToFS();
+    }
+  };
+  auto post = []() {
+    unsigned long start = millis();
+    while(cloud.QueuedCount() > 0 && millis() - start < 60000) {
+      cloud.Service(config);
+      delay(10);
+    }
+  };
+  nextHalfHour();
+  post();
+  int connections = server.connections;
+  benchmarkRepeated("Post (kept open)", post, nextHalfHour);
+  if(server.connections != connections || server.requests.size() != REPEATS + 1u)
+    printf("Posts made %d new connection(s), and %u requests\n", server.connections - connections, (unsigned)server.requests.size());
+  samples.OnSampleIndexChange(nullptr);
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+
+  printf("%d channel(s), %d days of readings every %lu s\n", SENSOR_CHANNELS, DAYS, SAMPLE_INTERVAL_MILLIS / 1000);
+  benchmarkSampling();
+
+  benchmarkRepeated("WriteToFS", []() { samples.WriteToFS(); });
+  printf("%-22s %7u bytes\n", "Journal size", (unsigned)LittleFS.Contents("/avgs.jnl").size());
+  benchmarkRepeated("ReadFromFS", []() { restored.ReadFromFS(); });
+
+  // The journal is only worth timing if it reads back as it was written.
+  int mismatches = 0;
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    const SampleTier& a = samples.GetTier(channel, TIER_HALF_HOUR);
+    const SampleTier& b = restored.GetTier(channel, TIER_HALF_HOUR);
+    int age;
+    if(a.Filled() != b.Filled())
+      mismatches++;
+    for(age = 0; age < a.Filled() && age < b.Filled(); age++) {
+      if(a.Mean(age) != b.Mean(age) || a.Count(age) != b.Count(age))
+        mismatches++;
+    }
+  }
+  if(mismatches > 0)
+    printf("ReadFromFS restored %d half hour slot(s) differently\n", mismatches);
+
+  benchmarkPages();
+  benchmarkPost();
+
+  for(const std::string& name : allocating)
+    printf("%s allocated\n", name.c_str());
+  return mismatches == 0 && allocating.empty() ? 0 : 1;
+}
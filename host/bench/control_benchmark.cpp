@@ -0,0 +1,149 @@
+// Runs each kind of heater control on a simulated fermenter in a fridge (support/ThermalModel.h),
+//  and reports how well it holds the temperature: the overshoot warming up from cold, the RMS
+//  error once settled, and how often it cycles the relay.
+//
+//  Fails if the relay is ever switched sooner than the minimum on or off time allows.
+
+#include <ControlEngine.h>
+#include <LittleFS.h>
+#include <ThermalModel.h>
+#include <climits>
+#include <math.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+const unsigned long READING_INTERVAL_MILLIS = 10000;
+const unsigned long MILLIS_PER_HOUR = 3600 * 1000UL;
+const unsigned long SETTLE_HOURS = 24;        // Left out of the RMS error and the cycle count
+const int DAYS = 4;
+const float START_TEMP = 12;
+
+struct Result {
+  float overshoot = 0;
+  double squared_error = 0;
+  long settled_seconds = 0;
+  uint32_t cycles = 0;
+  long heater_seconds = 0;
+  unsigned long shortest_on = ULONG_MAX;
+  unsigned long shortest_off = ULONG_MAX;
+};
+
+// Runs from cold for the given hours, a second at a time, with a reading every 10 seconds,
+//  as the main loop does.  Measures from the end of the settling time.
+Result run(DeviceConfig& config, ControlEngine& engine, ThermalModel& model, float target, unsigned long hours) {
+  Result result;
+  unsigned long start = millis();
+  unsigned long settled = start + SETTLE_HOURS * MILLIS_PER_HOUR;
+  unsigned long lastSwitch = start;
+  bool on = engine.HeaterOn();
+
+  while(millis() - start < hours * MILLIS_PER_HOUR) {
+    HostClock::Advance(1000);
+    model.Step(on, 1, HostClock::WorldMillis());
+    if(millis() % READING_INTERVAL_MILLIS == 0)
+      engine.Reading(model.SensorTemp());
+
+    if(engine.Update() != on) {
+      unsigned long held = millis() - lastSwitch;
+      if(on)
+        result.shortest_on = std::min(result.shortest_on, held);
+      else if(lastSwitch != start)
+        result.shortest_off = std::min(result.shortest_off, held);
+      on = !on;
+      lastSwitch = millis();
+      if(on && (long)(millis() - settled) >= 0)
+        result.cycles++;
+    }
+
+    float error = model.MassTemp() - target;
+    result.overshoot = std::max(result.overshoot, error);
+    if((long)(millis() - settled) >= 0) {
+      result.squared_error += error * error;
+      result.settled_seconds++;
+      if(on)
+        result.heater_seconds++;
+    }
+  }
+  return result;
+}
+
+bool report(const char* name, const DeviceConfig& config, const Result& r) {
+  float settledDays = r.settled_seconds / 86400.0;
+  printf("%-20s %6.2f C %9.3f C %12.1f %10.0f%%\n", name, r.overshoot, sqrt(r.squared_error / r.settled_seconds),
+    r.cycles / settledDays, 100.0 * r.heater_seconds / r.settled_seconds);
+
+  bool ok = true;
+  if(r.shortest_on < config.min_on_seconds * 1000UL || r.shortest_off < config.min_off_seconds * 1000UL) {
+    printf("%s: relay held on for only %lu s, or off for %lu s\n", name, r.shortest_on / 1000, r.shortest_off / 1000);
+    ok = false;
+  }
+  return ok;
+}
+
+bool benchmarkHysteresis() {
+  DeviceConfig config;
+  config.control_mode = CONTROL_HYSTERESIS;
+  ControlEngine engine(config);
+  ThermalModel model;
+  model.Reset(START_TEMP);
+  float target = (config.relay_on_below_temp + config.relay_off_above_temp) / 2;
+  return report("Hysteresis", config, run(config, engine, model, target, DAYS * 24));
+}
+
+bool benchmarkPid() {
+  DeviceConfig config;
+  config.control_mode = CONTROL_PID;
+  ControlEngine engine(config);
+  ThermalModel model;
+  model.Reset(START_TEMP);
+  return report("PID, default gains", config, run(config, engine, model, config.control_setpoint, DAYS * 24));
+}
+
+// Autotuned from cold, and then measured with the gains it found, so its overshoot is from
+//  where the autotune left it rather than from cold.
+bool benchmarkAutotunedPid() {
+  DeviceConfig config;
+  config.control_mode = CONTROL_PID;
+  ControlEngine engine(config);
+  ThermalModel model;
+  model.Reset(START_TEMP);
+
+  float defaultKp = config.pid_kp;
+  engine.Update();
+  engine.StartAutotune();
+  unsigned long start = millis();
+  while(config.pid_kp == defaultKp && millis() - start < 48 * MILLIS_PER_HOUR) {
+    HostClock::Advance(1000);
+    model.Step(engine.HeaterOn(), 1, HostClock::WorldMillis());
+    if(millis() % READING_INTERVAL_MILLIS == 0)
+      engine.Reading(model.SensorTemp());
+    engine.Update();
+  }
+  if(config.pid_kp == defaultKp) {
+    printf("Autotune didn't finish\n");
+    return false;
+  }
+  printf("Autotuned in %lu minutes: Kp %0.4f, Ki %0.6f, Kd %0.2f\n", (millis() - start) / 60000,
+    config.pid_kp, config.pid_ki, config.pid_kd);
+  return report("PID, autotuned", config, run(config, engine, model, config.control_setpoint, DAYS * 24));
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+
+  ThermalModel::Parameters room;
+  printf("A fermenter starting at %0.1f C, in a room of %0.1f +/- %0.1f C over the day, for %d days\n",
+    START_TEMP, room.room_mean, room.room_swing, DAYS);
+  printf("%-20s %8s %11s %12s %11s\n", "", "overshoot", "RMS error", "cycles/day", "heater on");
+
+  bool ok = benchmarkHysteresis();
+  ok = benchmarkPid() && ok;
+  ok = benchmarkAutotunedPid() && ok;
+  return ok ? 0 : 1;
+}
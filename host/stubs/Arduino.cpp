@@ -0,0 +1,576 @@
+#include "Arduino.h"
+#include "HostHeap.h"
+#include "coredecls.h"
+#include <sys/time.h>
+extern "C" {
+#include "user_interface.h"
+}
+
+HardwareSerial Serial;
+EspClass ESP;
+
+namespace {
+
+uint64_t worldMicros = 0;           // The real time, since 1970
+uint64_t bootMicros = 0;            // Since the board's last reset
+bool clockSet = false;
+int64_t clockOffsetMicros = 0;      // The board's time is bootMicros plus this, once set
+uint64_t rtcMicros = 0;             // Only zeroed by losing power
+
+std::function<void(bool)> timeSetCallback;
+uint8_t pinValues[32];
+
+// The RTC timer's period, in 1/4096ths of a microsecond.  About 6.25us, as on a board, so
+//  the 32 bit count wraps after about 7.5 hours.
+const uint32_t RTC_CALIBRATION = 25600;
+
+struct HostStartup {
+  HostStartup() {
+    setenv("TZ", "UTC0", 1);
+    tzset();
+  }
+} hostStartup;
+
+}
+
+// ----------------------------------------------------------------------
+
+unsigned long millis() {
+  return (unsigned long)(bootMicros / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)bootMicros;
+}
+
+void delay(unsigned long ms) {
+  HostClock::Advance(ms);
+}
+
+void yield() {
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  if(pin < sizeof(pinValues))
+    pinValues[pin] = value;
+}
+
+int digitalRead(uint8_t pin) {
+  return pin < sizeof(pinValues) ? pinValues[pin] : LOW;
+}
+
+void configTime(const char* timezone, const char* server1, const char* server2, const char* server3) {
+  setenv("TZ", timezone, 1);
+  tzset();
+}
+
+void settimeofday_cb(const std::function<void(bool)>& callback) {
+  timeSetCallback = callback;
+}
+
+// The firmware's calls to time() and settimeofday() get the board's clock, not the host's.
+extern "C" time_t time(time_t* result) noexcept {
+  uint64_t now = clockSet ? bootMicros + clockOffsetMicros : bootMicros;
+  time_t seconds = (time_t)(now / 1000000);
+  if(result)
+    *result = seconds;
+  return seconds;
+}
+
+extern "C" int settimeofday(const struct timeval* tv, const struct timezone* tz) noexcept {
+  if(tv == NULL)
+    return 0;
+  clockSet = true;
+  clockOffsetMicros = (int64_t)tv->tv_sec * 1000000 + tv->tv_usec - (int64_t)bootMicros;
+  if(timeSetCallback)
+    timeSetCallback(false);
+  return 0;
+}
+
+extern "C" uint32_t system_get_rtc_time(void) {
+  return (uint32_t)(rtcMicros * 4096 / RTC_CALIBRATION);
+}
+
+extern "C" uint32_t system_rtc_clock_cali_proc(void) {
+  return RTC_CALIBRATION;
+}
+
+namespace HostClock {
+
+void Begin(time_t worldTime) {
+  worldMicros = (uint64_t)worldTime * 1000000;
+  bootMicros = 0;
+  rtcMicros = 0;
+  clockSet = false;
+  ESP.ClearRtcMemory();
+  ESP.reset_info.reason = 0;    // Power on
+}
+
+void AdvanceMicros(uint64_t us) {
+  worldMicros += us;
+  bootMicros += us;
+  rtcMicros += us;
+}
+
+void Advance(unsigned long ms) {
+  AdvanceMicros((uint64_t)ms * 1000);
+}
+
+time_t World() {
+  return (time_t)(worldMicros / 1000000);
+}
+
+uint64_t WorldMillis() {
+  return worldMicros / 1000;
+}
+
+void SyncNtp() {
+  clockSet = true;
+  clockOffsetMicros = (int64_t)worldMicros - (int64_t)bootMicros;
+  if(timeSetCallback)
+    timeSetCallback(true);
+}
+
+void Reset(unsigned long offMillis, bool powerLost) {
+  worldMicros += (uint64_t)offMillis * 1000;
+  bootMicros = 0;
+  clockSet = false;
+  if(powerLost) {
+    rtcMicros = 0;
+    ESP.ClearRtcMemory();
+    ESP.reset_info.reason = 0;    // Power on
+  } else {
+    rtcMicros += (uint64_t)offMillis * 1000;
+    ESP.reset_info.reason = 4;    // Software restart
+  }
+}
+
+uint32_t RtcCycles() {
+  return system_get_rtc_time();
+}
+
+}
+
+// ----------------------------------------------------------------------
+
+uint32_t EspClass::getFreeHeap() {
+  size_t used = HostHeap::LiveBytes();
+  return used < HOST_HEAP_SIZE ? HOST_HEAP_SIZE - used : 0;
+}
+
+uint32_t EspClass::random() {
+  return (uint32_t)rand();
+}
+
+void EspClass::restart() {
+  restarts++;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size) {
+  if(offset * 4 + size > sizeof(rtc_memory))
+    return false;
+  memcpy(data, rtc_memory + offset * 4, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size) {
+  if(offset * 4 + size > sizeof(rtc_memory))
+    return false;
+  memcpy(rtc_memory + offset * 4, data, size);
+  return true;
+}
+
+// ----------------------------------------------------------------------
+
+String::String(const char* text) {
+  sso[0] = 0;
+  if(text)
+    concat(text, strlen(text));
+}
+
+String::String(const String& other) : String() {
+  concat(other.c_str(), other.len);
+}
+
+String::String(String&& other) : String() {
+  *this = (String&&)other;
+}
+
+String::String(char c) : String() {
+  concat(&c, 1);
+}
+
+String::String(int value, unsigned char base) : String((long)value, base) {
+}
+
+String::String(unsigned int value, unsigned char base) : String((unsigned long)value, base) {
+}
+
+String::String(long value, unsigned char base) : String() {
+  char text[8 * sizeof(long) + 2];
+  if(base == 10) {
+    snprintf(text, sizeof(text), "%ld", value);
+    concat(text);
+  } else {
+    *this = String((unsigned long)value, base);
+  }
+}
+
+String::String(unsigned long value, unsigned char base) : String() {
+  char text[8 * sizeof(long) + 1];
+  char* c = text + sizeof(text) - 1;
+  *c = 0;
+  do {
+    unsigned digit = value % base;
+    *--c = digit < 10 ? '0' + digit : 'a' + digit - 10;
+    value /= base;
+  } while(value);
+  concat(c);
+}
+
+String::String(float value, unsigned char decimalPlaces) : String((double)value, decimalPlaces) {
+}
+
+String::String(double value, unsigned char decimalPlaces) : String() {
+  char text[64];
+  snprintf(text, sizeof(text), "%.*f", decimalPlaces, value);
+  concat(text);
+}
+
+String::~String() {
+  invalidate();
+}
+
+void String::invalidate() {
+  if(heap)
+    free(heap);
+  heap = NULL;
+  capacity = SSO_CAPACITY;
+  len = 0;
+  sso[0] = 0;
+}
+
+String& String::operator=(const String& other) {
+  if(this != &other) {
+    len = 0;
+    concat(other.c_str(), other.len);
+  }
+  return *this;
+}
+
+String& String::operator=(String&& other) {
+  if(this != &other) {
+    invalidate();
+    if(other.heap) {
+      heap = other.heap;
+      capacity = other.capacity;
+      len = other.len;
+      other.heap = NULL;
+      other.capacity = SSO_CAPACITY;
+      other.len = 0;
+      other.sso[0] = 0;
+    } else {
+      memcpy(sso, other.sso, sizeof(sso));
+      len = other.len;
+    }
+  }
+  return *this;
+}
+
+String& String::operator=(const char* text) {
+  len = 0;
+  buffer()[0] = 0;
+  if(text)
+    concat(text, strlen(text));
+  return *this;
+}
+
+// As the core, the buffer grows to exactly the size asked for.
+bool String::reserve(unsigned int size) {
+  if(size <= capacity)
+    return true;
+
+  char* grown = (char*)(isSSO() ? malloc(size + 1) : realloc(heap, size + 1));
+  if(grown == NULL)
+    return false;
+  if(isSSO())
+    memcpy(grown, sso, len + 1);
+  heap = grown;
+  capacity = size;
+  return true;
+}
+
+bool String::concat(const char* text, unsigned int length) {
+  if(length == 0)
+    return true;
+
+  // The text may be part of this String, which reserve() can move.
+  const char* start = c_str();
+  bool self = text >= start && text < start + len;
+  size_t offset = text - start;
+  if(!reserve(len + length))
+    return false;
+  if(self)
+    text = c_str() + offset;
+
+  memmove(buffer() + len, text, length);
+  len += length;
+  buffer()[len] = 0;
+  return true;
+}
+
+bool String::concat(int value)           { return concat(String(value)); }
+bool String::concat(unsigned int value)  { return concat(String(value)); }
+bool String::concat(long value)          { return concat(String(value)); }
+bool String::concat(unsigned long value) { return concat(String(value)); }
+bool String::concat(float value)         { return concat(String(value)); }
+bool String::concat(double value)        { return concat(String(value)); }
+
+bool String::startsWith(const char* prefix) const {
+  size_t length = strlen(prefix);
+  return length <= len && strncmp(c_str(), prefix, length) == 0;
+}
+
+bool String::endsWith(const char* suffix) const {
+  size_t length = strlen(suffix);
+  return length <= len && strcmp(c_str() + len - length, suffix) == 0;
+}
+
+int String::indexOf(char c, unsigned int from) const {
+  if(from >= len)
+    return -1;
+  const char* found = strchr(c_str() + from, c);
+  return found ? found - c_str() : -1;
+}
+
+int String::indexOf(const char* text, unsigned int from) const {
+  if(from >= len)
+    return -1;
+  const char* found = strstr(c_str() + from, text);
+  return found ? found - c_str() : -1;
+}
+
+String String::substring(unsigned int from, unsigned int to) const {
+  if(from > to) {
+    unsigned int swap = from;
+    from = to;
+    to = swap;
+  }
+  String result;
+  if(from >= len)
+    return result;
+  if(to > len)
+    to = len;
+  result.concat(c_str() + from, to - from);
+  return result;
+}
+
+void String::trim() {
+  const char* start = c_str();
+  const char* end = start + len;
+  while(start < end && isspace((unsigned char)*start))
+    start++;
+  while(end > start && isspace((unsigned char)end[-1]))
+    end--;
+  len = end - start;
+  memmove(buffer(), start, len);
+  buffer()[len] = 0;
+}
+
+void String::toLowerCase() {
+  char* c;
+  for(c = buffer(); *c; c++)
+    *c = tolower((unsigned char)*c);
+}
+
+String operator+(const String& left, const String& right) {
+  String result(left);
+  result.concat(right);
+  return result;
+}
+
+String operator+(const String& left, const char* right) {
+  String result(left);
+  result.concat(right);
+  return result;
+}
+
+String operator+(const char* left, const String& right) {
+  String result(left);
+  result.concat(right);
+  return result;
+}
+
+// ----------------------------------------------------------------------
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+  size_t written = 0;
+  while(size--)
+    written += write(*buffer++);
+  return written;
+}
+
+size_t Print::print(long value, int base) {
+  if(base == 10 && value < 0) {
+    size_t written = print('-');
+    return written + print((unsigned long)-value, base);
+  }
+  return print((unsigned long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+  char text[8 * sizeof(long) + 1];
+  char* c = text + sizeof(text) - 1;
+  *c = 0;
+  if(base < 2)
+    base = 10;
+  do {
+    unsigned digit = value % base;
+    *--c = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    value /= base;
+  } while(value);
+  return write(c);
+}
+
+size_t Print::print(double value, int digits) {
+  if(isnan(value))
+    return write("nan");
+  if(isinf(value))
+    return write("inf");
+  if(value > 4294967040.0 || value < -4294967040.0)
+    return write("ovf");
+
+  char text[48];
+  snprintf(text, sizeof(text), "%.*f", digits, value);
+  return write(text);
+}
+
+size_t Print::vprintf(const char* format, va_list args) {
+  char temp[64];
+  va_list copy;
+  va_copy(copy, args);
+  int length = vsnprintf(temp, sizeof(temp), format, copy);
+  va_end(copy);
+  if(length < 0)
+    return 0;
+  if((size_t)length < sizeof(temp))
+    return write((const uint8_t*)temp, length);
+
+  char* buffer = new char[length + 1];
+  vsnprintf(buffer, length + 1, format, args);
+  size_t written = write((const uint8_t*)buffer, length);
+  delete[] buffer;
+  return written;
+}
+
+size_t Print::printf(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t written = vprintf(format, args);
+  va_end(args);
+  return written;
+}
+
+size_t Print::printf_P(PGM_P format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t written = vprintf(format, args);
+  va_end(args);
+  return written;
+}
+
+// ----------------------------------------------------------------------
+
+size_t Stream::readBytes(char* buffer, size_t length) {
+  size_t count = 0;
+  while(count < length) {
+    int c = read();
+    if(c < 0)
+      break;
+    buffer[count++] = (char)c;
+  }
+  return count;
+}
+
+int Stream::peekNumeric(bool allowDecimal) {
+  while(true) {
+    int c = peek();
+    if(c < 0 || c == '-' || (c >= '0' && c <= '9') || (allowDecimal && c == '.'))
+      return c;
+    read();
+  }
+}
+
+long Stream::parseInt() {
+  int c = peekNumeric(false);
+  if(c < 0)
+    return 0;
+
+  bool negative = false;
+  long value = 0;
+  while(c == '-' || (c >= '0' && c <= '9')) {
+    if(c == '-')
+      negative = true;
+    else
+      value = value * 10 + c - '0';
+    read();
+    c = peek();
+  }
+  return negative ? -value : value;
+}
+
+float Stream::parseFloat() {
+  int c = peekNumeric(true);
+  if(c < 0)
+    return 0;
+
+  bool negative = false;
+  bool fraction = false;
+  double value = 0;
+  double scale = 1;
+  while(c == '-' || c == '.' || (c >= '0' && c <= '9')) {
+    if(c == '-') {
+      negative = true;
+    } else if(c == '.') {
+      fraction = true;
+    } else {
+      value = value * 10 + c - '0';
+      if(fraction)
+        scale *= 10;
+    }
+    read();
+    c = peek();
+  }
+  value /= scale;
+  return negative ? -value : value;
+}
+
+String Stream::readString() {
+  String result;
+  int c;
+  while((c = read()) >= 0)
+    result += (char)c;
+  return result;
+}
+
+String Stream::readStringUntil(char terminator) {
+  String result;
+  int c;
+  while((c = read()) >= 0 && c != terminator)
+    result += (char)c;
+  return result;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t* buffer, size_t size) {
+  static bool echo = getenv("HOST_SERIAL") != NULL;
+  if(echo)
+    fwrite(buffer, 1, size, stdout);
+  return size;
+}
@@ -0,0 +1,306 @@
+#ifndef __HOST_ARDUINO__
+#define __HOST_ARDUINO__
+
+// ----------------------------------------------------------------------
+// Host stand-in for the ESP8266 Arduino core.
+//
+//  Just enough of the core for the firmware's modules to build and run on Linux, with the
+//  parts that matter for measuring kept faithful: String and Print::printf_P() allocate as
+//  the core's do, and the clock only moves when a test moves it (see HostClock).  Anything
+//  marked "Host only" isn't in the real core, and is for the tests to drive the stand-ins.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <ctype.h>
+#include <time.h>
+#include <functional>
+#include <algorithm>
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// Flash and RAM are one address space here.
+#define PROGMEM
+#define PSTR(s) (s)
+#define PGM_P const char*
+#define F(s) ((const __FlashStringHelper*)(s))
+#define FPSTR(p) ((const __FlashStringHelper*)(p))
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+#define sprintf_P sprintf
+#define strlen_P strlen
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define memcpy_P memcpy
+#define pgm_read_byte(p) (*(const uint8_t*)(p))
+#define ICACHE_RAM_ATTR
+#define IRAM_ATTR
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define DEC 10
+#define HEX 16
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+using std::min;
+using std::max;
+
+template<typename T> T constrain(T value, T low, T high) { return value < low ? low : value > high ? high : value; }
+
+class __FlashStringHelper;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);     // Moves the clock on
+void yield();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+
+void configTime(const char* timezone, const char* server1, const char* server2 = NULL, const char* server3 = NULL);
+
+// ----------------------------------------------------------------------
+// As the core's String: the text is on the heap once it's longer than the 11 characters kept
+//  in the object itself, and grows to the exact length needed, so building one up a piece at a
+//  time reallocates.
+
+class String
+{
+public:
+    String(const char* text = "");
+    String(const __FlashStringHelper* text) : String((const char*)text) {}
+    String(const String& other);
+    String(String&& other);
+    explicit String(char c);
+    explicit String(int value, unsigned char base = 10);
+    explicit String(unsigned int value, unsigned char base = 10);
+    explicit String(long value, unsigned char base = 10);
+    explicit String(unsigned long value, unsigned char base = 10);
+    explicit String(float value, unsigned char decimalPlaces = 2);
+    explicit String(double value, unsigned char decimalPlaces = 2);
+    ~String();
+
+    String& operator=(const String& other);
+    String& operator=(String&& other);
+    String& operator=(const char* text);
+    String& operator=(const __FlashStringHelper* text) { return *this = (const char*)text; }
+
+    bool reserve(unsigned int size);
+    unsigned int length() const { return len; }
+    bool isEmpty() const        { return len == 0; }
+    const char* c_str() const   { return buffer(); }
+
+    bool concat(const char* text, unsigned int length);
+    bool concat(const char* text) { return concat(text, strlen(text)); }
+    bool concat(const String& other) { return concat(other.c_str(), other.len); }
+    bool concat(char c) { return concat(&c, 1); }
+    bool concat(int value);
+    bool concat(unsigned int value);
+    bool concat(long value);
+    bool concat(unsigned long value);
+    bool concat(float value);
+    bool concat(double value);
+
+    template<typename T> String& operator+=(const T& value) { concat(value); return *this; }
+    String& operator+=(const __FlashStringHelper* text) { concat((const char*)text); return *this; }
+
+    int compareTo(const String& other) const { return strcmp(c_str(), other.c_str()); }
+    bool equals(const char* text) const      { return strcmp(c_str(), text) == 0; }
+    bool operator==(const String& other) const { return len == other.len && compareTo(other) == 0; }
+    bool operator==(const char* text) const  { return equals(text); }
+    bool operator!=(const String& other) const { return !(*this == other); }
+    bool operator!=(const char* text) const  { return !equals(text); }
+    bool operator<(const String& other) const  { return compareTo(other) < 0; }
+    bool operator>(const String& other) const  { return compareTo(other) > 0; }
+
+    bool startsWith(const char* prefix) const;
+    bool startsWith(const String& prefix) const { return startsWith(prefix.c_str()); }
+    bool endsWith(const char* suffix) const;
+    bool endsWith(const String& suffix) const { return endsWith(suffix.c_str()); }
+
+    char charAt(unsigned int index) const    { return index < len ? buffer()[index] : 0; }
+    char operator[](unsigned int index) const { return charAt(index); }
+    int indexOf(char c, unsigned int from = 0) const;
+    int indexOf(const char* text, unsigned int from = 0) const;
+    int indexOf(const String& text, unsigned int from = 0) const { return indexOf(text.c_str(), from); }
+    String substring(unsigned int from) const { return substring(from, len); }
+    String substring(unsigned int from, unsigned int to) const;
+    void trim();
+    void toLowerCase();
+
+    long toInt() const     { return atol(c_str()); }
+    float toFloat() const  { return atof(c_str()); }
+    double toDouble() const { return atof(c_str()); }
+
+private:
+    static const unsigned int SSO_CAPACITY = 11;
+
+    bool isSSO() const     { return heap == NULL; }
+    char* buffer()         { return isSSO() ? sso : heap; }
+    const char* buffer() const { return isSSO() ? sso : heap; }
+    void invalidate();
+
+    char sso[SSO_CAPACITY + 1];
+    char* heap = NULL;
+    unsigned int capacity = SSO_CAPACITY;
+    unsigned int len = 0;
+};
+
+String operator+(const String& left, const String& right);
+String operator+(const String& left, const char* right);
+String operator+(const char* left, const String& right);
+
+// ----------------------------------------------------------------------
+
+class Print
+{
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* text) { return text ? write((const uint8_t*)text, strlen(text)) : 0; }
+    size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    // As the core: printf() formats into 64 bytes on the stack, and allocates for anything longer.
+    size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+    size_t printf_P(PGM_P format, ...) __attribute__((format(printf, 2, 3)));
+
+    size_t print(const __FlashStringHelper* text) { return write((const char*)text); }
+    size_t print(const String& text)              { return write((const uint8_t*)text.c_str(), text.length()); }
+    size_t print(const char* text)                { return write(text); }
+    size_t print(char c)                          { return write((uint8_t)c); }
+    size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(int value, int base = DEC)       { return print((long)value, base); }
+    size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    template<typename T> size_t println(const T& value) { size_t n = print(value); return n + println(); }
+    template<typename T> size_t println(const T& value, int format) { size_t n = print(value, format); return n + println(); }
+    size_t println() { return write("\r\n"); }
+
+private:
+    size_t vprintf(const char* format, va_list args);
+};
+
+class Stream : public Print
+{
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { timeout_millis = timeout; }
+    virtual size_t readBytes(char* buffer, size_t length);
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+    // As the core: skip anything that can't start a number, then read it.
+    long parseInt();
+    float parseFloat();
+    String readString();
+    String readStringUntil(char terminator);
+
+protected:
+    int peekNumeric(bool allowDecimal);
+    unsigned long timeout_millis = 1000;
+};
+
+// Only written to stdout when HOST_SERIAL is set, to keep the test output readable.
+class HardwareSerial : public Stream
+{
+public:
+    void begin(unsigned long baud) {}
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override { return 0; }
+    int read() override      { return -1; }
+    int peek() override      { return -1; }
+};
+
+extern HardwareSerial Serial;
+
+// ----------------------------------------------------------------------
+
+struct rst_info {
+  uint32_t reason;
+  uint32_t exccause;
+  uint32_t epc1;
+  uint32_t epc2;
+  uint32_t epc3;
+  uint32_t excvaddr;
+  uint32_t depc;
+};
+
+// The heap is modelled as HOST_HEAP_SIZE bytes, less whatever the firmware holds (see
+//  HostHeap.h).  That's about what's free on a board running this firmware, before its own
+//  allocations.
+const uint32_t HOST_HEAP_SIZE = 40 * 1024;
+
+class EspClass
+{
+public:
+    uint32_t getFreeHeap();
+    uint32_t getMaxFreeBlockSize() { return getFreeHeap(); }
+    uint8_t getHeapFragmentation() { return 0; }
+    uint32_t getChipId()           { return 0x00C0FFEE; }
+    uint32_t getCycleCount()       { return micros() * 80; }
+    uint32_t random();
+    void restart();
+    struct rst_info* getResetInfoPtr() { return &reset_info; }
+
+    // 512 bytes, in 4 byte blocks.  Kept across HostClock::Reset(), unless the power was lost.
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t* data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t* data, size_t size);
+
+    // Host only
+    void ClearRtcMemory() { memset(rtc_memory, 0, sizeof(rtc_memory)); }
+    uint32_t restarts = 0;
+    struct rst_info reset_info = {};
+
+private:
+    uint8_t rtc_memory[512] = {};
+};
+
+extern EspClass ESP;
+
+// ----------------------------------------------------------------------
+// Host only: the board's clocks.
+//
+//  The world's time moves on only with Advance(), or delay().  The board's millis() count from
+//  its last reset, and its time() is the seconds since then until the clock is set, as on the
+//  ESP8266.  The RTC timer (system_get_rtc_time()) runs on through a reset, but not a power cut.
+
+namespace HostClock {
+  void Begin(time_t worldTime);             // Back to a board that's just been powered on
+  void Advance(unsigned long ms);
+  void AdvanceMicros(uint64_t us);
+  time_t World();                           // The real time now
+  uint64_t WorldMillis();
+
+  // Sets the board's clock to the real time, as SNTP does, and calls the settimeofday_cb.
+  void SyncNtp();
+
+  // The board resets (or is powered off) for offMillis.  The clock is no longer set, and
+  //  millis() starts again.  Losing power also clears RTC memory and the RTC timer.
+  void Reset(unsigned long offMillis, bool powerLost);
+
+  uint32_t RtcCycles();
+}
+
+#endif // __HOST_ARDUINO__
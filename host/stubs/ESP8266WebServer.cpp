@@ -0,0 +1,374 @@
+#include "ESP8266WebServer.h"
+#include "HostHeap.h"
+#include <strings.h>
+
+ESP8266WebServer* ESP8266WebServer::instance = NULL;
+
+namespace {
+
+const String& emptyString() {
+  static String empty;
+  return empty;
+}
+
+const char* reasonPhrase(int code) {
+  switch(code) {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+    default:  return "";
+  }
+}
+
+// "%41" and "+" in a query string
+std::string urlDecoded(const std::string& text) {
+  std::string result;
+  size_t i;
+  for(i = 0; i < text.size(); i++) {
+    if(text[i] == '+') {
+      result += ' ';
+    } else if(text[i] == '%' && i + 2 < text.size()) {
+      result += (char)strtol(text.substr(i + 1, 2).c_str(), NULL, 16);
+      i += 2;
+    } else {
+      result += text[i];
+    }
+  }
+  return result;
+}
+
+}
+
+std::string HostWebResponse::Header(const char* name) const {
+  for(const auto& header : headers) {
+    if(strcasecmp(header.first.c_str(), name) == 0)
+      return header.second;
+  }
+  return std::string();
+}
+
+// ----------------------------------------------------------------------
+
+ESP8266WebServer::ESP8266WebServer(int port) {
+  instance = this;
+}
+
+ESP8266WebServer::~ESP8266WebServer() {
+  HostHeap::Untracked untracked;
+  if(instance == this)
+    instance = NULL;
+  routes.clear();
+  static_routes.clear();
+  collected_headers.clear();
+  current_args.clear();
+  current_headers.clear();
+  current_client = WiFiClient();
+}
+
+void ESP8266WebServer::on(const String& uri, HTTPMethod method, THandlerFunction handler, THandlerFunction uploadHandler) {
+  HostHeap::Untracked untracked;
+  routes.push_back(Route{ uri, method, handler, uploadHandler });
+}
+
+void ESP8266WebServer::serveStatic(const char* uri, FS& fs, const char* path, const char* cacheHeader) {
+  HostHeap::Untracked untracked;
+  static_routes.push_back(StaticRoute{ String(uri), &fs, String(path), String(cacheHeader ? cacheHeader : "") });
+}
+
+void ESP8266WebServer::collectHeaders(const char* headerKeys[], const size_t count) {
+  HostHeap::Untracked untracked;
+  collected_headers.clear();
+  size_t i;
+  for(i = 0; i < count; i++)
+    collected_headers.push_back(String(headerKeys[i]));
+}
+
+// ----------------------------------------------------------------------
+
+void ESP8266WebServer::writeRaw(const char* data, size_t length) {
+  current_client.write((const uint8_t*)data, length);
+}
+
+void ESP8266WebServer::send(int code, const char* contentType, const String& content) {
+  send(code, contentType, content.c_str(), content.length());
+}
+
+void ESP8266WebServer::send(int code, const char* contentType, const char* content) {
+  send(code, contentType, content, content ? strlen(content) : 0);
+}
+
+void ESP8266WebServer::send(int code, const char* contentType, const char* content, size_t contentLength) {
+  HostHeap::Untracked untracked;
+  char line[64];
+  std::string head;
+  snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\n", code, reasonPhrase(code));
+  head += line;
+  if(contentType) {
+    head += "Content-Type: ";
+    head += contentType;
+    head += "\r\n";
+  }
+
+  chunked = content_length == CONTENT_LENGTH_UNKNOWN;
+  if(chunked) {
+    head += "Transfer-Encoding: chunked\r\n";
+  } else {
+    snprintf(line, sizeof(line), "Content-Length: %u\r\n", (unsigned)(content_length != CONTENT_LENGTH_NOT_SET ? content_length : contentLength));
+    head += line;
+  }
+  head += response_headers;
+  head += "Connection: close\r\n\r\n";
+  response_headers.clear();
+  content_length = CONTENT_LENGTH_NOT_SET;
+
+  writeRaw(head.data(), head.size());
+  if(chunked) {
+    if(contentLength > 0)
+      sendContent(content, contentLength);
+  } else {
+    writeRaw(content, contentLength);
+  }
+}
+
+void ESP8266WebServer::sendHeader(const String& name, const String& value, bool first) {
+  HostHeap::Untracked untracked;
+  std::string header = std::string(name.c_str()) + ": " + value.c_str() + "\r\n";
+  if(first)
+    response_headers.insert(0, header);
+  else
+    response_headers += header;
+}
+
+void ESP8266WebServer::sendContent(const char* content, size_t length) {
+  if(!chunked) {
+    writeRaw(content, length);
+    return;
+  }
+
+  char size[16];
+  snprintf(size, sizeof(size), "%x\r\n", (unsigned)length);
+  writeRaw(size, strlen(size));
+  writeRaw(content, length);
+  writeRaw("\r\n", 2);
+  if(length == 0)
+    chunked = false;
+}
+
+// ----------------------------------------------------------------------
+
+const String& ESP8266WebServer::arg(const String& name) const {
+  for(const auto& a : current_args) {
+    if(a.first == name)
+      return a.second;
+  }
+  return emptyString();
+}
+
+const String& ESP8266WebServer::arg(int i) const {
+  return i >= 0 && i < (int)current_args.size() ? current_args[i].second : emptyString();
+}
+
+const String& ESP8266WebServer::argName(int i) const {
+  return i >= 0 && i < (int)current_args.size() ? current_args[i].first : emptyString();
+}
+
+bool ESP8266WebServer::hasArg(const String& name) const {
+  for(const auto& a : current_args) {
+    if(a.first == name)
+      return true;
+  }
+  return false;
+}
+
+const String& ESP8266WebServer::header(const String& name) const {
+  for(const auto& h : current_headers) {
+    if(strcasecmp(h.first.c_str(), name.c_str()) == 0)
+      return h.second;
+  }
+  return emptyString();
+}
+
+bool ESP8266WebServer::hasHeader(const String& name) const {
+  for(const auto& h : current_headers) {
+    if(strcasecmp(h.first.c_str(), name.c_str()) == 0)
+      return true;
+  }
+  return false;
+}
+
+// ----------------------------------------------------------------------
+
+void ESP8266WebServer::begin(HTTPMethod method, const char* uri, const HostWebArgs& args, const HostWebArgs& headers) {
+  HostHeap::Untracked untracked;
+  std::string path(uri);
+  current_args.clear();
+  size_t query = path.find('?');
+  if(query != std::string::npos) {
+    std::string rest = path.substr(query + 1);
+    path.resize(query);
+    while(!rest.empty()) {
+      size_t end = rest.find('&');
+      std::string pair = rest.substr(0, end);
+      size_t equals = pair.find('=');
+      std::string name = urlDecoded(pair.substr(0, equals));
+      std::string value = equals == std::string::npos ? std::string() : urlDecoded(pair.substr(equals + 1));
+      current_args.push_back(std::make_pair(String(name.c_str()), String(value.c_str())));
+      rest = end == std::string::npos ? std::string() : rest.substr(end + 1);
+    }
+  }
+  for(const auto& a : args)
+    current_args.push_back(std::make_pair(String(a.first.c_str()), String(a.second.c_str())));
+
+  // As the core, only the headers asked for are kept.
+  current_headers.clear();
+  for(const auto& h : headers) {
+    for(const String& wanted : collected_headers) {
+      if(strcasecmp(wanted.c_str(), h.first.c_str()) == 0)
+        current_headers.push_back(std::make_pair(wanted, String(h.second.c_str())));
+    }
+  }
+
+  current_uri = path.c_str();
+  current_method = method;
+  response_headers.clear();
+  content_length = CONTENT_LENGTH_NOT_SET;
+  chunked = false;
+  current_client = WiFiClient(std::make_shared<HostConnection>());
+}
+
+const ESP8266WebServer::Route* ESP8266WebServer::findRoute() const {
+  for(const Route& route : routes) {
+    if(route.uri == current_uri && (route.method == HTTP_ANY || route.method == current_method))
+      return &route;
+  }
+  return NULL;
+}
+
+// The core's static handler, which is all its own allocations.
+bool ESP8266WebServer::serveStaticFile() {
+  HostHeap::Untracked untracked;
+  for(const StaticRoute& route : static_routes) {
+    if(!current_uri.startsWith(route.uri))
+      continue;
+
+    String path = route.path + current_uri.substring(route.uri.length());
+    if(path.endsWith("/"))
+      path += "index.htm";
+    if(!route.fs->exists(path))
+      continue;
+
+    File file = route.fs->open(path, "r");
+    if(route.cache_header.length() > 0)
+      sendHeader("Cache-Control", route.cache_header);
+    const char* type = path.endsWith(".css") ? "text/css" : path.endsWith(".js") ? "application/javascript" :
+      path.endsWith(".html") || path.endsWith(".htm") ? "text/html" : "application/octet-stream";
+    streamFile(file, type);
+    return true;
+  }
+  return false;
+}
+
+HostWebResponse ESP8266WebServer::finish() {
+  HostHeap::Untracked untracked;
+  HostWebResponse response;
+  response.connection = current_client.Connection();
+  current_client = WiFiClient();
+  current_args.clear();
+  current_headers.clear();
+
+  const std::string& raw = response.connection->written;
+  size_t end = raw.find("\r\n\r\n");
+  if(end == std::string::npos)
+    return response;
+
+  size_t lineEnd = raw.find("\r\n");
+  size_t space = raw.find(' ');
+  response.status = space < lineEnd ? atoi(raw.c_str() + space + 1) : 0;
+  size_t start = lineEnd + 2;
+  while(start < end) {
+    size_t next = raw.find("\r\n", start);
+    std::string line = raw.substr(start, next - start);
+    size_t colon = line.find(':');
+    if(colon != std::string::npos) {
+      size_t value = line.find_first_not_of(' ', colon + 1);
+      response.headers.push_back(std::make_pair(line.substr(0, colon), value == std::string::npos ? std::string() : line.substr(value)));
+    }
+    start = next + 2;
+  }
+
+  size_t body = end + 4;
+  if(strcasecmp(response.Header("Transfer-Encoding").c_str(), "chunked") != 0) {
+    response.body = raw.substr(body);
+    return response;
+  }
+
+  while(body < raw.size()) {
+    size_t sizeEnd = raw.find("\r\n", body);
+    if(sizeEnd == std::string::npos)
+      break;
+    size_t length = strtoul(raw.c_str() + body, NULL, 16);
+    if(length == 0)
+      break;
+    response.body += raw.substr(sizeEnd + 2, length);
+    response.chunks++;
+    body = sizeEnd + 2 + length + 2;
+  }
+  return response;
+}
+
+HostWebResponse ESP8266WebServer::Request(HTTPMethod method, const char* uri, const HostWebArgs& args, const HostWebArgs& headers) {
+  begin(method, uri, args, headers);
+
+  const Route* route = findRoute();
+  if(route)
+    route->handler();
+  else if(serveStaticFile())
+    ;
+  else if(not_found)
+    not_found();
+  else
+    send(404, "text/plain", "Not found");
+
+  return finish();
+}
+
+HostWebResponse ESP8266WebServer::Upload(const char* uri, const char* filename, const std::string& data) {
+  begin(HTTP_POST, uri, HostWebArgs(), HostWebArgs());
+
+  const Route* route = findRoute();
+  if(route == NULL || !route->upload_handler) {
+    send(404, "text/plain", "Not found");
+    return finish();
+  }
+
+  {
+    HostHeap::Untracked untracked;
+    current_upload.filename = filename;
+    current_upload.totalSize = 0;
+    current_upload.currentSize = 0;
+  }
+  current_upload.status = UPLOAD_FILE_START;
+  route->upload_handler();
+
+  size_t offset = 0;
+  while(offset < data.size()) {
+    current_upload.status = UPLOAD_FILE_WRITE;
+    current_upload.currentSize = std::min(data.size() - offset, (size_t)HTTP_UPLOAD_BUFLEN);
+    memcpy(current_upload.buf, data.data() + offset, current_upload.currentSize);
+    route->upload_handler();
+    offset += current_upload.currentSize;
+    current_upload.totalSize = offset;
+  }
+
+  current_upload.status = UPLOAD_FILE_END;
+  current_upload.currentSize = 0;
+  route->upload_handler();
+  route->handler();
+  return finish();
+}
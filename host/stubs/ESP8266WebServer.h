@@ -0,0 +1,155 @@
+#ifndef __HOST_ESP8266WEBSERVER__
+#define __HOST_ESP8266WEBSERVER__
+
+#include "ESP8266WiFi.h"
+#include "FS.h"
+#include "HostHeap.h"
+
+// ----------------------------------------------------------------------
+// Host stand-in for the core's web server.
+//
+//  Requests don't come over the network: a test makes one with Request(), which runs the
+//  handler there and then, and returns the response as the browser would have got it.  What
+//  the handler writes goes through a HostConnection, so a client() kept after the request
+//  (for /events) goes on collecting what's written to it.  The server's own allocations, for
+//  the arguments and the response headers, are the core's, so HostHeap doesn't count them.
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+enum HTTPUploadStatus { UPLOAD_FILE_START, UPLOAD_FILE_WRITE, UPLOAD_FILE_END, UPLOAD_FILE_ABORTED };
+
+#define HTTP_UPLOAD_BUFLEN 2048
+#define CONTENT_LENGTH_UNKNOWN ((size_t) -1)
+#define CONTENT_LENGTH_NOT_SET ((size_t) -2)
+
+struct HTTPUpload {
+  HTTPUploadStatus status;
+  String filename;
+  String name;
+  String type;
+  size_t totalSize;
+  size_t currentSize;
+  uint8_t buf[HTTP_UPLOAD_BUFLEN];
+};
+
+// Host only: what the browser got.
+struct HostWebResponse {
+  int status = 0;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;                   // With any chunked encoding taken off
+  int chunks = 0;                     // Not counting the last, empty one
+  std::shared_ptr<HostConnection> connection;
+
+  std::string Header(const char* name) const;
+};
+
+typedef std::vector<std::pair<std::string, std::string>> HostWebArgs;
+
+class ESP8266WebServer
+{
+public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    ESP8266WebServer(int port = 80);
+    ~ESP8266WebServer();
+
+    void begin() {}
+    void handleClient() {}
+    void close() {}
+
+    void on(const String& uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+    void on(const String& uri, HTTPMethod method, THandlerFunction handler) { on(uri, method, handler, NULL); }
+    void on(const String& uri, HTTPMethod method, THandlerFunction handler, THandlerFunction uploadHandler);
+    void onNotFound(THandlerFunction handler) { not_found = handler; }
+    void serveStatic(const char* uri, FS& fs, const char* path, const char* cacheHeader = NULL);
+    void collectHeaders(const char* headerKeys[], const size_t count);
+
+    void send(int code, const char* contentType = NULL, const String& content = String());
+    void send(int code, const char* contentType, const char* content);
+    void send(int code, const char* contentType, const char* content, size_t contentLength);
+    void send_P(int code, PGM_P contentType, PGM_P content) { send(code, contentType, content); }
+    void send_P(int code, PGM_P contentType, PGM_P content, size_t contentLength) { send(code, contentType, content, contentLength); }
+    void sendHeader(const String& name, const String& value, bool first = false);
+    void setContentLength(size_t contentLength) { content_length = contentLength; }
+    void sendContent(const String& content) { sendContent(content.c_str(), content.length()); }
+    void sendContent(const char* content, size_t length);
+    void sendContent_P(PGM_P content) { sendContent(content, strlen(content)); }
+    void sendContent_P(PGM_P content, size_t length) { sendContent(content, length); }
+
+    // As the core's, a .gz file is sent as it is, with Content-Encoding: gzip.
+    template<typename T> size_t streamFile(T& file, const String& contentType, HTTPMethod method = HTTP_GET) {
+      size_t nameLength = strlen(file.name());
+      if(nameLength >= 3 && strcmp(file.name() + nameLength - 3, ".gz") == 0 &&
+        contentType != "application/x-gzip" && contentType != "application/octet-stream") {
+        HostHeap::Untracked untracked;
+        sendHeader("Content-Encoding", "gzip");
+      }
+      setContentLength(file.size());
+      send(200, contentType.c_str(), "");
+      uint8_t buffer[256];
+      size_t sent = 0;
+      size_t length;
+      while((length = file.read(buffer, sizeof(buffer))) > 0)
+        sent += current_client.write(buffer, length);
+      return sent;
+    }
+
+    const String& arg(const String& name) const;
+    const String& arg(int i) const;
+    const String& argName(int i) const;
+    int args() const { return current_args.size(); }
+    bool hasArg(const String& name) const;
+    const String& header(const String& name) const;
+    bool hasHeader(const String& name) const;
+    const String& uri() const { return current_uri; }
+    HTTPMethod method() const { return current_method; }
+
+    HTTPUpload& upload() { return current_upload; }
+    WiFiClient& client() { return current_client; }
+
+    // Host only.  The query string in uri is added to args.
+    HostWebResponse Request(HTTPMethod method, const char* uri, const HostWebArgs& args = HostWebArgs(), const HostWebArgs& headers = HostWebArgs());
+    HostWebResponse Upload(const char* uri, const char* filename, const std::string& data);
+
+    // The server the firmware made, so a test can reach it.
+    static ESP8266WebServer* Instance() { return instance; }
+
+private:
+    struct Route {
+      String uri;
+      HTTPMethod method;
+      THandlerFunction handler;
+      THandlerFunction upload_handler;
+    };
+    struct StaticRoute {
+      String uri;
+      FS* fs;
+      String path;
+      String cache_header;
+    };
+
+    void begin(HTTPMethod method, const char* uri, const HostWebArgs& args, const HostWebArgs& headers);
+    HostWebResponse finish();
+    const Route* findRoute() const;
+    bool serveStaticFile();
+    void writeRaw(const char* data, size_t length);
+
+    static ESP8266WebServer* instance;
+
+    std::vector<Route> routes;
+    std::vector<StaticRoute> static_routes;
+    THandlerFunction not_found;
+    std::vector<String> collected_headers;
+
+    WiFiClient current_client;
+    String current_uri;
+    HTTPMethod current_method = HTTP_GET;
+    std::vector<std::pair<String, String>> current_args;
+    std::vector<std::pair<String, String>> current_headers;
+    HTTPUpload current_upload;
+
+    std::string response_headers;
+    size_t content_length = CONTENT_LENGTH_NOT_SET;
+    bool chunked = false;
+};
+
+#endif // __HOST_ESP8266WEBSERVER__
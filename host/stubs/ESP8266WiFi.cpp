@@ -0,0 +1,234 @@
+#include "ESP8266WiFi.h"
+#include "HostHeap.h"
+#include <map>
+
+ESP8266WiFiClass WiFi;
+
+namespace {
+
+std::map<std::pair<std::string, uint16_t>, HostEndpoint*>& endpoints() {
+  static std::map<std::pair<std::string, uint16_t>, HostEndpoint*> listening;
+  return listening;
+}
+
+}
+
+String IPAddress::toString() const {
+  char text[16];
+  snprintf(text, sizeof(text), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+  return String(text);
+}
+
+// ----------------------------------------------------------------------
+
+namespace HostNetwork {
+
+unsigned long round_trip_millis = 40;
+
+void Listen(const char* host, uint16_t port, HostEndpoint* endpoint) {
+  HostHeap::Untracked untracked;
+  endpoints()[std::make_pair(std::string(host), port)] = endpoint;
+}
+
+void Unlisten(const char* host, uint16_t port) {
+  HostHeap::Untracked untracked;
+  endpoints().erase(std::make_pair(std::string(host), port));
+}
+
+HostEndpoint* Find(const char* host, uint16_t port) {
+  HostHeap::Untracked untracked;
+  auto found = endpoints().find(std::make_pair(std::string(host), port));
+  return found == endpoints().end() ? NULL : found->second;
+}
+
+}
+
+// ----------------------------------------------------------------------
+
+void HostConnection::Send(const uint8_t* data, size_t length, unsigned long delayMillis) {
+  if(board_closed || length == 0)
+    return;
+
+  HostHeap::Untracked untracked;
+  uint64_t arrival = HostClock::WorldMillis() + delayMillis;
+  if(!in_flight.empty() && in_flight.back().arrival > arrival)
+    arrival = in_flight.back().arrival;
+  in_flight.push_back(Segment{ arrival, std::vector<uint8_t>(data, data + length), false });
+}
+
+void HostConnection::Close(unsigned long delayMillis) {
+  HostHeap::Untracked untracked;
+  uint64_t arrival = HostClock::WorldMillis() + delayMillis;
+  if(!in_flight.empty() && in_flight.back().arrival > arrival)
+    arrival = in_flight.back().arrival;
+  in_flight.push_back(Segment{ arrival, std::vector<uint8_t>(), true });
+}
+
+void HostConnection::CancelClose() {
+  HostHeap::Untracked untracked;
+  deliver();
+  auto segment = in_flight.begin();
+  while(segment != in_flight.end()) {
+    if(segment->close)
+      segment = in_flight.erase(segment);
+    else
+      ++segment;
+  }
+}
+
+void HostConnection::deliver() {
+  HostHeap::Untracked untracked;
+  uint64_t now = HostClock::WorldMillis();
+  while(!in_flight.empty() && in_flight.front().arrival <= now) {
+    Segment& segment = in_flight.front();
+    if(segment.close)
+      peer_closed = true;
+    else
+      received.insert(received.end(), segment.data.begin(), segment.data.end());
+    in_flight.pop_front();
+  }
+}
+
+int HostConnection::Available() {
+  deliver();
+  return received.size();
+}
+
+int HostConnection::Read(uint8_t* buffer, size_t size) {
+  HostHeap::Untracked untracked;
+  deliver();
+  size_t length = std::min(size, received.size());
+  std::copy(received.begin(), received.begin() + length, buffer);
+  received.erase(received.begin(), received.begin() + length);
+  return length;
+}
+
+int HostConnection::Peek() {
+  deliver();
+  return received.empty() ? -1 : received.front();
+}
+
+bool HostConnection::Open() {
+  deliver();
+  return !board_closed && !peer_closed;
+}
+
+size_t HostConnection::Write(const uint8_t* data, size_t length) {
+  if(!Open())
+    return 0;
+
+  HostHeap::Untracked untracked;
+  if(endpoint)
+    endpoint->Received(*this, data, length);
+  else
+    written.append((const char*)data, length);
+  return length;
+}
+
+void HostConnection::Stop() {
+  if(board_closed)
+    return;
+
+  HostHeap::Untracked untracked;
+  board_closed = true;
+  in_flight.clear();
+  received.clear();
+  if(endpoint)
+    endpoint->Closed(*this);
+}
+
+uint64_t HostConnection::NextArrival() const {
+  return in_flight.empty() ? 0 : in_flight.front().arrival;
+}
+
+// ----------------------------------------------------------------------
+
+int WiFiClient::connect(const char* host, uint16_t port) {
+  WiFiClient::stop();
+
+  HostHeap::Untracked untracked;
+  HostEndpoint* endpoint = HostNetwork::Find(host, port);
+  delay(HostNetwork::round_trip_millis);
+  if(endpoint == NULL)
+    return 0;
+
+  connection = std::make_shared<HostConnection>(endpoint);
+  if(!endpoint->Accept(connection)) {
+    connection.reset();
+    return 0;
+  }
+  return 1;
+}
+
+uint8_t WiFiClient::connected() {
+  return connection && (connection->Open() || connection->Available() > 0);
+}
+
+void WiFiClient::stop() {
+  if(!connection)
+    return;
+  HostHeap::Untracked untracked;
+  connection->Stop();
+  connection.reset();
+}
+
+size_t WiFiClient::write(const uint8_t* buffer, size_t size) {
+  return connection ? connection->Write(buffer, size) : 0;
+}
+
+int WiFiClient::availableForWrite() {
+  return connection && connection->Open() ? connection->window : 0;
+}
+
+int WiFiClient::available() {
+  return connection ? connection->Available() : 0;
+}
+
+int WiFiClient::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t* buffer, size_t size) {
+  return connection ? connection->Read(buffer, size) : 0;
+}
+
+int WiFiClient::peek() {
+  return connection ? connection->Peek() : -1;
+}
+
+// ----------------------------------------------------------------------
+
+wl_status_t ESP8266WiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel, const uint8_t* bssid, bool connect) {
+  HostHeap::Untracked untracked;
+  begin_calls++;
+  if(ssid)
+    this->ssid = ssid;
+  if(passphrase)
+    this->passphrase = passphrase;
+  if(channel)
+    wifi_channel = channel;
+  if(bssid)
+    memcpy(this->bssid, bssid, sizeof(this->bssid));
+  if(!static_ip)
+    local_ip = dhcp_ip;
+  wifi_status = access_point_up ? WL_CONNECTED : WL_NO_SSID_AVAIL;
+  return wifi_status;
+}
+
+bool ESP8266WiFiClass::config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  static_ip = local.isSet();
+  if(!static_ip)
+    return true;      // Back to DHCP
+  local_ip = local;
+  gateway_ip = gateway;
+  subnet_mask = subnet;
+  dns_ip[0] = dns1;
+  dns_ip[1] = dns2;
+  return true;
+}
+
+bool ESP8266WiFiClass::disconnect(bool wifiOff) {
+  wifi_status = WL_DISCONNECTED;
+  return true;
+}
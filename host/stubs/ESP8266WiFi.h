@@ -0,0 +1,191 @@
+#ifndef __HOST_ESP8266WIFI__
+#define __HOST_ESP8266WIFI__
+
+#include "Arduino.h"
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ----------------------------------------------------------------------
+// Host stand-ins for the core's WiFi and TCP client.
+//
+//  Connections are made in memory, to whatever a test has listening (a HostEndpoint) at the
+//  host and port.  What the board writes reaches the endpoint straight away, and what the
+//  endpoint sends back reaches the board once the clock has moved on to its arrival time.
+//  The connection's buffers are lwIP's on a board, so HostHeap doesn't count them.
+
+class IPAddress
+{
+public:
+    IPAddress() {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+    IPAddress(uint32_t a) : address(a) {}
+    operator uint32_t() const      { return address; }
+    bool isSet() const             { return address != 0; }
+    uint8_t operator[](int i) const { return address >> (8 * i); }
+    String toString() const;
+
+private:
+    uint32_t address = 0;
+};
+
+class HostConnection;
+
+// Host only: something listening for connections.
+class HostEndpoint
+{
+public:
+    virtual ~HostEndpoint() {}
+
+    // Returns false to refuse the connection.
+    virtual bool Accept(const std::shared_ptr<HostConnection>& connection) { return true; }
+    virtual void Received(HostConnection& connection, const uint8_t* data, size_t length) {}
+    virtual void Closed(HostConnection& connection) {}
+
+    // Whether a TLS endpoint agrees to the Maximum Fragment Length extension.
+    virtual bool MaxFragmentLength() { return false; }
+};
+
+// Host only: one TCP connection, between the board and an endpoint.
+class HostConnection
+{
+public:
+    explicit HostConnection(HostEndpoint* endpoint = NULL) : endpoint(endpoint) {}
+
+    // The endpoint's end.  Bytes arrive in the order sent, delayMillis from now at the soonest.
+    void Send(const uint8_t* data, size_t length, unsigned long delayMillis = 0);
+    void Send(const char* text, unsigned long delayMillis = 0) { Send((const uint8_t*)text, strlen(text), delayMillis); }
+    void Close(unsigned long delayMillis = 0);
+    void CancelClose();                 // Unless it has already arrived
+    bool BoardClosed() const { return board_closed; }
+
+    // The board's end
+    int Available();
+    int Read(uint8_t* buffer, size_t size);
+    int Peek();
+    bool Open();                        // Until the board stops, or the endpoint's close arrives
+    size_t Write(const uint8_t* data, size_t length);
+    void Stop();
+
+    // When (HostClock::WorldMillis()) the next bytes or the close reach the board, or 0 if
+    //  nothing is on its way.
+    uint64_t NextArrival() const;
+
+    HostEndpoint* endpoint;
+    std::string written;                // What the board wrote, when there's no endpoint
+    int window = 2920;                  // What availableForWrite() says
+    void* context = NULL;               // For the endpoint
+
+private:
+    void deliver();
+
+    struct Segment {
+      uint64_t arrival;
+      std::vector<uint8_t> data;
+      bool close;
+    };
+    std::deque<Segment> in_flight;
+    std::deque<uint8_t> received;
+    bool board_closed = false;
+    bool peer_closed = false;
+};
+
+// Host only
+namespace HostNetwork {
+  void Listen(const char* host, uint16_t port, HostEndpoint* endpoint);
+  void Unlisten(const char* host, uint16_t port);
+  HostEndpoint* Find(const char* host, uint16_t port);
+
+  // One round trip, for the TCP handshake and the TLS stand-in's probe.
+  extern unsigned long round_trip_millis;
+}
+
+class WiFiClient : public Stream
+{
+public:
+    WiFiClient() {}
+    explicit WiFiClient(const std::shared_ptr<HostConnection>& connection) : connection(connection) {}
+    virtual ~WiFiClient() {}
+
+    virtual int connect(const char* host, uint16_t port);
+    virtual uint8_t connected();
+    virtual void stop();
+    operator bool() { return connected(); }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int availableForWrite() override;
+    int available() override;
+    int read() override;
+    virtual int read(uint8_t* buffer, size_t size);
+    int peek() override;
+
+    void setNoDelay(bool noDelay) {}
+    void setSync(bool sync) {}
+    void keepAlive(uint16_t idle = 7200, uint16_t interval = 75, uint8_t count = 9) {}
+    IPAddress remoteIP() { return IPAddress(192, 168, 1, 2); }
+
+    // Host only
+    std::shared_ptr<HostConnection> Connection() const { return connection; }
+
+protected:
+    std::shared_ptr<HostConnection> connection;
+};
+
+enum wl_status_t {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_DISCONNECTED = 6
+};
+
+enum WiFiMode_t { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA };
+
+// Connecting succeeds straight away, unless the test says the access point isn't there.  The
+//  address is dhcp_ip, unless config() set one statically.
+class ESP8266WiFiClass
+{
+public:
+    wl_status_t status() { return wifi_status; }
+    wl_status_t begin(const char* ssid, const char* passphrase = NULL, int32_t channel = 0, const uint8_t* bssid = NULL, bool connect = true);
+    bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(), IPAddress dns2 = IPAddress());
+    bool disconnect(bool wifiOff = false);
+    bool mode(WiFiMode_t m)            { return true; }
+    bool persistent(bool persist)      { return true; }
+    bool setAutoConnect(bool autoConnect) { return true; }
+    bool setAutoReconnect(bool autoReconnect) { return true; }
+
+    String SSID() const                { return String(ssid.c_str()); }
+    String psk() const                 { return String(passphrase.c_str()); }
+    uint8_t* BSSID()                   { return bssid; }
+    int32_t channel()                  { return wifi_channel; }
+    int32_t RSSI()                     { return -60; }
+    IPAddress localIP()                { return local_ip; }
+    IPAddress gatewayIP()              { return gateway_ip; }
+    IPAddress subnetMask()             { return subnet_mask; }
+    IPAddress dnsIP(uint8_t n = 0)     { return dns_ip[n ? 1 : 0]; }
+
+    // Host only
+    bool access_point_up = true;
+    uint32_t begin_calls = 0;
+    IPAddress dhcp_ip = IPAddress(192, 168, 1, 50);
+    bool static_ip = false;
+    std::string ssid = "host";
+    std::string passphrase = "password";
+
+private:
+    wl_status_t wifi_status = WL_DISCONNECTED;
+    uint8_t bssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    int32_t wifi_channel = 6;
+    IPAddress local_ip = IPAddress(192, 168, 1, 50);
+    IPAddress gateway_ip = IPAddress(192, 168, 1, 1);
+    IPAddress subnet_mask = IPAddress(255, 255, 255, 0);
+    IPAddress dns_ip[2] = { IPAddress(192, 168, 1, 1), IPAddress() };
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif // __HOST_ESP8266WIFI__
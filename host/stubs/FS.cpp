@@ -0,0 +1,256 @@
+#include "LittleFS.h"
+#include "HostHeap.h"
+
+FS LittleFS;
+
+namespace {
+
+const size_t OPEN_FILE_HEAP = 224;
+
+std::string normalized(const char* path) {
+  std::string result(path ? path : "");
+  if(result.empty() || result[0] != '/')
+    result.insert(0, "/");
+  return result;
+}
+
+}
+
+// ----------------------------------------------------------------------
+
+size_t File::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t File::write(const uint8_t* buffer, size_t size) {
+  if(!impl || !impl->writable)
+    return 0;
+
+  HostHeap::Untracked untracked;
+  size_t length = impl->fs->writable(size);
+  std::vector<uint8_t>& data = *impl->data;
+  if(impl->append)
+    impl->position = data.size();
+  if(impl->position + length > data.size())
+    data.resize(impl->position + length);
+  memcpy(data.data() + impl->position, buffer, length);
+  impl->position += length;
+  impl->fs->bytes_written += length;
+  return length;
+}
+
+int File::available() {
+  if(!impl)
+    return 0;
+  return impl->data->size() - std::min(impl->position, impl->data->size());
+}
+
+int File::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::peek() {
+  if(available() <= 0)
+    return -1;
+  return (*impl->data)[impl->position];
+}
+
+size_t File::read(uint8_t* buffer, size_t size) {
+  size_t length = std::min(size, (size_t)available());
+  if(length > 0) {
+    memcpy(buffer, impl->data->data() + impl->position, length);
+    impl->position += length;
+  }
+  return length;
+}
+
+bool File::seek(uint32_t pos, SeekMode mode) {
+  if(!impl)
+    return false;
+  long target = pos;
+  if(mode == SeekCur)
+    target += impl->position;
+  else if(mode == SeekEnd)
+    target = impl->data->size() - pos;
+  if(target < 0 || (size_t)target > impl->data->size())
+    return false;
+  impl->position = target;
+  return true;
+}
+
+size_t File::position() const {
+  return impl ? impl->position : 0;
+}
+
+size_t File::size() const {
+  return impl ? impl->data->size() : 0;
+}
+
+bool File::truncate(uint32_t size) {
+  if(!impl || !impl->writable || impl->fs->powered_off)
+    return false;
+  HostHeap::Untracked untracked;
+  impl->data->resize(size);
+  impl->fs->metadata_writes++;
+  return true;
+}
+
+void File::close() {
+  HostHeap::Untracked untracked;
+  impl.reset();
+}
+
+const char* File::name() const {
+  if(!impl)
+    return "";
+  return impl->path.c_str() + impl->path.rfind('/') + 1;
+}
+
+const char* File::fullName() const {
+  return impl ? impl->path.c_str() : "";
+}
+
+// ----------------------------------------------------------------------
+
+bool Dir::next() {
+  return ++index < (int)entries.size();
+}
+
+String Dir::fileName() {
+  if(index < 0 || index >= (int)entries.size())
+    return String();
+  return String(entries[index].first.c_str());
+}
+
+size_t Dir::fileSize() {
+  if(index < 0 || index >= (int)entries.size())
+    return 0;
+  return entries[index].second;
+}
+
+// ----------------------------------------------------------------------
+
+bool FS::exists(const char* path) {
+  HostHeap::Untracked untracked;
+  return files.count(normalized(path)) > 0;
+}
+
+File FS::open(const char* path, const char* mode) {
+  File file;
+  {
+    HostHeap::Untracked untracked;
+    file = openUntracked(path, mode);
+  }
+  if(file) {
+    file.impl->heap = malloc(OPEN_FILE_HEAP);
+    files_opened++;
+  }
+  return file;
+}
+
+File FS::openUntracked(const char* path, const char* mode) {
+  File file;
+  std::string name = normalized(path);
+  bool plus = strchr(mode, '+') != NULL;
+  auto found = files.find(name);
+
+  if(mode[0] == 'r') {
+    if(found == files.end() || powered_off)
+      return file;
+  } else if(mode[0] == 'w' || mode[0] == 'a') {
+    if(powered_off)
+      return file;
+    if(mode[0] == 'w' || found == files.end()) {
+      files[name] = std::make_shared<std::vector<uint8_t>>();
+      found = files.find(name);
+      metadata_writes++;
+    }
+  } else {
+    return file;
+  }
+
+  file.impl = std::make_shared<File::Impl>();
+  file.impl->heap = NULL;
+  file.impl->fs = this;
+  file.impl->path = name;
+  file.impl->data = found->second;
+  file.impl->writable = mode[0] != 'r' || plus;
+  file.impl->append = mode[0] == 'a';
+  file.impl->position = 0;
+  return file;
+}
+
+bool FS::remove(const char* path) {
+  HostHeap::Untracked untracked;
+  if(powered_off || files.erase(normalized(path)) == 0)
+    return false;
+  metadata_writes++;
+  return true;
+}
+
+bool FS::rename(const char* from, const char* to) {
+  HostHeap::Untracked untracked;
+  auto found = files.find(normalized(from));
+  if(powered_off || fail_renames || found == files.end())
+    return false;
+  std::shared_ptr<std::vector<uint8_t>> data = found->second;
+  files.erase(found);
+  files[normalized(to)] = data;
+  metadata_writes++;
+  return true;
+}
+
+Dir FS::openDir(const char* path) {
+  HostHeap::Untracked untracked;
+  Dir dir;
+  std::string prefix = normalized(path);
+  if(prefix.back() != '/')
+    prefix += '/';
+  for(auto& entry : files) {
+    if(entry.first.compare(0, prefix.size(), prefix) == 0 && entry.first.find('/', prefix.size()) == std::string::npos)
+      dir.entries.push_back(std::make_pair(entry.first.substr(prefix.size()), entry.second->size()));
+  }
+  return dir;
+}
+
+void FS::Format() {
+  HostHeap::Untracked untracked;
+  files.clear();
+}
+
+std::vector<uint8_t> FS::Contents(const char* path) {
+  HostHeap::Untracked untracked;
+  auto found = files.find(normalized(path));
+  return found == files.end() ? std::vector<uint8_t>() : *found->second;
+}
+
+void FS::SetContents(const char* path, const std::vector<uint8_t>& data) {
+  HostHeap::Untracked untracked;
+  files[normalized(path)] = std::make_shared<std::vector<uint8_t>>(data);
+}
+
+void FS::SetContents(const char* path, const char* text) {
+  SetContents(path, std::vector<uint8_t>(text, text + strlen(text)));
+}
+
+void FS::CutPowerAfter(size_t bytes) {
+  cut_after = bytes;
+}
+
+size_t FS::writable(size_t length) {
+  if(powered_off)
+    return 0;
+  if(length >= cut_after) {
+    length = cut_after;
+    powered_off = true;
+    cut_after = SIZE_MAX;
+  } else if(cut_after != SIZE_MAX) {
+    cut_after -= length;
+  }
+  if(free_space != SIZE_MAX) {
+    length = std::min(length, free_space);
+    free_space -= length;
+  }
+  return length;
+}
@@ -0,0 +1,137 @@
+#ifndef __HOST_FS__
+#define __HOST_FS__
+
+#include "Arduino.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+// ----------------------------------------------------------------------
+// Host stand-in for the core's file system, kept in memory.
+//
+//  Power cuts are modelled pessimistically: every byte written is durable as soon as it's
+//  written, so a cut part way through a write leaves the file with only the start of it (a
+//  torn write).  Renames and removes happen entirely or not at all, as on LittleFS.  Once the
+//  power is cut nothing else reaches the flash, until Restore() (the next boot).
+//
+//  Each open file allocates about what LittleFS allocates on a board (its lfs_file_t, the
+//  64 byte cache and the File's own objects), as one block that HostHeap counts.  The rest of
+//  the stand-in's allocations aren't counted.
+
+enum SeekMode { SeekSet = 0, SeekCur = 1, SeekEnd = 2 };
+
+class FS;
+
+class File : public Stream
+{
+public:
+    File() {}
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+    size_t read(uint8_t* buffer, size_t size);
+    size_t readBytes(char* buffer, size_t length) override { return read((uint8_t*)buffer, length); }
+    int availableForWrite() override { return 256; }
+    void flush() override {}
+
+    bool seek(uint32_t pos, SeekMode mode = SeekSet);
+    size_t position() const;
+    size_t size() const;
+    bool truncate(uint32_t size);
+    void close();
+    operator bool() const { return impl != NULL; }
+    const char* name() const;
+    const char* fullName() const;
+
+private:
+    friend class FS;
+
+    struct Impl {
+      ~Impl() { free(heap); }
+
+      void* heap;
+      FS* fs;
+      std::string path;
+      std::shared_ptr<std::vector<uint8_t>> data;
+      size_t position;
+      bool writable;
+      bool append;
+    };
+    std::shared_ptr<Impl> impl;
+};
+
+class Dir
+{
+public:
+    bool next();
+    String fileName();
+    size_t fileSize();
+
+private:
+    friend class FS;
+
+    std::vector<std::pair<std::string, size_t>> entries;
+    int index = -1;
+};
+
+class FS
+{
+public:
+    bool begin() { return !powered_off; }
+    void end() {}
+
+    bool exists(const char* path);
+    bool exists(const String& path) { return exists(path.c_str()); }
+    File open(const char* path, const char* mode);
+    File open(const String& path, const char* mode) { return open(path.c_str(), mode); }
+    bool remove(const char* path);
+    bool remove(const String& path) { return remove(path.c_str()); }
+    bool rename(const char* from, const char* to);
+    bool rename(const String& from, const String& to) { return rename(from.c_str(), to.c_str()); }
+    Dir openDir(const char* path);
+    Dir openDir(const String& path) { return openDir(path.c_str()); }
+
+    // Host only
+    void Format();                                  // Removes everything
+    std::vector<uint8_t> Contents(const char* path);
+    void SetContents(const char* path, const std::vector<uint8_t>& data);
+    void SetContents(const char* path, const char* text);
+
+    // The power goes off once this many more bytes have been written, part way through a
+    //  write if need be.
+    void CutPowerAfter(size_t bytes);
+    void PowerCut()         { powered_off = true; }
+    void Restore()          { powered_off = false; cut_after = SIZE_MAX; free_space = SIZE_MAX; }
+    bool PoweredOff() const { return powered_off; }
+
+    // Writes come up short once this many more bytes have been written, as when the flash is
+    //  full, until Restore().  The power stays on, so renames and removes still work.
+    void SetFreeSpace(size_t bytes) { free_space = bytes; }
+
+    bool fail_renames = false;        // As when the flash has no room for the new metadata
+
+    uint32_t bytes_written = 0;
+    uint32_t metadata_writes = 0;     // Files created or truncated, renames and removes
+    uint32_t files_opened = 0;        // Each takes a heap allocation for its buffers, as on a board
+
+private:
+    friend class File;
+
+    File openUntracked(const char* path, const char* mode);
+
+    // Returns how many of length bytes can be written before the power goes, or the space
+    //  runs out.
+    size_t writable(size_t length);
+
+    std::map<std::string, std::shared_ptr<std::vector<uint8_t>>> files;
+    bool powered_off = false;
+    size_t cut_after = SIZE_MAX;
+    size_t free_space = SIZE_MAX;
+};
+
+#endif // __HOST_FS__
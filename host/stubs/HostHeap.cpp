@@ -0,0 +1,192 @@
+#include "HostHeap.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+
+extern "C" {
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t count, size_t size);
+void* __real_realloc(void* pointer, size_t size);
+void __real_free(void* pointer);
+}
+
+namespace {
+
+// The blocks allocated while tracking, so frees of untracked blocks (from before, or made by
+//  the stand-ins) aren't counted against them.  A fixed open addressed table, so tracking
+//  never allocates itself.
+const size_t TABLE_SIZE = 1 << 16;
+
+struct Block {
+  void* pointer;
+  size_t size;
+};
+
+Block blocks[TABLE_SIZE];
+size_t tableUsed = 0;
+
+HostHeap::Stats stats;
+int untrackedDepth = 0;
+
+size_t slotFor(void* pointer) {
+  return ((uintptr_t)pointer >> 4) * 2654435761u % TABLE_SIZE;
+}
+
+void addBlock(void* pointer, size_t size) {
+  if(tableUsed >= TABLE_SIZE / 2) {
+    fprintf(stderr, "HostHeap: too many live allocations to track\n");
+    abort();
+  }
+  size_t slot = slotFor(pointer);
+  while(blocks[slot].pointer != NULL)
+    slot = (slot + 1) % TABLE_SIZE;
+  blocks[slot].pointer = pointer;
+  blocks[slot].size = size;
+  tableUsed++;
+
+  stats.live_bytes += size;
+  if(stats.live_bytes > stats.peak_bytes)
+    stats.peak_bytes = stats.live_bytes;
+}
+
+// Returns false if the block wasn't tracked.  The entries after it are shifted back into
+//  the hole, so a lookup can always stop at the first empty slot.
+bool removeBlock(void* pointer) {
+  size_t slot = slotFor(pointer);
+  while(blocks[slot].pointer != pointer) {
+    if(blocks[slot].pointer == NULL)
+      return false;
+    slot = (slot + 1) % TABLE_SIZE;
+  }
+  stats.live_bytes -= blocks[slot].size;
+  blocks[slot].pointer = NULL;
+  tableUsed--;
+
+  size_t hole = slot;
+  size_t next = (slot + 1) % TABLE_SIZE;
+  while(blocks[next].pointer != NULL) {
+    size_t home = slotFor(blocks[next].pointer);
+    bool canMove = hole <= next ? (home <= hole || home > next) : (home <= hole && home > next);
+    if(canMove) {
+      blocks[hole] = blocks[next];
+      blocks[next].pointer = NULL;
+      hole = next;
+    }
+    next = (next + 1) % TABLE_SIZE;
+  }
+  return true;
+}
+
+void* allocated(void* pointer) {
+  if(pointer != NULL && untrackedDepth == 0) {
+    stats.allocations++;
+    addBlock(pointer, malloc_usable_size(pointer));
+  }
+  return pointer;
+}
+
+void freed(void* pointer) {
+  if(pointer != NULL && removeBlock(pointer))
+    stats.frees++;
+}
+
+}
+
+namespace HostHeap {
+
+void Reset() {
+  size_t live = stats.live_bytes;
+  stats = Stats();
+  stats.live_bytes = live;
+  stats.peak_bytes = live;
+}
+
+Stats Get() {
+  return stats;
+}
+
+size_t LiveBytes() {
+  return stats.live_bytes;
+}
+
+Untracked::Untracked() {
+  untrackedDepth++;
+}
+
+Untracked::~Untracked() {
+  untrackedDepth--;
+}
+
+}
+
+extern "C" {
+
+void* __wrap_malloc(size_t size) {
+  return allocated(__real_malloc(size));
+}
+
+void* __wrap_calloc(size_t count, size_t size) {
+  return allocated(__real_calloc(count, size));
+}
+
+void* __wrap_realloc(void* pointer, size_t size) {
+  if(pointer == NULL)
+    return __wrap_malloc(size);
+
+  bool tracked = removeBlock(pointer);
+  void* moved = __real_realloc(pointer, size);
+  if(moved == NULL) {
+    if(tracked)
+      addBlock(pointer, malloc_usable_size(pointer));
+    return NULL;
+  }
+  if(tracked || untrackedDepth == 0) {
+    stats.reallocations++;
+    addBlock(moved, malloc_usable_size(moved));
+  }
+  return moved;
+}
+
+void __wrap_free(void* pointer) {
+  freed(pointer);
+  __real_free(pointer);
+}
+
+}
+
+void* operator new(size_t size) {
+  void* pointer = allocated(__real_malloc(size ? size : 1));
+  if(pointer == NULL)
+    throw std::bad_alloc();
+  return pointer;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return allocated(__real_malloc(size ? size : 1));
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return allocated(__real_malloc(size ? size : 1));
+}
+
+void operator delete(void* pointer) noexcept {
+  freed(pointer);
+  __real_free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+  operator delete(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+  operator delete(pointer);
+}
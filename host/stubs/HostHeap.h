@@ -0,0 +1,42 @@
+#ifndef __HOST_HEAP__
+#define __HOST_HEAP__
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ----------------------------------------------------------------------
+// Host only: counts the heap allocations the firmware makes.
+//
+//  malloc(), calloc(), realloc() and free() are wrapped at link time (-Wl,--wrap), and the
+//  global operator new and delete replaced, so every allocation made by the firmware's code,
+//  String and Print included, is seen.  The stand-ins for the parts of the core that allocate
+//  internally (LittleFS, the web server, the TLS client) do so inside an Untracked scope, as
+//  those are the platform's allocations rather than the firmware's.
+//
+//  Sizes are the usable size of each block, so live and peak bytes are close to what the
+//  board's allocator would hand out.
+
+namespace HostHeap {
+  struct Stats {
+    uint32_t allocations;     // malloc, calloc, new, and realloc of a new block
+    uint32_t reallocations;   // realloc of an existing block
+    uint32_t frees;
+    size_t live_bytes;
+    size_t peak_bytes;        // Highest live_bytes since the last Reset()
+  };
+
+  // Zeros the counts, and starts the peak from the bytes live now.
+  void Reset();
+  Stats Get();
+  size_t LiveBytes();
+
+  // Allocations made while one of these is in scope aren't counted.
+  class Untracked
+  {
+  public:
+      Untracked();
+      ~Untracked();
+  };
+}
+
+#endif // __HOST_HEAP__
@@ -0,0 +1,8 @@
+#ifndef __HOST_LITTLEFS__
+#define __HOST_LITTLEFS__
+
+#include "FS.h"
+
+extern FS LittleFS;
+
+#endif // __HOST_LITTLEFS__
@@ -0,0 +1,297 @@
+#include "WiFiClientSecure.h"
+#include "HostHeap.h"
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+
+namespace BearSSL {
+
+// About what BearSSL takes on an 80 MHz ESP8266: an ECDHE key exchange and checking the
+//  server's chain for a full handshake, and only the symmetric crypto for a resumed one.
+unsigned long WiFiClientSecure::full_handshake_millis = 1500;
+unsigned long WiFiClientSecure::resumed_handshake_millis = 40;
+
+namespace {
+
+// br_ssl_client_context and br_x509_minimal_context, roughly.
+const size_t ENGINE_SIZE = 4600;
+const unsigned long HANDSHAKE_TIMEOUT = 15000;
+
+SSL_CTX* clientContext() {
+  static SSL_CTX* context = NULL;
+  if(context == NULL) {
+    context = SSL_CTX_new(TLS_client_method());
+    SSL_CTX_set_max_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);    // Only what's in a Session is resumed
+  }
+  return context;
+}
+
+}
+
+// ----------------------------------------------------------------------
+
+X509List::~X509List() {
+  for(br_x509_certificate& cert : certs)
+    free(cert.data);
+}
+
+bool X509List::append(const char* pem) {
+  std::vector<std::vector<uint8_t>> ders;
+  {
+    HostHeap::Untracked untracked;
+    BIO* bio = BIO_new_mem_buf(pem, -1);
+    X509* x509;
+    while((x509 = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+      unsigned char* der = NULL;
+      int length = i2d_X509(x509, &der);
+      if(length > 0)
+        ders.push_back(std::vector<uint8_t>(der, der + length));
+      OPENSSL_free(der);
+      X509_free(x509);
+    }
+    ERR_clear_error();
+    BIO_free(bio);
+  }
+
+  bool appended = false;
+  for(const std::vector<uint8_t>& der : ders)
+    appended = append(der.data(), der.size()) || appended;
+
+  HostHeap::Untracked untracked;
+  ders.clear();
+  return appended;
+}
+
+bool X509List::append(const uint8_t* der, size_t length) {
+  br_x509_certificate cert;
+  cert.data = (unsigned char*)malloc(length);
+  if(cert.data == NULL)
+    return false;
+  memcpy(cert.data, der, length);
+  cert.data_len = length;
+  certs.push_back(cert);
+  return true;
+}
+
+// ----------------------------------------------------------------------
+
+WiFiClientSecure::~WiFiClientSecure() {
+  stop();
+}
+
+void WiFiClientSecure::setBufferSizes(int recv, int xmit) {
+  recv = std::max(512, std::min(16384, recv));
+  xmit = std::max(512, std::min(16384, xmit));
+  iobuf_in_size = recv + 325;
+  iobuf_out_size = xmit + 85;
+}
+
+int WiFiClientSecure::getLastSSLError(char* dest, size_t length) {
+  if(dest && length > 0)
+    snprintf(dest, length, "%s", last_error ? ERR_reason_error_string(last_error) : "");
+  return last_error;
+}
+
+bool WiFiClientSecure::probeMaxFragmentLength(const char* host, uint16_t port, uint16_t length) {
+  HostEndpoint* endpoint = HostNetwork::Find(host, port);
+  delay(2 * HostNetwork::round_trip_millis);      // Connecting, and a ClientHello
+  return endpoint != NULL && endpoint->MaxFragmentLength();
+}
+
+int WiFiClientSecure::connect(const char* host, uint16_t port) {
+  stop();
+
+  iobuf_in = (uint8_t*)malloc(iobuf_in_size);
+  iobuf_out = (uint8_t*)malloc(iobuf_out_size);
+  engine = (uint8_t*)malloc(ENGINE_SIZE);
+  if(iobuf_in == NULL || iobuf_out == NULL || engine == NULL || !WiFiClient::connect(host, port)) {
+    stop();
+    return 0;
+  }
+
+  if(!handshake(host)) {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+bool WiFiClientSecure::handshake(const char* host) {
+  HostHeap::Untracked untracked;
+  if(!insecure && (trust_anchors == NULL || trust_anchors->getCount() == 0))
+    return false;
+
+  ssl = SSL_new(clientContext());
+  SSL_set_bio(ssl, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+  SSL_set_connect_state(ssl);
+  SSL_set_tlsext_host_name(ssl, host);
+
+  if(insecure) {
+    SSL_set_verify(ssl, SSL_VERIFY_NONE, NULL);
+  } else {
+    // As BearSSL, any certificate in the chain can be the trust anchor.
+    X509_STORE* store = X509_STORE_new();
+    const br_x509_certificate* certs = trust_anchors->getX509Certs();
+    size_t i;
+    for(i = 0; i < trust_anchors->getCount(); i++) {
+      const unsigned char* der = certs[i].data;
+      X509* x509 = d2i_X509(NULL, &der, certs[i].data_len);
+      if(x509) {
+        X509_STORE_add_cert(store, x509);
+        X509_free(x509);
+      }
+    }
+    SSL_set0_verify_cert_store(ssl, store);
+    SSL_set_verify(ssl, SSL_VERIFY_PEER, NULL);
+    SSL_set1_host(ssl, host);
+    // The firmware doesn't give BearSSL the time (setX509Time()), so validity dates aren't checked.
+    X509_VERIFY_PARAM_set_flags(SSL_get0_param(ssl), X509_V_FLAG_PARTIAL_CHAIN | X509_V_FLAG_NO_CHECK_TIME);
+  }
+
+  if(session && session->saved)
+    SSL_set_session(ssl, session->saved.get());
+
+  while(true) {
+    int result = SSL_do_handshake(ssl);
+    if(!flushOutgoing())
+      return false;
+    if(result == 1)
+      break;
+    if(SSL_get_error(ssl, result) != SSL_ERROR_WANT_READ || !waitForIncoming()) {
+      last_error = ERR_peek_last_error();
+      ERR_clear_error();
+      return false;
+    }
+    readIncoming();
+  }
+
+  resumed = SSL_session_reused(ssl);
+  if(session)
+    session->saved = std::shared_ptr<ssl_session_st>(SSL_get1_session(ssl), SSL_SESSION_free);
+  delay(resumed ? resumed_handshake_millis : full_handshake_millis);
+  return true;
+}
+
+// Sends whatever OpenSSL has written.
+bool WiFiClientSecure::flushOutgoing() {
+  BIO* out = SSL_get_wbio(ssl);
+  uint8_t buffer[2048];
+  int length;
+  while((length = BIO_read(out, buffer, sizeof(buffer))) > 0) {
+    if(WiFiClient::write(buffer, length) != (size_t)length)
+      return false;
+  }
+  return true;
+}
+
+// Hands OpenSSL whatever has arrived, and decrypts what it can.
+void WiFiClientSecure::readIncoming() {
+  HostHeap::Untracked untracked;
+  uint8_t buffer[2048];
+  int length;
+  while((length = WiFiClient::read(buffer, sizeof(buffer))) > 0)
+    BIO_write(SSL_get_rbio(ssl), buffer, length);
+
+  if(!SSL_is_init_finished(ssl))
+    return;
+  while((length = SSL_read(ssl, buffer, sizeof(buffer))) > 0)
+    plaintext.insert(plaintext.end(), buffer, buffer + length);
+  if(SSL_get_error(ssl, length) == SSL_ERROR_ZERO_RETURN)
+    close_notified = true;
+  ERR_clear_error();
+}
+
+// Blocks, as BearSSL does during the handshake, until the server's next bytes arrive.
+bool WiFiClientSecure::waitForIncoming() {
+  unsigned long start = millis();
+  while(WiFiClient::available() == 0) {
+    uint64_t arrival = connection ? connection->NextArrival() : 0;
+    if(arrival == 0 || !connection->Open())
+      return false;
+    if(arrival - HostClock::WorldMillis() > HANDSHAKE_TIMEOUT - (millis() - start)) {
+      delay(HANDSHAKE_TIMEOUT - (millis() - start));
+      return false;
+    }
+    delay(arrival - HostClock::WorldMillis());
+  }
+  return true;
+}
+
+uint8_t WiFiClientSecure::connected() {
+  if(available() > 0)
+    return true;
+  return ssl != NULL && !close_notified && connection && connection->Open();
+}
+
+void WiFiClientSecure::stop() {
+  {
+    HostHeap::Untracked untracked;
+    // OpenSSL won't resume a session whose connection was dropped without a close_notify.
+    //  BearSSL doesn't mind, and the firmware only ever drops connections.
+    if(ssl) {
+      SSL_set_shutdown(ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+      SSL_free(ssl);
+    }
+    ssl = NULL;
+    plaintext.clear();
+    plaintext.shrink_to_fit();
+  }
+  close_notified = false;
+  resumed = false;
+  WiFiClient::stop();
+  freeBuffers();
+}
+
+void WiFiClientSecure::freeBuffers() {
+  free(iobuf_in);
+  free(iobuf_out);
+  free(engine);
+  iobuf_in = iobuf_out = engine = NULL;
+}
+
+size_t WiFiClientSecure::write(const uint8_t* buffer, size_t size) {
+  if(ssl == NULL || !connected())
+    return 0;
+
+  HostHeap::Untracked untracked;
+  if(SSL_write(ssl, buffer, size) != (int)size) {
+    ERR_clear_error();
+    return 0;
+  }
+  return flushOutgoing() ? size : 0;
+}
+
+int WiFiClientSecure::availableForWrite() {
+  return ssl && connected() ? iobuf_out_size - 85 : 0;
+}
+
+int WiFiClientSecure::available() {
+  if(ssl == NULL)
+    return 0;
+  readIncoming();
+  return plaintext.size();
+}
+
+int WiFiClientSecure::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClientSecure::read(uint8_t* buffer, size_t size) {
+  size_t length = std::min(size, (size_t)available());
+  if(length == 0)
+    return 0;
+  HostHeap::Untracked untracked;
+  memcpy(buffer, plaintext.data(), length);
+  plaintext.erase(plaintext.begin(), plaintext.begin() + length);
+  return length;
+}
+
+int WiFiClientSecure::peek() {
+  return available() > 0 ? plaintext[0] : -1;
+}
+
+}
@@ -0,0 +1,117 @@
+#ifndef __HOST_WIFICLIENTSECURE__
+#define __HOST_WIFICLIENTSECURE__
+
+#include "ESP8266WiFi.h"
+
+// ----------------------------------------------------------------------
+// Host stand-in for the core's BearSSL client, using OpenSSL.
+//
+//  The TLS is real (1.2, as BearSSL), over the in-memory connections of ESP8266WiFi.h, so
+//  certificates are verified, and a saved Session really is resumed, or not.  What BearSSL
+//  costs on a board is added on top: its buffers and context are allocated from the heap
+//  (and counted by HostHeap) while connected, and the clock is moved on by the time its
+//  handshake takes on an 80 MHz ESP8266.  OpenSSL's own allocations aren't counted.
+
+struct ssl_st;
+struct ssl_session_st;
+
+struct br_x509_certificate {
+  unsigned char* data;
+  size_t data_len;
+};
+
+namespace BearSSL {
+
+class X509List
+{
+public:
+    X509List() {}
+    X509List(const char* pem) { append(pem); }
+    X509List(const uint8_t* der, size_t length) { append(der, length); }
+    X509List(const X509List&) = delete;
+    X509List& operator=(const X509List&) = delete;
+    ~X509List();
+
+    bool append(const char* pem);
+    bool append(const uint8_t* der, size_t length);
+    size_t getCount() const { return certs.size(); }
+    const br_x509_certificate* getX509Certs() const { return certs.data(); }
+
+private:
+    std::vector<br_x509_certificate> certs;
+};
+
+class Session
+{
+public:
+    // Host only
+    bool Saved() const { return (bool)saved; }
+
+private:
+    friend class WiFiClientSecure;
+    std::shared_ptr<ssl_session_st> saved;
+};
+
+class WiFiClientSecure : public WiFiClient
+{
+public:
+    WiFiClientSecure() {}
+    WiFiClientSecure(const WiFiClientSecure&) = delete;
+    WiFiClientSecure& operator=(const WiFiClientSecure&) = delete;
+    ~WiFiClientSecure() override;
+
+    int connect(const char* host, uint16_t port) override;
+    uint8_t connected() override;
+    void stop() override;
+
+    size_t write(const uint8_t* buffer, size_t size) override;
+    using WiFiClient::write;
+    int availableForWrite() override;
+    int available() override;
+    int read() override;
+    int read(uint8_t* buffer, size_t size) override;
+    int peek() override;
+
+    void setSession(Session* session)                 { this->session = session; }
+    void setTrustAnchors(const X509List* anchors)     { trust_anchors = anchors; insecure = false; }
+    void setInsecure()                                { insecure = true; }
+    void setBufferSizes(int recv, int xmit);
+    int getLastSSLError(char* dest = NULL, size_t length = 0);
+
+    static bool probeMaxFragmentLength(const char* host, uint16_t port, uint16_t length);
+
+    // Host only
+    bool Resumed() const { return resumed; }
+    static unsigned long full_handshake_millis;       // BearSSL's key exchange, on a board
+    static unsigned long resumed_handshake_millis;
+
+private:
+    bool handshake(const char* host);
+    bool flushOutgoing();
+    void readIncoming();
+    bool waitForIncoming();
+    void freeBuffers();
+
+    ssl_st* ssl = NULL;
+    Session* session = NULL;
+    const X509List* trust_anchors = NULL;
+    bool insecure = false;
+    bool resumed = false;
+    bool close_notified = false;
+    int last_error = 0;
+    std::vector<uint8_t> plaintext;
+
+    // As BearSSL's, which are allocated on connecting, and freed on stopping.
+    int iobuf_in_size = 16384 + 325;
+    int iobuf_out_size = 512 + 85;
+    uint8_t* iobuf_in = NULL;
+    uint8_t* iobuf_out = NULL;
+    uint8_t* engine = NULL;
+};
+
+}
+
+using BearSSL::X509List;
+using BearSSL::WiFiClientSecure;
+
+#endif // __HOST_WIFICLIENTSECURE__
@@ -0,0 +1,28 @@
+#ifndef __HOST_WIFIMANAGER__
+#define __HOST_WIFIMANAGER__
+
+#include "ESP8266WiFi.h"
+
+// ----------------------------------------------------------------------
+// Host stand-in for WiFiManager's declarations.  Only the sketch itself uses it, and that
+//  isn't built on the host.
+
+class WiFiManagerParameter
+{
+public:
+    WiFiManagerParameter(const char* id, const char* placeholder, const char* defaultValue, int length) {}
+    const char* getValue() { return ""; }
+};
+
+class WiFiManager
+{
+public:
+    void setConfigPortalTimeout(unsigned long seconds) {}
+    void setConnectTimeout(unsigned long seconds) {}
+    void addParameter(WiFiManagerParameter* parameter) {}
+    void setSaveConfigCallback(std::function<void()> callback) {}
+    bool autoConnect(const char* apName) { return WiFi.begin(NULL) == WL_CONNECTED; }
+    void erase() {}
+};
+
+#endif // __HOST_WIFIMANAGER__
@@ -0,0 +1,56 @@
+#include "Wire.h"
+
+TwoWire Wire;
+
+void TwoWire::Attach(uint8_t address, I2CDevice* device) {
+  devices[address & 0x7F] = device;
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+  tx_address = address & 0x7F;
+  tx_length = 0;
+}
+
+uint8_t TwoWire::endTransmission(bool sendStop) {
+  transactions++;
+  I2CDevice* device = devices[tx_address];
+  if(device == NULL)
+    return 2;
+  return device->Write(tx_buffer, tx_length) ? 0 : 3;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, size_t length, bool sendStop) {
+  transactions++;
+  rx_index = rx_length = 0;
+  I2CDevice* device = devices[address & 0x7F];
+  if(device == NULL)
+    return 0;
+  rx_length = device->Read(rx_buffer, std::min(length, BUFFER_LENGTH));
+  return rx_length;
+}
+
+size_t TwoWire::write(uint8_t c) {
+  if(tx_length >= BUFFER_LENGTH)
+    return 0;
+  tx_buffer[tx_length++] = c;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t* data, size_t length) {
+  size_t written = 0;
+  while(written < length && write(data[written]))
+    written++;
+  return written;
+}
+
+int TwoWire::available() {
+  return rx_length - rx_index;
+}
+
+int TwoWire::read() {
+  return rx_index < rx_length ? rx_buffer[rx_index++] : -1;
+}
+
+int TwoWire::peek() {
+  return rx_index < rx_length ? rx_buffer[rx_index] : -1;
+}
@@ -0,0 +1,62 @@
+#ifndef __HOST_WIRE__
+#define __HOST_WIRE__
+
+#include "Arduino.h"
+
+// ----------------------------------------------------------------------
+// Host stand-in for the core's I2C master, with devices modelled by the tests.
+
+// Host only: a device on the bus.
+class I2CDevice
+{
+public:
+    virtual ~I2CDevice() {}
+
+    // A write transaction, after the address.  Returns false if the device doesn't ACK.
+    virtual bool Write(const uint8_t* data, size_t length) = 0;
+
+    // A read transaction.  Returns how many bytes the device sent.
+    virtual size_t Read(uint8_t* data, size_t length) = 0;
+};
+
+class TwoWire : public Stream
+{
+public:
+    void begin() {}
+    void begin(int sda, int scl) {}
+    void setClock(uint32_t frequency) {}
+
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+    // 0 on success, 2 when the address isn't ACKed, 3 when the data isn't.
+    uint8_t endTransmission(bool sendStop = true);
+    uint8_t requestFrom(uint8_t address, size_t length, bool sendStop = true);
+    uint8_t requestFrom(int address, int length) { return requestFrom((uint8_t)address, (size_t)length); }
+
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* data, size_t length) override;
+    using Print::write;
+    int available() override;
+    int read() override;
+    int peek() override;
+
+    // Host only
+    void Attach(uint8_t address, I2CDevice* device);
+    void Detach(uint8_t address) { Attach(address, NULL); }
+    uint32_t transactions = 0;
+
+private:
+    static const size_t BUFFER_LENGTH = 32;
+
+    I2CDevice* devices[128] = {};
+    uint8_t tx_address = 0;
+    uint8_t tx_buffer[BUFFER_LENGTH];
+    size_t tx_length = 0;
+    uint8_t rx_buffer[BUFFER_LENGTH];
+    size_t rx_length = 0;
+    size_t rx_index = 0;
+};
+
+extern TwoWire Wire;
+
+#endif // __HOST_WIRE__
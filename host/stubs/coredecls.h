@@ -0,0 +1,9 @@
+#ifndef __HOST_COREDECLS__
+#define __HOST_COREDECLS__
+
+#include <functional>
+
+// Called whenever the clock is set.  fromSntp is false for settimeofday() calls.
+void settimeofday_cb(const std::function<void(bool)>& callback);
+
+#endif // __HOST_COREDECLS__
@@ -0,0 +1,10 @@
+#ifndef __HOST_USER_INTERFACE__
+#define __HOST_USER_INTERFACE__
+
+#include <stdint.h>
+
+// The RTC timer, in cycles of system_rtc_clock_cali_proc() / 4096 microseconds.
+uint32_t system_get_rtc_time(void);
+uint32_t system_rtc_clock_cali_proc(void);
+
+#endif // __HOST_USER_INTERFACE__
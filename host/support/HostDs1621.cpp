@@ -0,0 +1,91 @@
+#include "HostDs1621.h"
+#include <math.h>
+
+const uint8_t DS1621_BASE_ADDRESS = 0x48;
+
+const uint8_t READ_TEMPERATURE = 0xAA;
+const uint8_t READ_COUNTER = 0xA8;
+const uint8_t READ_SLOPE = 0xA9;
+const uint8_t ACCESS_CONFIG = 0xAC;
+const uint8_t START_CONVERT = 0xEE;
+
+const uint8_t CONFIG_DONE = 0x80;
+const uint8_t CONFIG_ONE_SHOT = 0x01;
+const uint8_t CONFIG_WRITABLE = 0x03;       // POL and 1SHOT
+
+// COUNT_PER_C is 16 on the parts seen so far.
+const uint8_t COUNT_PER_C = 16;
+
+HostDs1621::HostDs1621(int channel) : address(DS1621_BASE_ADDRESS + channel) {
+  Wire.Attach(address, this);
+}
+
+HostDs1621::~HostDs1621() {
+  Wire.Detach(address);
+}
+
+bool HostDs1621::Converting() const {
+  return converting && (stuck || millis() - conversion_start < conversion_millis);
+}
+
+void HostDs1621::FinishConversion() {
+  if(converting && !Converting()) {
+    converting = false;
+    converted = temp;
+    have_reading = true;
+  }
+}
+
+bool HostDs1621::Write(const uint8_t* data, size_t length) {
+  if(length == 0)
+    return true;
+  command = data[0];
+  FinishConversion();
+
+  if(command == START_CONVERT) {
+    if(refuse_start)
+      return false;
+    converting = true;
+    conversion_start = millis();
+    conversions++;
+  } else if(command == ACCESS_CONFIG && length > 1) {
+    config = (config & ~CONFIG_WRITABLE) | (data[1] & CONFIG_WRITABLE);
+  }
+  return true;
+}
+
+// The counters give the fraction above TEMP_READ - 0.25, so TEMP_READ is picked to keep that
+//  fraction between 0 and 1, and the high resolution reading is the temperature to 1/16 C.
+size_t HostDs1621::Read(uint8_t* data, size_t length) {
+  FinishConversion();
+
+  float reading = have_reading ? converted : 0;
+  int whole = (int)floorf(reading + 0.25f);
+  int remain = COUNT_PER_C - (int)lroundf((reading - whole + 0.25f) * COUNT_PER_C);
+  remain = remain < 0 ? 0 : remain > COUNT_PER_C ? COUNT_PER_C : remain;
+
+  uint8_t reply[2] = { 0, 0 };
+  size_t size = 1;
+  switch(command) {
+    case ACCESS_CONFIG:
+      reply[0] = config | (Converting() ? 0 : CONFIG_DONE);
+      break;
+    case READ_TEMPERATURE:
+      reply[0] = (uint8_t)(int8_t)whole;
+      reply[1] = reading - whole >= 0.5f ? 0x80 : 0;
+      size = 2;
+      break;
+    case READ_COUNTER:
+      reply[0] = remain;
+      break;
+    case READ_SLOPE:
+      reply[0] = COUNT_PER_C;
+      break;
+    default:
+      return 0;
+  }
+
+  size = size < length ? size : length;
+  memcpy(data, reply, size);
+  return size;
+}
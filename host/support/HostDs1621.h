@@ -0,0 +1,46 @@
+#ifndef __HOST_DS1621__
+#define __HOST_DS1621__
+
+#include <Wire.h>
+
+// ----------------------------------------------------------------------
+// Host only: a DS1621 on the I2C bus, for the sensor tests.
+//
+//  Answers the commands SensorInterface uses: the configuration register, starting a
+//  conversion, and the temperature, counter and slope registers.  A one-shot conversion takes
+//  conversion_millis, and then the registers hold the temperature set when it started.  One
+//  that's stuck never finishes, as a sensor browning out part way through does, and one that
+//  refuses to start doesn't acknowledge the command, as on a noisy bus.
+
+class HostDs1621 : public I2CDevice
+{
+public:
+    // Attaches itself to the bus at 0x48 + channel, and detaches when destroyed.
+    explicit HostDs1621(int channel);
+    ~HostDs1621();
+    HostDs1621(const HostDs1621&) = delete;
+    HostDs1621& operator=(const HostDs1621&) = delete;
+
+    bool Write(const uint8_t* data, size_t length) override;
+    size_t Read(uint8_t* data, size_t length) override;
+
+    float temp = 20;                        // C, what the next conversion will read
+    unsigned long conversion_millis = 750;
+    bool stuck = false;
+    bool refuse_start = false;
+    uint32_t conversions = 0;
+
+private:
+    bool Converting() const;
+    void FinishConversion();
+
+    uint8_t address;
+    uint8_t config = 0;                     // One-shot off, as shipped
+    uint8_t command = 0;
+    bool converting = false;
+    unsigned long conversion_start = 0;
+    float converted = 0;
+    bool have_reading = false;
+};
+
+#endif // __HOST_DS1621__
@@ -0,0 +1,307 @@
+#include "HostHttpServer.h"
+#include "HostHeap.h"
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <strings.h>
+#include <algorithm>
+
+struct HostHttpServer::Connection {
+  std::shared_ptr<HostConnection> connection;
+  int number;
+  SSL* ssl;
+  bool handshaken;
+  std::string input;
+  int served;
+};
+
+namespace {
+
+const char* reasonPhrase(int status) {
+  switch(status) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 204: return "No Content";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 500: return "Internal Server Error";
+    case 502: return "Bad Gateway";
+    case 503: return "Service Unavailable";
+    case 504: return "Gateway Timeout";
+    default:  return "Unknown";
+  }
+}
+
+}
+
+std::string HostHttpRequest::Header(const char* name) const {
+  for(const auto& header : headers) {
+    if(strcasecmp(header.first.c_str(), name) == 0)
+      return header.second;
+  }
+  return std::string();
+}
+
+// ----------------------------------------------------------------------
+
+HostHttpServer::HostHttpServer(const char* host, uint16_t port, bool tls) :
+  host(host), port(port), tls(tls)
+{
+  HostHeap::Untracked untracked;
+  handler = [](const HostHttpRequest&) { return HostHttpResponse(); };
+
+  if(tls) {
+    // A self-signed certificate for the host name, which the firmware can take as its root.
+    key = EVP_EC_gen("P-256");
+    certificate = X509_new();
+    X509_set_version(certificate, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(certificate), 1);
+    ASN1_TIME_set(X509_getm_notBefore(certificate), 0);
+    ASN1_TIME_set(X509_getm_notAfter(certificate), 4102444800);     // 2100
+    X509_NAME* name = X509_get_subject_name(certificate);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char*)host, -1, -1, 0);
+    X509_set_issuer_name(certificate, name);
+    X509_set_pubkey(certificate, key);
+
+    X509V3_CTX extensions;
+    X509V3_set_ctx_nodb(&extensions);
+    X509V3_set_ctx(&extensions, certificate, certificate, NULL, NULL, 0);
+    std::string altName = std::string("DNS:") + host;
+    X509_EXTENSION* extension = X509V3_EXT_conf_nid(NULL, &extensions, NID_subject_alt_name, altName.c_str());
+    X509_add_ext(certificate, extension, -1);
+    X509_EXTENSION_free(extension);
+    extension = X509V3_EXT_conf_nid(NULL, &extensions, NID_basic_constraints, "critical,CA:TRUE");
+    X509_add_ext(certificate, extension, -1);
+    X509_EXTENSION_free(extension);
+    X509_sign(certificate, key, EVP_sha256());
+
+    context = SSL_CTX_new(TLS_server_method());
+    SSL_CTX_set_max_proto_version(context, TLS1_2_VERSION);
+    SSL_CTX_use_certificate(context, certificate);
+    SSL_CTX_use_PrivateKey(context, key);
+    SSL_CTX_set_session_id_context(context, (const unsigned char*)"host", 4);
+  }
+
+  HostNetwork::Listen(host, port, this);
+}
+
+HostHttpServer::~HostHttpServer() {
+  HostHeap::Untracked untracked;
+  HostNetwork::Unlisten(host.c_str(), port);
+  while(!open.empty())
+    forget(open.back());
+  requests.clear();
+  handler = nullptr;
+  if(context)
+    SSL_CTX_free(context);
+  if(certificate)
+    X509_free(certificate);
+  if(key)
+    EVP_PKEY_free(key);
+}
+
+std::string HostHttpServer::CertificatePem() const {
+  HostHeap::Untracked untracked;
+  if(certificate == NULL)
+    return std::string();
+  BIO* bio = BIO_new(BIO_s_mem());
+  PEM_write_bio_X509(bio, certificate);
+  char* data;
+  long length = BIO_get_mem_data(bio, &data);
+  std::string pem(data, length);
+  BIO_free(bio);
+  return pem;
+}
+
+void HostHttpServer::CloseAll() {
+  HostHeap::Untracked untracked;
+  while(!open.empty()) {
+    open.back()->connection->Close();
+    forget(open.back());
+  }
+}
+
+// ----------------------------------------------------------------------
+
+bool HostHttpServer::Accept(const std::shared_ptr<HostConnection>& connection) {
+  if(down)
+    return false;
+
+  HostHeap::Untracked untracked;
+  Connection* c = new Connection{ connection, ++connections, NULL, !tls, std::string(), 0 };
+  if(tls) {
+    c->ssl = SSL_new(context);
+    SSL_set_bio(c->ssl, BIO_new(BIO_s_mem()), BIO_new(BIO_s_mem()));
+    SSL_set_accept_state(c->ssl);
+  }
+  open.push_back(c);
+  return true;
+}
+
+HostHttpServer::Connection* HostHttpServer::find(HostConnection& connection) {
+  for(Connection* c : open) {
+    if(c->connection.get() == &connection)
+      return c;
+  }
+  return NULL;
+}
+
+void HostHttpServer::forget(Connection* connection) {
+  open.erase(std::find(open.begin(), open.end(), connection));
+  if(connection->ssl) {
+    SSL_set_shutdown(connection->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);     // Keeps the session resumable
+    SSL_free(connection->ssl);
+  }
+  delete connection;
+}
+
+void HostHttpServer::Closed(HostConnection& connection) {
+  HostHeap::Untracked untracked;
+  Connection* c = find(connection);
+  if(c)
+    forget(c);
+}
+
+// What OpenSSL has written goes back to the board, arriving after delayMillis.
+void HostHttpServer::flush(Connection& connection, unsigned long delayMillis) {
+  BIO* out = SSL_get_wbio(connection.ssl);
+  uint8_t buffer[4096];
+  int length;
+  while((length = BIO_read(out, buffer, sizeof(buffer))) > 0)
+    connection.connection->Send(buffer, length, delayMillis);
+}
+
+void HostHttpServer::Received(HostConnection& connection, const uint8_t* data, size_t length) {
+  HostHeap::Untracked untracked;
+  Connection* c = find(connection);
+  if(c == NULL)
+    return;
+
+  // Anything from the board puts off closing the connection for being idle.
+  connection.CancelClose();
+
+  if(!tls) {
+    c->input.append((const char*)data, length);
+    serve(*c);
+    return;
+  }
+
+  BIO_write(SSL_get_rbio(c->ssl), data, length);
+  if(!c->handshaken) {
+    int result = SSL_do_handshake(c->ssl);
+    flush(*c, HostNetwork::round_trip_millis);
+    if(result != 1) {
+      if(SSL_get_error(c->ssl, result) != SSL_ERROR_WANT_READ) {
+        ERR_clear_error();
+        connection.Close(HostNetwork::round_trip_millis);
+        forget(c);
+      }
+      return;
+    }
+    c->handshaken = true;
+    if(SSL_session_reused(c->ssl))
+      resumed_handshakes++;
+    else
+      full_handshakes++;
+  }
+
+  uint8_t buffer[4096];
+  int read;
+  while((read = SSL_read(c->ssl, buffer, sizeof(buffer))) > 0)
+    c->input.append((const char*)buffer, read);
+  ERR_clear_error();
+  serve(*c);
+}
+
+// Answers each whole request received so far.
+void HostHttpServer::serve(Connection& connection) {
+  while(true) {
+    size_t end = connection.input.find("\r\n\r\n");
+    if(end == std::string::npos)
+      return;
+
+    HostHttpRequest request;
+    std::string head = connection.input.substr(0, end);
+    size_t lineEnd = head.find("\r\n");
+    std::string line = head.substr(0, lineEnd);
+    size_t space = line.find(' ');
+    request.method = line.substr(0, space);
+    request.path = line.substr(space + 1, line.rfind(' ') - space - 1);
+
+    size_t start = lineEnd == std::string::npos ? head.size() : lineEnd + 2;
+    while(start < head.size()) {
+      size_t next = head.find("\r\n", start);
+      if(next == std::string::npos)
+        next = head.size();
+      std::string header = head.substr(start, next - start);
+      size_t colon = header.find(':');
+      if(colon != std::string::npos) {
+        size_t value = header.find_first_not_of(' ', colon + 1);
+        request.headers.push_back(std::make_pair(header.substr(0, colon), value == std::string::npos ? std::string() : header.substr(value)));
+      }
+      start = next + 2;
+    }
+
+    size_t bodyLength = strtoul(request.Header("Content-Length").c_str(), NULL, 10);
+    if(connection.input.size() < end + 4 + bodyLength)
+      return;
+    request.body = connection.input.substr(end + 4, bodyLength);
+    connection.input.erase(0, end + 4 + bodyLength);
+
+    request.connection = connection.number;
+    request.reused = connection.served++ > 0;
+    requests.push_back(request);
+
+    HostHttpResponse response = handler(request);
+    if(strcasecmp(request.Header("Connection").c_str(), "close") == 0)
+      response.close = true;
+    respond(connection, response);
+    if(response.close)
+      return;
+  }
+}
+
+void HostHttpServer::respond(Connection& connection, const HostHttpResponse& response) {
+  char line[128];
+  std::string text;
+  snprintf(line, sizeof(line), "HTTP/1.1 %d %s\r\nContent-Type: %s\r\n", response.status, reasonPhrase(response.status), response.content_type.c_str());
+  text += line;
+  if(response.chunked)
+    text += "Transfer-Encoding: chunked\r\n";
+  else {
+    snprintf(line, sizeof(line), "Content-Length: %u\r\n", (unsigned)response.body.size());
+    text += line;
+  }
+  text += response.close ? "Connection: close\r\n\r\n" : "Connection: keep-alive\r\n\r\n";
+  if(response.chunked) {
+    if(!response.body.empty()) {
+      snprintf(line, sizeof(line), "%x\r\n", (unsigned)response.body.size());
+      text += line;
+      text += response.body;
+      text += "\r\n";
+    }
+    text += "0\r\n\r\n";
+  } else {
+    text += response.body;
+  }
+
+  unsigned long delayMillis = HostNetwork::round_trip_millis + response.delay_millis;
+  std::shared_ptr<HostConnection> board = connection.connection;
+  if(tls) {
+    SSL_write(connection.ssl, text.data(), text.size());
+    if(response.close)
+      SSL_shutdown(connection.ssl);
+    flush(connection, delayMillis);
+  } else {
+    board->Send((const uint8_t*)text.data(), text.size(), delayMillis);
+  }
+
+  if(response.close) {
+    board->Close(delayMillis);
+    forget(&connection);
+  } else {
+    board->Close(delayMillis + keep_alive_millis);
+  }
+}
@@ -0,0 +1,86 @@
+#ifndef __HOST_HTTP_SERVER__
+#define __HOST_HTTP_SERVER__
+
+#include <ESP8266WiFi.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+struct ssl_ctx_st;
+struct evp_pkey_st;
+struct x509_st;
+
+// ----------------------------------------------------------------------
+// Host only: an HTTP(S) server for the firmware's client to post to.
+//
+//  It listens on the in-memory network of the ESP8266WiFi.h stand-in, with a self-signed
+//  certificate for its host name, and keeps connections alive between requests until they've
+//  been idle for keep_alive_millis.  Every request is kept, and connections and handshakes are
+//  counted, so a test can check what the firmware sent and how.
+
+struct HostHttpRequest {
+  std::string method;
+  std::string path;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+  int connection;                 // Numbered from 1, in the order accepted
+  bool reused;                    // Not the connection's first request
+
+  std::string Header(const char* name) const;
+};
+
+struct HostHttpResponse {
+  int status = 200;
+  std::string body = "{}";
+  std::string content_type = "application/json";
+  bool close = false;             // Send "Connection: close", and close after the response
+  bool chunked = false;
+  unsigned long delay_millis = 0; // Time taken to answer, on top of the round trip
+};
+
+class HostHttpServer : public HostEndpoint
+{
+public:
+    HostHttpServer(const char* host, uint16_t port = 443, bool tls = true);
+    ~HostHttpServer();
+
+    // The certificate, to give the firmware as its root certificate.
+    std::string CertificatePem() const;
+
+    // Closes every connection, as a server restarting would.
+    void CloseAll();
+
+    std::function<HostHttpResponse(const HostHttpRequest&)> handler;
+    bool down = false;                      // Refuses connections
+    bool max_fragment_length = true;
+    unsigned long keep_alive_millis = 60000;
+
+    std::vector<HostHttpRequest> requests;
+    int connections = 0;
+    int full_handshakes = 0;
+    int resumed_handshakes = 0;
+
+    bool Accept(const std::shared_ptr<HostConnection>& connection) override;
+    void Received(HostConnection& connection, const uint8_t* data, size_t length) override;
+    void Closed(HostConnection& connection) override;
+    bool MaxFragmentLength() override { return tls && max_fragment_length && !down; }   // A probe's refused too
+
+private:
+    struct Connection;
+
+    Connection* find(HostConnection& connection);
+    void flush(Connection& connection, unsigned long delayMillis);
+    void serve(Connection& connection);
+    void respond(Connection& connection, const HostHttpResponse& response);
+    void forget(Connection* connection);
+
+    std::string host;
+    uint16_t port;
+    bool tls;
+    ssl_ctx_st* context = NULL;
+    evp_pkey_st* key = NULL;
+    x509_st* certificate = NULL;
+    std::vector<Connection*> open;
+};
+
+#endif // __HOST_HTTP_SERVER__
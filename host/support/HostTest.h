@@ -0,0 +1,63 @@
+#ifndef __HOST_TEST__
+#define __HOST_TEST__
+
+#include <Arduino.h>
+#include <stdio.h>
+#include <iostream>
+#include <string>
+
+// ----------------------------------------------------------------------
+// Host only: the checks the tests use.
+//
+//  Each failed check is printed and counted, and a test's main() returns HostTestResult(), so
+//  ctest sees the failure.  Tests carry on after a failed check, to show everything that's wrong.
+
+inline int& HostTestFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define CHECK(condition) \
+  do { \
+    if(!(condition)) { \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+      HostTestFailures()++; \
+    } \
+  } while(0)
+
+#define CHECK_EQUAL(expected, actual) \
+  do { \
+    auto expectedValue = (expected); \
+    auto actualValue = (actual); \
+    if(!(expectedValue == actualValue)) { \
+      std::cout << __FILE__ << ":" << __LINE__ << ": CHECK_EQUAL(" #expected ", " #actual ") failed: expected " \
+        << expectedValue << ", got " << actualValue << std::endl; \
+      HostTestFailures()++; \
+    } \
+  } while(0)
+
+#define RUN_TEST(test) \
+  do { \
+    int failuresBefore = HostTestFailures(); \
+    test(); \
+    printf("%s %s\n", HostTestFailures() == failuresBefore ? "pass" : "FAIL", #test); \
+  } while(0)
+
+// Collects what's printed to it, e.g. the event log.
+class HostPrint : public Print
+{
+public:
+    size_t write(uint8_t c) override { text += (char)c; return 1; }
+    size_t write(const uint8_t* data, size_t size) override { text.append((const char*)data, size); return size; }
+    using Print::write;
+
+    std::string text;
+};
+
+inline int HostTestResult() {
+  if(HostTestFailures() > 0)
+    printf("%d check(s) failed\n", HostTestFailures());
+  return HostTestFailures() == 0 ? 0 : 1;
+}
+
+#endif // __HOST_TEST__
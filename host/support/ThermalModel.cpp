@@ -0,0 +1,38 @@
+#include "ThermalModel.h"
+#include <math.h>
+
+const float SECONDS_PER_HOUR = 3600;
+const float MILLIS_PER_DAY = 24 * 3600 * 1000.0f;
+
+ThermalModel::ThermalModel(const Parameters& parameters) : p(parameters) {
+  Reset(p.room_mean);
+}
+
+void ThermalModel::Reset(float startTemp) {
+  air = startTemp;
+  mass = startTemp;
+}
+
+float ThermalModel::RoomTemp(unsigned long worldMillis) const {
+  // Coldest around 6am, warmest around 6pm.
+  float day = fmodf(worldMillis, MILLIS_PER_DAY) / MILLIS_PER_DAY;
+  return p.room_mean - p.room_swing * cosf((day - 0.25f) * 2 * M_PI);
+}
+
+// Small steps, so a simple Euler step is accurate enough for time constants of many minutes.
+void ThermalModel::Step(bool heaterOn, float seconds, unsigned long worldMillis) {
+  float room = RoomTemp(worldMillis);
+  float hours = seconds / SECONDS_PER_HOUR;
+
+  float airChange = (room - air) / p.air_to_room_hours + (mass - air) / p.air_to_mass_hours;
+  if(heaterOn)
+    airChange += p.heater_degrees_per_hour;
+  float massChange = (air - mass) / p.mass_to_air_hours;
+
+  air += airChange * hours;
+  mass += massChange * hours;
+}
+
+float ThermalModel::SensorTemp() const {
+  return roundf(mass / p.sensor_step) * p.sensor_step;
+}
@@ -0,0 +1,47 @@
+#ifndef __THERMAL_MODEL__
+#define __THERMAL_MODEL__
+
+// ----------------------------------------------------------------------
+// Host only: a fermenter in an old fridge, with a heater, for trying the heater control on.
+//
+//  The heater warms the air in the fridge, which warms the fermenter, which loses heat back
+//  to the air, and the air to the room outside.  The sensor is taped to the fermenter, so it
+//  lags the heater by the time the air takes to warm the fermenter, which is what makes simple
+//  on/off control overshoot.  The room warms and cools through the day.
+
+class ThermalModel
+{
+public:
+    struct Parameters {
+        float room_mean = 15;               // C
+        float room_swing = 3;               //  either side, over a day
+        float air_to_room_hours = 1.5;      // Time constant of the fridge air with the room
+        float air_to_mass_hours = 0.5;      //  and with the fermenter, as seen from the air
+        float mass_to_air_hours = 4;        // Time constant of the fermenter with the air
+        float heater_degrees_per_hour = 12; // How fast the heater alone warms the air
+        float sensor_step = 0.0625;         // The DS1621's high resolution step
+    };
+
+    ThermalModel() : ThermalModel(Parameters()) {}
+    explicit ThermalModel(const Parameters& parameters);
+
+    // The air and the fermenter both at startTemp.
+    void Reset(float startTemp);
+
+    // Moves on by seconds, with the heater on or off for all of it.
+    void Step(bool heaterOn, float seconds, unsigned long worldMillis);
+
+    float RoomTemp(unsigned long worldMillis) const;
+    float AirTemp() const      { return air; }
+    float MassTemp() const     { return mass; }
+
+    // What the sensor reads: the fermenter, in the sensor's steps.
+    float SensorTemp() const;
+
+private:
+    Parameters p;
+    float air = 0;
+    float mass = 0;
+};
+
+#endif // __THERMAL_MODEL__
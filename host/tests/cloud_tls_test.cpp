@@ -0,0 +1,202 @@
+// Posts to a local HTTPS server, checking that the connection is kept between posts, and that
+//  when it isn't, the saved TLS session is resumed rather than a full handshake done again.
+//  The server's asked for a smaller maximum fragment length (MFLN) up front, and asked again if
+//  it couldn't be reached.
+
+#include <CloudInterface.h>
+#include <EventLog.h>
+#include <HostHttpServer.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+#include <memory>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+
+DeviceConfig config;
+SampleBuffer samples;
+
+struct Post {
+  unsigned long millis;
+  std::string result;
+};
+
+std::unique_ptr<CloudInterface> setUp(HostHttpServer& server) {
+  LittleFS.Format();
+  LittleFS.SetContents(CloudInterface::ROOT_CERT_FILE, server.CertificatePem().c_str());
+  config.cloudLoggingUrl = "https://cloud.example/prod/readings";
+  config.cloudLoggingApiKey = "test-api-key";
+  std::unique_ptr<CloudInterface> cloud(new CloudInterface());
+  cloud->Setup();
+  return cloud;
+}
+
+// A new reading, posted from the test page, which waits for the response.
+Post post(CloudInterface& cloud) {
+  HostClock::Advance(10000);
+  samples.SetSample(0, 2000);
+  HostPrint out;
+  unsigned long start = millis();
+  cloud.WriteDataToCloud(samples, config, out);
+  return { millis() - start, out.text };
+}
+
+std::string logSince(uint32_t sequence) {
+  HostPrint out;
+  eventLog.PrintSince(out, sequence);
+  return out.text;
+}
+
+bool succeeded(const Post& post) {
+  return post.result.find("HTTP Response: 200") != std::string::npos;
+}
+
+void testKeepAliveReusesConnection() {
+  HostHttpServer server("cloud.example");
+  std::unique_ptr<CloudInterface> cloud = setUp(server);
+
+  Post first = post(*cloud);
+  Post second = post(*cloud);
+  Post third = post(*cloud);
+  CHECK(succeeded(first) && succeeded(second) && succeeded(third));
+  CHECK_EQUAL(1, server.connections);
+  CHECK_EQUAL(1, server.full_handshakes);
+  CHECK_EQUAL((size_t)3, server.requests.size());
+  CHECK(!server.requests[0].reused);
+  CHECK(server.requests[1].reused && server.requests[2].reused);
+  CHECK(second.result.find("reused connection") != std::string::npos);
+
+  // Only the round trip, without the TCP connection or the handshake.
+  CHECK(second.millis < first.millis / 10);
+  CHECK(third.millis < first.millis / 10);
+  printf("Kept alive: %lu ms for a new connection, then %lu and %lu ms\n", first.millis, second.millis, third.millis);
+
+  const HostHttpRequest& request = server.requests[0];
+  CHECK_EQUAL(std::string("POST"), request.method);
+  CHECK_EQUAL(std::string("/prod/readings"), request.path);
+  CHECK_EQUAL(std::string("test-api-key"), request.Header("x-api-key"));
+  CHECK_EQUAL(std::string("keep-alive"), request.Header("Connection"));
+  CHECK_EQUAL(std::string("application/json"), request.Header("Content-Type"));
+}
+
+void testClosedConnectionResumesSession() {
+  HostHttpServer server("cloud.example");
+  server.handler = [](const HostHttpRequest&) {
+    HostHttpResponse response;
+    response.close = true;
+    return response;
+  };
+  std::unique_ptr<CloudInterface> cloud = setUp(server);
+
+  Post first = post(*cloud);
+  Post second = post(*cloud);
+  Post third = post(*cloud);
+  CHECK(succeeded(first) && succeeded(second) && succeeded(third));
+  CHECK_EQUAL(3, server.connections);
+  CHECK_EQUAL(1, server.full_handshakes);
+  CHECK_EQUAL(2, server.resumed_handshakes);
+
+  // A resumed handshake skips the key exchange, which is most of a full one.
+  CHECK(second.millis < first.millis / 4);
+  CHECK(third.millis < first.millis / 4);
+  printf("Closed each time: %lu ms for a full handshake, then %lu and %lu ms resumed\n", first.millis, second.millis, third.millis);
+}
+
+// The server closes connections that have been idle a while, as API Gateway does.
+void testIdleConnectionResumesSession() {
+  HostHttpServer server("cloud.example");
+  server.keep_alive_millis = 5000;
+  std::unique_ptr<CloudInterface> cloud = setUp(server);
+
+  Post first = post(*cloud);
+  HostClock::Advance(10000);
+  Post second = post(*cloud);     // Comes after the server's closed it
+  CHECK(succeeded(first) && succeeded(second));
+  CHECK_EQUAL(2, server.connections);
+  CHECK_EQUAL(1, server.full_handshakes);
+  CHECK_EQUAL(1, server.resumed_handshakes);
+  CHECK(second.result.find("new connection") != std::string::npos);
+}
+
+// Changing the URL starts again with a new session.
+void testNewUrlNewSession() {
+  HostHttpServer server("cloud.example");
+  std::unique_ptr<CloudInterface> cloud = setUp(server);
+
+  CHECK(succeeded(post(*cloud)));
+  config.cloudLoggingUrl = "https://cloud.example/prod/other";
+  CHECK(succeeded(post(*cloud)));
+  CHECK_EQUAL(2, server.connections);
+  CHECK_EQUAL(2, server.full_handshakes);
+  CHECK_EQUAL(std::string("/prod/other"), server.requests.back().path);
+}
+
+// A server the root certificate doesn't vouch for is never sent anything.
+void testUntrustedServerRefused() {
+  HostHttpServer server("cloud.example");
+  std::unique_ptr<CloudInterface> cloud;
+  {
+    HostHttpServer other("other.example");
+    cloud = setUp(other);
+  }
+
+  Post refused = post(*cloud);
+  CHECK(refused.result.find("Failed to connect") != std::string::npos);
+  CHECK(server.requests.empty());
+  CHECK_EQUAL(1, cloud->QueuedCount());
+}
+
+// Down when first asked about MFLN, which looks like a server without it, so it's asked again.
+void testMflnProbedAgainAfterOutage() {
+  HostHttpServer server("cloud.example");
+  std::unique_ptr<CloudInterface> cloud = setUp(server);
+
+  server.down = true;
+  uint32_t before = eventLog.LastSequence();
+  CHECK(post(*cloud).result.find("Failed to connect") != std::string::npos);
+  CHECK(logSince(before).find("not supported") == std::string::npos);
+
+  server.down = false;
+  Post up = post(*cloud);
+  CHECK(succeeded(up));
+  CHECK(up.result.find("MFLN, ") != std::string::npos);
+}
+
+// Without MFLN, the full size receive buffer isn't kept between posts.
+void testNoMflnClosesConnection() {
+  HostHttpServer server("cloud.example");
+  server.max_fragment_length = false;
+  std::unique_ptr<CloudInterface> cloud = setUp(server);
+
+  uint32_t before = eventLog.LastSequence();
+  Post first = post(*cloud);
+  Post second = post(*cloud);
+  CHECK(succeeded(first) && succeeded(second));
+  CHECK(first.result.find("MFLN, ") == std::string::npos);
+  CHECK_EQUAL(2, server.connections);
+  CHECK_EQUAL(1, server.resumed_handshakes);
+
+  // Only said once it's borne out.
+  std::string log = logSince(before);
+  size_t said = log.find("not supported");
+  CHECK(said != std::string::npos && log.find("not supported", said + 1) == std::string::npos);
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+
+  RUN_TEST(testKeepAliveReusesConnection);
+  RUN_TEST(testClosedConnectionResumesSession);
+  RUN_TEST(testIdleConnectionResumesSession);
+  RUN_TEST(testNewUrlNewSession);
+  RUN_TEST(testUntrustedServerRefused);
+  RUN_TEST(testMflnProbedAgainAfterOutage);
+  RUN_TEST(testNoMflnClosesConnection);
+  return HostTestResult();
+}
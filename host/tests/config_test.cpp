@@ -0,0 +1,282 @@
+// Settings from the configure page are checked before they're used or saved, and so are
+//  settings loaded from flash, so the heater control never runs with values it can't work with.
+//  A damaged or cut short configuration file loads as the defaults, never a mix.
+
+#include <DeviceWebServer.h>
+#include <ControlEngine.h>
+#include <PayloadEncoder.h>
+#include <EventLog.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+
+const char CONFIG_FILE[] = "/config.bin";
+const char LEGACY_CONFIG_FILE[] = "/config.csv";
+
+DeviceConfig config;
+SampleBuffer samples;
+DeviceWebServer web(config, samples);
+
+// The configure form, as a browser posts it, with the defaults and any changes.
+HostWebArgs form(const HostWebArgs& changes) {
+  HostWebArgs args = {
+    { "minset", "21.0" }, { "maxset", "21.5" },
+    { "controlMode", "1" }, { "setpoint", "21.25" }, { "kp", "0.5" }, { "ki", "0.0002" }, { "kd", "0" },
+    { "window", "600" }, { "minon", "60" }, { "minoff", "60" }, { "controlChannel", "0" },
+    { "cloudUrl", "" }, { "cloudApiKey", "" }, { "cloudInstanceId", "1" },
+  };
+  for(const auto& change : changes) {
+    for(auto& arg : args) {
+      if(arg.first == change.first)
+        arg.second = change.second;
+    }
+  }
+  return args;
+}
+
+int post(const HostWebArgs& changes) {
+  return ESP8266WebServer::Instance()->Request(HTTP_POST, "/configure", form(changes)).status;
+}
+
+std::string logSince(uint32_t sequence) {
+  HostPrint out;
+  eventLog.PrintSince(out, sequence);
+  return out.text;
+}
+
+DeviceConfig loaded() {
+  DeviceConfig c;
+  CHECK(c.ReadFromFS());
+  return c;
+}
+
+void setUp() {
+  LittleFS.Format();
+  config.control_mode = CONTROL_HYSTERESIS;
+  config.relay_on_below_temp = 21.0;
+  config.relay_off_above_temp = 21.5;
+  config.pid_window_seconds = 600;
+  config.min_on_seconds = 60;
+  config.min_off_seconds = 60;
+}
+
+void testValidSaved() {
+  setUp();
+  CHECK_EQUAL(302, post({ { "window", "900" }, { "minon", "120" }, { "minoff", "300" } }));
+  CHECK_EQUAL(CONTROL_PID, config.control_mode);
+  CHECK_EQUAL(900, config.pid_window_seconds);
+  CHECK_EQUAL(120, loaded().min_on_seconds);
+  CHECK_EQUAL(300, loaded().min_off_seconds);
+}
+
+// Compared as numbers: as text, "9.5" sorts after "10.5".
+void testRelayTempsComparedAsNumbers() {
+  setUp();
+  post({ { "minset", "9.5" }, { "maxset", "10.5" } });
+  CHECK_EQUAL(9.5f, config.relay_on_below_temp);
+  CHECK_EQUAL(10.5f, config.relay_off_above_temp);
+
+  uint32_t logged = eventLog.LastSequence();
+  post({ { "minset", "22" }, { "maxset", "21.5" } });
+  CHECK_EQUAL(9.5f, config.relay_on_below_temp);
+  CHECK(logSince(logged).find("must be below the off") != std::string::npos);
+  CHECK_EQUAL(9.5f, loaded().relay_on_below_temp);
+}
+
+void testControlOutOfRangeRefused() {
+  const HostWebArgs refused[] = {
+    { { "controlMode", "2" } },
+    { { "controlMode", "-1" } },
+    { { "window", "0" } },
+    { { "window", "59" } },
+    { { "window", "3601" } },
+    { { "minon", "-1" } },
+    { { "minoff", "1801" } },
+    { { "window", "120" }, { "minon", "60" }, { "minoff", "61" } },    // No room for both
+    { { "kp", "-0.5" } },
+    { { "ki", "nan" } },
+    { { "setpoint", "200" } },
+    { { "setpoint", "abc" }, { "window", "abc" } },
+  };
+
+  for(const HostWebArgs& changes : refused) {
+    setUp();
+    uint32_t logged = eventLog.LastSequence();
+    post(changes);
+    CHECK_EQUAL(CONTROL_HYSTERESIS, config.control_mode);
+    CHECK_EQUAL(600, config.pid_window_seconds);
+    CHECK_EQUAL(60, config.min_on_seconds);
+    CHECK_EQUAL(60, config.min_off_seconds);
+    CHECK(logSince(logged).find("heater control not changed") != std::string::npos);
+
+    // The rest of the form is still saved.
+    CHECK_EQUAL(21.0f, loaded().relay_on_below_temp);
+  }
+}
+
+// Settings saved by firmware that didn't check them are put back to the defaults on loading.
+void testOutOfRangeLoadedAsDefaults() {
+  setUp();
+  config.control_mode = 7;
+  config.pid_window_seconds = 5;
+  config.min_on_seconds = -30;
+  config.relay_on_below_temp = 30;
+  config.WriteToFS();
+
+  uint32_t logged = eventLog.LastSequence();
+  DeviceConfig c = loaded();
+  const DeviceConfig defaults;
+  CHECK_EQUAL(defaults.control_mode, c.control_mode);
+  CHECK_EQUAL(defaults.pid_window_seconds, c.pid_window_seconds);
+  CHECK_EQUAL(defaults.min_on_seconds, c.min_on_seconds);
+  CHECK_EQUAL(defaults.relay_on_below_temp, c.relay_on_below_temp);
+  CHECK_EQUAL(defaults.relay_off_above_temp, c.relay_off_above_temp);
+  CHECK(logSince(logged).find("out of range") != std::string::npos);
+}
+
+// A build with more channels saved a channel this one doesn't have.
+void testChannelOutOfRangeLoaded() {
+  setUp();
+  config.control_channel = SENSOR_CHANNELS;
+  config.WriteToFS();
+  CHECK_EQUAL(0, loaded().control_channel);
+
+  config.control_channel = -1;
+  config.WriteToFS();
+  CHECK_EQUAL(0, loaded().control_channel);
+
+  // And from the old text file.
+  LittleFS.Format();
+  LittleFS.SetContents(LEGACY_CONFIG_FILE, "12,21.0,21.5,,,1,0,21.25,0.5,0.0002,0,600,60,60,7");
+  CHECK_EQUAL(0, loaded().control_channel);
+  CHECK_EQUAL(600, loaded().pid_window_seconds);
+}
+
+// A format this build can't encode, from a newer build or a file damaged before it was saved,
+//  is put back to JSON rather than cast to an encoding that doesn't exist.
+void testPayloadFormatOutOfRangeLoaded() {
+  setUp();
+  int formats[] = { NUM_PAYLOAD_FORMATS, 7, -1 };
+  for(int format : formats) {
+    config.cloud_payload_format = format;
+    config.WriteToFS();
+    uint32_t logged = eventLog.LastSequence();
+    CHECK_EQUAL((int)PAYLOAD_JSON, loaded().cloud_payload_format);
+    CHECK(logSince(logged).find("payload format") != std::string::npos);
+  }
+
+  config.cloud_payload_format = PAYLOAD_CBOR;
+  config.WriteToFS();
+  CHECK_EQUAL((int)PAYLOAD_CBOR, loaded().cloud_payload_format);
+  config.cloud_payload_format = PAYLOAD_JSON;
+}
+
+// Everything saved, or everything the default.
+bool allSaved(const DeviceConfig& c) {
+  return c.control_mode == CONTROL_PID && c.pid_window_seconds == 900 && c.min_off_seconds == 120 &&
+    c.relay_on_below_temp == 18.5f && c.cloudLoggingApiKey == "test-api-key" && c.timezone_offset == -5;
+}
+
+bool allDefaults(const DeviceConfig& c) {
+  const DeviceConfig defaults;
+  return c.control_mode == defaults.control_mode && c.pid_window_seconds == defaults.pid_window_seconds &&
+    c.min_off_seconds == defaults.min_off_seconds && c.relay_on_below_temp == defaults.relay_on_below_temp &&
+    c.cloudLoggingApiKey == defaults.cloudLoggingApiKey && c.timezone_offset == defaults.timezone_offset;
+}
+
+std::vector<uint8_t> savedFile() {
+  setUp();
+  config.control_mode = CONTROL_PID;
+  config.pid_window_seconds = 900;
+  config.min_off_seconds = 120;
+  config.relay_on_below_temp = 18.5;
+  config.cloudLoggingApiKey = "test-api-key";
+  config.timezone_offset = -5;
+  config.WriteToFS();
+  return LittleFS.Contents(CONFIG_FILE);
+}
+
+void testTruncatedLoadsDefaults() {
+  std::vector<uint8_t> file = savedFile();
+  size_t length;
+  int wrong = 0;
+  for(length = 0; length < file.size(); length++) {
+    LittleFS.SetContents(CONFIG_FILE, std::vector<uint8_t>(file.begin(), file.begin() + length));
+    DeviceConfig c;
+    if(c.ReadFromFS() || !allDefaults(c))
+      wrong++;
+  }
+  CHECK_EQUAL(0, wrong);
+
+  LittleFS.SetContents(CONFIG_FILE, file);
+  DeviceConfig c;
+  CHECK(c.ReadFromFS() && allSaved(c));
+}
+
+// Every byte changed in turn, and some garbage appended.
+void testCorruptedLoadsDefaults() {
+  std::vector<uint8_t> file = savedFile();
+  size_t i;
+  int wrong = 0;
+  for(i = 0; i < file.size(); i++) {
+    std::vector<uint8_t> damaged = file;
+    damaged[i] ^= 0x5A;
+    LittleFS.SetContents(CONFIG_FILE, damaged);
+    DeviceConfig c;
+    if(c.ReadFromFS() || !allDefaults(c))
+      wrong++;
+  }
+  CHECK_EQUAL(0, wrong);
+
+  // After the end record, it's ignored.
+  std::vector<uint8_t> longer = file;
+  longer.insert(longer.end(), 20, 0xA5);
+  LittleFS.SetContents(CONFIG_FILE, longer);
+  DeviceConfig c;
+  CHECK(c.ReadFromFS() && allSaved(c));
+
+  // Too big to be a configuration at all.
+  LittleFS.SetContents(CONFIG_FILE, std::vector<uint8_t>(4096, 0));
+  DeviceConfig big;
+  CHECK(!big.ReadFromFS() && allDefaults(big));
+}
+
+// The new file can't replace the old one: that's logged, the old one's kept, and the
+//  temporary file doesn't linger.
+void testFailedRenameKeepsPrevious() {
+  std::vector<uint8_t> previous = savedFile();
+  config.timezone_offset = 3;
+  LittleFS.fail_renames = true;
+  uint32_t logged = eventLog.LastSequence();
+  config.WriteToFS();
+  LittleFS.fail_renames = false;
+
+  CHECK(logSince(logged).find("DeviceConfig: failed to write") != std::string::npos);
+  CHECK(previous == LittleFS.Contents(CONFIG_FILE));
+  CHECK(!LittleFS.exists("/config.tmp"));
+  CHECK_EQUAL(-5, loaded().timezone_offset);
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+  web.Setup();
+
+  RUN_TEST(testValidSaved);
+  RUN_TEST(testRelayTempsComparedAsNumbers);
+  RUN_TEST(testControlOutOfRangeRefused);
+  RUN_TEST(testOutOfRangeLoadedAsDefaults);
+  RUN_TEST(testChannelOutOfRangeLoaded);
+  RUN_TEST(testTruncatedLoadsDefaults);
+  RUN_TEST(testCorruptedLoadsDefaults);
+  RUN_TEST(testPayloadFormatOutOfRangeLoaded);
+  RUN_TEST(testFailedRenameKeepsPrevious);
+  return HostTestResult();
+}
@@ -0,0 +1,59 @@
+// The heater's minimum on and off times keep the relay from switching too often, but only time
+//  from a switch: straight after a reboot, the heater comes on as soon as it's wanted.
+
+#include <ControlEngine.h>
+#include <HostTest.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+const unsigned long SECOND = 1000;
+
+DeviceConfig hysteresis() {
+  DeviceConfig config;
+  config.control_mode = CONTROL_HYSTERESIS;
+  config.relay_on_below_temp = 20.0;
+  config.relay_off_above_temp = 21.0;
+  config.min_on_seconds = 300;
+  config.min_off_seconds = 600;
+  return config;
+}
+
+// A reading, and a second later the control updated, as the main loop does.
+bool step(ControlEngine& control, float temp) {
+  HostClock::Advance(SECOND);
+  control.Reading(temp);
+  return control.Update();
+}
+
+void testFirstSwitchNotHeldBack() {
+  HostClock::Begin(START_TIME);
+  DeviceConfig config = hysteresis();
+  ControlEngine control(config);
+  CHECK(step(control, 18.0));
+}
+
+void testMinimumTimesFromSwitch() {
+  HostClock::Begin(START_TIME);
+  DeviceConfig config = hysteresis();
+  ControlEngine control(config);
+  CHECK(step(control, 18.0));
+
+  // Held on for min_on, then off for min_off.
+  unsigned long switched = millis();
+  while(step(control, 22.0)) {}
+  CHECK(millis() - switched >= config.min_on_seconds * SECOND);
+
+  switched = millis();
+  while(!step(control, 18.0)) {}
+  CHECK(millis() - switched >= config.min_off_seconds * SECOND);
+}
+
+}
+
+int main() {
+  RUN_TEST(testFirstSwitchNotHeldBack);
+  RUN_TEST(testMinimumTimesFromSwitch);
+  return HostTestResult();
+}
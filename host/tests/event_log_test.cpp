@@ -0,0 +1,87 @@
+// The RAM event log: a ring of the latest entries, read back from a sequence number on.
+
+#include <EventLog.h>
+#include <ClockKeeper.h>
+#include <HostHeap.h>
+#include <HostTest.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+
+std::string since(uint32_t sequence) {
+  HostPrint out;
+  eventLog.PrintSince(out, sequence);
+  return out.text;
+}
+
+int lines(const std::string& text) {
+  return std::count(text.begin(), text.end(), '\n');
+}
+
+// Before the clock's set, entries have the uptime, and after, the date and time.
+void testTimes() {
+  HostClock::Advance(1500);
+  eventLog.Add(PSTR("before %d"), 1);
+  HostClock::SyncNtp();
+  eventLog.Add(PSTR("after %d"), 2);
+
+  CHECK_EQUAL(std::string("1 +1.500s before 1\n2 2026-01-01 00:00:01 after 2\n"), since(0));
+}
+
+void testSince() {
+  uint32_t last = eventLog.LastSequence();
+  eventLog.Add(PSTR("one"));
+  eventLog.Add(PSTR("two"));
+  std::string newer = since(last + 1);
+  CHECK_EQUAL(1, lines(newer));
+  CHECK(newer.find(" two\n") != std::string::npos);
+  CHECK_EQUAL(2, lines(since(last)));
+  CHECK_EQUAL(std::string(), since(last + 2));
+  CHECK_EQUAL(std::string(), since(last + 100));
+
+  // since + 1 would wrap to 0, and print everything.
+  CHECK_EQUAL(std::string(), since(UINT32_MAX));
+  CHECK_EQUAL(std::string(), since(UINT32_MAX - 1));
+}
+
+// Only the latest entries are kept, oldest first.
+void testRingWraps() {
+  int i;
+  for(i = 0; i < EVENT_LOG_ENTRIES + 5; i++)
+    eventLog.Add(PSTR("entry %d"), i);
+
+  std::string all = since(0);
+  CHECK_EQUAL(EVENT_LOG_ENTRIES, lines(all));
+  CHECK(all.find("entry 5\n") != std::string::npos);
+  CHECK(all.find("entry 4\n") == std::string::npos);
+  CHECK(all.find("entry 5\n") < all.find("entry 6\n"));
+  CHECK_EQUAL(1, lines(since(eventLog.LastSequence() - 1)));
+}
+
+// Long messages are cut short, in the entry, without the heap.
+void testNoHeap() {
+  char longText[200];
+  memset(longText, 'x', sizeof(longText) - 1);
+  longText[sizeof(longText) - 1] = 0;
+
+  HostHeap::Reset();
+  eventLog.Add(PSTR("long %s"), longText);
+  CHECK_EQUAL(0u, HostHeap::Get().allocations);
+
+  std::string last = since(eventLog.LastSequence() - 1);
+  CHECK_EQUAL((size_t)EVENT_LOG_TEXT - 1, last.size() - last.find("long") - 1);
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+
+  RUN_TEST(testTimes);
+  RUN_TEST(testSince);
+  RUN_TEST(testRingWraps);
+  RUN_TEST(testNoHeap);
+  return HostTestResult();
+}
@@ -0,0 +1,141 @@
+// The RAM the firmware needs, as built for a board (SENSOR_CHANNELS at its default), must leave
+//  the SDK some heap at the worst moment: a TLS connection to the cloud held open while a web
+//  page is served.  A server without MFLN needs the full 16 KB receive buffer, which is more
+//  than that leaves, so its connection is only open for the post itself.
+//
+//  On the ESP8266 the globals and the heap share the same DRAM, so what's free is what an empty
+//  sketch has, less the sketch's globals, less what it allocates.  The globals are measured
+//  here with sizeof, which on the host is a little more than on the board (8 byte pointers).
+
+#include <DeviceWebServer.h>
+#include <CloudInterface.h>
+#include <SensorInterface.h>
+#include <ControlEngine.h>
+#include <ClockKeeper.h>
+#include <TaskScheduler.h>
+#include <WiFiFastConnect.h>
+#include <EventLog.h>
+#include <HostHeap.h>
+#include <HostHttpServer.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+
+// Free heap in an empty sketch on the ESP8266 Arduino core, once WiFi has connected.
+const size_t EMPTY_SKETCH_FREE = 50 * 1024;
+
+// Kept back for the SDK's own bursts (WiFi reconnects, lwIP buffers for a busy page).
+const size_t MIN_FREE = 8 * 1024;
+
+// Outlive the cloud interface, which keeps its connection open.
+HostHttpServer server("cloud.example");
+HostHttpServer plainServer("plain.example");     // Without MFLN
+
+// The sketch's globals, as ESP_TempSensor.ino declares them.
+DeviceConfig config;
+SensorInterface sensor;
+CloudInterface cloudInterface;
+SampleBuffer samples;
+DeviceWebServer webServer(config, samples);
+TaskScheduler scheduler;
+ControlEngine controlEngine(config);
+ClockKeeper clockKeeper;
+WiFiFastConnect wifiFastConnect;
+
+const size_t GLOBALS_SIZE = sizeof(config) + sizeof(sensor) + sizeof(cloudInterface) + sizeof(samples) +
+  sizeof(webServer) + sizeof(scheduler) + sizeof(controlEngine) + sizeof(clockKeeper) + sizeof(wifiFastConnect) +
+  sizeof(eventLog);
+
+class NullPrint : public Print
+{
+public:
+    size_t write(uint8_t) override { return 1; }
+    using Print::write;
+};
+
+// Serves the pages and API, and returns the peak heap since the last HostHeap::Reset().
+size_t pagesPeak() {
+  ESP8266WebServer* web = ESP8266WebServer::Instance();
+  CHECK_EQUAL(200, web->Request(HTTP_GET, "/").status);
+  CHECK_EQUAL(200, web->Request(HTTP_GET, "/api/samples?tier=halfhour&points=336").status);
+  CHECK_EQUAL(200, web->Request(HTTP_GET, "/configure").status);
+  CHECK_EQUAL(200, web->Request(HTTP_GET, "/perf").status);
+  return HostHeap::Get().peak_bytes;
+}
+
+void testHeapBudget() {
+  LittleFS.SetContents(CloudInterface::ROOT_CERT_FILE, server.CertificatePem().c_str());
+  config.cloudLoggingUrl = "https://cloud.example/readings";
+  config.cloudLoggingApiKey = "test-api-key";
+
+  HostHeap::Reset();
+  cloudInterface.Setup();
+  webServer.Setup();
+
+  // A week of readings, then a post, whose connection's kept open for the next.
+  int minute;
+  for(minute = 0; minute < 7 * MINUTES_PER_DAY; minute++) {
+    HostClock::Advance(60000);
+    samples.SetSample(0, 2000 + minute % 300);
+  }
+  NullPrint out;
+  cloudInterface.WriteDataToCloud(samples, config, out);
+  CHECK_EQUAL(1, server.connections);
+  size_t connected = HostHeap::LiveBytes();
+
+  // The pages and API, while it's open.
+  size_t peak = pagesPeak();
+
+  size_t sketchFree = EMPTY_SKETCH_FREE - GLOBALS_SIZE;
+  long lowest = (long)sketchFree - (long)peak;
+  printf("%d channel(s): %u bytes of globals (%u per channel), %u bytes of heap connected, %u at the peak\n",
+    SENSOR_CHANNELS, (unsigned)GLOBALS_SIZE, (unsigned)sizeof(SampleChannel), (unsigned)connected, (unsigned)peak);
+  printf("Free heap: %u bytes after setup, %ld at the lowest, of %u for an empty sketch\n",
+    (unsigned)sketchFree, lowest, (unsigned)EMPTY_SKETCH_FREE);
+  CHECK(lowest >= (long)MIN_FREE);
+}
+
+// Between posts, it's back to what setup left.  During one, a page served while waiting for the
+//  response has to fit alongside the connection, though not with the SDK's margin.
+void testHeapBudgetWithoutMfln() {
+  plainServer.max_fragment_length = false;
+  LittleFS.SetContents(CloudInterface::ROOT_CERT_FILE, plainServer.CertificatePem().c_str());
+  cloudInterface.Setup();
+  config.cloudLoggingUrl = "https://plain.example/readings";
+
+  HostClock::Advance(60000);
+  samples.SetSample(0, 2000);
+  NullPrint out;
+  size_t idle = HostHeap::LiveBytes();
+  HostHeap::Reset();
+  cloudInterface.WriteDataToCloud(samples, config, out);
+  CHECK_EQUAL(1, plainServer.connections);
+  size_t post = HostHeap::Get().peak_bytes - idle;
+  CHECK_EQUAL(idle, HostHeap::LiveBytes());
+
+  HostHeap::Reset();
+  size_t peak = pagesPeak();
+  size_t sketchFree = EMPTY_SKETCH_FREE - GLOBALS_SIZE;
+  long lowest = (long)sketchFree - (long)peak;
+  long lowestPosting = lowest - (long)post;
+  printf("Without MFLN: %u bytes of heap for a post, %ld free at the lowest between posts, %ld during one\n",
+    (unsigned)post, lowest, lowestPosting);
+  CHECK(lowest >= (long)MIN_FREE);
+  CHECK(lowestPosting > 0);
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+
+  RUN_TEST(testHeapBudget);
+  RUN_TEST(testHeapBudgetWithoutMfln);
+  return HostTestResult();
+}
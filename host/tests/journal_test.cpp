@@ -0,0 +1,241 @@
+// The sample journal loads back the finished slots as they were when it was last flushed,
+//  including when readings stopped for a while, and the tiers moved on over empty slots.  (The
+//  current slot is only saved as it starts, so its readings since are left out.)  After a reset
+//  with the clock set from the time saved before it, the readings until NTP syncs are kept in
+//  slots of their own, and moved once it does.  That holds away from UTC too, as long as the
+//  timezone's set before the journal's loaded, as setup() does.
+
+#include <SampleBuffer.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+#include <memory>
+#include <sys/time.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+const unsigned long MINUTE = 60000;
+
+const char JOURNAL_FILE[] = "/avgs.jnl";
+
+// The first difference between two tiers' finished slots, or an empty string.
+std::string tierDifference(const char* name, const SampleTier& a, const SampleTier& b) {
+  char text[120];
+  if(a.Filled() != b.Filled() || a.StartMinutes(0) != b.StartMinutes(0)) {
+    snprintf(text, sizeof(text), "%s: %d slots from %ld, loaded %d from %ld", name, a.Filled(), a.StartMinutes(0), b.Filled(), b.StartMinutes(0));
+    return text;
+  }
+  int age;
+  for(age = 1; age < a.Filled(); age++) {
+    if(a.Count(age) != b.Count(age) || a.Mean(age) != b.Mean(age) ||
+      a.Min(age) != b.Min(age) || a.Max(age) != b.Max(age) || a.StdDev(age) != b.StdDev(age)) {
+      snprintf(text, sizeof(text), "%s age %d: count %d mean %d, loaded count %d mean %d", name, age,
+        a.Count(age), a.Mean(age), b.Count(age), b.Mean(age));
+      return text;
+    }
+  }
+  return "";
+}
+
+// Loads the journal, and compares the persisted tiers with the samples that wrote it.
+std::string loadedDifference(const SampleBuffer& samples) {
+  std::unique_ptr<SampleBuffer> loaded(new SampleBuffer());
+  loaded->ReadFromFS();
+  std::string difference = tierDifference("half hour", samples.GetTier(0, TIER_HALF_HOUR), loaded->GetTier(0, TIER_HALF_HOUR));
+  if(difference.empty())
+    difference = tierDifference("daily", samples.GetTier(0, TIER_DAILY), loaded->GetTier(0, TIER_DAILY));
+  return difference;
+}
+
+// A reading a minute, flushed each time, as the main loop does.
+void record(SampleBuffer& samples, int minutes) {
+  int minute;
+  for(minute = 0; minute < minutes; minute++) {
+    HostClock::Advance(MINUTE);
+    samples.SetSample(0, 1800 + (millis() / MINUTE * 7) % 500);
+    samples.FlushToFS();
+  }
+}
+
+// Readings stop for a while, and then carry on.
+void gap(SampleBuffer& samples, long minutes) {
+  HostClock::Advance(minutes * MINUTE);
+}
+
+std::unique_ptr<SampleBuffer> start() {
+  LittleFS.Format();
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  return std::unique_ptr<SampleBuffer>(new SampleBuffer());
+}
+
+// The slot that finished before the gap, and the empty slots in it, are appended along with
+//  the new slot.
+void testGapOfHours() {
+  std::unique_ptr<SampleBuffer> samples = start();
+  record(*samples, MINUTES_PER_DAY + 45);
+  CHECK_EQUAL(std::string(), loadedDifference(*samples));
+
+  gap(*samples, 3 * 60 + 20);
+  size_t before = LittleFS.Contents(JOURNAL_FILE).size();
+  record(*samples, 1);
+  CHECK(LittleFS.Contents(JOURNAL_FILE).size() > before);    // Appended, not rewritten
+  CHECK_EQUAL(std::string(), loadedDifference(*samples));
+  CHECK(samples->GetTier(0, TIER_HALF_HOUR).IsGap(1));
+
+  record(*samples, 90);
+  CHECK_EQUAL(std::string(), loadedDifference(*samples));
+}
+
+// Once the ring has wrapped, the empty slots are over older readings, which mustn't come back.
+void testGapAfterWrapping() {
+  std::unique_ptr<SampleBuffer> samples = start();
+  record(*samples, 15 * MINUTES_PER_DAY);
+  gap(*samples, 2 * MINUTES_PER_DAY + 100);
+  record(*samples, 1);
+  CHECK_EQUAL(std::string(), loadedDifference(*samples));
+  CHECK(samples->GetTier(0, TIER_DAILY).IsGap(1));
+
+  record(*samples, MINUTES_PER_DAY);
+  CHECK_EQUAL(std::string(), loadedDifference(*samples));
+}
+
+// Too many empty slots to be worth appending: the journal's rewritten instead.
+void testLongGapCompacts() {
+  std::unique_ptr<SampleBuffer> samples = start();
+  record(*samples, 3 * MINUTES_PER_DAY);
+  gap(*samples, 10 * MINUTES_PER_DAY);
+  record(*samples, 1);
+  CHECK_EQUAL(std::string(), loadedDifference(*samples));
+
+  // Just the snapshot, with nothing appended after it.
+  std::vector<uint8_t> journal = LittleFS.Contents(JOURNAL_FILE);
+  samples->WriteToFS();
+  CHECK(journal == LittleFS.Contents(JOURNAL_FILE));
+}
+
+// Longer than the half hour ring: it starts again from one slot.
+void testGapLongerThanRing() {
+  std::unique_ptr<SampleBuffer> samples = start();
+  record(*samples, 2 * MINUTES_PER_DAY);
+  gap(*samples, 20 * MINUTES_PER_DAY);
+  record(*samples, 1);
+  CHECK_EQUAL(1, samples->GetTier(0, TIER_HALF_HOUR).Filled());
+  CHECK_EQUAL(std::string(), loadedDifference(*samples));
+
+  record(*samples, 60);
+  CHECK_EQUAL(std::string(), loadedDifference(*samples));
+}
+
+// The board resets, and is off for offMinutes.  Its clock is set back to the last reading's
+//  time, as ClockKeeper would from the time it saved, and the journal loaded.
+std::unique_ptr<SampleBuffer> restart(const SampleBuffer& samples, long offMinutes) {
+  time_t saved = samples.LastSampleTime();
+  HostClock::Reset(offMinutes * MINUTE, false);
+  timeval tv = { saved, 0 };
+  settimeofday(&tv, NULL);
+
+  std::unique_ptr<SampleBuffer> restarted(new SampleBuffer());
+  restarted->ReadFromFS();
+  restarted->ClockRestored();
+  return restarted;
+}
+
+// NTP syncs, and the readings since the restart are moved by how far behind the clock was.
+void sync(SampleBuffer& samples) {
+  long seconds = (long)(HostClock::World() - time(NULL));
+  HostClock::SyncNtp();
+  samples.ClockCorrected(seconds);
+}
+
+// Readings either side of a reset, which the clock puts in the same half hour, aren't mixed
+//  in one slot, and only those after it are moved when the clock's corrected.
+void testRestoredClockKeepsSlotsApart() {
+  std::unique_ptr<SampleBuffer> samples = start();
+  record(*samples, 2 * MINUTES_PER_DAY + 10);
+  long beforeStart = samples->GetTier(0, TIER_HALF_HOUR).StartMinutes(0);
+
+  std::unique_ptr<SampleBuffer> restarted = restart(*samples, 3 * 60);
+  const SampleTier& halfHour = restarted->GetTier(0, TIER_HALF_HOUR);
+  int beforeCount = halfHour.Count(0);
+  record(*restarted, 5);
+  CHECK_EQUAL(5, halfHour.Count(0));
+  CHECK_EQUAL(beforeStart, halfHour.StartMinutes(1));
+  CHECK_EQUAL(beforeCount, halfHour.Count(1));
+
+  // Three hours later, and nothing in between.
+  sync(*restarted);
+  CHECK_EQUAL(beforeStart + 6 * MINUTES_PER_SAMPLE, halfHour.StartMinutes(0));
+  CHECK_EQUAL(5, halfHour.Count(0));
+  CHECK(halfHour.IsGap(1) && halfHour.IsGap(5));
+  CHECK_EQUAL(beforeCount, halfHour.Count(6));
+  CHECK_EQUAL(std::string(), loadedDifference(*restarted));
+
+  // The readings since are added to the moved slot.
+  record(*restarted, 1);
+  CHECK_EQUAL(6, halfHour.Count(0));
+}
+
+// Off for longer than the half hour ring: once they're moved, the readings since the reset are
+//  all it has left, and that's what's saved.
+void testRestoredClockOutByMoreThanRing() {
+  std::unique_ptr<SampleBuffer> samples = start();
+  record(*samples, 2 * MINUTES_PER_DAY + 10);
+  std::unique_ptr<SampleBuffer> restarted = restart(*samples, 20 * MINUTES_PER_DAY);
+  record(*restarted, 5);
+  sync(*restarted);
+
+  const SampleTier& halfHour = restarted->GetTier(0, TIER_HALF_HOUR);
+  CHECK_EQUAL(1, halfHour.Filled());
+  CHECK_EQUAL(5, halfHour.Count(0));
+  CHECK_EQUAL(std::string(), loadedDifference(*restarted));
+
+  std::unique_ptr<SampleBuffer> loaded(new SampleBuffer());
+  loaded->ReadFromFS();
+  CHECK_EQUAL(5, loaded->GetTier(0, TIER_HALF_HOUR).Count(0));
+  CHECK_EQUAL(halfHour.Mean(0), loaded->GetTier(0, TIER_HALF_HOUR).Mean(0));
+}
+
+// The timezone's in place before the restart loads the journal and takes the first reading,
+//  so the slots either side of the reset are in local time, and syncing only moves them by how
+//  far behind the clock was, not by the timezone as well.
+void testRestoredClockAwayFromUtc() {
+  configTime("UTC+12", "pool.ntp.org");
+  std::unique_ptr<SampleBuffer> samples = start();
+  record(*samples, 2 * MINUTES_PER_DAY + 10);
+  long beforeStart = samples->GetTier(0, TIER_HALF_HOUR).StartMinutes(0);
+  CHECK_EQUAL(SampleBuffer::LocalMinutesNow() - SampleBuffer::LocalMinutesNow() % MINUTES_PER_SAMPLE, beforeStart);
+
+  std::unique_ptr<SampleBuffer> restarted = restart(*samples, 3 * 60);
+  const SampleTier& halfHour = restarted->GetTier(0, TIER_HALF_HOUR);
+  record(*restarted, 5);
+  CHECK_EQUAL(beforeStart, halfHour.StartMinutes(1));
+
+  sync(*restarted);
+  restarted->TimezoneChanged();   // Set again once WiFi's up, to the same timezone.
+  CHECK_EQUAL(beforeStart + 6 * MINUTES_PER_SAMPLE, halfHour.StartMinutes(0));
+  CHECK(halfHour.IsGap(1) && halfHour.IsGap(5));
+
+  // Carrying on in local time: no slot behind the current one, and no false gaps.
+  record(*restarted, MINUTES_PER_SAMPLE);
+  CHECK_EQUAL(beforeStart + 7 * MINUTES_PER_SAMPLE, halfHour.StartMinutes(0));
+  CHECK(!halfHour.IsGap(1));
+  CHECK_EQUAL(std::string(), loadedDifference(*restarted));
+  configTime("UTC0", "pool.ntp.org");
+}
+
+}
+
+int main() {
+  LittleFS.begin();
+
+  RUN_TEST(testGapOfHours);
+  RUN_TEST(testGapAfterWrapping);
+  RUN_TEST(testLongGapCompacts);
+  RUN_TEST(testGapLongerThanRing);
+  RUN_TEST(testRestoredClockKeepsSlotsApart);
+  RUN_TEST(testRestoredClockOutByMoreThanRing);
+  RUN_TEST(testRestoredClockAwayFromUtc);
+  return HostTestResult();
+}
@@ -0,0 +1,479 @@
+// Cloud posts decode back to the readings queued, as JSON and as CBOR, including negative and
+//  extreme temperatures, gaps, and both kinds of instance id.  The decoders here are written
+//  from the formats (RFC 8259 and RFC 8949), not from the encoder, and refuse anything the
+//  encoder isn't documented to write.
+
+#include <CloudInterface.h>
+#include <PayloadEncoder.h>
+#include <HostHttpServer.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+#include <memory>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+const unsigned long HALF_HOUR = 30 * 60 * 1000UL;
+
+// A decoded value: text, or number * 10^-scale.
+struct Value {
+  bool is_text = false;
+  std::string text;
+  int64_t number = 0;
+  int scale = 0;
+};
+
+typedef std::vector<std::pair<std::string, Value>> Map;
+
+// ----------------------------------------------------------------------
+// JSON: an array of objects, whose values are strings or numbers.
+
+class JsonDecoder
+{
+public:
+    JsonDecoder(const std::string& body) : at(body.c_str()), end(body.c_str() + body.size()) {}
+
+    bool Decode(std::vector<Map>& maps) {
+      if(!Expect('['))
+        return false;
+      if(Peek() == ']')
+        return Expect(']') && at == end;
+      do {
+        Map map;
+        if(!Object(map))
+          return false;
+        maps.push_back(map);
+      } while(Accept(','));
+      return Expect(']') && at == end;
+    }
+
+private:
+    char Peek() const { return at < end ? *at : 0; }
+    bool Accept(char c) {
+      if(Peek() != c)
+        return false;
+      at++;
+      return true;
+    }
+    bool Expect(char c) { return Accept(c); }
+
+    bool Object(Map& map) {
+      if(!Expect('{'))
+        return false;
+      do {
+        std::string key;
+        Value value;
+        if(!String(key) || !Expect(':'))
+          return false;
+        if(Peek() == '"') {
+          value.is_text = true;
+          if(!String(value.text))
+            return false;
+        } else if(!Number(value)) {
+          return false;
+        }
+        map.push_back({ key, value });
+      } while(Accept(','));
+      return Expect('}');
+    }
+
+    bool String(std::string& text) {
+      if(!Expect('"'))
+        return false;
+      while(at < end && *at != '"') {
+        if((uint8_t)*at < ' ')
+          return false;
+        if(*at == '\\') {
+          at++;
+          if(Peek() != '"' && Peek() != '\\')
+            return false;
+        }
+        text += *at++;
+      }
+      return Expect('"');
+    }
+
+    bool Number(Value& value) {
+      bool negative = Accept('-');
+      if(!isdigit(Peek()) || (Peek() == '0' && at + 1 < end && isdigit(at[1])))
+        return false;
+      while(isdigit(Peek()))
+        value.number = value.number * 10 + (*at++ - '0');
+      if(Accept('.')) {
+        if(!isdigit(Peek()))
+          return false;
+        while(isdigit(Peek())) {
+          value.number = value.number * 10 + (*at++ - '0');
+          value.scale++;
+        }
+      }
+      if(negative)
+        value.number = -value.number;
+      return true;
+    }
+
+    const char* at;
+    const char* end;
+};
+
+// ----------------------------------------------------------------------
+// CBOR: a definite length array of maps, with text keys, and values that are integers, text,
+//  or decimal fractions (tag 4).  Heads must be the shortest for their value.
+
+class CborDecoder
+{
+public:
+    CborDecoder(const std::string& body) : data((const uint8_t*)body.data()), length(body.size()) {}
+
+    bool Decode(std::vector<Map>& maps) {
+      uint8_t major;
+      uint64_t count;
+      if(!Head(major, count) || major != 4)
+        return false;
+      uint64_t i;
+      for(i = 0; i < count; i++) {
+        Map map;
+        if(!ReadMap(map))
+          return false;
+        maps.push_back(map);
+      }
+      return at == length;
+    }
+
+private:
+    bool Byte(uint8_t& byte) {
+      if(at >= length)
+        return false;
+      byte = data[at++];
+      return true;
+    }
+
+    bool Head(uint8_t& major, uint64_t& value) {
+      uint8_t initial;
+      if(!Byte(initial))
+        return false;
+      major = initial >> 5;
+      uint8_t info = initial & 0x1F;
+      if(info < 24) {
+        value = info;
+        return true;
+      }
+      if(info > 27)
+        return false;     // Indefinite lengths, and reserved
+      int bytes = 1 << (info - 24);
+      value = 0;
+      int i;
+      for(i = 0; i < bytes; i++) {
+        uint8_t byte;
+        if(!Byte(byte))
+          return false;
+        value = value << 8 | byte;
+      }
+      uint64_t shortest = info == 24 ? 24 : (uint64_t)1 << (4 << (info - 24));
+      return value >= shortest;
+    }
+
+    bool Integer(int64_t& number) {
+      uint8_t major;
+      uint64_t value;
+      if(!Head(major, value) || major > 1 || value > INT64_MAX)
+        return false;
+      number = major == 0 ? (int64_t)value : -1 - (int64_t)value;
+      return true;
+    }
+
+    bool Text(std::string& text) {
+      uint8_t major;
+      uint64_t size;
+      if(!Head(major, size) || major != 3 || size > length - at)
+        return false;
+      text.assign((const char*)data + at, size);
+      at += size;
+      return true;
+    }
+
+    bool Item(Value& value) {
+      if(at >= length)
+        return false;
+      uint8_t major = data[at] >> 5;
+      if(major <= 1)
+        return Integer(value.number);
+      if(major == 3) {
+        value.is_text = true;
+        return Text(value.text);
+      }
+      uint64_t tag, items;
+      int64_t exponent;
+      if(!Head(major, tag) || major != 6 || tag != 4)
+        return false;
+      if(!Head(major, items) || major != 4 || items != 2)
+        return false;
+      if(!Integer(exponent) || exponent > 0 || !Integer(value.number))
+        return false;
+      value.scale = -exponent;
+      return true;
+    }
+
+    bool ReadMap(Map& map) {
+      uint8_t major;
+      uint64_t count;
+      if(!Head(major, count) || major != 5)
+        return false;
+      uint64_t i;
+      for(i = 0; i < count; i++) {
+        std::string key;
+        Value value;
+        if(!Text(key) || !Item(value))
+          return false;
+        map.push_back({ key, value });
+      }
+      return true;
+    }
+
+    const uint8_t* data;
+    size_t length;
+    size_t at = 0;
+};
+
+// ----------------------------------------------------------------------
+
+std::vector<Map> decode(PayloadFormat format, const std::string& body, bool& ok) {
+  std::vector<Map> maps;
+  if(format == PAYLOAD_CBOR)
+    ok = CborDecoder(body).Decode(maps);
+  else
+    ok = JsonDecoder(body).Decode(maps);
+  return maps;
+}
+
+const Value* find(const Map& map, const char* key) {
+  for(const auto& field : map) {
+    if(field.first == key)
+      return &field.second;
+  }
+  return NULL;
+}
+
+// The integer, or temperature in hundredths, under key.
+bool integer(const Map& map, const char* key, int64_t& number) {
+  const Value* value = find(map, key);
+  if(!value || value->is_text || value->scale != 0)
+    return false;
+  number = value->number;
+  return true;
+}
+
+bool centis(const Map& map, const char* key, int64_t& number) {
+  const Value* value = find(map, key);
+  if(!value || value->is_text || value->scale != 2)
+    return false;
+  number = value->number;
+  return true;
+}
+
+// Empty if the map holds the reading and instance id, and nothing else, or what's different.
+std::string mapDifference(const Map& map, const UplinkReading& reading, const char* instanceId) {
+  int64_t channel, timestamp, value, mean, minimum, maximum, count;
+  if(!integer(map, "channel", channel) || !integer(map, "timestamp", timestamp) || !centis(map, "value", value))
+    return "reading fields missing";
+  if(channel != reading.channel || timestamp != reading.timestamp || value != reading.value)
+    return "reading fields differ";
+
+  const Value* id = find(map, "instanceId");
+  if(!id)
+    return "no instanceId";
+  std::string idText = id->is_text ? id->text : std::to_string(id->number);
+  if(idText != instanceId || (!id->is_text && id->scale != 0))
+    return "instanceId " + idText;
+
+  if(reading.count == 0)
+    return map.size() == 4 ? "" : "interval sent for a gap";
+  if(map.size() != 8 || !centis(map, "meanValue", mean) || !centis(map, "minimumValue", minimum) ||
+    !centis(map, "maximumValue", maximum) || !integer(map, "count", count))
+    return "interval fields missing";
+  if(mean != reading.mean_value || minimum != reading.min_value || maximum != reading.max_value || count != reading.count)
+    return "interval fields differ";
+  return "";
+}
+
+std::string encode(PayloadFormat format, const std::vector<UplinkReading>& readings, const char* instanceId) {
+  std::vector<uint8_t> buffer(16384);
+  PayloadEncoder encoder(buffer.data(), buffer.size());
+  size_t length = encoder.Encode(format, readings.data(), readings.size(), instanceId);
+  CHECK(length > 0);
+  return std::string((const char*)buffer.data(), length);
+}
+
+// Encoded and decoded again, the first difference, or an empty string.
+std::string roundTripDifference(PayloadFormat format, const std::vector<UplinkReading>& readings, const char* instanceId) {
+  std::string body = encode(format, readings, instanceId);
+  bool ok;
+  std::vector<Map> maps = decode(format, body, ok);
+  if(!ok)
+    return "didn't decode";
+  if(maps.size() != readings.size())
+    return "decoded " + std::to_string(maps.size()) + " readings";
+  size_t i;
+  for(i = 0; i < readings.size(); i++) {
+    std::string difference = mapDifference(maps[i], readings[i], instanceId);
+    if(!difference.empty())
+      return "reading " + std::to_string(i) + ": " + difference;
+  }
+  return "";
+}
+
+UplinkReading reading(uint32_t timestamp, int channel, centi_t value, centi_t mean, centi_t minimum, centi_t maximum, uint16_t count) {
+  UplinkReading r = {};
+  r.timestamp = timestamp;
+  r.channel = channel;
+  r.value = value;
+  r.mean_value = mean;
+  r.min_value = minimum;
+  r.max_value = maximum;
+  r.count = count;
+  return r;
+}
+
+// Typical readings, and ones at the edges of each field's range (and of CBOR's head sizes).
+std::vector<UplinkReading> edgeReadings() {
+  return {
+    reading(START_TIME, 0, 2012, 2001, 1950, 2050, 180),
+    reading(START_TIME + 1800, 2, 1999, 0, 0, 0, 0),           // A gap: no interval
+    reading(23, 23, 7, -5, -99, 100, 1),
+    reading(24, 24, -1, -1, -100, -1, 24),
+    reading(0xFFFF, 255, 0, 0, 0, 0, 0xFF),
+    reading(0x10000, 1, -24, -25, -256, 255, 0x100),
+    reading(UINT32_MAX, 255, INT16_MIN, 0, INT16_MIN, INT16_MAX, UINT16_MAX),
+  };
+}
+
+const PayloadFormat FORMATS[] = { PAYLOAD_JSON, PAYLOAD_CBOR };
+
+void testRoundTrip() {
+  for(PayloadFormat format : FORMATS) {
+    CHECK_EQUAL(std::string(), roundTripDifference(format, edgeReadings(), "1"));
+    CHECK_EQUAL(std::string(), roundTripDifference(format, {}, "1"));
+  }
+}
+
+// Digits are sent as a number, as they always have been, unless that would change them.
+void testInstanceIds() {
+  const char* ids[] = { "0", "1", "123456789", "1234567890", "007", "", "fridge-2", "say \"hi\" \\ bye" };
+  for(PayloadFormat format : FORMATS) {
+    for(const char* id : ids)
+      CHECK_EQUAL(std::string(), roundTripDifference(format, edgeReadings(), id));
+  }
+
+  bool ok;
+  std::vector<Map> maps = decode(PAYLOAD_JSON, encode(PAYLOAD_JSON, edgeReadings(), "123456789"), ok);
+  CHECK(ok && !find(maps[0], "instanceId")->is_text);
+  maps = decode(PAYLOAD_CBOR, encode(PAYLOAD_CBOR, edgeReadings(), "007"), ok);
+  CHECK(ok && find(maps[0], "instanceId")->is_text);
+}
+
+// Control characters are left out of a string id, so JSON and CBOR give the server the same id.
+void testInstanceIdControlCharacters() {
+  for(PayloadFormat format : FORMATS) {
+    bool ok;
+    std::vector<Map> maps = decode(format, encode(format, edgeReadings(), "\tfridge\x01-2\n"), ok);
+    CHECK(ok && find(maps[0], "instanceId")->is_text);
+    CHECK_EQUAL(std::string("fridge-2"), find(maps[0], "instanceId")->text);
+  }
+}
+
+// Too small a buffer gives nothing at all, never a body cut short.
+void testOverflow() {
+  for(PayloadFormat format : FORMATS) {
+    std::vector<UplinkReading> readings = edgeReadings();
+    std::string body = encode(format, readings, "fridge-2");
+    std::vector<uint8_t> buffer(body.size());
+    size_t capacity;
+    int wrong = 0;
+    for(capacity = 0; capacity < body.size(); capacity++) {
+      PayloadEncoder encoder(buffer.data(), capacity);
+      if(encoder.Encode(format, readings.data(), readings.size(), "fridge-2") != 0)
+        wrong++;
+    }
+    CHECK_EQUAL(0, wrong);
+
+    PayloadEncoder exact(buffer.data(), buffer.size());
+    CHECK_EQUAL(body.size(), exact.Encode(format, readings.data(), readings.size(), "fridge-2"));
+    CHECK(body == std::string(buffer.begin(), buffer.end()));
+  }
+}
+
+// A day's backlog of half hours, as one post.
+void testCborSmaller() {
+  std::vector<UplinkReading> readings;
+  int i;
+  for(i = 0; i < 48; i++)
+    readings.push_back(reading(START_TIME + i * 1800, 0, 1900 + i, 1890 + i, 1850 + i, 1950 + i, 180));
+  size_t json = encode(PAYLOAD_JSON, readings, "1").size();
+  size_t cbor = encode(PAYLOAD_CBOR, readings, "1").size();
+  printf("48 readings: %u bytes of JSON, %u of CBOR\n", (unsigned)json, (unsigned)cbor);
+  CHECK(cbor < json);
+}
+
+// The readings the cloud interface posts arrive as CBOR, and decode to the half hours recorded.
+void testPostedAsCbor() {
+  LittleFS.Format();
+  HostHttpServer server("cloud.example");
+  LittleFS.SetContents(CloudInterface::ROOT_CERT_FILE, server.CertificatePem().c_str());
+  DeviceConfig config;
+  config.cloudLoggingUrl = "https://cloud.example/readings";
+  config.cloudLoggingApiKey = "test-api-key";
+  config.cloudInstanceId = "fridge-2";
+  config.cloud_payload_format = PAYLOAD_CBOR;
+
+  SampleBuffer samples;
+  std::unique_ptr<CloudInterface> cloud(new CloudInterface());
+  cloud->Setup();
+  CloudInterface* c = cloud.get();
+  samples.OnSampleIndexChange([c, &samples]() { c->QueueReading(samples); });
+
+  // A reading every 10 seconds for two hours, each new half hour queued and sent.
+  unsigned long start = millis();
+  while(millis() - start < 4 * HALF_HOUR) {
+    if(millis() % 10000 < 100) {
+      samples.SetSample(0, 2000 + millis() / 10000 % 100);
+      samples.FlushToFS();
+    }
+    cloud->Service(config);
+    delay(100);
+  }
+
+  CHECK(!server.requests.empty());
+  int readings = 0;
+  for(const HostHttpRequest& request : server.requests) {
+    CHECK_EQUAL(std::string("application/cbor"), request.Header("Content-Type"));
+    bool ok;
+    std::vector<Map> maps = decode(PAYLOAD_CBOR, request.body, ok);
+    CHECK(ok);
+    for(const Map& map : maps) {
+      int64_t count, mean;
+      CHECK(find(map, "instanceId") && find(map, "instanceId")->text == "fridge-2");
+      if(integer(map, "count", count) && centis(map, "meanValue", mean)) {
+        CHECK(count > 0 && mean >= 2000 && mean < 2100);
+        readings++;
+      }
+    }
+  }
+  CHECK(readings >= 3);
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+
+  RUN_TEST(testRoundTrip);
+  RUN_TEST(testInstanceIds);
+  RUN_TEST(testInstanceIdControlCharacters);
+  RUN_TEST(testOverflow);
+  RUN_TEST(testCborSmaller);
+  RUN_TEST(testPostedAsCbor);
+  return HostTestResult();
+}
@@ -0,0 +1,313 @@
+// The power can go off part way through any write to flash.  The sample journal must then
+//  load as it was before the write or as it was after, and the uplink queue must still hold
+//  every reading that wasn't sent, in order.
+
+#include <SampleBuffer.h>
+#include <UplinkQueue.h>
+#include <RecordFile.h>
+#include <EventLog.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+#include <memory>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+const int DAYS = 3;
+
+const char JOURNAL_FILE[] = "/avgs.jnl";
+const char QUEUE_FILE[] = "/uplink.q";
+const char QUEUE_HEAD_FILE[] = "/uplink.hd";
+
+bool sameTier(const SampleTier& a, const SampleTier& b) {
+  if(a.Filled() != b.Filled() || a.StartMinutes(0) != b.StartMinutes(0))
+    return false;
+  int age;
+  for(age = 0; age < a.Filled(); age++) {
+    if(a.Count(age) != b.Count(age) || a.Mean(age) != b.Mean(age))
+      return false;
+    if(a.HasStats() && (a.Min(age) != b.Min(age) || a.Max(age) != b.Max(age) || a.StdDev(age) != b.StdDev(age)))
+      return false;
+  }
+  return true;
+}
+
+// Everything the journal keeps.
+bool sameHistory(const SampleBuffer& a, const SampleBuffer& b) {
+  int channel;
+  for(channel = 0; channel < SENSOR_CHANNELS; channel++) {
+    const SampleChannel& x = a.Channel(channel);
+    const SampleChannel& y = b.Channel(channel);
+    if(x.current_temp != y.current_temp || x.min_temp != y.min_temp || x.max_temp != y.max_temp)
+      return false;
+    if(!sameTier(x.tiers[TIER_HALF_HOUR], y.tiers[TIER_HALF_HOUR]) || !sameTier(x.tiers[TIER_DAILY], y.tiers[TIER_DAILY]))
+      return false;
+  }
+  return true;
+}
+
+std::unique_ptr<SampleBuffer> loaded() {
+  std::unique_ptr<SampleBuffer> samples(new SampleBuffer());
+  samples->ReadFromFS();
+  return samples;
+}
+
+// A few days of a reading a minute, flushed as the main loop does, stopping on the reading
+//  that starts a new half hour, so there's an append waiting.
+std::unique_ptr<SampleBuffer> recorded() {
+  LittleFS.Format();
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  std::unique_ptr<SampleBuffer> samples(new SampleBuffer());
+  int minute;
+  for(minute = 1; minute <= DAYS * MINUTES_PER_DAY + 30; minute++) {
+    samples->FlushToFS();
+    HostClock::Advance(60000);
+    samples->SetSample(0, 1800 + (minute * 7) % 500);
+  }
+  return samples;
+}
+
+void testAppendCut() {
+  std::unique_ptr<SampleBuffer> samples = recorded();
+  std::vector<uint8_t> journal = LittleFS.Contents(JOURNAL_FILE);
+  std::unique_ptr<SampleBuffer> before = loaded();
+  samples->FlushToFS();
+  std::unique_ptr<SampleBuffer> after = loaded();
+  size_t appended = LittleFS.Contents(JOURNAL_FILE).size() - journal.size();
+  CHECK(appended > 0);
+  CHECK(!sameHistory(*before, *after));
+
+  size_t cut;
+  int wrong = 0;
+  for(cut = 0; cut < appended; cut++) {
+    samples = recorded();
+    LittleFS.SetContents(JOURNAL_FILE, journal);
+    LittleFS.CutPowerAfter(cut);
+    samples->FlushToFS();
+    CHECK(LittleFS.PoweredOff());
+    LittleFS.Restore();
+
+    // Loading drops what there is of the append, and compacts the journal, so the next
+    //  boot loads the same.
+    if(!sameHistory(*loaded(), *before) || !sameHistory(*loaded(), *before))
+      wrong++;
+  }
+  CHECK_EQUAL(0, wrong);
+}
+
+void testSnapshotCut() {
+  std::unique_ptr<SampleBuffer> samples = recorded();
+  samples->FlushToFS();
+  std::vector<uint8_t> journal = LittleFS.Contents(JOURNAL_FILE);
+  std::unique_ptr<SampleBuffer> before = loaded();
+
+  // Resetting the min and max rewrites the whole journal.
+  samples->ResetMinMaxTemps();
+  samples->WriteToFS();
+  std::unique_ptr<SampleBuffer> after = loaded();
+  size_t snapshot = LittleFS.Contents(JOURNAL_FILE).size();
+  CHECK(!sameHistory(*before, *after));
+
+  // Every few bytes, and every byte of the last records.
+  size_t cut;
+  int wrong = 0;
+  for(cut = 0; cut < snapshot; cut += cut < snapshot - 64 ? 13 : 1) {
+    LittleFS.SetContents(JOURNAL_FILE, journal);
+    LittleFS.CutPowerAfter(cut);
+    samples->WriteToFS();
+    LittleFS.Restore();
+    if(!sameHistory(*loaded(), *before))
+      wrong++;
+  }
+  CHECK_EQUAL(0, wrong);
+
+  // Without a cut, the new journal replaces the old.
+  samples->WriteToFS();
+  CHECK(sameHistory(*loaded(), *after));
+}
+
+UplinkReading reading(uint32_t n) {
+  UplinkReading r = {};
+  r.timestamp = START_TIME + n * 1800;
+  r.value = 2000 + n;
+  r.mean_value = 2000 + n;
+  r.count = 180;
+  return r;
+}
+
+std::vector<UplinkReading> peekAll() {
+  UplinkQueue queue;
+  queue.Begin();
+  std::vector<UplinkReading> readings(UplinkQueue::MAX_QUEUED);
+  readings.resize(queue.Peek(readings.data(), readings.size()));
+  CHECK_EQUAL(queue.Count(), (int)readings.size());
+  return readings;
+}
+
+// The readings are readings first to last, undamaged, with the timestamps of those from
+//  retimedFrom on moved by seconds.
+bool holds(const std::vector<UplinkReading>& readings, uint32_t first, uint32_t last, uint32_t retimedFrom = UINT32_MAX, long seconds = 0) {
+  if(readings.size() != last - first + 1)
+    return false;
+  uint32_t n;
+  for(n = first; n <= last; n++) {
+    UplinkReading expected = reading(n);
+    if(n >= retimedFrom)
+      expected.timestamp += seconds;
+    if(memcmp(&expected, &readings[n - first], sizeof(expected)) != 0)
+      return false;
+  }
+  return true;
+}
+
+// Readings 1 to last queued, and the first 10 sent.
+void queueReadings(UplinkQueue& queue, uint32_t last = 30) {
+  LittleFS.Format();
+  queue.Begin();
+  uint32_t n;
+  for(n = 1; n <= last; n++)
+    queue.Push(reading(n));
+  queue.Pop(10);
+}
+
+// As above, with a reboot before reading 20, so only the readings from there on were taken
+//  with the clock set at startup, and are retimed.
+void queueSinceReboot(UplinkQueue& rebooted) {
+  UplinkQueue before;
+  queueReadings(before, 19);
+  rebooted.Begin();
+  uint32_t n;
+  for(n = 20; n <= 30; n++)
+    rebooted.Push(reading(n));
+}
+
+void testQueuePushCut() {
+  UplinkQueue queue;
+  queueReadings(queue);
+  std::vector<uint8_t> file = LittleFS.Contents(QUEUE_FILE);
+  std::vector<uint8_t> head = LittleFS.Contents(QUEUE_HEAD_FILE);
+
+  size_t cut;
+  for(cut = 0; cut <= RecordFile::RecordSize(sizeof(UplinkReading)); cut++) {
+    LittleFS.SetContents(QUEUE_FILE, file);
+    LittleFS.SetContents(QUEUE_HEAD_FILE, head);
+    queue.Begin();
+    LittleFS.CutPowerAfter(cut);
+    queue.Push(reading(31));
+    LittleFS.Restore();
+
+    std::vector<UplinkReading> readings = peekAll();
+    CHECK(holds(readings, 11, 30) || holds(readings, 11, 31));
+
+    // A torn reading is dropped on loading, so the next one follows on from the last whole one.
+    UplinkQueue next;
+    next.Begin();
+    CHECK(next.Push(reading(32)));
+    readings = peekAll();
+    CHECK_EQUAL(reading(32).timestamp, readings.back().timestamp);
+  }
+}
+
+// Only the readings queued since the reboot are retimed, and not any of those already sent.
+//  Loading the queue again (for a new root certificate) doesn't change which they are.
+void testQueueRetimeSinceReboot() {
+  UplinkQueue queue;
+  queueSinceReboot(queue);
+  queue.Retime(3600);
+  CHECK(holds(peekAll(), 11, 30, 20, 3600));
+
+  UplinkQueue sent;
+  queueSinceReboot(sent);
+  sent.Pop(12);
+  sent.Begin();
+  sent.Retime(3600);
+  CHECK(holds(peekAll(), 23, 30, 20, 3600));
+
+  // Only once.
+  sent.Retime(3600);
+  CHECK(holds(peekAll(), 23, 30, 20, 3600));
+}
+
+// Retiming the queue rewrites it, as does a Pop() once enough has been sent.
+void testQueueCompactCut() {
+  UplinkQueue before;
+  queueReadings(before, 19);
+  std::vector<uint8_t> file = LittleFS.Contents(QUEUE_FILE);
+  std::vector<uint8_t> head = LittleFS.Contents(QUEUE_HEAD_FILE);
+  size_t compacted = 0;
+
+  size_t cut;
+  for(cut = 0; cut == 0 || cut < compacted; cut++) {
+    LittleFS.SetContents(QUEUE_FILE, file);
+    LittleFS.SetContents(QUEUE_HEAD_FILE, head);
+    UplinkQueue queue;
+    queue.Begin();
+    uint32_t n;
+    for(n = 20; n <= 30; n++)
+      queue.Push(reading(n));
+
+    // The first time through, uncut, to find how much the retime writes.
+    uint32_t written = LittleFS.bytes_written;
+    if(compacted > 0)
+      LittleFS.CutPowerAfter(cut);
+    queue.Retime(3600);
+    LittleFS.Restore();
+    if(compacted == 0) {
+      compacted = LittleFS.bytes_written - written;
+      CHECK(holds(peekAll(), 11, 30, 20, 3600));
+      CHECK(compacted > 0);
+      continue;
+    }
+
+    // Once the new file has replaced the old, losing the saved head means starting from
+    //  the start of it, which is where it's meant to be anyway.
+    std::vector<UplinkReading> readings = peekAll();
+    CHECK(holds(readings, 11, 30) || holds(readings, 11, 30, 20, 3600));
+  }
+}
+
+// With the flash full, the rewritten queue is left out, and the old one kept as it was.
+void testQueueCompactFull() {
+  UplinkQueue queue;
+  queueSinceReboot(queue);
+  uint32_t logged = eventLog.LastSequence();
+
+  LittleFS.SetFreeSpace(5 * RecordFile::RecordSize(sizeof(UplinkReading)) + 3);
+  queue.Retime(3600);
+  CHECK_EQUAL(20, queue.Count());
+  CHECK(!LittleFS.exists("/uplink.tmp"));
+  LittleFS.Restore();
+
+  HostPrint log;
+  eventLog.PrintSince(log, logged);
+  CHECK(log.text.find("failed to compact") != std::string::npos);
+
+  // Readings are still sent from where they were, and queued after the last one.
+  UplinkReading readings[20];
+  CHECK_EQUAL(20, queue.Peek(readings, 20));
+  CHECK_EQUAL(reading(11).timestamp, readings[0].timestamp);
+  CHECK(queue.Push(reading(31)));
+
+  // Loading it again, the head saved with the flash full may not have been kept, and then
+  //  the sent readings are sent again (the server ignores repeats).  None are lost.
+  std::vector<UplinkReading> queued = peekAll();
+  CHECK(holds(queued, 11, 31) || holds(queued, 1, 31));
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+
+  RUN_TEST(testAppendCut);
+  RUN_TEST(testSnapshotCut);
+  RUN_TEST(testQueuePushCut);
+  RUN_TEST(testQueueRetimeSinceReboot);
+  RUN_TEST(testQueueCompactCut);
+  RUN_TEST(testQueueCompactFull);
+  return HostTestResult();
+}
@@ -0,0 +1,103 @@
+// Tasks keep to their original deadlines, so the cadence doesn't drift with the time other work
+//  takes, and start again from now if a whole period's missed.  Lateness is added up in 64 bits,
+//  so a task held up for hours, as the WiFi portal or a long outage can, is reported as it was.
+
+#include <TaskScheduler.h>
+#include <HostTest.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+const unsigned long SECOND = 1000;
+const unsigned long HOUR = 3600 * SECOND;
+
+// The main loop, every 10ms, for a while.
+void runLoop(TaskScheduler& scheduler, unsigned long duration) {
+  unsigned long start = millis();
+  while(millis() - start < duration) {
+    scheduler.Run();
+    delay(10);
+  }
+}
+
+// A task's value in the Prometheus text, or an empty string.
+std::string metric(TaskScheduler& scheduler, const char* name, const char* task) {
+  HostPrint out;
+  scheduler.PrintMetrics(out);
+  std::string prefix = std::string(name) + "{task=\"" + task + "\"} ";
+  size_t at = out.text.find(prefix);
+  if(at == std::string::npos)
+    return "";
+  at += prefix.size();
+  return out.text.substr(at, out.text.find('\n', at) - at);
+}
+
+// Another task taking 300ms each time doesn't push the 1 second task's deadlines back.
+void testCadenceDoesNotDrift() {
+  HostClock::Begin(START_TIME);
+  TaskScheduler scheduler;
+  std::vector<unsigned long> runs;
+  scheduler.Add("tick", SECOND, [&runs]() { runs.push_back(millis()); });
+  scheduler.Add("slow", 700, []() { delay(300); });
+
+  unsigned long start = millis();
+  runLoop(scheduler, 60 * SECOND);
+  CHECK(runs.size() >= 59 && runs.size() <= 61);
+  CHECK(runs.back() - start < 60 * SECOND);
+  CHECK(runs.back() - start >= (runs.size() - 1) * SECOND);
+  CHECK_EQUAL(std::string("0"), metric(scheduler, "brewmon_task_overruns_total", "tick"));
+}
+
+// Held up for longer than its period: counted as an overrun, and run once, not to catch up.
+void testMissedPeriodStartsAgain() {
+  HostClock::Begin(START_TIME);
+  TaskScheduler scheduler;
+  int runs = 0;
+  bool blocked = false;
+  scheduler.Add("tick", SECOND, [&runs]() { runs++; });
+  scheduler.Add("block", HOUR, [&blocked]() {
+    if(!blocked) {
+      blocked = true;
+      delay(10 * SECOND);
+    }
+  });
+
+  runLoop(scheduler, 5 * SECOND);   // Only ends after the block, 10 seconds in
+  CHECK_EQUAL(1, runs);
+  scheduler.Run();
+  scheduler.Run();
+  CHECK_EQUAL(2, runs);
+  CHECK_EQUAL(std::string("1"), metric(scheduler, "brewmon_task_overruns_total", "tick"));
+}
+
+// Two hours late: more than 32 bits of microseconds, for the total and the maximum.
+void testLatenessOverAnHour() {
+  HostClock::Begin(START_TIME);
+  TaskScheduler scheduler;
+  bool blocked = false;
+  scheduler.Add("block", 24 * HOUR, [&blocked]() {
+    if(!blocked) {
+      blocked = true;
+      delay(2 * HOUR);
+    }
+  });
+  scheduler.Add("tick", SECOND, []() {});
+
+  scheduler.Run();
+  CHECK_EQUAL(std::string("7200.000000"), metric(scheduler, "brewmon_task_late_max_seconds", "tick"));
+  CHECK_EQUAL(std::string("7200.000000"), metric(scheduler, "brewmon_task_late_seconds_total", "tick"));
+
+  HostPrint stats;
+  scheduler.PrintStats(stats);
+  CHECK(stats.text.find("4294967295") != std::string::npos);
+}
+
+}
+
+int main() {
+  RUN_TEST(testCadenceDoesNotDrift);
+  RUN_TEST(testMissedPeriodStartsAgain);
+  RUN_TEST(testLatenessOverAnHour);
+  return HostTestResult();
+}
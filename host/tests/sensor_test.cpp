@@ -0,0 +1,156 @@
+// Readings from several DS1621s on the I2C bus (support/HostDs1621.h), converting together.
+//  A sensor that doesn't start converting, or doesn't finish in time, is left out of the
+//  reading, rather than holding up the others or recording a stale value.
+
+#include <SensorInterface.h>
+#include <EventLog.h>
+#include <HostDs1621.h>
+#include <HostTest.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+const int RESCAN_READINGS = 30;
+
+std::string logSince(uint32_t sequence) {
+  HostPrint out;
+  eventLog.PrintSince(out, sequence);
+  return out.text;
+}
+
+// A reading, as the main loop takes one: started, then collected by Service() every 100ms.
+//  Returns how long it took.
+unsigned long takeReading(SensorInterface& sensor, SampleBuffer& samples) {
+  HostClock::Advance(10000);
+  unsigned long start = millis();
+  sensor.StartReading(samples);
+  while(sensor.Converting()) {
+    HostClock::Advance(100);
+    sensor.Service(samples);
+  }
+  return millis() - start;
+}
+
+void testAllChannelsRead() {
+  HostDs1621 sensors[3] = { HostDs1621(0), HostDs1621(1), HostDs1621(2) };
+  sensors[0].temp = 18.5;
+  sensors[1].temp = 20.25;
+  sensors[2].temp = 3.0625;
+  SampleBuffer samples;
+  SensorInterface sensor;
+  sensor.Setup();
+  CHECK_EQUAL(7, (int)sensor.PresentMask());
+
+  unsigned long took = takeReading(sensor, samples);
+  CHECK(took >= 750 && took < 1000);
+  CHECK_EQUAL(1850, (int)samples.Channel(0).current_temp);
+  CHECK_EQUAL(2025, (int)samples.Channel(1).current_temp);
+  CHECK_EQUAL(306, (int)samples.Channel(2).current_temp);
+}
+
+void testStuckChannelLeftOut() {
+  HostDs1621 sensors[3] = { HostDs1621(0), HostDs1621(1), HostDs1621(2) };
+  SampleBuffer samples;
+  SensorInterface sensor;
+  sensor.Setup();
+  takeReading(sensor, samples);
+  time_t before = samples.Channel(1).last_sample_time;
+
+  sensors[0].temp = 21;
+  sensors[1].temp = 22;
+  sensors[2].temp = 23;
+  sensors[1].stuck = true;
+  uint32_t logged = eventLog.LastSequence();
+  unsigned long took = takeReading(sensor, samples);
+
+  // The others are recorded once the timeout's up, and the stuck one's last reading isn't
+  //  recorded again as new.
+  CHECK(took >= 1500 && took < 1700);
+  CHECK_EQUAL(2100, (int)samples.Channel(0).current_temp);
+  CHECK_EQUAL(2300, (int)samples.Channel(2).current_temp);
+  CHECK_EQUAL(2000, (int)samples.Channel(1).current_temp);
+  CHECK_EQUAL(before, samples.Channel(1).last_sample_time);
+  CHECK_EQUAL(5, (int)sensor.PresentMask());
+  std::string log = logSince(logged);
+  CHECK(log.find("channel 1 didn't finish converting") != std::string::npos);
+  CHECK(log.find("channel 0") == std::string::npos && log.find("channel 2") == std::string::npos);
+
+  // It isn't asked again until missing sensors are looked for, so the others aren't held up.
+  uint32_t conversions = sensors[1].conversions;
+  CHECK(takeReading(sensor, samples) < 1000);
+  CHECK_EQUAL(conversions, sensors[1].conversions);
+
+  // Once it's working again, it's found on the next scan and read as usual.
+  sensors[1].stuck = false;
+  int i;
+  for(i = 0; i < RESCAN_READINGS; i++)
+    takeReading(sensor, samples);
+  CHECK_EQUAL(7, (int)sensor.PresentMask());
+  CHECK_EQUAL(2200, (int)samples.Channel(1).current_temp);
+}
+
+// Its registers still hold the last conversion, which mustn't be recorded as a new reading.
+void testFailedStartLeftOut() {
+  HostDs1621 sensors[3] = { HostDs1621(0), HostDs1621(1), HostDs1621(2) };
+  SampleBuffer samples;
+  SensorInterface sensor;
+  sensor.Setup();
+  takeReading(sensor, samples);
+  time_t before = samples.Channel(1).last_sample_time;
+
+  sensors[0].temp = 21;
+  sensors[1].temp = 22;
+  sensors[2].temp = 23;
+  sensors[1].refuse_start = true;
+  uint32_t logged = eventLog.LastSequence();
+  takeReading(sensor, samples);
+
+  CHECK_EQUAL(2100, (int)samples.Channel(0).current_temp);
+  CHECK_EQUAL(2300, (int)samples.Channel(2).current_temp);
+  CHECK_EQUAL(2000, (int)samples.Channel(1).current_temp);
+  CHECK_EQUAL(before, samples.Channel(1).last_sample_time);
+  CHECK_EQUAL(5, (int)sensor.PresentMask());
+  std::string log = logSince(logged);
+  CHECK(log.find("channel 1 not answering") != std::string::npos);
+  CHECK(log.find("channel 0") == std::string::npos && log.find("channel 2") == std::string::npos);
+
+  // Found again on the next scan, once it answers.
+  sensors[1].refuse_start = false;
+  int i;
+  for(i = 0; i < RESCAN_READINGS; i++)
+    takeReading(sensor, samples);
+  CHECK_EQUAL(7, (int)sensor.PresentMask());
+  CHECK_EQUAL(2200, (int)samples.Channel(1).current_temp);
+}
+
+void testMissingChannelLeftOut() {
+  HostDs1621 first(0);
+  SampleBuffer samples;
+  SensorInterface sensor;
+  {
+    HostDs1621 second(1);
+    sensor.Setup();
+    CHECK_EQUAL(3, (int)sensor.PresentMask());
+  }
+
+  uint32_t logged = eventLog.LastSequence();
+  first.temp = 19;
+  takeReading(sensor, samples);
+  CHECK_EQUAL(1900, (int)samples.Channel(0).current_temp);
+  CHECK_EQUAL(1, (int)sensor.PresentMask());
+  CHECK(logSince(logged).find("channel 1 not answering") != std::string::npos);
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+
+  RUN_TEST(testAllChannelsRead);
+  RUN_TEST(testStuckChannelLeftOut);
+  RUN_TEST(testFailedStartLeftOut);
+  RUN_TEST(testMissingChannelLeftOut);
+  return HostTestResult();
+}
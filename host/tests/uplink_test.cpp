@@ -0,0 +1,246 @@
+// Readings queued for the cloud reach the server oldest first, survive outages and reboots,
+//  and back off while the server's failing.  A reading is only sent again if its post might
+//  not have got through, and then with the same timestamp, so the server can ignore it.
+
+#include <CloudInterface.h>
+#include <HostHttpServer.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+#include <memory>
+#include <set>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+const unsigned long HALF_HOUR = 30 * 60 * 1000UL;
+
+DeviceConfig config;
+SampleBuffer samples;
+
+struct Received {
+  uint32_t timestamp;
+  int channel;
+  bool operator<(const Received& other) const {
+    return timestamp < other.timestamp || (timestamp == other.timestamp && channel < other.channel);
+  }
+};
+
+// The readings in a JSON post, in the order sent.
+std::vector<Received> readingsIn(const std::string& body) {
+  std::vector<Received> readings;
+  size_t at = 0;
+  while((at = body.find("\"channel\":", at)) != std::string::npos) {
+    Received r;
+    r.channel = atoi(body.c_str() + at + 10);
+    at = body.find("\"timestamp\":", at);
+    r.timestamp = strtoul(body.c_str() + at + 12, NULL, 10);
+    readings.push_back(r);
+  }
+  return readings;
+}
+
+std::vector<Received> allReceived(const HostHttpServer& server) {
+  std::vector<Received> all;
+  for(const HostHttpRequest& request : server.requests) {
+    std::vector<Received> readings = readingsIn(request.body);
+    all.insert(all.end(), readings.begin(), readings.end());
+  }
+  return all;
+}
+
+bool inOrder(const std::vector<Received>& readings) {
+  size_t i;
+  for(i = 1; i < readings.size(); i++) {
+    if(readings[i] < readings[i - 1])
+      return false;
+  }
+  return true;
+}
+
+std::unique_ptr<CloudInterface> boot(HostHttpServer& server) {
+  LittleFS.SetContents(CloudInterface::ROOT_CERT_FILE, server.CertificatePem().c_str());
+  std::unique_ptr<CloudInterface> cloud(new CloudInterface());
+  cloud->Setup();
+  return cloud;
+}
+
+// The main loop, for a while: a reading every 10 seconds, each new half hour queued, and
+//  Service() called in between.
+void runLoop(CloudInterface& cloud, unsigned long duration) {
+  unsigned long start = millis();
+  while(millis() - start < duration) {
+    if(millis() % 10000 < 100) {
+      samples.SetSample(0, 2000 + millis() / 10000 % 100);
+      samples.FlushToFS();
+    }
+    cloud.Service(config);
+    delay(100);
+  }
+}
+
+// Service() alone, with no new readings, until the queue's sent.
+void drain(CloudInterface& cloud) {
+  unsigned long start = millis();
+  while(cloud.QueuedCount() > 0 && millis() - start < HALF_HOUR) {
+    cloud.Service(config);
+    delay(100);
+  }
+}
+
+void setUp() {
+  LittleFS.Format();
+  config.cloudLoggingUrl = "https://cloud.example/readings";
+  config.cloudLoggingApiKey = "test-api-key";
+  samples.OnSampleIndexChange(nullptr);
+}
+
+void testOutageSendsInOrder() {
+  setUp();
+  HostHttpServer server("cloud.example");
+  std::unique_ptr<CloudInterface> cloud = boot(server);
+  CloudInterface* c = cloud.get();
+  int queued = 0;
+  samples.OnSampleIndexChange([c, &queued]() { c->QueueReading(samples); queued++; });
+
+  server.down = true;
+  runLoop(*cloud, 4 * HALF_HOUR);
+  CHECK(server.requests.empty());
+  CHECK(cloud->QueuedCount() >= 4);
+  CHECK_EQUAL(queued, cloud->QueuedCount());
+
+  // Back up: the backlog goes out in batches, and then each new reading as it comes.  The
+  //  last may only just have been queued, so it's given time to go.
+  server.down = false;
+  runLoop(*cloud, 2 * HALF_HOUR);
+  drain(*cloud);
+  CHECK_EQUAL(0, cloud->QueuedCount());
+  std::vector<Received> received = allReceived(server);
+  CHECK(queued >= 6);
+  CHECK_EQUAL((size_t)queued, received.size());
+  CHECK(inOrder(received));
+  CHECK(readingsIn(server.requests[0].body).size() > 1);
+}
+
+// While the server fails, attempts back off: 30 seconds, doubling up to 30 minutes.
+void testBackoff() {
+  setUp();
+  HostHttpServer server("cloud.example");
+  std::vector<unsigned long> attempts;
+  server.handler = [&attempts](const HostHttpRequest&) {
+    attempts.push_back(millis());
+    HostHttpResponse response;
+    response.status = 503;
+    return response;
+  };
+  std::unique_ptr<CloudInterface> cloud = boot(server);
+  CloudInterface* c = cloud.get();
+  samples.OnSampleIndexChange([c]() { c->QueueReading(samples); });
+
+  runLoop(*cloud, 6 * 60 * 60 * 1000UL);
+  CHECK(attempts.size() >= 8);
+  size_t i;
+  unsigned long expected = 30000;
+  for(i = 1; i < attempts.size(); i++) {
+    unsigned long gap = attempts[i] - attempts[i - 1];
+    CHECK(gap >= expected && gap < expected + 3000);
+    expected = std::min(expected * 2, 30 * 60 * 1000UL);
+  }
+  CHECK_EQUAL(30 * 60 * 1000UL, (unsigned long)(attempts.back() - attempts[attempts.size() - 2]) / 1000 * 1000);
+}
+
+// A response that never arrives may still have been stored, so the readings are sent again,
+//  the same, and the server sees repeats it can drop.
+void testLostResponseRepeats() {
+  setUp();
+  HostHttpServer server("cloud.example");
+  int answered = 0;
+  server.handler = [&answered](const HostHttpRequest&) {
+    HostHttpResponse response;
+    if(answered++ == 0)
+      response.delay_millis = 20000;      // Past the post timeout
+    return response;
+  };
+  std::unique_ptr<CloudInterface> cloud = boot(server);
+  CloudInterface* c = cloud.get();
+  size_t queued = 0;
+  samples.OnSampleIndexChange([c, &queued]() { c->QueueReading(samples); queued++; });
+
+  runLoop(*cloud, 3 * HALF_HOUR);
+  drain(*cloud);
+  CHECK_EQUAL(0, cloud->QueuedCount());
+
+  std::vector<Received> received = allReceived(server);
+  std::set<Received> unique(received.begin(), received.end());
+  CHECK(received.size() > unique.size());
+  CHECK_EQUAL(queued, unique.size());
+  CHECK(inOrder(std::vector<Received>(unique.begin(), unique.end())));
+
+  // Queuing the same reading again (at the same time) doesn't add it twice.
+  HostClock::Advance(1000);
+  size_t before = cloud->QueuedCount();
+  cloud->QueueReading(samples);
+  cloud->QueueReading(samples);
+  CHECK_EQUAL(before + 1, (size_t)cloud->QueuedCount());
+}
+
+// Readings queued during an outage are still sent after a reboot, before the new ones.
+void testRebootDuringOutage() {
+  setUp();
+  HostHttpServer server("cloud.example");
+  server.down = true;
+  {
+    std::unique_ptr<CloudInterface> cloud = boot(server);
+    CloudInterface* c = cloud.get();
+    samples.OnSampleIndexChange([c]() { c->QueueReading(samples); });
+    runLoop(*cloud, 3 * HALF_HOUR);
+    CHECK_EQUAL(3, cloud->QueuedCount());
+  }
+
+  HostClock::Reset(60000, false);
+  HostClock::SyncNtp();
+  server.down = false;
+  std::unique_ptr<CloudInterface> cloud = boot(server);
+  CHECK_EQUAL(3, cloud->QueuedCount());
+  CloudInterface* c = cloud.get();
+  samples.OnSampleIndexChange([c]() { c->QueueReading(samples); });
+  runLoop(*cloud, HALF_HOUR);
+
+  std::vector<Received> received = allReceived(server);
+  CHECK_EQUAL((size_t)4, received.size());
+  CHECK(inOrder(received));
+  CHECK_EQUAL(0, cloud->QueuedCount());
+}
+
+// Posts only go over TLS, so anything but an https URL isn't used.
+void testHttpsOnly() {
+  setUp();
+  HostHttpServer server("cloud.example");
+  HostHttpServer plain("cloud.example", 80, false);
+  config.cloudLoggingUrl = "http://cloud.example/readings";
+  std::unique_ptr<CloudInterface> cloud = boot(server);
+  CHECK(!CloudInterface::IsValidUrl(config.cloudLoggingUrl));
+  CHECK(CloudInterface::IsValidUrl("https://cloud.example:8443/readings"));
+  CHECK(!CloudInterface::IsValidUrl("https:///readings"));
+
+  HostPrint out;
+  HostClock::Advance(1000);
+  cloud->WriteDataToCloud(samples, config, out);
+  CHECK(out.text.find("Not configured") != std::string::npos);
+  CHECK(server.requests.empty() && plain.requests.empty());
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+
+  RUN_TEST(testOutageSendsInOrder);
+  RUN_TEST(testBackoff);
+  RUN_TEST(testLostResponseRepeats);
+  RUN_TEST(testRebootDuringOutage);
+  RUN_TEST(testHttpsOnly);
+  return HostTestResult();
+}
@@ -0,0 +1,110 @@
+// Conditional requests: a browser that sends back the ETag it was given gets a 304 only if the
+//  response would be the same, so it never keeps showing data that's changed.  The page is sent
+//  gzipped, as it's stored.  Static files are versioned by name instead, so they're sent
+//  gzipped, to be kept for good, and timed like the other pages.
+
+#include <DeviceWebServer.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+
+DeviceConfig config;
+SampleBuffer samples;
+DeviceWebServer web(config, samples);
+
+const char INDEX_PAGE_FILE[] = "/index.html.gz";
+const char CHART_JS[] = "/static/chart-4.4.1.js";
+const char CHART_JS_FILE[] = "/static/chart-4.4.1.js.gz";
+
+HostWebResponse get(const char* uri, const std::string& etag = "") {
+  HostWebArgs headers;
+  if(!etag.empty())
+    headers.push_back({ "If-None-Match", etag });
+  return ESP8266WebServer::Instance()->Request(HTTP_GET, uri, HostWebArgs(), headers);
+}
+
+// The readings are served before the startup time's recorded, then the body gains it without
+//  the readings changing.
+void testStartupTimeChangesApiETag() {
+  HostClock::Advance(60000);
+  samples.SetSample(0, 2000);
+
+  HostWebResponse before = get("/api/samples");
+  CHECK_EQUAL(200, before.status);
+  CHECK(before.body.find("\"startup\":0,") != std::string::npos);
+  CHECK(!before.Header("ETag").empty());
+  CHECK_EQUAL(304, get("/api/samples", before.Header("ETag")).status);
+
+  CHECK(web.RecordStartupTime());
+  HostWebResponse after = get("/api/samples", before.Header("ETag"));
+  CHECK_EQUAL(200, after.status);
+  CHECK(after.body.find("\"startup\":0,") == std::string::npos);
+  CHECK(after.Header("ETag") != before.Header("ETag"));
+  CHECK_EQUAL(304, get("/api/samples", after.Header("ETag")).status);
+}
+
+// The page is sent as build.py gzipped it, and not again to a browser that already has it.
+void testIndexPageGzippedAndNotModified() {
+  LittleFS.SetContents(INDEX_PAGE_FILE, std::vector<uint8_t>(3000, 'x'));
+
+  HostWebResponse page = get("/");
+  CHECK_EQUAL(200, page.status);
+  CHECK_EQUAL(std::string("gzip"), page.Header("Content-Encoding"));
+  CHECK_EQUAL(std::string("text/html"), page.Header("Content-Type"));
+  CHECK_EQUAL(std::string("no-cache"), page.Header("Cache-Control"));
+  CHECK_EQUAL((size_t)3000, page.body.size());
+  CHECK(!page.Header("ETag").empty());
+
+  HostWebResponse again = get("/", page.Header("ETag"));
+  CHECK_EQUAL(304, again.status);
+  CHECK(again.body.empty());
+  CHECK(again.Header("Content-Encoding").empty());
+  CHECK_EQUAL(200, get("/", "\"stale\"").status);
+}
+
+// The count for a timed handler in /metrics, or an empty string.
+std::string metricCount(const char* name) {
+  std::string body = get("/metrics").body;
+  std::string prefix = std::string("brewmon_duration_seconds_count{name=\"") + name + "\"} ";
+  size_t at = body.find(prefix);
+  if(at == std::string::npos)
+    return "";
+  at += prefix.size();
+  return body.substr(at, body.find('\n', at) - at);
+}
+
+// Asked for by the name the page uses, and sent from the .gz build.py writes.
+void testStaticFileGzippedAndTimed() {
+  LittleFS.SetContents(CHART_JS_FILE, std::vector<uint8_t>(2000, 'z'));
+  CHECK_EQUAL(std::string("0"), metricCount("DeviceWebServer::handleStatic"));
+
+  HostWebResponse response = get(CHART_JS);
+  CHECK_EQUAL(200, response.status);
+  CHECK_EQUAL(std::string("gzip"), response.Header("Content-Encoding"));
+  CHECK_EQUAL(std::string("application/javascript"), response.Header("Content-Type"));
+  CHECK_EQUAL(std::string("max-age=31536000, immutable"), response.Header("Cache-Control"));
+  CHECK_EQUAL((size_t)2000, response.body.size());
+  CHECK_EQUAL(std::string("1"), metricCount("DeviceWebServer::handleStatic"));
+
+  CHECK_EQUAL(404, get("/static/chart-4.4.0.js").status);
+  CHECK_EQUAL(404, get("/static/../index.html").status);
+  CHECK_EQUAL(std::string("3"), metricCount("DeviceWebServer::handleStatic"));
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+  web.Setup();
+
+  RUN_TEST(testStartupTimeChangesApiETag);
+  RUN_TEST(testIndexPageGzippedAndNotModified);
+  RUN_TEST(testStaticFileGzippedAndTimed);
+  return HostTestResult();
+}
@@ -0,0 +1,128 @@
+// The web pages stream from fixed buffers, so the heap a request takes mustn't grow with the
+//  size of the response.
+
+#include <DeviceWebServer.h>
+#include <HostHeap.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+
+DeviceConfig config;
+SampleBuffer samples;
+DeviceWebServer web(config, samples);
+
+struct Measured {
+  HostWebResponse response;
+  HostHeap::Stats heap;
+};
+
+Measured request(const char* uri) {
+  HostHeap::Reset();
+  Measured measured;
+  measured.response = ESP8266WebServer::Instance()->Request(HTTP_GET, uri);
+  measured.heap = HostHeap::Get();
+  measured.heap.peak_bytes -= HostHeap::LiveBytes();
+  return measured;
+}
+
+int countOf(const std::string& text, char c) {
+  return std::count(text.begin(), text.end(), c);
+}
+
+// The number of values in one of the JSON response's arrays.
+int arrayLength(const std::string& json, const char* name) {
+  size_t start = json.find(std::string("\"") + name + "\":[");
+  if(start == std::string::npos)
+    return -1;
+  start = json.find('[', start) + 1;
+  size_t end = json.find(']', start);
+  return end == start ? 0 : countOf(json.substr(start, end - start), ',') + 1;
+}
+
+// Two weeks of a reading a minute, filling the half hour tier.
+void fillSamples() {
+  int minute;
+  for(minute = 0; minute < 14 * MINUTES_PER_DAY; minute++) {
+    HostClock::Advance(60000);
+    samples.SetSample(0, 2000 + minute % 300);
+  }
+}
+
+void testApiSamplesHeapIsFlat() {
+  Measured day = request("/api/samples?tier=halfhour&points=48");
+  Measured week = request("/api/samples?tier=halfhour&points=336");
+  Measured fortnight = request("/api/samples?tier=halfhour&points=672");
+
+  CHECK_EQUAL(200, fortnight.response.status);
+  CHECK_EQUAL('}', fortnight.response.body.back());
+  CHECK(fortnight.response.chunks > 10);
+  CHECK(fortnight.response.body.size() > 10 * day.response.body.size());
+
+  CHECK_EQUAL(672, arrayLength(fortnight.response.body, "counts"));
+  CHECK_EQUAL(672, arrayLength(fortnight.response.body, "stdDevs"));
+
+  CHECK_EQUAL(day.heap.peak_bytes, week.heap.peak_bytes);
+  CHECK_EQUAL(day.heap.peak_bytes, fortnight.heap.peak_bytes);
+  CHECK_EQUAL(day.heap.allocations, fortnight.heap.allocations);
+  printf("/api/samples: %u bytes peak heap for %u bytes of JSON, %u for %u\n",
+    (unsigned)day.heap.peak_bytes, (unsigned)day.response.body.size(),
+    (unsigned)fortnight.heap.peak_bytes, (unsigned)fortnight.response.body.size());
+}
+
+void testCsvHeapIsFlat() {
+  Measured day = request("/api/samples.csv?tier=halfhour&points=48");
+  Measured fortnight = request("/api/samples.csv?tier=halfhour&points=672");
+
+  CHECK_EQUAL(200, fortnight.response.status);
+  CHECK_EQUAL(673, countOf(fortnight.response.body, '\n'));
+  CHECK_EQUAL(day.heap.peak_bytes, fortnight.heap.peak_bytes);
+}
+
+// A repeat of the last request comes from the response cache, without rendering.
+void testCachedResponseHeapIsFlat() {
+  Measured rendered = request("/api/samples?tier=halfhour&points=48");
+  Measured cached = request("/api/samples?tier=halfhour&points=48");
+
+  CHECK_EQUAL(rendered.response.body, cached.response.body);
+  CHECK(cached.heap.peak_bytes <= rendered.heap.peak_bytes);
+}
+
+// The page is streamed from the file, however big it is.
+void testIndexPageHeapIsFlat() {
+  LittleFS.SetContents("/index.html.gz", std::vector<uint8_t>(1000, 'x'));
+  Measured small = request("/");
+  web.Setup();        // Forgets the page's checksum
+  LittleFS.SetContents("/index.html.gz", std::vector<uint8_t>(80000, 'x'));
+  Measured large = request("/");
+
+  CHECK_EQUAL(200, large.response.status);
+  CHECK_EQUAL((size_t)80000, large.response.body.size());
+  CHECK_EQUAL(small.heap.peak_bytes, large.heap.peak_bytes);
+
+  // Without the page, the fallback is chunked from the fixed buffer.
+  LittleFS.remove("/index.html.gz");
+  Measured missing = request("/");
+  CHECK_EQUAL(200, missing.response.status);
+  CHECK(missing.response.body.find("</html>") != std::string::npos);
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+  web.Setup();
+  web.RecordStartupTime();
+  fillSamples();
+
+  RUN_TEST(testApiSamplesHeapIsFlat);
+  RUN_TEST(testCsvHeapIsFlat);
+  RUN_TEST(testCachedResponseHeapIsFlat);
+  RUN_TEST(testIndexPageHeapIsFlat);
+  return HostTestResult();
+}
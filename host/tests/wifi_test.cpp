@@ -0,0 +1,108 @@
+// After the first connection, later boots rejoin the same access point directly, skipping the
+//  scan, but still take their address from DHCP.  If the direct reconnect hasn't connected in
+//  3 seconds, the saved details are dropped and the sketch runs the WiFiManager flow instead.
+
+#include <WiFiFastConnect.h>
+#include <ESP8266WiFi.h>
+#include <EventLog.h>
+#include <HostTest.h>
+#include <LittleFS.h>
+
+namespace {
+
+// 2026-01-01 00:00 UTC
+const time_t START_TIME = 1767225600;
+
+const char WIFI_FILE[] = "/wifi.bin";
+
+std::string logSince(uint32_t sequence) {
+  HostPrint out;
+  eventLog.PrintSince(out, sequence);
+  return out.text;
+}
+
+// What the sketch's connectWifi() does: WiFiManager's scan and DHCP, then the details saved.
+void wifiManager(WiFiFastConnect& fast) {
+  WiFi.begin(WiFi.ssid.c_str(), WiFi.passphrase.c_str());
+  fast.Save();
+}
+
+// The sketch's "wifi" task, every 100ms, until it's done with the direct reconnect.  Returns
+//  true if it fell back to WiFiManager.
+bool service(WiFiFastConnect& fast) {
+  while(fast.Connecting()) {
+    if(fast.Service())
+      return true;
+    delay(100);
+  }
+  return false;
+}
+
+void firstBoot(WiFiFastConnect& fast) {
+  LittleFS.Format();
+  WiFi.disconnect();
+  WiFi.access_point_up = true;
+  WiFi.dhcp_ip = IPAddress(192, 168, 1, 50);
+  CHECK(!fast.Begin());
+  wifiManager(fast);
+  CHECK(LittleFS.Contents(WIFI_FILE).size() > 0);
+}
+
+// The access point's lease ran out while the board was off, and DHCP hands out another
+//  address, which is the one used.
+void testDirectReconnectUsesDhcp() {
+  WiFiFastConnect first;
+  firstBoot(first);
+
+  WiFi.disconnect();
+  WiFi.dhcp_ip = IPAddress(192, 168, 1, 77);
+  uint32_t beginCalls = WiFi.begin_calls;
+  WiFiFastConnect fast;
+  CHECK(fast.Begin());
+  CHECK(!service(fast));
+  CHECK(fast.Connected());
+  CHECK_EQUAL(beginCalls + 1, WiFi.begin_calls);
+  CHECK(!WiFi.static_ip);
+  CHECK_EQUAL((uint32_t)IPAddress(192, 168, 1, 77), (uint32_t)WiFi.localIP());
+}
+
+// The access point's gone: 3 seconds, then WiFiManager, which saves the new details for the
+//  boot after.
+void testTimeoutFallsBackToWiFiManager() {
+  WiFiFastConnect first;
+  firstBoot(first);
+
+  WiFi.disconnect();
+  WiFi.access_point_up = false;
+  WiFiFastConnect fast;
+  CHECK(fast.Begin());
+  uint32_t before = eventLog.LastSequence();
+  unsigned long start = millis();
+  CHECK(service(fast));
+  CHECK(millis() - start >= 3000 && millis() - start < 3200);
+  CHECK(!fast.Service());     // Only once
+  CHECK(!LittleFS.exists(WIFI_FILE));
+  CHECK(logSince(before).find("using WiFiManager") != std::string::npos);
+
+  WiFi.access_point_up = true;
+  wifiManager(fast);
+  CHECK_EQUAL(WL_CONNECTED, WiFi.status());
+
+  WiFi.disconnect();
+  WiFiFastConnect next;
+  CHECK(next.Begin());
+  CHECK(!service(next));
+  CHECK(next.Connected());
+}
+
+}
+
+int main() {
+  HostClock::Begin(START_TIME);
+  HostClock::SyncNtp();
+  LittleFS.begin();
+
+  RUN_TEST(testDirectReconnectUsesDhcp);
+  RUN_TEST(testTimeoutFallsBackToWiFiManager);
+  return HostTestResult();
+}